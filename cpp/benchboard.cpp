@@ -0,0 +1,396 @@
+#include "core/global.h"
+#include "core/rand.h"
+#include "core/timer.h"
+#include "dataio/sgf.h"
+#include "game/board.h"
+#include "game/boardhistory.h"
+#include "neuralnet/nninputs.h"
+#include "search/search.h"
+#include "main.h"
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+//A starting position and a sequence of moves that are legal from it under the rules it was generated or truncated for
+struct BenchGame {
+  Board board;
+  Player pla;
+  vector<Move> moves;
+  //The same moves as they apply to the board alone, for replaying without a BoardHistory
+  vector<Move> boardMoves;
+};
+
+//A pass-for-ko in the encore leaves the board unchanged, so to the board alone it is a pass
+static Move boardMove(const Board& board, const BoardHistory& hist, Loc loc, Player pla) {
+  if(hist.encorePhase > 0 && loc != Board::PASS_LOC) {
+    bool koProhibited = pla == P_BLACK ? hist.blackKoProhibited[loc] : hist.whiteKoProhibited[loc];
+    if(koProhibited && board.wouldBeKoCapture(loc,pla))
+      return Move(Board::PASS_LOC,pla);
+  }
+  return Move(loc,pla);
+}
+
+//Play random legal moves (random play produces lots of captures and kos, which is what stresses superko handling)
+static BenchGame generateRandomGame(int boardSize, const Rules& rules, int maxMoves, Rand& rand) {
+  Board board(boardSize,boardSize);
+  Player pla = P_BLACK;
+  BoardHistory hist(board,pla,rules,0);
+  BenchGame game;
+  game.board = board;
+  game.pla = pla;
+  vector<Loc> candidates;
+  for(int i = 0; i<maxMoves && !hist.isGameFinished; i++) {
+    candidates.clear();
+    for(int y = 0; y<boardSize; y++) {
+      for(int x = 0; x<boardSize; x++) {
+        Loc loc = Location::getLoc(x,y,boardSize);
+        if(hist.isLegal(board,loc,pla))
+          candidates.push_back(loc);
+      }
+    }
+    Loc loc = Board::PASS_LOC;
+    if(candidates.size() > 0 && rand.nextDouble() > 0.02)
+      loc = candidates[rand.nextUInt((uint32_t)candidates.size())];
+    game.moves.push_back(Move(loc,pla));
+    game.boardMoves.push_back(boardMove(board,hist,loc,pla));
+    hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+    pla = getOpp(pla);
+  }
+  return game;
+}
+
+//Take the moves of the sgf up until the first one that is illegal under these rules or the game ends
+static BenchGame truncatedSgfGame(CompactSgf* sgf, const Rules& rules) {
+  Board board;
+  Player pla;
+  BoardHistory hist;
+  sgf->setupInitialBoardAndHist(rules,board,pla,hist);
+  BenchGame game;
+  game.board = board;
+  game.pla = pla;
+  for(size_t i = 0; i<sgf->moves.size() && !hist.isGameFinished; i++) {
+    const Move& move = sgf->moves[i];
+    if(!hist.isLegal(board,move.loc,move.pla))
+      break;
+    game.moves.push_back(move);
+    game.boardMoves.push_back(boardMove(board,hist,move.loc,move.pla));
+    hist.makeBoardMoveAssumeLegal(board,move.loc,move.pla,NULL);
+  }
+  return game;
+}
+
+static const int FUNC_PLAY_MOVE = 0;
+static const int FUNC_MAKE_BOARD_MOVE = 1;
+static const int FUNC_IS_LEGAL = 2;
+static const int FUNC_SUPERKO_BANS = 3;
+static const int FUNC_CALCULATE_AREA = 4;
+static const int FUNC_POS_HASH_AFTER_MOVE = 5;
+static const int FUNC_FILL_ROW_V5 = 6;
+static const int FUNC_COPY_BOARD = 7;
+static const int FUNC_END_GAME_IF_ALL_PASS_ALIVE = 8;
+static const int NUM_FUNCS = 9;
+
+static const char* funcName(int func) {
+  switch(func) {
+  case FUNC_PLAY_MOVE: return "Board::playMoveAssumeLegal";
+  case FUNC_MAKE_BOARD_MOVE: return "BoardHistory::makeBoardMoveAssumeLegal";
+  case FUNC_IS_LEGAL: return "BoardHistory::isLegal (all locs)";
+  case FUNC_SUPERKO_BANS: return "BoardHistory::isSuperKoBanned (all locs)";
+  case FUNC_CALCULATE_AREA: return "Board::calculateArea";
+  case FUNC_POS_HASH_AFTER_MOVE: return "Board::getPosHashAfterMove (all empty locs)";
+  case FUNC_FILL_ROW_V5: return "NNInputs::fillRowV5";
+  case FUNC_COPY_BOARD: return "Board copy";
+  case FUNC_END_GAME_IF_ALL_PASS_ALIVE: return "BoardHistory::endGameIfAllPassAlive";
+  default: assert(false);
+  }
+  return "";
+}
+
+//Replay all the games, applying func at every position, and return the number of operations performed.
+//Other than for the two move-making functions, the time also includes replaying the moves themselves, which is
+//small in comparison since every other function is called at least once per position.
+//Adds into checksumOut only once at the end, since the caller's slots for different threads may share a cache line.
+static int64_t runFunction(int func, const Rules& rules, const vector<BenchGame>& games, int posLen, int64_t& checksumOut) {
+  int64_t numOps = 0;
+  int64_t checksum = 0;
+  float* rowBin = NULL;
+  float* rowGlobal = NULL;
+  if(func == FUNC_FILL_ROW_V5) {
+    rowBin = new float[NNInputs::NUM_FEATURES_BIN_V5 * posLen * posLen];
+    rowGlobal = new float[NNInputs::NUM_FEATURES_GLOBAL_V5];
+  }
+  Color* area = new Color[Board::MAX_ARR_SIZE];
+
+  for(size_t g = 0; g<games.size(); g++) {
+    const BenchGame& game = games[g];
+    Board board(game.board);
+    const int xSize = board.x_size;
+    const int ySize = board.y_size;
+
+    if(func == FUNC_PLAY_MOVE) {
+      for(size_t i = 0; i<game.boardMoves.size(); i++)
+        board.playMoveAssumeLegal(game.boardMoves[i].loc,game.boardMoves[i].pla);
+      numOps += game.boardMoves.size();
+      checksum += (int64_t)(board.pos_hash.hash0 & 0xFFFF);
+      continue;
+    }
+
+    BoardHistory hist(board,game.pla,rules,0);
+    if(func == FUNC_MAKE_BOARD_MOVE) {
+      for(size_t i = 0; i<game.moves.size(); i++)
+        hist.makeBoardMoveAssumeLegal(board,game.moves[i].loc,game.moves[i].pla,NULL);
+      numOps += game.moves.size();
+      checksum += (int64_t)(board.pos_hash.hash0 & 0xFFFF);
+      continue;
+    }
+
+    Player pla = game.pla;
+    for(size_t i = 0; i<=game.moves.size(); i++) {
+      if(func == FUNC_IS_LEGAL) {
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            if(hist.isLegal(board,Location::getLoc(x,y,xSize),pla))
+              checksum++;
+          }
+        }
+        numOps += xSize * ySize;
+      }
+      else if(func == FUNC_SUPERKO_BANS) {
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            if(hist.isSuperKoBanned(board,Location::getLoc(x,y,xSize)))
+              checksum++;
+          }
+        }
+        numOps += xSize * ySize;
+      }
+      else if(func == FUNC_CALCULATE_AREA) {
+        board.calculateArea(area,true,true,true,rules.multiStoneSuicideLegal);
+        checksum += area[Location::getLoc(xSize/2,ySize/2,xSize)];
+        numOps += 1;
+      }
+      else if(func == FUNC_POS_HASH_AFTER_MOVE) {
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            Loc loc = Location::getLoc(x,y,xSize);
+            if(board.colors[loc] == C_EMPTY) {
+              checksum += (int64_t)(board.getPosHashAfterMove(loc,pla).hash0 & 0xFF);
+              numOps += 1;
+            }
+          }
+        }
+      }
+      else if(func == FUNC_FILL_ROW_V5) {
+        NNInputs::fillRowV5(board,hist,pla,0.5,posLen,true,rowBin,rowGlobal);
+        checksum += (int64_t)rowGlobal[0];
+        numOps += 1;
+      }
+      else if(func == FUNC_COPY_BOARD) {
+        //Several copies per position so that the cost of replaying the move doesn't dominate
+        for(int c = 0; c<16; c++) {
+          Board copy(board);
+          checksum += copy.empty_list.size();
+        }
+        numOps += 16;
+      }
+      else if(func == FUNC_END_GAME_IF_ALL_PASS_ALIVE) {
+        hist.endGameIfAllPassAlive(board);
+        checksum += hist.isGameFinished;
+        numOps += 1;
+      }
+      else {
+        assert(false);
+      }
+
+      if(i < game.moves.size()) {
+        hist.makeBoardMoveAssumeLegal(board,game.moves[i].loc,game.moves[i].pla,NULL);
+        pla = getOpp(game.moves[i].pla);
+      }
+    }
+  }
+
+  delete[] area;
+  delete[] rowBin;
+  delete[] rowGlobal;
+  checksumOut += checksum;
+  return numOps;
+}
+
+//Run func on numThreads threads at once, each replaying the full set of games repeatedly until minSeconds have
+//passed, and return total ops/sec
+static double runFunctionThreaded(int func, const Rules& rules, const vector<BenchGame>& games, int posLen, int numThreads, double minSeconds) {
+  vector<int64_t> numOps(numThreads,0);
+  vector<int64_t> checksums(numThreads,0);
+  auto runThread = [&](int threadIdx) {
+    ClockTimer threadTimer;
+    int64_t threadOps = 0;
+    int64_t threadChecksum = 0;
+    do {
+      threadOps += runFunction(func,rules,games,posLen,threadChecksum);
+    } while(threadTimer.getSeconds() < minSeconds);
+    numOps[threadIdx] = threadOps;
+    checksums[threadIdx] = threadChecksum;
+  };
+
+  ClockTimer timer;
+  vector<std::thread> threads;
+  for(int t = 0; t<numThreads; t++)
+    threads.push_back(std::thread(runThread,t));
+  for(int t = 0; t<numThreads; t++)
+    threads[t].join();
+  double seconds = timer.getSeconds();
+
+  int64_t totalOps = 0;
+  int64_t totalChecksum = 0;
+  for(int t = 0; t<numThreads; t++) {
+    totalOps += numOps[t];
+    totalChecksum += checksums[t];
+  }
+  //Keep the compiler from optimizing anything away
+  if(totalChecksum < 0)
+    cout << totalChecksum << endl;
+  return totalOps / seconds;
+}
+
+int MainCmds::benchboard(int argc, const char* const* argv) {
+  Board::initHash();
+  ScoreValue::initTables();
+
+  int boardSize;
+  int numGames;
+  string seed;
+  vector<string> sgfDirs;
+  int maxSgfs;
+  vector<int> numThreadsList;
+  double minSeconds;
+  try {
+    TCLAP::CmdLine cmd("Benchmark board, history, and featurization throughput", ' ', "1.0",true);
+    TCLAP::ValueArg<int> boardSizeArg("","board-size","Board size for random games",false,19,"SIZE");
+    TCLAP::ValueArg<int> numGamesArg("","num-games","Number of random games to replay per rules configuration",false,40,"N");
+    TCLAP::ValueArg<string> seedArg("","seed","Random seed for generating games",false,"benchboard","SEED");
+    TCLAP::MultiArg<string> sgfDirArg("","sgf-dir","Directory of sgf files to also replay",false,"DIR");
+    TCLAP::ValueArg<int> maxSgfsArg("","max-sgfs","Max number of sgf files to use",false,1000,"N");
+    TCLAP::ValueArg<string> numThreadsArg("","num-threads","Comma-separated thread counts to measure scaling with, default 1 and the number of cores",false,"","N,N,...");
+    cmd.add(boardSizeArg);
+    cmd.add(numGamesArg);
+    cmd.add(seedArg);
+    cmd.add(sgfDirArg);
+    cmd.add(maxSgfsArg);
+    TCLAP::ValueArg<double> minSecondsArg("","min-seconds","Minimum time to spend measuring each function for each thread count",false,0.5,"SECONDS");
+    cmd.add(numThreadsArg);
+    cmd.add(minSecondsArg);
+    cmd.parse(argc,argv);
+    boardSize = boardSizeArg.getValue();
+    numGames = numGamesArg.getValue();
+    seed = seedArg.getValue();
+    sgfDirs = sgfDirArg.getValue();
+    maxSgfs = maxSgfsArg.getValue();
+    if(maxSgfs < 0)
+      throw StringError("Invalid max sgfs: " + Global::intToString(maxSgfs));
+    minSeconds = minSecondsArg.getValue();
+
+    if(numThreadsArg.getValue() == "") {
+      numThreadsList.push_back(1);
+      int numCores = (int)std::thread::hardware_concurrency();
+      if(numCores > 1)
+        numThreadsList.push_back(numCores);
+    }
+    else {
+      vector<string> pieces = Global::split(numThreadsArg.getValue(),',');
+      for(size_t i = 0; i<pieces.size(); i++) {
+        int numThreads = Global::stringToInt(Global::trim(pieces[i]));
+        if(numThreads <= 0)
+          throw StringError("Invalid number of threads: " + pieces[i]);
+        numThreadsList.push_back(numThreads);
+      }
+    }
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+  if(boardSize < 2 || boardSize > Board::MAX_LEN)
+    throw StringError("Invalid board size, this build supports board sizes up to " + Global::intToString(Board::MAX_LEN));
+
+  cout << "Compiled max board size " << Board::MAX_LEN << endl;
+  cout << "sizeof(Board) " << sizeof(Board) << " sizeof(BoardHistory) " << sizeof(BoardHistory)
+       << " sizeof(SearchThread) " << sizeof(SearchThread) << endl;
+
+  vector<CompactSgf*> sgfs;
+  {
+    const string sgfSuffix = ".sgf";
+    auto sgfFilter = [&](const string& name) {
+      return Global::isSuffix(name,sgfSuffix);
+    };
+    vector<string> sgfFiles;
+    for(size_t i = 0; i<sgfDirs.size(); i++)
+      Global::collectFiles(sgfDirs[i], sgfFilter, sgfFiles);
+    if(sgfFiles.size() > (size_t)maxSgfs)
+      sgfFiles.resize((size_t)maxSgfs);
+    sgfs = CompactSgf::loadFiles(sgfFiles);
+    if(sgfDirs.size() > 0)
+      cout << "Loaded " << sgfs.size() << " sgfs" << endl;
+  }
+
+  int posLen = boardSize;
+  for(size_t i = 0; i<sgfs.size(); i++)
+    posLen = std::max(posLen,sgfs[i]->bSize);
+
+  const int maxMovesPerGame = boardSize * boardSize * 2;
+  const vector<int> koRules = {Rules::KO_SIMPLE, Rules::KO_POSITIONAL, Rules::KO_SITUATIONAL, Rules::KO_SPIGHT};
+  const vector<int> scoringRules = {Rules::SCORING_AREA, Rules::SCORING_TERRITORY};
+  const vector<bool> suicideRules = {false, true};
+  for(size_t k = 0; k<koRules.size(); k++) {
+    for(size_t s = 0; s<scoringRules.size(); s++) {
+      for(size_t m = 0; m<suicideRules.size(); m++) {
+        Rules rules = Rules::getTrompTaylorish();
+        rules.koRule = koRules[k];
+        rules.scoringRule = scoringRules[s];
+        rules.multiStoneSuicideLegal = suicideRules[m];
+        string rulesName =
+          "ko " + Rules::writeKoRule(rules.koRule) +
+          " scoring " + Rules::writeScoringRule(rules.scoringRule) +
+          " suicide " + Global::boolToString(rules.multiStoneSuicideLegal);
+
+        Rand rand(seed + Global::intToString(boardSize) + rulesName);
+        vector<BenchGame> games;
+        for(int g = 0; g<numGames; g++)
+          games.push_back(generateRandomGame(boardSize,rules,maxMovesPerGame,rand));
+        for(size_t i = 0; i<sgfs.size(); i++)
+          games.push_back(truncatedSgfGame(sgfs[i],rules));
+
+        int64_t numMoves = 0;
+        for(size_t g = 0; g<games.size(); g++)
+          numMoves += games[g].moves.size();
+
+        cout << "Rules: " << rulesName << ", games " << games.size() << ", moves " << numMoves << endl;
+        string header = Global::strprintf("  %-46s", "ops/sec by threads");
+        for(size_t t = 0; t<numThreadsList.size(); t++)
+          header += Global::strprintf(" %12s", (Global::intToString(numThreadsList[t]) + "t").c_str());
+        if(numThreadsList.size() > 1)
+          header += "  scaling";
+        cout << header << endl;
+
+        for(int func = 0; func<NUM_FUNCS; func++) {
+          string line = Global::strprintf("  %-46s", funcName(func));
+          double firstOpsPerSec = 0.0;
+          double lastOpsPerSec = 0.0;
+          for(size_t t = 0; t<numThreadsList.size(); t++) {
+            double opsPerSec = runFunctionThreaded(func,rules,games,posLen,numThreadsList[t],minSeconds);
+            if(t == 0)
+              firstOpsPerSec = opsPerSec;
+            lastOpsPerSec = opsPerSec;
+            line += Global::strprintf(" %12.0f", opsPerSec);
+          }
+          if(numThreadsList.size() > 1)
+            line += Global::strprintf("  %.2fx", lastOpsPerSec / firstOpsPerSec);
+          cout << line << endl;
+        }
+      }
+    }
+  }
+
+  for(size_t i = 0; i<sgfs.size(); i++)
+    delete sgfs[i];
+  return 0;
+}
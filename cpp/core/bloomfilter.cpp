@@ -0,0 +1,159 @@
+#include "../core/bloomfilter.h"
+
+#include <cmath>
+#include <thread>
+#include "../core/hash.h"
+#include "../core/rand.h"
+#include "../core/test.h"
+
+BloomFilter::BloomFilter(uint64_t expectedNumElts, double falsePositiveRate)
+  :numBits(),numWords(),numHashes(),words(NULL),numAdded(0)
+{
+  if(expectedNumElts <= 0)
+    throw StringError("BloomFilter: expectedNumElts must be positive");
+  if(!(falsePositiveRate > 0.0 && falsePositiveRate < 1.0))
+    throw StringError("BloomFilter: falsePositiveRate must be between 0 and 1");
+
+  //Standard optimal sizing, m = -n ln(p) / ln(2)^2 bits and k = m/n ln(2) hashes
+  double ln2 = std::log(2.0);
+  double bitsPerElt = -std::log(falsePositiveRate) / (ln2 * ln2);
+  numWords = (uint64_t)std::ceil(bitsPerElt * (double)expectedNumElts / 64.0);
+  if(numWords < 1)
+    numWords = 1;
+  numBits = numWords * 64;
+  numHashes = (int)std::round(bitsPerElt * ln2);
+  if(numHashes < 1)
+    numHashes = 1;
+  if(numHashes > 32)
+    numHashes = 32;
+
+  words = new std::atomic<uint64_t>[numWords];
+  for(uint64_t i = 0; i<numWords; i++)
+    words[i].store(0,std::memory_order_relaxed);
+}
+
+BloomFilter::~BloomFilter() {
+  delete[] words;
+}
+
+//Double hashing, bit i is (start + i * step) mod numBits. Step is odd, and numBits is a multiple of 64, so the
+//bits for a given x are distinct as long as numHashes <= 64.
+void BloomFilter::getBitIdxs(uint64_t x, uint64_t& start, uint64_t& step) const {
+  uint64_t h = Hash::murmurMix(x);
+  start = h % numBits;
+  step = (Hash::murmurMix(h ^ 0x9E3779B97F4A7C15ULL) | 1) % numBits;
+}
+
+bool BloomFilter::add(uint64_t x) {
+  uint64_t bitIdx;
+  uint64_t step;
+  getBitIdxs(x,bitIdx,step);
+  bool isNew = false;
+  for(int i = 0; i<numHashes; i++) {
+    uint64_t mask = (uint64_t)1 << (bitIdx % 64);
+    uint64_t prev = words[bitIdx / 64].fetch_or(mask,std::memory_order_relaxed);
+    if((prev & mask) == 0)
+      isNew = true;
+    bitIdx += step;
+    if(bitIdx >= numBits)
+      bitIdx -= numBits;
+  }
+  if(isNew)
+    numAdded.fetch_add(1,std::memory_order_relaxed);
+  return isNew;
+}
+
+bool BloomFilter::contains(uint64_t x) const {
+  uint64_t bitIdx;
+  uint64_t step;
+  getBitIdxs(x,bitIdx,step);
+  for(int i = 0; i<numHashes; i++) {
+    uint64_t mask = (uint64_t)1 << (bitIdx % 64);
+    if((words[bitIdx / 64].load(std::memory_order_relaxed) & mask) == 0)
+      return false;
+    bitIdx += step;
+    if(bitIdx >= numBits)
+      bitIdx -= numBits;
+  }
+  return true;
+}
+
+uint64_t BloomFilter::getNumAdded() const {
+  return numAdded.load(std::memory_order_relaxed);
+}
+uint64_t BloomFilter::getNumBits() const {
+  return numBits;
+}
+int BloomFilter::getNumHashes() const {
+  return numHashes;
+}
+double BloomFilter::getApproxFalsePositiveRate() const {
+  //Standard estimate (1 - e^(-kn/m))^k
+  double fillProp = 1.0 - std::exp(-(double)numHashes * (double)getNumAdded() / (double)numBits);
+  return std::pow(fillProp, numHashes);
+}
+
+void BloomFilter::runTests() {
+  cout << "Running bloom filter tests" << endl;
+
+  {
+    const uint64_t capacity = 20000;
+    const double falsePositiveRate = 0.01;
+    BloomFilter filter(capacity,falsePositiveRate);
+    testAssert(filter.getNumBits() % 64 == 0);
+    testAssert(filter.getNumHashes() == 7);
+
+    Rand rand("bloomfilter");
+    vector<uint64_t> added;
+    for(uint64_t i = 0; i<capacity; i++)
+      added.push_back(rand.nextUInt64());
+
+    //New elements are only rarely reported as present, and added ones always are
+    uint64_t numNew = 0;
+    for(size_t i = 0; i<added.size(); i++) {
+      if(filter.add(added[i]))
+        numNew++;
+    }
+    testAssert(numNew == filter.getNumAdded());
+    testAssert(numNew >= capacity - capacity * falsePositiveRate);
+    for(size_t i = 0; i<added.size(); i++) {
+      testAssert(filter.contains(added[i]));
+      testAssert(!filter.add(added[i]));
+    }
+    testAssert(numNew == filter.getNumAdded());
+
+    //At capacity, the false positive rate should be about the configured one
+    const int numTrials = 200000;
+    int numFalsePositives = 0;
+    for(int i = 0; i<numTrials; i++) {
+      if(filter.contains(rand.nextUInt64()))
+        numFalsePositives++;
+    }
+    double measuredRate = (double)numFalsePositives / numTrials;
+    testAssert(measuredRate > falsePositiveRate * 0.7 && measuredRate < falsePositiveRate * 1.3);
+    double approxRate = filter.getApproxFalsePositiveRate();
+    testAssert(approxRate > falsePositiveRate * 0.7 && approxRate < falsePositiveRate * 1.3);
+  }
+
+  {
+    //Concurrent adds of disjoint elements should lose none of them
+    const int numThreads = 4;
+    const uint64_t numPerThread = 5000;
+    BloomFilter filter(numThreads * numPerThread, 0.001);
+    auto addAll = [&](int threadIdx) {
+      for(uint64_t i = 0; i<numPerThread; i++)
+        filter.add(Hash::murmurMix(threadIdx * numPerThread + i));
+    };
+    vector<std::thread> threads;
+    for(int t = 0; t<numThreads; t++)
+      threads.push_back(std::thread(addAll,t));
+    for(int t = 0; t<numThreads; t++)
+      threads[t].join();
+
+    for(uint64_t i = 0; i<numThreads * numPerThread; i++)
+      testAssert(filter.contains(Hash::murmurMix(i)));
+    uint64_t numAdded = filter.getNumAdded();
+    testAssert(numAdded <= numThreads * numPerThread);
+    testAssert(numAdded >= numThreads * numPerThread * 0.99);
+  }
+}
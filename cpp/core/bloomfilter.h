@@ -0,0 +1,43 @@
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <atomic>
+#include "../core/global.h"
+
+//Approximate set of 64-bit hashes, such as position hashes, in a fixed amount of memory chosen up front from the
+//expected number of elements and the desired false positive rate - about 1.2 bytes per element at a rate of 1%.
+//Elements cannot be removed. Safe to use concurrently from multiple threads.
+class BloomFilter {
+ public:
+  BloomFilter(uint64_t expectedNumElts, double falsePositiveRate);
+  ~BloomFilter();
+
+  BloomFilter(const BloomFilter&) = delete;
+  BloomFilter& operator=(const BloomFilter&) = delete;
+
+  //Add x, returning true if it was not already present. Once expectedNumElts elements have been added, returns
+  //false for a new element with probability about falsePositiveRate, and more often beyond that.
+  bool add(uint64_t x);
+  //False positives as for add, but never false negatives
+  bool contains(uint64_t x) const;
+
+  //Number of calls to add that returned true, which approximates the number of distinct elements added
+  uint64_t getNumAdded() const;
+  uint64_t getNumBits() const;
+  int getNumHashes() const;
+  //Approximate probability that contains returns true for an element never added, given getNumAdded
+  double getApproxFalsePositiveRate() const;
+
+  static void runTests();
+
+ private:
+  uint64_t numBits;
+  uint64_t numWords;
+  int numHashes;
+  std::atomic<uint64_t>* words;
+  std::atomic<uint64_t> numAdded;
+
+  void getBitIdxs(uint64_t x, uint64_t& start, uint64_t& step) const;
+};
+
+#endif
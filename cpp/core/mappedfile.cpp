@@ -0,0 +1,115 @@
+#include "../core/mappedfile.h"
+
+#ifdef _WIN32
+ #define _MAPPEDFILE_IS_WINDOWS
+#elif _WIN64
+ #define _MAPPEDFILE_IS_WINDOWS
+#elif __unix || __APPLE__
+  #define _MAPPEDFILE_IS_UNIX
+#else
+ #error Unknown OS!
+#endif
+
+#ifdef _MAPPEDFILE_IS_WINDOWS
+  #include <windows.h>
+#endif
+#ifdef _MAPPEDFILE_IS_UNIX
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#ifdef _MAPPEDFILE_IS_WINDOWS
+struct MappedFileHandles {
+  HANDLE fileHandle;
+  HANDLE mappingHandle;
+};
+
+MappedFile::MappedFile(const string& fName)
+  :fileName(fName),data(NULL),size(0),handles(NULL)
+{
+  HANDLE fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(fileHandle == INVALID_HANDLE_VALUE)
+    throw IOError("Could not open " + fileName);
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(fileHandle,&fileSize)) {
+    CloseHandle(fileHandle);
+    throw IOError("Could not get size of " + fileName);
+  }
+  //Windows cannot map an empty file
+  if(fileSize.QuadPart <= 0) {
+    CloseHandle(fileHandle);
+    return;
+  }
+  HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(mappingHandle == NULL) {
+    CloseHandle(fileHandle);
+    throw IOError("Could not map " + fileName);
+  }
+  void* ptr = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  if(ptr == NULL) {
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+    throw IOError("Could not map " + fileName);
+  }
+  MappedFileHandles* h = new MappedFileHandles();
+  h->fileHandle = fileHandle;
+  h->mappingHandle = mappingHandle;
+  handles = h;
+  data = (const char*)ptr;
+  size = (uint64_t)fileSize.QuadPart;
+}
+
+MappedFile::~MappedFile() {
+  if(handles == NULL)
+    return;
+  MappedFileHandles* h = (MappedFileHandles*)handles;
+  UnmapViewOfFile(data);
+  CloseHandle(h->mappingHandle);
+  CloseHandle(h->fileHandle);
+  delete h;
+}
+#endif
+
+#ifdef _MAPPEDFILE_IS_UNIX
+MappedFile::MappedFile(const string& fName)
+  :fileName(fName),data(NULL),size(0),handles(NULL)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw IOError("Could not open " + fileName);
+  struct stat st;
+  if(fstat(fd,&st) != 0) {
+    close(fd);
+    throw IOError("Could not get size of " + fileName);
+  }
+  //mmap cannot map an empty file
+  if(st.st_size <= 0) {
+    close(fd);
+    return;
+  }
+  void* ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  //The mapping stays valid after closing the descriptor
+  close(fd);
+  if(ptr == MAP_FAILED)
+    throw IOError("Could not map " + fileName);
+  data = (const char*)ptr;
+  size = (uint64_t)st.st_size;
+}
+
+MappedFile::~MappedFile() {
+  if(data != NULL)
+    munmap(const_cast<char*>(data), (size_t)size);
+}
+#endif
+
+const string& MappedFile::getFileName() const {
+  return fileName;
+}
+const char* MappedFile::getData() const {
+  return data;
+}
+uint64_t MappedFile::getSize() const {
+  return size;
+}
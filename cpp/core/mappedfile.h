@@ -0,0 +1,27 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "../core/global.h"
+
+//Read-only memory mapping of a whole file. Throws IOError if the file cannot be opened or mapped.
+//An empty file gives a NULL data pointer and a size of zero.
+class MappedFile {
+ public:
+  MappedFile(const string& fileName);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const string& getFileName() const;
+  const char* getData() const;
+  uint64_t getSize() const;
+
+ private:
+  string fileName;
+  const char* data;
+  uint64_t size;
+  void* handles; //Platform-specific state needed to unmap
+};
+
+#endif
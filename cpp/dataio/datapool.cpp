@@ -91,4 +91,38 @@ void DataPool::finishAndWritePool(Rand& rand) {
   delete[] indices;
 }
 
+//-------------------------------------------------------------------------------------
 
+ShardedDataPool::ShardedDataPool(size_t rowWidth_, size_t poolCapacity, size_t writeBufCapacity, int numShards, std::function<void(const float*,size_t)> writeRow)
+  :rowWidth(rowWidth_),
+   shards(),
+   shardMutexes()
+{
+  assert(numShards > 0);
+  for(int i = 0; i<numShards; i++) {
+    //Split the capacity as evenly as possible, but every shard needs room for at least one row
+    size_t shardCapacity = poolCapacity / numShards + ((size_t)i < poolCapacity % numShards ? 1 : 0);
+    shardCapacity = std::max(shardCapacity,(size_t)1);
+    shards.push_back(new DataPool(rowWidth,shardCapacity,writeBufCapacity,writeRow));
+    shardMutexes.push_back(new std::mutex());
+  }
+}
+
+ShardedDataPool::~ShardedDataPool() {
+  for(size_t i = 0; i<shards.size(); i++) {
+    delete shards[i];
+    delete shardMutexes[i];
+  }
+}
+
+void ShardedDataPool::addRow(const float* row, Rand& rand) {
+  size_t shardIdx = (size_t)rand.nextUInt((uint32_t)shards.size());
+  std::lock_guard<std::mutex> lock(*shardMutexes[shardIdx]);
+  float* newRow = shards[shardIdx]->addNewRow(rand);
+  std::memcpy(newRow,row,sizeof(float)*rowWidth);
+}
+
+void ShardedDataPool::finishAndWritePool(Rand& rand) {
+  for(size_t i = 0; i<shards.size(); i++)
+    shards[i]->finishAndWritePool(rand);
+}
@@ -3,6 +3,7 @@
 
 #include <functional>
 #include "../core/global.h"
+#include "../core/multithread.h"
 #include "../core/rand.h"
 
 class DataPool {
@@ -38,5 +39,27 @@ private:
 
 };
 
+//Several DataPools, each with its own lock and an equal share of the capacity, so that many threads can add rows at once.
+//Each row goes to a random shard, so the output is shuffled about as well as by a single DataPool of the full capacity.
+//writeRow is called by whichever thread evicts rows from a shard, while holding only that shard's lock, so it must be
+//thread-safe.
+class ShardedDataPool {
+  size_t rowWidth;
+  vector<DataPool*> shards;
+  vector<std::mutex*> shardMutexes;
+
+public:
+  ShardedDataPool(size_t rowWidth, size_t poolMaxCapacity, size_t writeBufCapacity, int numShards, std::function<void(const float*,size_t)> writeRow);
+  ~ShardedDataPool();
+
+  ShardedDataPool(const ShardedDataPool&) = delete;
+  ShardedDataPool& operator=(const ShardedDataPool&) = delete;
+
+  //Copy row into a random shard. Thread-safe.
+  void addRow(const float* row, Rand& rand);
+  //Write out all the remaining rows. Not thread-safe, call only once all adding is done.
+  void finishAndWritePool(Rand& rand);
+};
+
 
 #endif
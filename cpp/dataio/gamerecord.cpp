@@ -0,0 +1,508 @@
+#include "../dataio/gamerecord.h"
+#include "../dataio/sgf.h"
+
+#include <cstring>
+#include "../core/mappedfile.h"
+
+static const char* FILE_MAGIC = "GAMEREC1";
+static const char* INDEX_MAGIC = "GRINDEX1";
+static const size_t MAGIC_LEN = 8;
+
+GameRecordValues::GameRecordValues()
+  :win(0),loss(0),noResult(0),score(0),unreducedNumVisits(0)
+{}
+GameRecordValues::~GameRecordValues()
+{}
+
+GameRecord::GameRecord()
+  :bName(),wName(),rules(),bSize(0),gameHash(),
+   mode(0),modeMeta1(0),modeMeta2(0),changedNeuralNets(),
+   placements(),initialPla(P_BLACK),initialEncorePhase(0),moves(),
+   startTurnIdx(0),valuesByTurn(),
+   isGameFinished(false),winner(C_EMPTY),finalWhiteMinusBlackScore(0.0f),isNoResult(false),isResignation(false)
+{}
+GameRecord::~GameRecord()
+{}
+
+void GameRecord::setFromHistory(const string& bN, const string& wN, const Rules& r, const BoardHistory& hist) {
+  const Board& initialBoard = hist.initialBoard;
+  assert(initialBoard.x_size == initialBoard.y_size);
+
+  bName = bN;
+  wName = wN;
+  rules = r;
+  bSize = initialBoard.x_size;
+
+  placements.clear();
+  for(int y = 0; y<bSize; y++) {
+    for(int x = 0; x<bSize; x++) {
+      Loc loc = Location::getLoc(x,y,bSize);
+      if(initialBoard.colors[loc] == C_BLACK || initialBoard.colors[loc] == C_WHITE)
+        placements.push_back(Move(loc,initialBoard.colors[loc]));
+    }
+  }
+  initialPla = hist.initialPla;
+  moves = hist.moveHistory;
+
+  isGameFinished = hist.isGameFinished;
+  winner = hist.winner;
+  finalWhiteMinusBlackScore = hist.finalWhiteMinusBlackScore;
+  isNoResult = hist.isNoResult;
+  isResignation = hist.isResignation;
+}
+
+void GameRecord::setFromFinishedGame(const FinishedGameData& data) {
+  //Selfplay writes sgfs with the rules as of the start of the training period, so do the same
+  setFromHistory(data.bName,data.wName,data.startHist.rules,data.endHist);
+  gameHash = data.gameHash;
+
+  mode = data.mode;
+  modeMeta1 = data.modeMeta1;
+  modeMeta2 = data.modeMeta2;
+  changedNeuralNets.clear();
+  for(size_t i = 0; i<data.changedNeuralNets.size(); i++)
+    changedNeuralNets.push_back(*(data.changedNeuralNets[i]));
+
+  //Play::runGame only starts a game in the encore by clearing the history with mode 1 and the phase as modeMeta1
+  initialEncorePhase = data.mode == 1 ? data.modeMeta1 : 0;
+
+  startTurnIdx = (int)data.startHist.moveHistory.size();
+  valuesByTurn.clear();
+  if(data.whiteValueTargetsByTurn.size() + startTurnIdx >= moves.size()) {
+    for(size_t i = startTurnIdx; i<moves.size(); i++) {
+      const ValueTargets& targets = data.whiteValueTargetsByTurn[i-startTurnIdx];
+      GameRecordValues values;
+      values.win = targets.win;
+      values.loss = targets.loss;
+      values.noResult = targets.noResult;
+      values.score = targets.score;
+      if(i-startTurnIdx < data.policyTargetsByTurn.size())
+        values.unreducedNumVisits = data.policyTargetsByTurn[i-startTurnIdx].unreducedNumVisits;
+      valuesByTurn.push_back(values);
+    }
+  }
+}
+
+void GameRecord::setupInitialBoardAndHist(Board& board, Player& nextPla, BoardHistory& hist) const {
+  board = Board(bSize,bSize);
+  for(size_t i = 0; i<placements.size(); i++)
+    board.setStone(placements[i].loc,placements[i].pla);
+  nextPla = initialPla;
+  hist = BoardHistory(board,nextPla,rules,initialEncorePhase);
+}
+
+void GameRecord::setupBoardAndHist(Board& board, Player& nextPla, BoardHistory& hist, int turnNumber) const {
+  setupInitialBoardAndHist(board, nextPla, hist);
+
+  assert(turnNumber <= moves.size());
+  for(size_t i = 0; i<turnNumber; i++) {
+    hist.makeBoardMoveAssumeLegal(board,moves[i].loc,moves[i].pla,NULL);
+    nextPla = getOpp(moves[i].pla);
+  }
+}
+
+void GameRecord::writeSgf(ostream& out) const {
+  WriteSgf::writeSgf(out,*this,true);
+}
+
+//ENCODING--------------------------------------------------------------------
+
+static void putU8(string& buf, uint8_t x) {
+  buf.push_back((char)x);
+}
+static void putU16(string& buf, uint16_t x) {
+  for(int i = 0; i<2; i++)
+    buf.push_back((char)((x >> (8*i)) & 0xFF));
+}
+static void putU32(string& buf, uint32_t x) {
+  for(int i = 0; i<4; i++)
+    buf.push_back((char)((x >> (8*i)) & 0xFF));
+}
+static void putU64(string& buf, uint64_t x) {
+  for(int i = 0; i<8; i++)
+    buf.push_back((char)((x >> (8*i)) & 0xFF));
+}
+static void putF32(string& buf, float x) {
+  uint32_t bits;
+  std::memcpy(&bits,&x,sizeof(bits));
+  putU32(buf,bits);
+}
+//Seven bits at a time, with the high bit set on all but the last byte
+static void putVarUInt(string& buf, uint64_t x) {
+  while(x >= 0x80) {
+    buf.push_back((char)((x & 0x7F) | 0x80));
+    x >>= 7;
+  }
+  buf.push_back((char)x);
+}
+static void putString(string& buf, const string& s) {
+  if(s.size() > 0xFFFF)
+    throw StringError("Game record string is too long: " + s.substr(0,100) + "...");
+  putU16(buf,(uint16_t)s.size());
+  buf.append(s);
+}
+
+//Moves are encoded in 16 bits as the point index y*bSize+x, or bSize*bSize for pass, with the top bit set for white
+static const uint16_t WHITE_MOVE_BIT = 0x8000;
+static uint16_t encodeMove(const Move& move, int bSize) {
+  uint16_t point;
+  if(move.loc == Board::PASS_LOC)
+    point = (uint16_t)(bSize*bSize);
+  else
+    point = (uint16_t)(Location::getY(move.loc,bSize) * bSize + Location::getX(move.loc,bSize));
+  return point | (move.pla == P_WHITE ? WHITE_MOVE_BIT : 0);
+}
+
+namespace {
+  struct ByteReader {
+    const char* data;
+    size_t len;
+    size_t pos;
+
+    ByteReader(const char* d, size_t l)
+      :data(d),len(l),pos(0)
+    {}
+
+    void need(size_t n) {
+      if(len - pos < n)
+        throw IOError(string("Game record is truncated"));
+    }
+    uint64_t getLE(int numBytes) {
+      need(numBytes);
+      uint64_t x = 0;
+      for(int i = 0; i<numBytes; i++)
+        x |= (uint64_t)(uint8_t)data[pos+i] << (8*i);
+      pos += numBytes;
+      return x;
+    }
+    uint8_t getU8() { return (uint8_t)getLE(1); }
+    uint16_t getU16() { return (uint16_t)getLE(2); }
+    uint32_t getU32() { return (uint32_t)getLE(4); }
+    uint64_t getU64() { return getLE(8); }
+    float getF32() {
+      uint32_t bits = getU32();
+      float x;
+      std::memcpy(&x,&bits,sizeof(x));
+      return x;
+    }
+    uint64_t getVarUInt() {
+      uint64_t x = 0;
+      for(int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = getU8();
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if((b & 0x80) == 0)
+          return x;
+      }
+      throw IOError(string("Game record has a bad varint"));
+    }
+    string getString() {
+      uint16_t n = getU16();
+      need(n);
+      string s(data+pos,n);
+      pos += n;
+      return s;
+    }
+    Move getMove(int bSize) {
+      uint16_t x = getU16();
+      Player pla = (x & WHITE_MOVE_BIT) ? P_WHITE : P_BLACK;
+      int point = x & ~WHITE_MOVE_BIT;
+      if(point > bSize*bSize)
+        throw IOError("Game record has a bad move: " + Global::intToString(point));
+      if(point == bSize*bSize)
+        return Move(Board::PASS_LOC,pla);
+      return Move(Location::getLoc(point % bSize, point / bSize, bSize),pla);
+    }
+  };
+}
+
+void GameRecord::encode(string& buf) const {
+  putString(buf,bName);
+  putString(buf,wName);
+  putU8(buf,(uint8_t)bSize);
+  putU8(buf,(uint8_t)rules.koRule);
+  putU8(buf,(uint8_t)rules.scoringRule);
+  putU8(buf,(uint8_t)rules.multiStoneSuicideLegal);
+  putF32(buf,rules.komi);
+  putU64(buf,gameHash.hash0);
+  putU64(buf,gameHash.hash1);
+
+  putU32(buf,(uint32_t)mode);
+  putU32(buf,(uint32_t)modeMeta1);
+  putU32(buf,(uint32_t)modeMeta2);
+  putU16(buf,(uint16_t)changedNeuralNets.size());
+  for(size_t i = 0; i<changedNeuralNets.size(); i++) {
+    putString(buf,changedNeuralNets[i].name);
+    putU32(buf,(uint32_t)changedNeuralNets[i].turnNumber);
+  }
+
+  putU16(buf,(uint16_t)placements.size());
+  for(size_t i = 0; i<placements.size(); i++)
+    putU16(buf,encodeMove(placements[i],bSize));
+  putU8(buf,(uint8_t)initialPla);
+  putU8(buf,(uint8_t)initialEncorePhase);
+  putU32(buf,(uint32_t)moves.size());
+  for(size_t i = 0; i<moves.size(); i++)
+    putU16(buf,encodeMove(moves[i],bSize));
+
+  putU32(buf,(uint32_t)startTurnIdx);
+  putU32(buf,(uint32_t)valuesByTurn.size());
+  for(size_t i = 0; i<valuesByTurn.size(); i++) {
+    putF32(buf,valuesByTurn[i].win);
+    putF32(buf,valuesByTurn[i].loss);
+    putF32(buf,valuesByTurn[i].noResult);
+    putF32(buf,valuesByTurn[i].score);
+    putVarUInt(buf,(uint64_t)valuesByTurn[i].unreducedNumVisits);
+  }
+
+  uint8_t resultFlags = (isGameFinished ? 1 : 0) | (isNoResult ? 2 : 0) | (isResignation ? 4 : 0);
+  putU8(buf,resultFlags);
+  putU8(buf,(uint8_t)winner);
+  putF32(buf,finalWhiteMinusBlackScore);
+}
+
+void GameRecord::decode(const char* data, size_t len) {
+  ByteReader in(data,len);
+  bName = in.getString();
+  wName = in.getString();
+  bSize = in.getU8();
+  if(bSize < 2 || bSize > Board::MAX_LEN)
+    throw IOError("Game record has a bad board size: " + Global::intToString(bSize));
+  rules.koRule = in.getU8();
+  rules.scoringRule = in.getU8();
+  rules.multiStoneSuicideLegal = in.getU8() != 0;
+  rules.komi = in.getF32();
+  if(rules.koRule > Rules::KO_SPIGHT || rules.scoringRule > Rules::SCORING_TERRITORY)
+    throw IOError(string("Game record has bad rules"));
+  gameHash.hash0 = in.getU64();
+  gameHash.hash1 = in.getU64();
+
+  mode = (int)in.getU32();
+  modeMeta1 = (int)in.getU32();
+  modeMeta2 = (int)in.getU32();
+  changedNeuralNets.resize(in.getU16());
+  for(size_t i = 0; i<changedNeuralNets.size(); i++) {
+    changedNeuralNets[i].name = in.getString();
+    changedNeuralNets[i].turnNumber = (int)in.getU32();
+  }
+
+  placements.resize(in.getU16());
+  for(size_t i = 0; i<placements.size(); i++)
+    placements[i] = in.getMove(bSize);
+  initialPla = in.getU8();
+  initialEncorePhase = in.getU8();
+  if((initialPla != P_BLACK && initialPla != P_WHITE) || initialEncorePhase > 2)
+    throw IOError(string("Game record has a bad initial player or encore phase"));
+  uint32_t numMoves = in.getU32();
+  in.need((size_t)numMoves * 2);
+  moves.resize(numMoves);
+  for(size_t i = 0; i<moves.size(); i++)
+    moves[i] = in.getMove(bSize);
+
+  startTurnIdx = (int)in.getU32();
+  uint32_t numValues = in.getU32();
+  if(startTurnIdx < 0 || startTurnIdx > moves.size() || numValues > moves.size() - startTurnIdx)
+    throw IOError(string("Game record has a bad start turn or number of values"));
+  valuesByTurn.resize(numValues);
+  for(size_t i = 0; i<valuesByTurn.size(); i++) {
+    valuesByTurn[i].win = in.getF32();
+    valuesByTurn[i].loss = in.getF32();
+    valuesByTurn[i].noResult = in.getF32();
+    valuesByTurn[i].score = in.getF32();
+    valuesByTurn[i].unreducedNumVisits = (int64_t)in.getVarUInt();
+  }
+
+  uint8_t resultFlags = in.getU8();
+  isGameFinished = (resultFlags & 1) != 0;
+  isNoResult = (resultFlags & 2) != 0;
+  isResignation = (resultFlags & 4) != 0;
+  winner = in.getU8();
+  if(winner != C_EMPTY && winner != C_BLACK && winner != C_WHITE)
+    throw IOError(string("Game record has a bad winner"));
+  finalWhiteMinusBlackScore = in.getF32();
+
+  if(in.pos != len)
+    throw IOError(string("Game record has extra bytes"));
+}
+
+//WRITING---------------------------------------------------------------------
+
+GameRecordWriter::GameRecordWriter(const string& fileName)
+  :fileOut(NULL),out(NULL),bytesWritten(0),recordOffsets(),buf(),isClosed(false)
+{
+  fileOut = new std::ofstream(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!fileOut->good()) {
+    delete fileOut;
+    throw IOError("Could not open " + fileName);
+  }
+  out = fileOut;
+  buf.assign(FILE_MAGIC,MAGIC_LEN);
+  writeBuf();
+}
+
+GameRecordWriter::GameRecordWriter(ostream* o)
+  :fileOut(NULL),out(o),bytesWritten(0),recordOffsets(),buf(),isClosed(false)
+{
+  buf.assign(FILE_MAGIC,MAGIC_LEN);
+  writeBuf();
+}
+
+GameRecordWriter::~GameRecordWriter() {
+  //Destructors cannot throw, and a failed write here will just leave the file without an index
+  if(!isClosed) {
+    try {
+      close();
+    }
+    catch(const IOError&) {
+    }
+  }
+  if(fileOut != NULL)
+    delete fileOut;
+}
+
+void GameRecordWriter::writeBuf() {
+  out->write(buf.data(),buf.size());
+  if(!out->good())
+    throw IOError(string("Error writing game records"));
+  bytesWritten += buf.size();
+}
+
+void GameRecordWriter::writeGame(const FinishedGameData& data) {
+  GameRecord record;
+  record.setFromFinishedGame(data);
+  writeRecord(record);
+}
+
+void GameRecordWriter::writeRecord(const GameRecord& record) {
+  assert(!isClosed);
+  buf.clear();
+  putU32(buf,0);
+  record.encode(buf);
+  uint32_t recordLen = (uint32_t)(buf.size() - 4);
+  for(int i = 0; i<4; i++)
+    buf[i] = (char)((recordLen >> (8*i)) & 0xFF);
+  recordOffsets.push_back(bytesWritten);
+  writeBuf();
+}
+
+void GameRecordWriter::close() {
+  assert(!isClosed);
+  isClosed = true;
+  buf.clear();
+  for(size_t i = 0; i<recordOffsets.size(); i++)
+    putU64(buf,recordOffsets[i]);
+  putU64(buf,recordOffsets.size());
+  buf.append(INDEX_MAGIC,MAGIC_LEN);
+  writeBuf();
+  out->flush();
+  if(fileOut != NULL)
+    fileOut->close();
+}
+
+uint64_t GameRecordWriter::getNumRecords() const {
+  return recordOffsets.size();
+}
+
+//READING---------------------------------------------------------------------
+
+GameRecordReader::GameRecordReader(const string& fName)
+  :mapping(NULL),data(NULL),len(0),fileName(fName),recordOffsets(),fileHasIndex(false)
+{
+  mapping = new MappedFile(fileName);
+  data = mapping->getData();
+  len = (size_t)mapping->getSize();
+  try {
+    init();
+  }
+  catch(...) {
+    delete mapping;
+    throw;
+  }
+}
+
+GameRecordReader::GameRecordReader(const char* d, size_t l, const string& fName)
+  :mapping(NULL),data(d),len(l),fileName(fName),recordOffsets(),fileHasIndex(false)
+{
+  init();
+}
+
+GameRecordReader::~GameRecordReader() {
+  if(mapping != NULL)
+    delete mapping;
+}
+
+static uint64_t readU64(const char* p) {
+  uint64_t x = 0;
+  for(int i = 0; i<8; i++)
+    x |= (uint64_t)(uint8_t)p[i] << (8*i);
+  return x;
+}
+static uint32_t readU32(const char* p) {
+  uint32_t x = 0;
+  for(int i = 0; i<4; i++)
+    x |= (uint32_t)(uint8_t)p[i] << (8*i);
+  return x;
+}
+
+void GameRecordReader::init() {
+  if(len < MAGIC_LEN || std::memcmp(data,FILE_MAGIC,MAGIC_LEN) != 0)
+    throw IOError(fileName + " is not a game record file");
+
+  //Use the index if the file was closed
+  if(len >= MAGIC_LEN + 8 + MAGIC_LEN && std::memcmp(data + len - MAGIC_LEN,INDEX_MAGIC,MAGIC_LEN) == 0) {
+    uint64_t numRecords = readU64(data + len - MAGIC_LEN - 8);
+    size_t maxRecords = (len - MAGIC_LEN - 8 - MAGIC_LEN) / 8;
+    if(numRecords > maxRecords)
+      throw IOError(fileName + " has a bad game record index");
+    size_t indexStart = len - MAGIC_LEN - 8 - (size_t)numRecords * 8;
+    recordOffsets.resize((size_t)numRecords);
+    for(size_t i = 0; i<recordOffsets.size(); i++) {
+      uint64_t offset = readU64(data + indexStart + i*8);
+      //Written without adding to offset, which could wrap around for a corrupt one
+      if(offset < MAGIC_LEN || offset > indexStart - 4 || readU32(data + offset) > indexStart - 4 - offset)
+        throw IOError(fileName + " has a bad game record index");
+      recordOffsets[i] = offset;
+    }
+    fileHasIndex = true;
+    return;
+  }
+
+  //Otherwise find the records by their lengths, ignoring any partially written one at the end
+  size_t pos = MAGIC_LEN;
+  while(len - pos >= 4) {
+    size_t recordLen = readU32(data + pos);
+    if(len - pos - 4 < recordLen)
+      break;
+    recordOffsets.push_back(pos);
+    pos += 4 + recordLen;
+  }
+  fileHasIndex = false;
+}
+
+uint64_t GameRecordReader::getNumRecords() const {
+  return recordOffsets.size();
+}
+bool GameRecordReader::hasIndex() const {
+  return fileHasIndex;
+}
+
+void GameRecordReader::read(uint64_t idx, GameRecord& record) const {
+  assert(idx < recordOffsets.size());
+  const char* p = data + recordOffsets[idx];
+  try {
+    record.decode(p + 4, readU32(p));
+  }
+  catch(const IOError& e) {
+    throw IOError(fileName + " record " + Global::uint64ToString(idx) + ": " + e.message);
+  }
+}
+
+void GameRecordReader::iterRecords(const vector<string>& files, std::function<void(const string&,uint64_t,const GameRecord&)> f) {
+  GameRecord record;
+  for(size_t i = 0; i<files.size(); i++) {
+    GameRecordReader reader(files[i]);
+    for(uint64_t idx = 0; idx<reader.getNumRecords(); idx++) {
+      reader.read(idx,record);
+      f(files[i],idx,record);
+    }
+  }
+}
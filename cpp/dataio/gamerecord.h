@@ -0,0 +1,141 @@
+#ifndef GAMERECORD_H_
+#define GAMERECORD_H_
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../game/board.h"
+#include "../game/boardhistory.h"
+#include "../dataio/trainingwrite.h"
+
+class MappedFile;
+
+//Root search values before a move, as in ValueTargets from the perspective of white, and the visits of that search.
+struct GameRecordValues {
+  float win;
+  float loss;
+  float noResult;
+  float score;
+  int64_t unreducedNumVisits;
+
+  GameRecordValues();
+  ~GameRecordValues();
+};
+
+//Compact binary record of a finished game, holding everything needed to replay it or to export it as the same sgf
+//that WriteSgf::writeSgf would write for it.
+struct GameRecord {
+  string bName;
+  string wName;
+  Rules rules;
+  int bSize;
+  Hash128 gameHash;
+
+  //Metadata about how the game was initialized, as in FinishedGameData
+  int mode;
+  int modeMeta1;
+  int modeMeta2;
+  vector<ChangedNeuralNet> changedNeuralNets;
+
+  //Stones on the board at the start of the game, and who was to move and in what encore phase
+  vector<Move> placements;
+  Player initialPla;
+  int initialEncorePhase;
+  vector<Move> moves;
+
+  //Index of the first move that was used for training data, and the root values before each move from there on,
+  //or empty if these were not recorded.
+  int startTurnIdx;
+  vector<GameRecordValues> valuesByTurn;
+
+  //Result of the game, as in BoardHistory
+  bool isGameFinished;
+  Player winner;
+  float finalWhiteMinusBlackScore;
+  bool isNoResult;
+  bool isResignation;
+
+  GameRecord();
+  ~GameRecord();
+
+  //Set the players, rules, moves and result from hist, leaving the metadata and values as they are
+  void setFromHistory(const string& bName, const string& wName, const Rules& rules, const BoardHistory& hist);
+  void setFromFinishedGame(const FinishedGameData& data);
+
+  //Set board and hist to the start of the game, or after turnNumber moves
+  void setupInitialBoardAndHist(Board& board, Player& nextPla, BoardHistory& hist) const;
+  void setupBoardAndHist(Board& board, Player& nextPla, BoardHistory& hist, int turnNumber) const;
+
+  //Write the game as an sgf with no newlines, the same as selfplay writes, see WriteSgf::writeSgf
+  void writeSgf(ostream& out) const;
+
+  //Append the binary encoding of this record to buf, or decode one from exactly len bytes, throwing IOError if malformed
+  void encode(string& buf) const;
+  void decode(const char* data, size_t len);
+};
+
+//A game record file is a header, then each record as its length and its encoding, then an index of the offset of
+//each record and the number of records, all little-endian. Records are only ever appended, and the index is written
+//on close, so a file that was never closed, such as by a killed selfplay process, is still readable up through its
+//last complete record.
+class GameRecordWriter {
+ public:
+  GameRecordWriter(const string& fileName);
+  //Write to the given stream instead of a file, not taking ownership of it
+  GameRecordWriter(ostream* out);
+  //Closes, if not already closed
+  ~GameRecordWriter();
+
+  GameRecordWriter(const GameRecordWriter&) = delete;
+  GameRecordWriter& operator=(const GameRecordWriter&) = delete;
+
+  void writeGame(const FinishedGameData& data);
+  void writeRecord(const GameRecord& record);
+  //Write the index and flush, after which no more records may be written
+  void close();
+
+  uint64_t getNumRecords() const;
+
+ private:
+  std::ofstream* fileOut;
+  ostream* out;
+  uint64_t bytesWritten;
+  vector<uint64_t> recordOffsets;
+  string buf;
+  bool isClosed;
+
+  void writeBuf();
+};
+
+class GameRecordReader {
+ public:
+  //Throws IOError if the file cannot be read or is not a game record file
+  GameRecordReader(const string& fileName);
+  //Read from len bytes of data, which must outlive this reader
+  GameRecordReader(const char* data, size_t len, const string& fileName);
+  ~GameRecordReader();
+
+  GameRecordReader(const GameRecordReader&) = delete;
+  GameRecordReader& operator=(const GameRecordReader&) = delete;
+
+  uint64_t getNumRecords() const;
+  //False if the file has no index because it was never closed, in which case the records were found by scanning
+  bool hasIndex() const;
+
+  //Decode the idx-th record, throwing IOError if it is malformed. Safe to call concurrently.
+  void read(uint64_t idx, GameRecord& record) const;
+
+  //Read every record of every file in order, calling f with the file and record index
+  static void iterRecords(const vector<string>& files, std::function<void(const string&,uint64_t,const GameRecord&)> f);
+
+ private:
+  MappedFile* mapping;
+  const char* data;
+  size_t len;
+  string fileName;
+  vector<uint64_t> recordOffsets;
+  bool fileHasIndex;
+
+  void init();
+};
+
+#endif
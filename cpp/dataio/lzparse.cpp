@@ -1,27 +1,39 @@
-
-#include <zstr/src/zstr.hpp>
+#include <zlib.h>
 #include <cstdlib>
+#include <cstring>
+#include <sstream>
 
 #include "../dataio/lzparse.h"
 
+//Leela Zero data is always 19x19, so this build needs to support boards at least that big
+static int lzBoardLen() {
+  if(Board::MAX_LEN < 19)
+    throw IOError(
+      "Leela zero data is 19x19 but this build only supports boards up to " + Global::intToString(Board::MAX_LEN) +
+      ", recompile with COMPILE_MAX_BOARD_LEN >= 19"
+    );
+  return 19;
+}
+
 LZSample::LZSample()
-  :emptyBoard(19,19),plaStones(),oppStones(),sideStr(),policyStr(),resultStr()
+  :emptyBoard(lzBoardLen(),lzBoardLen()),plaStones(),oppStones(),pla(P_BLACK),policy(),plaWon(false)
 {}
 
 LZSample::~LZSample()
 {}
 
-static void getLine(istream& in, string& buf) {
-  std::getline(in,buf);
-  size_t len = buf.length();
-  if(len > 0 && buf[len-1] == '\r') //just in case
-    buf.pop_back();
-}
-
-static void setStone(Color* stones, int tensorPos, Color stone) {
-  int x = tensorPos % 19;
-  int y = tensorPos / 19;
-  stones[Location::getLoc(x,y,19)] = stone;
+//Find the next line in [pos,end), advancing pos past it, and return false if there is none. Strips any trailing \r.
+static bool nextLine(const char*& pos, const char* end, const char*& line, size_t& lineLen) {
+  if(pos >= end)
+    return false;
+  const char* newline = (const char*)std::memchr(pos,'\n',end-pos);
+  const char* lineEnd = newline == NULL ? end : newline;
+  line = pos;
+  lineLen = lineEnd - pos;
+  if(lineLen > 0 && line[lineLen-1] == '\r') //just in case
+    lineLen--;
+  pos = newline == NULL ? end : newline+1;
+  return true;
 }
 
 static int parseHexChar(char c) {
@@ -31,42 +43,55 @@ static int parseHexChar(char c) {
   else if (c >= 'a' && c <= 'f')
     d = c-'a'+10;
   else
-    assert(false);
+    throw IOError(string("Bad leela zero hex char"));
   return d;
 }
 
-static void decodeStones(const string& linePla, const string& lineOpp, Color* stones, Player pla)
-{
-  assert(linePla.length() == 91);
-  assert(lineOpp.length() == 91);
-  Player opp = getOpp(pla);
-  //The first 90 characters are a hex-encoding of the first 360 points
+//The high bit of each hex digit is the first of its four points, so reverse the bits to put that point lowest
+static const uint64_t reversedHexDigitBits[16] = {0x0,0x8,0x4,0xC,0x2,0xA,0x6,0xE,0x1,0x9,0x5,0xD,0x3,0xB,0x7,0xF};
+
+static void decodeStonesLine(const char* line, size_t lineLen, uint64_t stones[LZSample::NUM_STONE_WORDS]) {
+  if(lineLen != 91)
+    throw IOError(string("Bad leela zero stones line length"));
+  for(int w = 0; w<LZSample::NUM_STONE_WORDS; w++)
+    stones[w] = 0;
+  //The first 90 characters are a hex-encoding of the first 360 points.
+  //Since 64 is a multiple of 4, the points of each character lie within one word.
   for(int i = 0; i<90; i++) {
-    int dPla = parseHexChar(linePla[i]);
-    int dOpp = parseHexChar(lineOpp[i]);
-
-    Color stone;
-    if(dPla & 0x8) stone = pla; else if(dOpp & 0x8) stone = opp; else stone = C_EMPTY;
-    setStone(stones,i*4+0,stone);
-    if(dPla & 0x4) stone = pla; else if(dOpp & 0x4) stone = opp; else stone = C_EMPTY;
-    setStone(stones,i*4+1,stone);
-    if(dPla & 0x2) stone = pla; else if(dOpp & 0x2) stone = opp; else stone = C_EMPTY;
-    setStone(stones,i*4+2,stone);
-    if(dPla & 0x1) stone = pla; else if(dOpp & 0x1) stone = opp; else stone = C_EMPTY;
-    setStone(stones,i*4+3,stone);
+    int point = i*4;
+    stones[point / 64] |= reversedHexDigitBits[parseHexChar(line[i])] << (point % 64);
   }
   //The last character is either 0 or 1
-  {
-    int cPla = linePla[90];
-    int cOpp = lineOpp[90];
-
-    assert(cPla == '1' || cPla == '0');
-    assert(cOpp == '1' || cOpp == '0');
+  if(line[90] == '1')
+    stones[360 / 64] |= (uint64_t)1 << (360 % 64);
+  else if(line[90] != '0')
+    throw IOError(string("Bad leela zero last stone char"));
+}
 
-    Color stone;
-    if(cPla == '1') stone = pla; else if(cOpp == '1') stone = opp; else stone = C_EMPTY;
-    setStone(stones,90*4,stone);
+static void decodePolicyLine(const char* line, size_t lineLen, float policy[362]) {
+  //The line lies within a null-terminated buffer, but strtod skips newlines, so make sure it stays within the line
+  const char* lineEnd = line + lineLen;
+  const char* s = line;
+  for(int i = 0; i<362; i++) {
+    char* end = NULL;
+    policy[i] = (float)std::strtod(s,&end);
+    if(end == s || end > lineEnd)
+      throw IOError(string("Bad leela zero policy"));
+    s = end;
   }
+  while(s < lineEnd && Global::isWhitespace(*s))
+    s++;
+  if(s != lineEnd)
+    throw IOError(string("Bad leela zero policy, too many values"));
+}
+
+static Color getStone(const LZSample& sample, int historyIdx, int point, Player pla, Player opp) {
+  uint64_t bit = (uint64_t)1 << (point % 64);
+  if(sample.plaStones[historyIdx][point / 64] & bit)
+    return pla;
+  if(sample.oppStones[historyIdx][point / 64] & bit)
+    return opp;
+  return C_EMPTY;
 }
 
 static Move inferMove(Color* board, Color* prev, Player whoMoved, Color stones[8][Board::MAX_ARR_SIZE], int stonesIdx, const short adj_offsets[8]) {
@@ -100,19 +125,21 @@ static Move inferMove(Color* board, Color* prev, Player whoMoved, Color stones[8
     for(int x = 0; x<19; x++) {
       Loc loc = Location::getLoc(x,y,19);
       if(board[loc] != prev[loc]) {
+        //Include the boards in the error rather than printing them, since samples may be read on many threads at once
+        ostringstream out;
+        out << "Bad leela zero board consistency, problem getting to index " << stonesIdx << " from " << (stonesIdx+1) << endl;
         for(int i = 0; i<8; i++) {
           for(int y2 = 0; y2<19; y2++) {
             for(int x2 = 0; x2<19; x2++) {
               Loc loc2 = Location::getLoc(x2,y2,19);
               assert(stones[i][loc2] >= 0 && stones[i][loc2] <= 2);
-              cout << (stones[i][loc2] == 0 ? '.' : stones[i][loc2] == 1 ? 'X' : 'O');
+              out << (stones[i][loc2] == 0 ? '.' : stones[i][loc2] == 1 ? 'X' : 'O');
             }
-            cout << endl;
+            out << endl;
           }
-          cout << endl;
+          out << endl;
         }
-        cout << "Problem getting to index " << stonesIdx << " from " << (stonesIdx+1) << endl;
-        throw IOError(string("Bad leela zero board consistency"));
+        throw IOError(out.str());
       }
     }
   }
@@ -123,32 +150,87 @@ void LZSample::iterSamples(
   const string& gzippedFile,
   std::function<void(const LZSample&,const string&,int)> f
 ) {
-  LZSample sample;
-  zstr::ifstream in(gzippedFile);
+  lzBoardLen();
 
-  int sampleCount = 0;
-  while(in.good()) {
-    //First 8 lines are pla stones, second 8 lines are opp stones
-    //Most recent states are first
-    for(int i = 0; i<8; i++) {
-      getLine(in,sample.plaStones[i]);
-    }
-    for(int i = 0; i<8; i++) {
-      getLine(in,sample.oppStones[i]);
+  //Decompress the whole file at once, which is far faster than reading it a line at a time
+  string buf;
+  {
+    gzFile in = gzopen(gzippedFile.c_str(),"rb");
+    if(in == NULL)
+      throw IOError("Could not open " + gzippedFile);
+    gzbuffer(in,1 << 18);
+    const size_t readSize = 1 << 20;
+    while(true) {
+      size_t oldSize = buf.size();
+      buf.resize(oldSize + readSize);
+      int numRead = gzread(in,&buf[oldSize],(unsigned int)readSize);
+      if(numRead < 0) {
+        int errnum;
+        string msg = gzerror(in,&errnum);
+        gzclose(in);
+        throw IOError("Could not read " + gzippedFile + ": " + msg);
+      }
+      buf.resize(oldSize + numRead);
+      if(numRead == 0)
+        break;
     }
+    gzclose(in);
+  }
 
-    if(!in.good())
+  LZSample sample;
+  const char* pos = buf.data();
+  const char* end = buf.data() + buf.size();
+  int sampleCount = 0;
+  while(true) {
+    while(pos < end && (*pos == '\n' || *pos == '\r'))
+      pos++;
+    if(pos >= end)
       break;
 
-    //Next line is which color, 0 = black, 1 = white
-    getLine(in,sample.sideStr);
-    assert(sample.sideStr.length() == 1);
-
-    //Next we have 362 floats indicating moves
-    getLine(in,sample.policyStr);
+    try {
+      const char* line;
+      size_t lineLen;
+      auto getLine = [&]() {
+        if(!nextLine(pos,end,line,lineLen))
+          throw IOError(string("Truncated leela zero sample"));
+      };
+
+      //First 8 lines are pla stones, second 8 lines are opp stones
+      //Most recent states are first
+      for(int i = 0; i<NUM_HISTORY; i++) {
+        getLine();
+        decodeStonesLine(line,lineLen,sample.plaStones[i]);
+      }
+      for(int i = 0; i<NUM_HISTORY; i++) {
+        getLine();
+        decodeStonesLine(line,lineLen,sample.oppStones[i]);
+      }
 
-    //Next we have one line indicating whether the current player won or lost (+1 or -1).
-    getLine(in,sample.resultStr);
+      //Next line is which color, 0 = black, 1 = white
+      getLine();
+      if(lineLen == 1 && line[0] == '0')
+        sample.pla = P_BLACK;
+      else if(lineLen == 1 && line[0] == '1')
+        sample.pla = P_WHITE;
+      else
+        throw IOError(string("Bad leela zero side to move"));
+
+      //Next we have 362 floats indicating moves
+      getLine();
+      decodePolicyLine(line,lineLen,sample.policy);
+
+      //Next we have one line indicating whether the current player won or lost (+1 or -1).
+      getLine();
+      if(lineLen == 1 && line[0] == '1')
+        sample.plaWon = true;
+      else if(lineLen == 2 && line[0] == '-' && line[1] == '1')
+        sample.plaWon = false;
+      else
+        throw IOError(string("Bad leela zero result"));
+    }
+    catch(const IOError& e) {
+      throw IOError(gzippedFile + " sample " + Global::intToString(sampleCount) + ": " + e.message);
+    }
 
     f(sample,gzippedFile,sampleCount);
     sampleCount++;
@@ -166,19 +248,14 @@ void LZSample::parse(
   if(moves.size() != 8)
     moves.resize(8);
 
-  Player pla;
-  if(sideStr[0] == '0')
-    pla = P_BLACK;
-  else if(sideStr[0] == '1')
-    pla = P_WHITE;
-  else
-    assert(false);
   Player opp = getOpp(pla);
 
-  //Parse all stones
+  //Expand all stones
   Color stones[8][Board::MAX_ARR_SIZE];
-  for(int i = 0; i<8; i++)
-    decodeStones(plaStones[i], oppStones[i], stones[i], pla);
+  for(int i = 0; i<8; i++) {
+    for(int point = 0; point<NUM_POINTS; point++)
+      stones[i][Location::getLoc(point % 19, point / 19, 19)] = getStone(*this,i,point,pla,opp);
+  }
 
   //Infer the moves based on the stones
   for(int i = 0; i<7; i++)
@@ -211,22 +288,16 @@ void LZSample::parse(
   }
 
   {
-    const char* start = policyStr.c_str();
-    const char* s = start;
-    char* end = NULL;
-
     float maxProb = 0;
     int maxI = 0;
     for(int i = 0; i<362; i++) {
-      float prob = std::strtod(s,&end);
+      float prob = policy[i];
       policyTarget[i] = prob;
-      s = end;
       if(prob > maxProb) {
         maxProb = prob;
         maxI = i;
       }
     }
-    assert(end == start + policyStr.length());
 
     //Fill in the "next" move to be the argmax of the policyTarget
     if(maxI == 361)
@@ -238,12 +309,7 @@ void LZSample::parse(
     }
   }
 
-  if(resultStr == "1")
-    winner = pla;
-  else if(resultStr == "-1")
-    winner = opp;
-  else
-    assert(false);
+  winner = plaWon ? pla : opp;
 
   nextPlayer = pla;
 }
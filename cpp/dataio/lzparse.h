@@ -5,17 +5,29 @@
 #include "../game/board.h"
 #include "../dataio/sgf.h"
 
+//One sample of Leela Zero training data, decoded from text as it is read, so that it holds no strings.
 struct LZSample {
-  Board emptyBoard;
-  string plaStones[8];
-  string oppStones[8];
-  string sideStr;
-  string policyStr;
-  string resultStr;
+  static const int NUM_HISTORY = 8;
+  static const int NUM_POINTS = 361;
+  static const int NUM_STONE_WORDS = (NUM_POINTS + 63) / 64;
 
+  Board emptyBoard;
+  //Stones of the player to move and of the opponent, for each of the NUM_HISTORY most recent positions, most recent
+  //first. Bit (i%64) of word (i/64) is set if there is a stone at point i, where point y*19+x is (x,y).
+  uint64_t plaStones[NUM_HISTORY][NUM_STONE_WORDS];
+  uint64_t oppStones[NUM_HISTORY][NUM_STONE_WORDS];
+  Player pla;
+  float policy[NUM_POINTS+1]; //Indexed by y*19+x as usual, then pass
+  bool plaWon;
+
+  //Throws IOError if Board::MAX_LEN is less than 19
   LZSample();
   ~LZSample();
 
+  //Decompress a whole gzipped LZ training data file, and call f with each sample, the file name, and the index of
+  //the sample in the file. The same LZSample is reused for every call.
+  //Throws IOError if the file cannot be read or has a malformed sample, after calling f for all the prior samples.
+  //Also throws IOError up front if Board::MAX_LEN is less than 19.
   static void iterSamples(
     const string& gzippedFile,
     std::function<void(const LZSample&,const string&,int)> f
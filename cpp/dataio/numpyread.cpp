@@ -0,0 +1,433 @@
+#include "../dataio/numpyread.h"
+#include "../core/mappedfile.h"
+#include <cstring>
+#include <type_traits>
+#include <zlib.h>
+
+//-------------------------------------------------------------------------------------------------------------
+
+NumpyArrayView::NumpyArrayView()
+  :data(NULL),dtype(),shape(),numRows(0),elementBytes(0),rowBytes(0)
+{}
+
+static int64_t parseHeaderInt(const string& s, size_t& idx) {
+  int64_t x = 0;
+  size_t start = idx;
+  while(idx < s.size() && s[idx] >= '0' && s[idx] <= '9') {
+    if(x > ((int64_t)1 << 56))
+      throw IOError("Npy header has too large a shape: " + s);
+    x = x * 10 + (s[idx] - '0');
+    idx++;
+  }
+  if(idx == start)
+    throw IOError("Could not parse npy header shape: " + s);
+  return x;
+}
+
+static void skipSpaces(const string& s, size_t& idx) {
+  while(idx < s.size() && s[idx] == ' ')
+    idx++;
+}
+
+int64_t NumpyArrayView::parseHeader(const char* buf, uint64_t len, string& dtype, vector<int64_t>& shape) {
+  if(len < 10 || (uint8_t)buf[0] != 0x93 || strncmp(buf+1,"NUMPY",5) != 0)
+    throw IOError("Not an npy file");
+  int majorVersion = (uint8_t)buf[6];
+  uint64_t headerStart;
+  uint64_t headerLen;
+  if(majorVersion == 1) {
+    headerStart = 10;
+    headerLen = (uint64_t)(uint8_t)buf[8] | ((uint64_t)(uint8_t)buf[9] << 8);
+  }
+  else if(majorVersion == 2 || majorVersion == 3) {
+    if(len < 12)
+      throw IOError("Truncated npy header");
+    headerStart = 12;
+    headerLen =
+      (uint64_t)(uint8_t)buf[8] | ((uint64_t)(uint8_t)buf[9] << 8) |
+      ((uint64_t)(uint8_t)buf[10] << 16) | ((uint64_t)(uint8_t)buf[11] << 24);
+  }
+  else
+    throw IOError("Unsupported npy version " + Global::intToString(majorVersion));
+  if(headerStart + headerLen > len)
+    throw IOError("Truncated npy header");
+
+  //The header is a python dict literal, such as {'descr':'<f4','fortran_order':False,'shape':(25,19),}
+  string dict(buf + headerStart, headerLen);
+
+  size_t idx = dict.find("'descr'");
+  if(idx == string::npos)
+    throw IOError("Npy header has no descr: " + dict);
+  idx = dict.find('\'', idx + 7);
+  size_t end = (idx == string::npos) ? string::npos : dict.find('\'', idx + 1);
+  if(end == string::npos)
+    throw IOError("Could not parse npy header descr: " + dict);
+  dtype = dict.substr(idx + 1, end - idx - 1);
+
+  idx = dict.find("'fortran_order'");
+  if(idx == string::npos)
+    throw IOError("Npy header has no fortran_order: " + dict);
+  idx = dict.find(':', idx);
+  if(idx == string::npos)
+    throw IOError("Could not parse npy header fortran_order: " + dict);
+  idx++;
+  skipSpaces(dict,idx);
+  if(dict.compare(idx, 5, "False") != 0)
+    throw IOError("Fortran-ordered npy arrays are not supported: " + dict);
+
+  idx = dict.find("'shape'");
+  if(idx == string::npos)
+    throw IOError("Npy header has no shape: " + dict);
+  idx = dict.find('(', idx);
+  if(idx == string::npos)
+    throw IOError("Could not parse npy header shape: " + dict);
+  idx++;
+  shape.clear();
+  while(true) {
+    skipSpaces(dict,idx);
+    if(idx < dict.size() && dict[idx] == ')')
+      break;
+    shape.push_back(parseHeaderInt(dict,idx));
+    skipSpaces(dict,idx);
+    if(idx < dict.size() && dict[idx] == ',')
+      idx++;
+    else if(idx >= dict.size() || dict[idx] != ')')
+      throw IOError("Could not parse npy header shape: " + dict);
+  }
+  return (int64_t)(headerStart + headerLen);
+}
+
+NumpyArrayView::NumpyArrayView(const char* buf, uint64_t len)
+  :data(NULL),dtype(),shape(),numRows(0),elementBytes(0),rowBytes(0)
+{
+  int64_t headerBytes = parseHeader(buf,len,dtype,shape);
+  if(shape.size() <= 0)
+    throw IOError("Npy arrays without a leading dimension are not supported");
+
+  size_t idx = 0;
+  while(idx < dtype.size() && !(dtype[idx] >= '0' && dtype[idx] <= '9'))
+    idx++;
+  if(idx >= dtype.size())
+    throw IOError("Unsupported npy dtype: " + dtype);
+  elementBytes = Global::stringToInt(dtype.substr(idx));
+
+  numRows = shape[0];
+  rowBytes = elementBytes;
+  for(size_t i = 1; i<shape.size(); i++)
+    rowBytes *= shape[i];
+  if(rowBytes > 0 && (uint64_t)numRows > (len - headerBytes) / rowBytes)
+    throw IOError("Npy array is truncated, shape does not fit in the data");
+  if((uint64_t)(numRows * rowBytes) != len - headerBytes)
+    throw IOError("Npy array size does not match its shape");
+  data = buf + headerBytes;
+}
+
+const char* NumpyArrayView::getRowBytes(int64_t startRow, int64_t numRowsToGet) const {
+  if(startRow < 0 || numRowsToGet < 0 || startRow + numRowsToGet > numRows)
+    throw StringError(
+      "NumpyArrayView: rows " + Global::int64ToString(startRow) + "-" + Global::int64ToString(startRow+numRowsToGet) +
+      " out of range for " + Global::int64ToString(numRows) + " rows"
+    );
+  return data + startRow * rowBytes;
+}
+
+template <typename T>
+static char getDtypeKind() {
+  if(std::is_floating_point<T>::value)
+    return 'f';
+  if(std::is_signed<T>::value)
+    return 'i';
+  return 'u';
+}
+
+template <typename T>
+const T* NumpyArrayView::getRows(int64_t startRow, int64_t numRowsToGet, vector<T>& alignedBuf) const {
+  //Like NumpyBuffer, assumes a little-endian machine
+  assert(dtype.size() >= 3);
+  char byteOrder = dtype[0];
+  char kind = dtype[1];
+  if((byteOrder != '<' && byteOrder != '|' && byteOrder != '=') || kind != getDtypeKind<T>() || elementBytes != (int64_t)sizeof(T))
+    throw StringError("NumpyArrayView: cannot access dtype " + dtype + " as a type of size " + Global::intToString(sizeof(T)));
+  const char* bytes = getRowBytes(startRow,numRowsToGet);
+  if(reinterpret_cast<uintptr_t>(bytes) % alignof(T) == 0)
+    return reinterpret_cast<const T*>(bytes);
+  alignedBuf.resize(numRowsToGet * rowBytes / sizeof(T));
+  std::memcpy(alignedBuf.data(), bytes, numRowsToGet * rowBytes);
+  return alignedBuf.data();
+}
+
+template const float* NumpyArrayView::getRows<float>(int64_t,int64_t,vector<float>&) const;
+template const double* NumpyArrayView::getRows<double>(int64_t,int64_t,vector<double>&) const;
+template const uint8_t* NumpyArrayView::getRows<uint8_t>(int64_t,int64_t,vector<uint8_t>&) const;
+template const uint16_t* NumpyArrayView::getRows<uint16_t>(int64_t,int64_t,vector<uint16_t>&) const;
+template const uint32_t* NumpyArrayView::getRows<uint32_t>(int64_t,int64_t,vector<uint32_t>&) const;
+template const uint64_t* NumpyArrayView::getRows<uint64_t>(int64_t,int64_t,vector<uint64_t>&) const;
+template const int8_t* NumpyArrayView::getRows<int8_t>(int64_t,int64_t,vector<int8_t>&) const;
+template const int16_t* NumpyArrayView::getRows<int16_t>(int64_t,int64_t,vector<int16_t>&) const;
+template const int32_t* NumpyArrayView::getRows<int32_t>(int64_t,int64_t,vector<int32_t>&) const;
+template const int64_t* NumpyArrayView::getRows<int64_t>(int64_t,int64_t,vector<int64_t>&) const;
+
+//-------------------------------------------------------------------------------------------------------------
+
+static uint32_t readU16(const char* p) {
+  return (uint32_t)(uint8_t)p[0] | ((uint32_t)(uint8_t)p[1] << 8);
+}
+static uint32_t readU32(const char* p) {
+  return readU16(p) | (readU16(p+2) << 16);
+}
+static uint64_t readU64(const char* p) {
+  return (uint64_t)readU32(p) | ((uint64_t)readU32(p+4) << 32);
+}
+
+static const uint32_t ZIP_LOCAL_HEADER_SIG = 0x04034b50;
+static const uint32_t ZIP_CENTRAL_HEADER_SIG = 0x02014b50;
+static const uint32_t ZIP_END_SIG = 0x06054b50;
+static const uint32_t ZIP64_END_SIG = 0x06064b50;
+static const uint32_t ZIP64_END_LOCATOR_SIG = 0x07064b50;
+static const uint32_t ZIP64_EXTRA_ID = 0x0001;
+static const int ZIP_METHOD_STORED = 0;
+static const int ZIP_METHOD_DEFLATED = 8;
+
+ZipReader::ZipReader(const string& fName)
+  :fileName(fName),mapping(NULL),fileData(NULL),fileSize(0),names(),entries(),entryIdxByName()
+{
+  mapping = new MappedFile(fileName);
+  fileData = mapping->getData();
+  fileSize = mapping->getSize();
+  try {
+    readCentralDirectory();
+  }
+  catch(const IOError&) {
+    delete mapping;
+    throw;
+  }
+}
+
+ZipReader::~ZipReader() {
+  delete mapping;
+}
+
+void ZipReader::readCentralDirectory() {
+  auto fail = [this](const string& msg) {
+    throw IOError("Could not read zip file " + fileName + ": " + msg);
+  };
+
+  //Find the end of central directory record, searching back past any comment
+  const uint64_t endRecordLen = 22;
+  if(fileSize < endRecordLen)
+    fail("too short");
+  uint64_t endPos = fileSize - endRecordLen;
+  uint64_t minEndPos = fileSize > endRecordLen + 65535 ? fileSize - endRecordLen - 65535 : 0;
+  while(readU32(fileData + endPos) != ZIP_END_SIG) {
+    if(endPos <= minEndPos)
+      fail("no end of central directory record");
+    endPos--;
+  }
+  const char* end = fileData + endPos;
+  uint64_t numEntries = readU16(end + 10);
+  uint64_t dirSize = readU32(end + 12);
+  uint64_t dirOffset = readU32(end + 16);
+
+  //Zip64 files have a further record just before
+  if(endPos >= 20 && readU32(end - 20) == ZIP64_END_LOCATOR_SIG) {
+    uint64_t end64Pos = readU64(end - 20 + 8);
+    if(end64Pos + 56 > endPos || readU32(fileData + end64Pos) != ZIP64_END_SIG)
+      fail("bad zip64 end of central directory record");
+    const char* end64 = fileData + end64Pos;
+    numEntries = readU64(end64 + 32);
+    dirSize = readU64(end64 + 40);
+    dirOffset = readU64(end64 + 48);
+  }
+  if(dirOffset > fileSize || dirSize > fileSize - dirOffset)
+    fail("central directory out of bounds");
+
+  uint64_t pos = dirOffset;
+  const uint64_t dirEnd = dirOffset + dirSize;
+  for(uint64_t i = 0; i<numEntries; i++) {
+    if(pos + 46 > dirEnd || readU32(fileData + pos) != ZIP_CENTRAL_HEADER_SIG)
+      fail("bad central directory entry");
+    const char* h = fileData + pos;
+    uint32_t flags = readU16(h + 8);
+    Entry entry;
+    entry.method = (int)readU16(h + 10);
+    entry.crc = readU32(h + 16);
+    entry.compressedSize = readU32(h + 20);
+    entry.size = readU32(h + 24);
+    uint64_t nameLen = readU16(h + 28);
+    uint64_t extraLen = readU16(h + 30);
+    uint64_t commentLen = readU16(h + 32);
+    uint64_t localOffset = readU32(h + 42);
+    if(pos + 46 + nameLen + extraLen + commentLen > dirEnd)
+      fail("bad central directory entry");
+    entry.name = string(h + 46, nameLen);
+
+    //Zip64 sizes and offsets, present only for the fields that overflowed
+    const char* extra = h + 46 + nameLen;
+    const char* extraEnd = extra + extraLen;
+    while(extra + 4 <= extraEnd) {
+      uint32_t id = readU16(extra);
+      uint32_t len = readU16(extra + 2);
+      const char* field = extra + 4;
+      const char* fieldEnd = field + len;
+      if(fieldEnd > extraEnd)
+        fail("bad extra field for " + entry.name);
+      if(id == ZIP64_EXTRA_ID) {
+        if(entry.size == 0xFFFFFFFFULL && field + 8 <= fieldEnd) {
+          entry.size = readU64(field);
+          field += 8;
+        }
+        if(entry.compressedSize == 0xFFFFFFFFULL && field + 8 <= fieldEnd) {
+          entry.compressedSize = readU64(field);
+          field += 8;
+        }
+        if(localOffset == 0xFFFFFFFFULL && field + 8 <= fieldEnd) {
+          localOffset = readU64(field);
+          field += 8;
+        }
+      }
+      extra = fieldEnd;
+    }
+
+    if(flags & 0x1)
+      fail("encrypted member " + entry.name);
+    if(entry.method != ZIP_METHOD_STORED && entry.method != ZIP_METHOD_DEFLATED)
+      fail("unsupported compression method " + Global::intToString(entry.method) + " for " + entry.name);
+    if(entry.method == ZIP_METHOD_STORED && entry.compressedSize != entry.size)
+      fail("inconsistent sizes for " + entry.name);
+
+    //The data follows the local header, whose name and extra field lengths may differ from the central directory's
+    if(localOffset > fileSize || fileSize - localOffset < 30 || readU32(fileData + localOffset) != ZIP_LOCAL_HEADER_SIG)
+      fail("bad local header for " + entry.name);
+    uint64_t dataPos = localOffset + 30 + readU16(fileData + localOffset + 26) + readU16(fileData + localOffset + 28);
+    if(dataPos > fileSize || entry.compressedSize > fileSize - dataPos)
+      fail("data out of bounds for " + entry.name);
+    entry.data = fileData + dataPos;
+
+    entryIdxByName[entry.name] = entries.size();
+    names.push_back(entry.name);
+    entries.push_back(entry);
+    pos += 46 + nameLen + extraLen + commentLen;
+  }
+}
+
+const string& ZipReader::getFileName() const {
+  return fileName;
+}
+const vector<string>& ZipReader::getNames() const {
+  return names;
+}
+bool ZipReader::contains(const string& nameWithinZip) const {
+  return entryIdxByName.find(nameWithinZip) != entryIdxByName.end();
+}
+
+const ZipReader::Entry& ZipReader::getEntry(const string& nameWithinZip) const {
+  auto iter = entryIdxByName.find(nameWithinZip);
+  if(iter == entryIdxByName.end())
+    throw IOError("Could not find " + nameWithinZip + " within " + fileName);
+  return entries[iter->second];
+}
+
+uint64_t ZipReader::getSize(const string& nameWithinZip) const {
+  return getEntry(nameWithinZip).size;
+}
+bool ZipReader::isStored(const string& nameWithinZip) const {
+  return getEntry(nameWithinZip).method == ZIP_METHOD_STORED;
+}
+
+const char* ZipReader::getStoredData(const string& nameWithinZip) const {
+  const Entry& entry = getEntry(nameWithinZip);
+  if(entry.method != ZIP_METHOD_STORED)
+    throw StringError("ZipReader: " + nameWithinZip + " within " + fileName + " is compressed, cannot access in place");
+  return entry.data;
+}
+
+void ZipReader::readAll(const string& nameWithinZip, string& buf) const {
+  ZipMemberReader reader(*this,nameWithinZip);
+  buf.resize(reader.getSize());
+  uint64_t numRead = buf.size() > 0 ? reader.read(&buf[0],buf.size()) : 0;
+  //Read once more to hit the end and check the crc
+  char extra;
+  if(numRead != buf.size() || reader.read(&extra,1) != 0)
+    throw IOError("Could not read " + nameWithinZip + " within " + fileName + ", wrong size");
+}
+
+//-------------------------------------------------------------------------------------------------------------
+
+ZipMemberReader::ZipMemberReader(const ZipReader& z, const string& nameWithinZip)
+  :zip(z),entry(z.getEntry(nameWithinZip)),stream(NULL),numRead(0),numConsumed(0),crc(0),crcChecked(false)
+{
+  crc = (uint32_t)crc32(0L, Z_NULL, 0);
+  if(entry.method == ZIP_METHOD_DEFLATED) {
+    z_stream* zs = new z_stream();
+    memset(zs,0,sizeof(z_stream));
+    //Negative window bits for raw deflate data without a zlib header
+    if(inflateInit2(zs, -MAX_WBITS) != Z_OK) {
+      delete zs;
+      throw StringError("ZipMemberReader: could not initialize zlib");
+    }
+    stream = zs;
+  }
+}
+
+ZipMemberReader::~ZipMemberReader() {
+  if(stream != NULL) {
+    z_stream* zs = (z_stream*)stream;
+    inflateEnd(zs);
+    delete zs;
+  }
+}
+
+uint64_t ZipMemberReader::getSize() const {
+  return entry.size;
+}
+
+uint64_t ZipMemberReader::read(char* buf, uint64_t numBytes) {
+  auto fail = [this](const string& msg) {
+    throw IOError("Could not read " + entry.name + " within " + zip.fileName + ": " + msg);
+  };
+  uint64_t numToRead = std::min(numBytes, entry.size - numRead);
+  const uint64_t maxChunk = (uint64_t)1 << 30; //zlib lengths are 32 bit
+
+  if(entry.method == ZIP_METHOD_STORED) {
+    std::memcpy(buf, entry.data + numRead, numToRead);
+    numConsumed += numToRead;
+  }
+  else {
+    z_stream* zs = (z_stream*)stream;
+    uint64_t numDone = 0;
+    while(numDone < numToRead) {
+      uint64_t inLen = std::min(entry.compressedSize - numConsumed, maxChunk);
+      uint64_t outLen = std::min(numToRead - numDone, maxChunk);
+      //Without ZLIB_CONST, zlib declares next_in non-const even though it never writes through it
+      zs->next_in = const_cast<z_const Bytef*>(reinterpret_cast<const Bytef*>(entry.data + numConsumed));
+      zs->avail_in = (uInt)inLen;
+      zs->next_out = reinterpret_cast<Bytef*>(buf + numDone);
+      zs->avail_out = (uInt)outLen;
+      int ret = inflate(zs, Z_NO_FLUSH);
+      numConsumed += inLen - zs->avail_in;
+      numDone += outLen - zs->avail_out;
+      if(ret == Z_STREAM_END)
+        break;
+      if(ret != Z_OK)
+        fail("zlib error " + Global::intToString(ret));
+      if(zs->avail_in == inLen && zs->avail_out == outLen)
+        fail("truncated deflate data");
+    }
+    if(numDone != numToRead)
+      fail("deflate data ended early");
+  }
+
+  //crc32 takes 32 bit lengths too
+  for(uint64_t done = 0; done < numToRead; ) {
+    uint64_t len = std::min(numToRead - done, maxChunk);
+    crc = (uint32_t)crc32(crc, reinterpret_cast<const Bytef*>(buf + done), (uInt)len);
+    done += len;
+  }
+  numRead += numToRead;
+  if(numRead >= entry.size && !crcChecked) {
+    crcChecked = true;
+    if(crc != entry.crc)
+      fail("crc mismatch");
+  }
+  return numToRead;
+}
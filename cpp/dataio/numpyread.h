@@ -0,0 +1,117 @@
+#ifndef NUMPYREAD_H
+#define NUMPYREAD_H
+
+#include "../core/global.h"
+
+class MappedFile;
+
+/*
+  Reading counterparts to NumpyBuffer and ZipFile in numpywrite.h.
+
+  Usage: Open a ZipReader on an npz file. For members that are stored without compression, getStoredData gives the
+  bytes in place in the memory-mapped file. Otherwise, readAll decompresses a member into a buffer, or ZipMemberReader
+  decompresses it a piece at a time. Either way, NumpyArrayView parses the npy header and gives typed access to ranges
+  of rows of the array, without copying.
+*/
+
+//A view of a numpy array within a buffer of bytes holding a whole npy file. Does not own or copy the buffer,
+//which must outlive the view. Only C-ordered arrays are supported.
+struct NumpyArrayView {
+  const char* data; //Start of the array data, just past the header
+  string dtype;
+  vector<int64_t> shape;
+  int64_t numRows; //Length of the leading dimension
+  int64_t elementBytes;
+  int64_t rowBytes; //Number of bytes of each entry of the leading dimension
+
+  NumpyArrayView();
+  //Parse the npy file occupying the len bytes at buf. Throws IOError if it is malformed or its size does not
+  //match its shape.
+  NumpyArrayView(const char* buf, uint64_t len);
+
+  //Parse just the header of an npy file from a prefix of it, without requiring the data to be present.
+  //Returns the number of bytes of the header, and fills dtype and shape.
+  static int64_t parseHeader(const char* buf, uint64_t len, string& dtype, vector<int64_t>& shape);
+
+  //Pointer to rows [startRow,startRow+numRowsToGet) as elements of type T, which must match the dtype.
+  //Npz members start at arbitrary offsets in a zip, so if the rows are not aligned for T, they are copied into
+  //alignedBuf and the returned pointer is into that instead, valid until alignedBuf is next modified.
+  template <typename T>
+  const T* getRows(int64_t startRow, int64_t numRowsToGet, vector<T>& alignedBuf) const;
+  //Raw bytes of rows [startRow,startRow+numRowsToGet)
+  const char* getRowBytes(int64_t startRow, int64_t numRowsToGet) const;
+};
+
+//Simple class for reading zip files, such as those written by ZipFile or by numpy.
+//The file is memory-mapped, and stored and deflated members are supported.
+class ZipReader {
+ public:
+  ZipReader(const string& fileName);
+  ~ZipReader();
+
+  ZipReader(const ZipReader&) = delete;
+  ZipReader& operator=(const ZipReader&) = delete;
+
+  const string& getFileName() const;
+  //Names of all members, in the order of the zip's central directory
+  const vector<string>& getNames() const;
+  bool contains(const string& nameWithinZip) const;
+  uint64_t getSize(const string& nameWithinZip) const;
+  bool isStored(const string& nameWithinZip) const;
+
+  //Bytes of a member stored without compression, in place within the mapped file and valid for the lifetime of
+  //this ZipReader. Throws if the member is compressed.
+  const char* getStoredData(const string& nameWithinZip) const;
+  //Copy or decompress a whole member into buf, and check its crc
+  void readAll(const string& nameWithinZip, string& buf) const;
+
+ private:
+  struct Entry {
+    string name;
+    int method;
+    uint32_t crc;
+    uint64_t compressedSize;
+    uint64_t size;
+    const char* data; //Start of compressed data within the mapped file
+  };
+
+  string fileName;
+  MappedFile* mapping;
+  const char* fileData;
+  uint64_t fileSize;
+  vector<string> names;
+  vector<Entry> entries;
+  std::map<string,size_t> entryIdxByName;
+
+  const Entry& getEntry(const string& nameWithinZip) const;
+  void readCentralDirectory();
+
+  friend class ZipMemberReader;
+};
+
+//Reads one member of a ZipReader in sequential pieces, decompressing as it goes if needed.
+//The ZipReader must outlive this.
+class ZipMemberReader {
+ public:
+  ZipMemberReader(const ZipReader& zip, const string& nameWithinZip);
+  ~ZipMemberReader();
+
+  ZipMemberReader(const ZipMemberReader&) = delete;
+  ZipMemberReader& operator=(const ZipMemberReader&) = delete;
+
+  uint64_t getSize() const;
+  //Read up to numBytes into buf, returning the number of bytes read, which is less than numBytes only at the end.
+  //Checks the crc upon reaching the end.
+  uint64_t read(char* buf, uint64_t numBytes);
+
+ private:
+  const ZipReader& zip;
+  const ZipReader::Entry& entry;
+  void* stream; //zlib state, if deflated
+  uint64_t numRead;
+  uint64_t numConsumed;
+  uint32_t crc;
+  bool crcChecked;
+};
+
+#endif
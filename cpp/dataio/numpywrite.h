@@ -44,7 +44,7 @@ private:
 };
 
 //Simple class for writing zip-compressed data.
-//No current support for reading it.
+//For reading, see ZipReader in numpyread.h.
 class ZipFile {
  public:
   ZipFile(const string& fileName);
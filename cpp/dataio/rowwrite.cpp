@@ -0,0 +1,192 @@
+#include <cstring>
+#include "../dataio/rowwrite.h"
+
+using namespace RowWrite;
+
+void RowWrite::fillRow(const Board& board, const BoardHistory& hist, const vector<Move>& moves, int nextMoveIdx, Player nextPlayer,
+                       const float* policyTarget, float valueTarget,
+                       int target, int rankOneHot, Hash128 sgfHash, float* row, Rand& rand, bool alwaysHistory) {
+  assert(nextMoveIdx < moves.size());
+
+  Player pla = nextPlayer;
+  int xSize = board.x_size;
+  int ySize = board.y_size;
+  int posLen = NNPos::MAX_BOARD_LEN;
+
+  bool inputsUseNHWC = true;
+  NNInputs::fillRowV2(board,hist,nextPlayer,posLen,inputsUseNHWC,row);
+
+  //Optionally some stuff we can multiply the history planes by to randomly exclude history from a few training samples
+  bool includeHistory[5];
+  includeHistory[0] = alwaysHistory || rand.nextDouble() < 0.95;
+  includeHistory[1] = alwaysHistory || (includeHistory[0] && rand.nextDouble() < 0.98);
+  includeHistory[2] = alwaysHistory || (includeHistory[1] && rand.nextDouble() < 0.98);
+  includeHistory[3] = alwaysHistory || (includeHistory[2] && rand.nextDouble() < 0.98);
+  includeHistory[4] = alwaysHistory || (includeHistory[3] && rand.nextDouble() < 0.98);
+  for(int i = 0; i<5; i++)
+    row[includeHistoryStart+i] = (includeHistory[i] ? 1.0f : 0.0f);
+
+  if(target == TARGET_NEXT_MOVE) {
+    for(int i = 0; i<policyTargetLen; i++)
+      row[policyTargetStart + i] = policyTarget[i];
+  }
+
+  //Value target, +1 or -1
+  row[valueTargetStart] = valueTarget;
+
+  //Weight of the row, currently always 1.0
+  row[targetWeightsStart] = 1.0;
+
+  //One-hot indicating rank
+  if(rankOneHot != -1)
+    row[rankStart + rankOneHot] = 1.0;
+
+  //Indicate the side to move, black = 0, white = 1
+  if(pla == P_BLACK)
+    row[sideStart] = 0.0;
+  else
+    row[sideStart] = 1.0;
+
+  //Record what turn out of what turn it is
+  row[turnNumberStart] = nextMoveIdx;
+  row[turnNumberStart+1] = moves.size();
+
+  //Record recent captures, by marking any positions where stones vanished between one board and the next
+  for(int i = (int)BoardHistory::NUM_RECENT_BOARDS-2; i >= 0; i--) {
+    Board b = hist.getRecentBoard(board,i);
+    Board bPrev = hist.getRecentBoard(board,i+1);
+    for(int y = 0; y<ySize; y++) {
+      for(int x = 0; x<xSize; x++) {
+        Loc loc = Location::getLoc(x,y,xSize);
+        if(b.colors[loc] == C_EMPTY && bPrev.colors[loc] != C_EMPTY) {
+          int pos = NNPos::xyToPos(x,y,posLen);
+          row[recentCapturesStart+pos] = i+1;
+        }
+      }
+    }
+  }
+
+  //Record next moves
+  for(int i = 0; i<nextMovesLen; i++) {
+    int idx = nextMoveIdx + i;
+    if(idx >= moves.size())
+      row[nextMovesStart+i] = NNPos::locToPos(Board::NULL_LOC,xSize,posLen);
+    else {
+      row[nextMovesStart+i] = NNPos::locToPos(moves[idx].loc,xSize,posLen);
+    }
+  }
+
+  //Record 16-bit chunks of sgf hash, so that later we can identify where this training example came from
+  row[sgfHashStart+0] = (float)((sgfHash.hash1 >> 0) & 0xFFFF);
+  row[sgfHashStart+1] = (float)((sgfHash.hash1 >> 16) & 0xFFFF);
+  row[sgfHashStart+2] = (float)((sgfHash.hash1 >> 32) & 0xFFFF);
+  row[sgfHashStart+3] = (float)((sgfHash.hash1 >> 48) & 0xFFFF);
+  row[sgfHashStart+4] = (float)((sgfHash.hash0 >> 0) & 0xFFFF);
+  row[sgfHashStart+5] = (float)((sgfHash.hash0 >> 16) & 0xFFFF);
+  row[sgfHashStart+6] = (float)((sgfHash.hash0 >> 32) & 0xFFFF);
+  row[sgfHashStart+7] = (float)((sgfHash.hash0 >> 48) & 0xFFFF);
+}
+
+NpzRowWriter::NpzRowWriter(const string& prefix, int rowsPerF)
+  :filePrefix(prefix),
+   rowsPerFile(rowsPerF),
+   curRows(0),
+   numFilesWritten(0),
+   binaryInputNCHWPacked({rowsPerF, numBinaryFeatures, npzPackedBoardArea}),
+   globalInputNC({rowsPerF, 1}),
+   policyTargetsNMove({rowsPerF, policyTargetLen}),
+   globalTargetsNC({rowsPerF, numGlobalTargets}),
+   rankN({rowsPerF}),
+   recentCapturesNPos({rowsPerF, recentCapturesLen}),
+   nextMovesNC({rowsPerF, nextMovesLen}),
+   sgfHashN2({rowsPerF, 2}),
+   includeHistoryNC({rowsPerF, includeHistoryLen})
+{}
+
+void NpzRowWriter::addRow(const float* row) {
+  assert(curRows < rowsPerFile);
+  int64_t n = curRows;
+
+  //Inputs are NHWC, see fillRow
+  uint8_t* rowBinPacked = binaryInputNCHWPacked.data + n * numBinaryFeatures * npzPackedBoardArea;
+  std::memset(rowBinPacked,0,numBinaryFeatures * npzPackedBoardArea);
+  for(int c = 0; c<numBinaryFeatures; c++) {
+    uint8_t* plane = rowBinPacked + c * npzPackedBoardArea;
+    for(int pos = 0; pos<npzPosArea; pos++) {
+      if(row[inputStart + pos * numFeatures + c] != 0.0f)
+        plane[pos / 8] |= (uint8_t)(0x80 >> (pos % 8));
+    }
+  }
+  //Komi is the same everywhere on the board, and pos 0 is on the board for every board size
+  globalInputNC.data[n] = row[inputStart + numBinaryFeatures];
+
+  std::copy(row + policyTargetStart, row + policyTargetStart + policyTargetLen, policyTargetsNMove.data + n * policyTargetLen);
+
+  float* rowGlobal = globalTargetsNC.data + n * numGlobalTargets;
+  rowGlobal[0] = row[valueTargetStart];
+  rowGlobal[1] = row[targetWeightsStart];
+  rowGlobal[2] = row[sideStart];
+  rowGlobal[3] = row[turnNumberStart];
+  rowGlobal[4] = row[turnNumberStart+1];
+
+  int rankOneHot = -1;
+  for(int i = 0; i<rankLen; i++) {
+    if(row[rankStart + i] != 0.0f)
+      rankOneHot = i;
+  }
+  rankN.data[n] = (int8_t)rankOneHot;
+
+  for(int i = 0; i<recentCapturesLen; i++)
+    recentCapturesNPos.data[n * recentCapturesLen + i] = (int8_t)row[recentCapturesStart + i];
+  for(int i = 0; i<nextMovesLen; i++)
+    nextMovesNC.data[n * nextMovesLen + i] = (int16_t)row[nextMovesStart + i];
+
+  //Reassemble the hash from the 16-bit pieces that fillRow split it into
+  uint64_t hash1 = 0;
+  uint64_t hash0 = 0;
+  for(int i = 0; i<4; i++) {
+    hash1 |= (uint64_t)row[sgfHashStart + i] << (16 * i);
+    hash0 |= (uint64_t)row[sgfHashStart + 4 + i] << (16 * i);
+  }
+  sgfHashN2.data[n * 2 + 0] = hash0;
+  sgfHashN2.data[n * 2 + 1] = hash1;
+
+  for(int i = 0; i<includeHistoryLen; i++)
+    includeHistoryNC.data[n * includeHistoryLen + i] = (uint8_t)row[includeHistoryStart + i];
+
+  curRows++;
+  if(curRows >= rowsPerFile)
+    flush();
+}
+
+void NpzRowWriter::flush() {
+  if(curRows <= 0)
+    return;
+
+  string fileName = filePrefix + "." + Global::intToString(numFilesWritten) + ".npz";
+  ZipFile zipFile(fileName);
+  uint64_t numBytes;
+
+  numBytes = binaryInputNCHWPacked.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("binaryInputNCHWPacked", binaryInputNCHWPacked.dataIncludingHeader, numBytes);
+  numBytes = globalInputNC.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("globalInputNC", globalInputNC.dataIncludingHeader, numBytes);
+  numBytes = policyTargetsNMove.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("policyTargetsNMove", policyTargetsNMove.dataIncludingHeader, numBytes);
+  numBytes = globalTargetsNC.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("globalTargetsNC", globalTargetsNC.dataIncludingHeader, numBytes);
+  numBytes = rankN.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("rankN", rankN.dataIncludingHeader, numBytes);
+  numBytes = recentCapturesNPos.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("recentCapturesNPos", recentCapturesNPos.dataIncludingHeader, numBytes);
+  numBytes = nextMovesNC.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("nextMovesNC", nextMovesNC.dataIncludingHeader, numBytes);
+  numBytes = sgfHashN2.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("sgfHashN2", sgfHashN2.dataIncludingHeader, numBytes);
+  numBytes = includeHistoryNC.prepareHeaderWithNumRows(curRows);
+  zipFile.writeBuffer("includeHistoryNC", includeHistoryNC.dataIncludingHeader, numBytes);
+  zipFile.close();
+
+  numFilesWritten++;
+  curRows = 0;
+}
@@ -0,0 +1,137 @@
+#ifndef ROWWRITE_H
+#define ROWWRITE_H
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/rand.h"
+#include "../game/board.h"
+#include "../game/boardhistory.h"
+#include "../neuralnet/nninputs.h"
+#include "../dataio/numpywrite.h"
+
+/*
+  Output formats of the write tool
+
+  -output-format h5 (the default): A single h5 file with datasets "train" and "val", each of shape [N,totalRowLen] of
+  float32, where every row is laid out as in the segments below (inputStart, policyTargetStart, ...).
+
+  -output-format npz: The same rows, but written in a packed and typed form like that of TrainingWriteBuffers, into
+  files OUTPUT.train.<i>.npz and OUTPUT.val.<i>.npz of up to -npz-rows-per-file rows each. Each npz contains:
+  binaryInputNCHWPacked: uint8 [N,C,ceil(Pos/8)], C = numBinaryFeatures, the binary input features, where Pos = 19x19.
+    Packed bitwise, with each plane zero-padded to a round byte, and bits within each byte packed bigendianwise, so
+    that numpy's unpackbits recovers them.
+  globalInputNC: float32 [N,1], the only non-binary input feature, which is komi/15 from the perspective of the
+    player to move and is the same at every position on the board.
+  policyTargetsNMove: float32 [N,Pos+1], the policy target, with the last entry for passing.
+  globalTargetsNC: float32 [N,5]
+    C0: Value target, +1 or -1 from the perspective of the player to move
+    C1: Weight of the row
+    C2: Side to move, black = 0, white = 1
+    C3: Turn number of the next move, zero-indexed
+    C4: Total number of moves in the game
+  rankN: int8 [N], index of the rank one-hot (see rankStartKGS, etc), or -1 if none
+  recentCapturesNPos: int8 [N,Pos], for positions where stones were captured recently, how many turns ago, else 0.
+  nextMovesNC: int16 [N,12], the pos of the next 12 moves, Pos for pass and Pos+19 for no move.
+  sgfHashN2: uint64 [N,2], hash0 and hash1 of the sgf the row came from.
+  includeHistoryNC: uint8 [N,5], 1 to use or 0 to not use each of the 5 history features.
+*/
+
+namespace RowWrite {
+  //Data and feature row parameters
+  const int maxBoardSize = NNPos::MAX_BOARD_LEN;
+  const int numFeatures = NNInputs::NUM_FEATURES_V2;
+
+  //Different segments of the data row
+  const int inputStart = 0;
+  const int inputLen = maxBoardSize * maxBoardSize * numFeatures;
+
+  const int policyTargetStart = inputStart + inputLen;
+  const int policyTargetLen = maxBoardSize * maxBoardSize + 1; //+1 for pass move
+
+  const int ladderTargetStart = policyTargetStart + policyTargetLen;
+  const int ladderTargetLen = 0;
+  //   const int ladderTargetLen = maxBoardSize * maxBoardSize;
+
+  const int valueTargetStart = ladderTargetStart + ladderTargetLen;
+  const int valueTargetLen = 1;
+
+  const int targetWeightsStart = valueTargetStart + valueTargetLen;
+  const int targetWeightsLen = 1;
+
+  const int rankStart = targetWeightsStart + targetWeightsLen;
+  const int rankLenGoGoD = 1; //pro
+  const int rankLenKGS = 9; //1d-9d
+  const int rankLenFox = 17 + 9; //17k-9d
+  const int rankLenOGSPre2014 = 19 + 9; //19k-9d
+
+  const int rankStartGoGoD = 0;
+  const int rankStartKGS = rankLenGoGoD;
+  const int rankStartFox = rankLenGoGoD + rankLenKGS;
+  const int rankStartOGSPre2014 = rankLenGoGoD + rankLenKGS + rankLenFox;
+  const int rankLen = rankLenGoGoD + rankLenKGS + rankLenFox + rankLenOGSPre2014;
+
+  const int sideStart = rankStart + rankLen;
+  const int sideLen = 1;
+
+  const int turnNumberStart = sideStart + sideLen;
+  const int turnNumberLen = 2;
+
+  const int recentCapturesStart = turnNumberStart + turnNumberLen;
+  const int recentCapturesLen = maxBoardSize * maxBoardSize;
+
+  const int nextMovesStart = recentCapturesStart + recentCapturesLen;
+  const int nextMovesLen = 12;
+
+  const int sgfHashStart = nextMovesStart + nextMovesLen;
+  const int sgfHashLen = 8;
+
+  const int includeHistoryStart = sgfHashStart + sgfHashLen;
+  const int includeHistoryLen = 5;
+
+  const int totalRowLen = includeHistoryStart + includeHistoryLen;
+
+  //Npz parameters
+  const int npzPosArea = maxBoardSize * maxBoardSize;
+  const int npzPackedBoardArea = (npzPosArea + 7) / 8;
+  const int numBinaryFeatures = numFeatures - 1; //All but the last feature, komi
+  const int numGlobalTargets = 5;
+
+  const int TARGET_NEXT_MOVE = 0;
+
+  //Fill row, which must start zeroed, with the inputs and targets for the position of board and hist, where the next
+  //move is moves[nextMoveIdx] by nextPlayer
+  void fillRow(const Board& board, const BoardHistory& hist, const vector<Move>& moves, int nextMoveIdx, Player nextPlayer,
+               const float* policyTarget, float valueTarget,
+               int target, int rankOneHot, Hash128 sgfHash, float* row, Rand& rand, bool alwaysHistory);
+}
+
+//Accumulates rows in the packed npz format described above, writing them out rowsPerFile at a time to files
+//filePrefix.<i>.npz
+struct NpzRowWriter {
+  string filePrefix;
+  int rowsPerFile;
+  int curRows;
+  int numFilesWritten;
+
+  NumpyBuffer<uint8_t> binaryInputNCHWPacked;
+  NumpyBuffer<float> globalInputNC;
+  NumpyBuffer<float> policyTargetsNMove;
+  NumpyBuffer<float> globalTargetsNC;
+  NumpyBuffer<int8_t> rankN;
+  NumpyBuffer<int8_t> recentCapturesNPos;
+  NumpyBuffer<int16_t> nextMovesNC;
+  NumpyBuffer<uint64_t> sgfHashN2;
+  NumpyBuffer<uint8_t> includeHistoryNC;
+
+  NpzRowWriter(const string& filePrefix, int rowsPerFile);
+
+  NpzRowWriter(const NpzRowWriter&) = delete;
+  NpzRowWriter& operator=(const NpzRowWriter&) = delete;
+
+  //Pack a row laid out as by fillRow, writing out a file if that makes rowsPerFile rows
+  void addRow(const float* row);
+  //Write out any remaining rows
+  void flush();
+};
+
+#endif
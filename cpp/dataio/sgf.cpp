@@ -1,5 +1,10 @@
+#include "../core/mappedfile.h"
+#include "../core/multithread.h"
 #include "../core/sha2.h"
 #include "../dataio/sgf.h"
+#include "../dataio/gamerecord.h"
+#include <cstring>
+#include <exception>
 
 SgfNode::SgfNode()
   :props(NULL),move(0,0,C_EMPTY)
@@ -167,11 +172,9 @@ void SgfNode::accumMoves(vector<Move>& moves, int bSize) const {
   }
 }
 
-Rules SgfNode::getRules(const Rules& defaultRules) const {
+static Rules parseSgfRules(const string& ruleStr, const Rules& defaultRules) {
   Rules rules = defaultRules;
-  if(!hasProperty("RU"))
-    return rules;
-  string s = Global::toLower(getSingleProperty("RU"));
+  string s = Global::toLower(ruleStr);
   if(s == "japansese") {
     rules.scoringRule = Rules::SCORING_TERRITORY;
     rules.koRule = Rules::KO_SIMPLE;
@@ -229,6 +232,12 @@ Rules SgfNode::getRules(const Rules& defaultRules) const {
   return rules;
 }
 
+Rules SgfNode::getRules(const Rules& defaultRules) const {
+  if(!hasProperty("RU"))
+    return defaultRules;
+  return parseSgfRules(getSingleProperty("RU"),defaultRules);
+}
+
 
 Sgf::Sgf()
 {}
@@ -258,6 +267,8 @@ int Sgf::getBSize() const {
   bool suc = Global::tryStringToInt(nodes[0]->getSingleProperty("SZ"), bSize);
   if(!suc)
     propertyFail("Could not parse board size in sgf");
+  if(bSize <= 0 || bSize > Board::MAX_LEN)
+    propertyFail("Board size in sgf is not supported: " + Global::intToString(bSize));
   return bSize;
 }
 
@@ -656,11 +667,9 @@ vector<CompactSgf*> CompactSgf::loadFiles(const vector<string>& files) {
 }
 
 
-void CompactSgf::setupInitialBoardAndHist(const Rules& initialRules, Board& board, Player& nextPla, BoardHistory& hist) {
-  Rules rules = initialRules;
-  rules.komi = komi;
-  rules = rootNode.getRules(rules);
-
+static void setupInitialBoardAndHistFromPlacements(
+  const Rules& rules, int bSize, const vector<Move>& placements, Board& board, Player& nextPla, BoardHistory& hist
+) {
   board = Board(bSize,bSize);
   nextPla = P_BLACK;
   hist = BoardHistory(board,nextPla,rules,0);
@@ -679,6 +688,13 @@ void CompactSgf::setupInitialBoardAndHist(const Rules& initialRules, Board& boar
     nextPla = P_WHITE;
 }
 
+void CompactSgf::setupInitialBoardAndHist(const Rules& initialRules, Board& board, Player& nextPla, BoardHistory& hist) {
+  Rules rules = initialRules;
+  rules.komi = komi;
+  rules = rootNode.getRules(rules);
+  setupInitialBoardAndHistFromPlacements(rules,bSize,placements,board,nextPla,hist);
+}
+
 void CompactSgf::setupBoardAndHist(const Rules& initialRules, Board& board, Player& nextPla, BoardHistory& hist, int turnNumber) {
   setupInitialBoardAndHist(initialRules, board, nextPla, hist);
 
@@ -689,20 +705,365 @@ void CompactSgf::setupBoardAndHist(const Rules& initialRules, Board& board, Play
   }
 }
 
-void WriteSgf::printGameResult(ostream& out, const BoardHistory& hist) {
-  if(hist.isGameFinished) {
+//STREAMING PARSING-----------------------------------------------------------
+
+StreamedSgf::StreamedSgf()
+  :text(NULL),textLen(0),rootProperties(),placements(),moves(),bSize(0),depth(0),komi(0.0f),hash()
+{}
+StreamedSgf::~StreamedSgf()
+{}
+
+static bool textEquals(const char* text, size_t textLen, const char* str) {
+  return std::strncmp(text,str,textLen) == 0 && str[textLen] == '\0';
+}
+
+//Same unescaping as parseTextValue
+static string unescapeSgfText(const char* text, size_t textLen) {
+  string acc;
+  bool escaping = false;
+  for(size_t i = 0; i<textLen; i++) {
+    char c = text[i];
+    if(!escaping && c == '\\') {
+      escaping = true;
+      continue;
+    }
+    if(escaping && (c == '\n' || c == '\r')) {
+      while(i+1 < textLen && (text[i+1] == '\n' || text[i+1] == '\r'))
+        i++;
+      escaping = false;
+      continue;
+    }
+    if(c == '\t') {
+      escaping = false;
+      acc += ' ';
+      continue;
+    }
+    escaping = false;
+    acc += c;
+  }
+  return acc;
+}
+
+bool StreamedSgf::hasRootProperty(const char* key) const {
+  for(size_t i = 0; i<rootProperties.size(); i++) {
+    if(textEquals(rootProperties[i].key,rootProperties[i].keyLen,key))
+      return true;
+  }
+  return false;
+}
+
+string StreamedSgf::getRootProperty(const char* key) const {
+  const Property* found = NULL;
+  for(size_t i = 0; i<rootProperties.size(); i++) {
+    if(textEquals(rootProperties[i].key,rootProperties[i].keyLen,key)) {
+      if(found != NULL)
+        propertyFail("SGF property is not a singleton: " + string(key));
+      found = &rootProperties[i];
+    }
+  }
+  if(found == NULL)
+    propertyFail("SGF does not contain property: " + string(key));
+  return unescapeSgfText(found->value,found->valueLen);
+}
+
+Rules StreamedSgf::getRules(const Rules& defaultRules) const {
+  if(!hasRootProperty("RU"))
+    return defaultRules;
+  return parseSgfRules(getRootProperty("RU"),defaultRules);
+}
+
+void StreamedSgf::setupInitialBoardAndHist(const Rules& initialRules, Board& board, Player& nextPla, BoardHistory& hist) const {
+  Rules rules = initialRules;
+  rules.komi = komi;
+  rules = getRules(rules);
+  setupInitialBoardAndHistFromPlacements(rules,bSize,placements,board,nextPla,hist);
+}
+
+struct SgfStreamCursor {
+  const char* data;
+  size_t len;
+  size_t pos;
+  const string& fileName;
+};
+
+static void streamFail(const SgfStreamCursor& cur, const string& msg) {
+  throw IOError(msg + " (pos " + Global::uint64ToString(cur.pos) + " of " + cur.fileName + ")");
+}
+
+//Skip whitespace and return the next char without consuming it
+static char peekSgfChar(SgfStreamCursor& cur) {
+  while(true) {
+    if(cur.pos >= cur.len)
+      streamFail(cur,"Unexpected end of sgf");
+    char c = cur.data[cur.pos];
+    if(!Global::isWhitespace(c))
+      return c;
+    cur.pos++;
+  }
+}
+
+//Find the extent of a property value, starting just past its opening bracket and ending just past its closing bracket
+static void parseStreamValue(SgfStreamCursor& cur, const char*& value, size_t& valueLen) {
+  size_t start = cur.pos;
+  bool escaping = false;
+  while(true) {
+    if(cur.pos >= cur.len)
+      streamFail(cur,"Unexpected end of sgf");
+    char c = cur.data[cur.pos++];
+    if(!escaping && c == ']')
+      break;
+    escaping = !escaping && c == '\\';
+  }
+  value = cur.data + start;
+  valueLen = cur.pos - 1 - start;
+}
+
+static Loc parseStreamLoc(const SgfStreamCursor& cur, const char* value, size_t valueLen, int bSize, bool allowPass) {
+  if(allowPass && (valueLen == 0 || textEquals(value,valueLen,"tt")))
+    return Board::PASS_LOC;
+  if(valueLen != 2)
+    streamFail(cur,"Invalid location: " + string(value,valueLen));
+  int x = (int)value[0] - (int)'a';
+  int y = (int)value[1] - (int)'a';
+  if(x < 0 || x >= bSize || y < 0 || y >= bSize)
+    streamFail(cur,"Invalid location: " + string(value,valueLen));
+  return Location::getLoc(x,y,bSize);
+}
+
+//Parse the properties of a node, starting just past its semicolon. For the root, only records the properties.
+//Otherwise appends the moves of the node, black's before white's as in SgfNode::accumMoves.
+static void parseStreamNode(SgfStreamCursor& cur, StreamedSgf& sgf, bool isRoot, vector<Move>& moves, vector<Move>& whiteMovesBuf) {
+  whiteMovesBuf.clear();
+  while(true) {
+    if(!Global::isAlpha(peekSgfChar(cur)))
+      break;
+    const char* key = cur.data + cur.pos;
+    while(cur.pos < cur.len && Global::isAlpha(cur.data[cur.pos]))
+      cur.pos++;
+    size_t keyLen = (size_t)(cur.data + cur.pos - key);
+
+    bool parsedAtLeastOne = false;
+    while(peekSgfChar(cur) == '[') {
+      cur.pos++;
+      const char* value;
+      size_t valueLen;
+      parseStreamValue(cur,value,valueLen);
+      if(isRoot) {
+        StreamedSgf::Property prop;
+        prop.key = key;
+        prop.keyLen = keyLen;
+        prop.value = value;
+        prop.valueLen = valueLen;
+        sgf.rootProperties.push_back(prop);
+      }
+      else if(textEquals(key,keyLen,"B"))
+        moves.push_back(Move(parseStreamLoc(cur,value,valueLen,sgf.bSize,true),P_BLACK));
+      else if(textEquals(key,keyLen,"W"))
+        whiteMovesBuf.push_back(Move(parseStreamLoc(cur,value,valueLen,sgf.bSize,true),P_WHITE));
+      else if(textEquals(key,keyLen,"AB") || textEquals(key,keyLen,"AW") || textEquals(key,keyLen,"AE"))
+        streamFail(cur,"Found stone placements after the root");
+      parsedAtLeastOne = true;
+    }
+    if(!parsedAtLeastOne)
+      streamFail(cur,"No property values for property " + string(key,keyLen));
+  }
+  moves.insert(moves.end(),whiteMovesBuf.begin(),whiteMovesBuf.end());
+}
+
+//Once the root node is parsed, find the board size and komi, and the placements and moves of the root
+static void finishStreamRoot(const SgfStreamCursor& cur, StreamedSgf& sgf, vector<Move>& moves) {
+  sgf.bSize = 19; //Some SGF files don't specify, in that case assume 19
+  if(sgf.hasRootProperty("SZ")) {
+    if(!Global::tryStringToInt(sgf.getRootProperty("SZ"),sgf.bSize))
+      propertyFail("Could not parse board size in sgf");
+    if(sgf.bSize <= 0 || sgf.bSize > Board::MAX_LEN)
+      propertyFail("Board size in sgf is not supported: " + Global::intToString(sgf.bSize));
+  }
+  if(!Global::tryStringToFloat(sgf.getRootProperty("KM"),sgf.komi))
+    propertyFail("Could not parse komi in sgf");
+
+  const char* placementKeys[3] = {"AB","AW","AE"};
+  const Player placementPlas[3] = {P_BLACK,P_WHITE,C_EMPTY};
+  for(int k = 0; k<3; k++) {
+    for(size_t i = 0; i<sgf.rootProperties.size(); i++) {
+      const StreamedSgf::Property& prop = sgf.rootProperties[i];
+      if(textEquals(prop.key,prop.keyLen,placementKeys[k]))
+        sgf.placements.push_back(Move(parseStreamLoc(cur,prop.value,prop.valueLen,sgf.bSize,false),placementPlas[k]));
+    }
+  }
+  const char* moveKeys[2] = {"B","W"};
+  const Player movePlas[2] = {P_BLACK,P_WHITE};
+  for(int k = 0; k<2; k++) {
+    for(size_t i = 0; i<sgf.rootProperties.size(); i++) {
+      const StreamedSgf::Property& prop = sgf.rootProperties[i];
+      if(textEquals(prop.key,prop.keyLen,moveKeys[k]))
+        moves.push_back(Move(parseStreamLoc(cur,prop.value,prop.valueLen,sgf.bSize,true),movePlas[k]));
+    }
+  }
+}
+
+//Parse a tree, starting just past its opening paren and ending just past its closing paren, appending the moves
+//along its deepest line to moves and returning its depth. Ties go to the earliest variation, as in Sgf::getMoves.
+static int parseStreamTree(SgfStreamCursor& cur, StreamedSgf& sgf, bool isTop, vector<Move>& moves, vector<Move>& whiteMovesBuf) {
+  int numNodes = 0;
+  while(peekSgfChar(cur) == ';') {
+    cur.pos++;
+    bool isRoot = isTop && numNodes == 0;
+    parseStreamNode(cur,sgf,isRoot,moves,whiteMovesBuf);
+    if(isRoot)
+      finishStreamRoot(cur,sgf,moves);
+    numNodes++;
+  }
+  if(isTop && numNodes == 0)
+    streamFail(cur,"Empty sgf");
+
+  //The first variation is parsed straight into moves, so that sgfs without variations need no copying
+  int maxChildDepth = 0;
+  size_t numMovesBeforeChildren = moves.size();
+  vector<Move> childMoves;
+  bool isFirstChild = true;
+  while(peekSgfChar(cur) == '(') {
+    cur.pos++;
+    if(isFirstChild) {
+      maxChildDepth = parseStreamTree(cur,sgf,false,moves,whiteMovesBuf);
+      isFirstChild = false;
+    }
+    else {
+      childMoves.clear();
+      int childDepth = parseStreamTree(cur,sgf,false,childMoves,whiteMovesBuf);
+      if(childDepth > maxChildDepth) {
+        maxChildDepth = childDepth;
+        moves.resize(numMovesBeforeChildren);
+        moves.insert(moves.end(),childMoves.begin(),childMoves.end());
+      }
+    }
+  }
+  if(peekSgfChar(cur) != ')')
+    streamFail(cur,"Expected closing paren for sgf tree");
+  cur.pos++;
+  return numNodes + maxChildDepth;
+}
+
+SgfStreamParser::SgfStreamParser(const char* d, size_t l, const string& fName)
+  :data(d),len(l),pos(0),fileName(fName),nodeWhiteMovesBuf()
+{}
+SgfStreamParser::~SgfStreamParser()
+{}
+
+bool SgfStreamParser::next(StreamedSgf& sgf) {
+  while(pos < len && Global::isWhitespace(data[pos]))
+    pos++;
+  if(pos >= len)
+    return false;
+
+  size_t start = pos;
+  sgf.rootProperties.clear();
+  sgf.placements.clear();
+  sgf.moves.clear();
+  SgfStreamCursor cur = {data,len,pos,fileName};
+  try {
+    if(data[cur.pos] != '(')
+      streamFail(cur,"Expected opening paren for sgf");
+    cur.pos++;
+    sgf.depth = parseStreamTree(cur,sgf,true,sgf.moves,nodeWhiteMovesBuf);
+  }
+  catch(const IOError&) {
+    //Skip past the end of the line so that the next call can continue with the next sgf
+    while(pos < len && data[pos] != '\n')
+      pos++;
+    if(pos < len)
+      pos++;
+    throw;
+  }
+  pos = cur.pos;
+
+  sgf.text = data + start;
+  sgf.textLen = pos - start;
+  uint64_t hash[4];
+  SHA2::get256((const uint8_t*)sgf.text,sgf.textLen,hash);
+  sgf.hash = Hash128(hash[0],hash[1]);
+  return true;
+}
+
+vector<size_t> SgfStreamParser::splitOnGameBoundaries(const char* data, size_t len, int numPieces) {
+  vector<size_t> bounds;
+  bounds.push_back(0);
+  for(int i = 1; i<numPieces; i++) {
+    size_t p = (size_t)((uint64_t)len * (uint64_t)i / (uint64_t)numPieces);
+    if(p < bounds.back())
+      p = bounds.back();
+    while(p < len && !(data[p] == '(' && (p == 0 || data[p-1] == '\n')))
+      p++;
+    if(p > bounds.back() && p < len)
+      bounds.push_back(p);
+  }
+  bounds.push_back(len);
+  return bounds;
+}
+
+void SgfStreamParser::iterSgfsFile(const string& file, int numThreads, std::function<void(int,const StreamedSgf&)> f) {
+  MappedFile mappedFile(file);
+  const char* fileData = mappedFile.getData();
+  vector<size_t> bounds = splitOnGameBoundaries(fileData,(size_t)mappedFile.getSize(),numThreads);
+  int numPieces = (int)bounds.size() - 1;
+
+  std::mutex mutex;
+  std::exception_ptr firstException;
+  auto parsePiece = [&](int pieceIdx) {
+    try {
+      SgfStreamParser parser(fileData + bounds[pieceIdx], bounds[pieceIdx+1] - bounds[pieceIdx], file);
+      StreamedSgf sgf;
+      while(true) {
+        bool suc;
+        try {
+          suc = parser.next(sgf);
+        }
+        catch(const IOError& e) {
+          std::lock_guard<std::mutex> lock(mutex);
+          cout << "Skipping sgf in " << file << ": " << e.message << endl;
+          continue;
+        }
+        if(!suc)
+          break;
+        f(pieceIdx,sgf);
+      }
+    }
+    catch(...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!firstException)
+        firstException = std::current_exception();
+    }
+  };
+
+  if(numPieces <= 1)
+    parsePiece(0);
+  else {
+    vector<std::thread> threads;
+    for(int i = 0; i<numPieces; i++)
+      threads.push_back(std::thread(parsePiece,i));
+    for(int i = 0; i<numPieces; i++)
+      threads[i].join();
+  }
+  if(firstException)
+    std::rethrow_exception(firstException);
+}
+
+static void printGameResult(
+  ostream& out, bool isGameFinished, bool isNoResult, bool isResignation, Player winner, float finalWhiteMinusBlackScore
+) {
+  if(isGameFinished) {
     out << "RE[";
-    if(hist.isNoResult)
+    if(isNoResult)
       out << "Void";
-    else if(hist.isResignation && hist.winner == C_BLACK)
+    else if(isResignation && winner == C_BLACK)
       out << "B+R";
-    else if(hist.isResignation && hist.winner == C_WHITE)
+    else if(isResignation && winner == C_WHITE)
       out << "W+R";
-    else if(hist.winner == C_BLACK)
-      out << "B+" << (-hist.finalWhiteMinusBlackScore);
-    else if(hist.winner == C_WHITE)
-      out << "W+" << hist.finalWhiteMinusBlackScore;
-    else if(hist.winner == C_EMPTY)
+    else if(winner == C_BLACK)
+      out << "B+" << (-finalWhiteMinusBlackScore);
+    else if(winner == C_WHITE)
+      out << "W+" << finalWhiteMinusBlackScore;
+    else if(winner == C_EMPTY)
       out << "0";
     else
       assert(false);
@@ -710,112 +1071,105 @@ void WriteSgf::printGameResult(ostream& out, const BoardHistory& hist) {
   }
 }
 
+void WriteSgf::printGameResult(ostream& out, const BoardHistory& hist) {
+  ::printGameResult(out,hist.isGameFinished,hist.isNoResult,hist.isResignation,hist.winner,hist.finalWhiteMinusBlackScore);
+}
+
 void WriteSgf::writeSgf(
   ostream& out, const string& bName, const string& wName, const Rules& rules,
   const BoardHistory& hist,
   const FinishedGameData* gameData
 ) {
-  const Board& initialBoard = hist.initialBoard;
-  assert(initialBoard.x_size == initialBoard.y_size);
-  int bSize = initialBoard.x_size;
+  GameRecord record;
+  if(gameData != NULL) {
+    record.setFromFinishedGame(*gameData);
+    assert(hist.moveHistory.size() == gameData->endHist.moveHistory.size());
+    assert(hist.moveHistory.size() - record.startTurnIdx <= gameData->whiteValueTargetsByTurn.size());
+  }
+  record.setFromHistory(bName,wName,rules,hist);
+  writeSgf(out,record,gameData != NULL);
+}
+
+void WriteSgf::writeSgf(ostream& out, const GameRecord& record, bool withTrainingInfo) {
+  int bSize = record.bSize;
   out << "(;FF[4]GM[1]";
   out << "SZ[" << bSize << "]";
-  out << "PB[" << bName << "]";
-  out << "PW[" << wName << "]";
+  out << "PB[" << record.bName << "]";
+  out << "PW[" << record.wName << "]";
 
   int handicap = 0;
   bool hasWhite = false;
-  for(int y = 0; y<bSize; y++) {
-    for(int x = 0; x<bSize; x++) {
-      Loc loc = Location::getLoc(x,y,bSize);
-      if(initialBoard.colors[loc] == C_BLACK)
-        handicap += 1;
-      if(initialBoard.colors[loc] == C_WHITE)
-        hasWhite = true;
-    }
+  for(size_t i = 0; i<record.placements.size(); i++) {
+    if(record.placements[i].pla == P_BLACK)
+      handicap += 1;
+    else
+      hasWhite = true;
   }
   if(hasWhite)
     handicap = 0;
 
+  const Rules& rules = record.rules;
   out << "HA[" << handicap << "]";
   out << "KM[" << rules.komi << "]";
   out << "RU[ko" << Rules::writeKoRule(rules.koRule)
       << "score" << Rules::writeScoringRule(rules.scoringRule)
       << "sui" << rules.multiStoneSuicideLegal << "]";
-  printGameResult(out,hist);
-
-  bool hasAB = false;
-  for(int y = 0; y<bSize; y++) {
-    for(int x = 0; x<bSize; x++) {
-      Loc loc = Location::getLoc(x,y,bSize);
-      if(initialBoard.colors[loc] == C_BLACK) {
-        if(!hasAB) {
-          out << "AB";
-          hasAB = true;
-        }
-        out << "[";
-        writeSgfLoc(out,loc,bSize);
-        out << "]";
-      }
-    }
-  }
-
-  bool hasAW = false;
-  for(int y = 0; y<bSize; y++) {
-    for(int x = 0; x<bSize; x++) {
-      Loc loc = Location::getLoc(x,y,bSize);
-      if(initialBoard.colors[loc] == C_WHITE) {
-        if(!hasAW) {
-          out << "AW";
-          hasAW = true;
-        }
-        out << "[";
-        writeSgfLoc(out,loc,bSize);
-        out << "]";
+  ::printGameResult(out,record.isGameFinished,record.isNoResult,record.isResignation,record.winner,record.finalWhiteMinusBlackScore);
+
+  //Placements are in y-major order
+  Player colors[2] = {P_BLACK,P_WHITE};
+  const char* props[2] = {"AB","AW"};
+  for(int c = 0; c<2; c++) {
+    bool hasAny = false;
+    for(size_t i = 0; i<record.placements.size(); i++) {
+      if(record.placements[i].pla != colors[c])
+        continue;
+      if(!hasAny) {
+        out << props[c];
+        hasAny = true;
       }
+      out << "[";
+      writeSgfLoc(out,record.placements[i].loc,bSize);
+      out << "]";
     }
   }
 
-  int startTurnIdx = 0;
-  if(gameData != NULL) {
-    startTurnIdx = gameData->startHist.moveHistory.size();
+  size_t startTurnIdx = record.startTurnIdx;
+  if(withTrainingInfo) {
     out << "C[startTurnIdx=" << startTurnIdx
-        << "," << "mode=" << gameData->mode
-        << "," << "modeM1=" << gameData->modeMeta1
-        << "," << "modeM2=" << gameData->modeMeta2;
-    for(int j = 0; j<gameData->changedNeuralNets.size(); j++) {
-      out << ",newNeuralNetTurn" << gameData->changedNeuralNets[j]->turnNumber
-          << "=" << gameData->changedNeuralNets[j]->name;
+        << "," << "mode=" << record.mode
+        << "," << "modeM1=" << record.modeMeta1
+        << "," << "modeM2=" << record.modeMeta2;
+    for(size_t j = 0; j<record.changedNeuralNets.size(); j++) {
+      out << ",newNeuralNetTurn" << record.changedNeuralNets[j].turnNumber
+          << "=" << record.changedNeuralNets[j].name;
     }
     out << "]";
-    assert(hist.moveHistory.size() - startTurnIdx <= gameData->whiteValueTargetsByTurn.size());
   }
 
-  for(size_t i = 0; i<hist.moveHistory.size(); i++) {
-    if(hist.moveHistory[i].pla == P_BLACK)
+  for(size_t i = 0; i<record.moves.size(); i++) {
+    if(record.moves[i].pla == P_BLACK)
       out << ";B[";
     else
       out << ";W[";
-    writeSgfLoc(out,hist.moveHistory[i].loc,bSize);
+    writeSgfLoc(out,record.moves[i].loc,bSize);
     out << "]";
 
-    if(gameData != NULL) {
-      if(i >= startTurnIdx) {
-        const ValueTargets& targets = gameData->whiteValueTargetsByTurn[i-startTurnIdx];
-        char winBuf[32];
-        char lossBuf[32];
-        char noResultBuf[32];
-        char scoreBuf[32];
-        sprintf(winBuf,"%.2f",targets.win);
-        sprintf(lossBuf,"%.2f",targets.loss);
-        sprintf(noResultBuf,"%.2f",targets.noResult);
-        sprintf(scoreBuf,"%.1f",targets.score);
-        out << "C["
-            << winBuf << " "
-            << lossBuf << " "
-            << noResultBuf << " "
-            << scoreBuf << "]";
-      }
+    if(withTrainingInfo && i >= startTurnIdx && i-startTurnIdx < record.valuesByTurn.size()) {
+      const GameRecordValues& values = record.valuesByTurn[i-startTurnIdx];
+      char winBuf[32];
+      char lossBuf[32];
+      char noResultBuf[32];
+      char scoreBuf[32];
+      sprintf(winBuf,"%.2f",values.win);
+      sprintf(lossBuf,"%.2f",values.loss);
+      sprintf(noResultBuf,"%.2f",values.noResult);
+      sprintf(scoreBuf,"%.1f",values.score);
+      out << "C["
+          << winBuf << " "
+          << lossBuf << " "
+          << noResultBuf << " "
+          << scoreBuf << "]";
     }
   }
   out << ")";
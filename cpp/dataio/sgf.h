@@ -7,6 +7,8 @@
 #include "../game/boardhistory.h"
 #include "../dataio/trainingwrite.h"
 
+struct GameRecord;
+
 STRUCT_NAMED_TRIPLE(uint8_t,x,uint8_t,y,Player,pla,MoveNoBSize);
 
 struct SgfNode {
@@ -89,6 +91,84 @@ struct CompactSgf {
   void setupBoardAndHist(const Rules& initialRules, Board& board, Player& nextPla, BoardHistory& hist, int turnNumber);
 };
 
+/*
+  Streaming parsing of many sgfs one after another, such as from the .sgfs files of one sgf per line written by
+  selfplay, which can be too large to parse comfortably with Sgf::loadSgfsFile.
+
+  Instead of building a tree of SgfNodes from a copy of the text, SgfStreamParser walks each sgf directly over a range
+  of bytes, such as those of a MappedFile, and fills a StreamedSgf with the same moves, placements, board size, komi,
+  depth, and hash that CompactSgf would have, following the same line through any variations. Root properties are
+  kept only as pointers to their text. A StreamedSgf can be reused from one sgf to the next to avoid allocation.
+  Separate parsers can work in parallel on the pieces of a file from splitOnGameBoundaries, as iterSgfsFile does.
+*/
+struct StreamedSgf {
+  //Key and value of a root property, pointing into the parsed bytes. The value is as in the sgf, still escaped.
+  struct Property {
+    const char* key;
+    size_t keyLen;
+    const char* value;
+    size_t valueLen;
+  };
+
+  //The whole sgf within the parsed bytes, from its opening paren to its closing paren
+  const char* text;
+  size_t textLen;
+  vector<Property> rootProperties;
+  vector<Move> placements;
+  vector<Move> moves;
+  int bSize;
+  int depth;
+  float komi;
+  //Same as the hash of an Sgf parsed from exactly the text of this sgf
+  Hash128 hash;
+
+  StreamedSgf();
+  ~StreamedSgf();
+
+  StreamedSgf(const StreamedSgf&) = delete;
+  StreamedSgf& operator=(const StreamedSgf&) = delete;
+
+  bool hasRootProperty(const char* key) const;
+  //The unescaped value of a root property, which must have exactly one value
+  string getRootProperty(const char* key) const;
+  Rules getRules(const Rules& defaultRules) const;
+
+  void setupInitialBoardAndHist(const Rules& initialRules, Board& board, Player& nextPla, BoardHistory& hist) const;
+};
+
+class SgfStreamParser {
+ public:
+  //Parse the len bytes at data, which must outlive this parser and anything it parses.
+  //fileName is only for error messages.
+  SgfStreamParser(const char* data, size_t len, const string& fileName);
+  ~SgfStreamParser();
+
+  SgfStreamParser(const SgfStreamParser&) = delete;
+  SgfStreamParser& operator=(const SgfStreamParser&) = delete;
+
+  //Parse the next sgf into sgf, returning false if there are none left.
+  //Throws IOError if the next sgf is malformed, after skipping past the end of the line it starts on, so that calling
+  //next again continues with the sgf on the following line.
+  bool next(StreamedSgf& sgf);
+
+  //Split the len bytes at data into up to numPieces ranges of similar size, each beginning at a line that starts with
+  //an opening paren, as every sgf in a .sgfs file does. Returns the offsets of the boundaries, starting with 0 and
+  //ending with len.
+  static vector<size_t> splitOnGameBoundaries(const char* data, size_t len, int numPieces);
+
+  //Memory-map a .sgfs file and parse it with numThreads threads, each calling f with its threadIdx for every sgf in its
+  //piece of the file. Malformed sgfs are reported to cout and skipped. If f throws, the first exception is rethrown
+  //after all the threads finish.
+  static void iterSgfsFile(const string& file, int numThreads, std::function<void(int,const StreamedSgf&)> f);
+
+ private:
+  const char* data;
+  size_t len;
+  size_t pos;
+  string fileName;
+  vector<Move> nodeWhiteMovesBuf;
+};
+
 namespace WriteSgf {
   //Write an SGF with no newlines to the given ostream.
   //If startTurnIdx >= 0, write a comment in the SGF root node indicating startTurnIdx, so as to
@@ -99,6 +179,9 @@ namespace WriteSgf {
     const BoardHistory& hist,
     const FinishedGameData* gameData
   );
+  //Write the same SGF from a game record. Only with withTrainingInfo, write the startTurnIdx comment and the
+  //values after each move, as for a non-NULL gameData above.
+  void writeSgf(ostream& out, const GameRecord& record, bool withTrainingInfo);
 
   //If hist is a finished game, print the result to out, else do nothing
   void printGameResult(ostream& out, const BoardHistory& hist);
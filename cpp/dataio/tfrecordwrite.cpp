@@ -0,0 +1,182 @@
+#include "../dataio/tfrecordwrite.h"
+#include <cstring>
+#include <zlib.h>
+
+using namespace std;
+
+//Protobuf wire format, just the parts needed for tf.train.Example----------------------------------------------
+//Example { Features features = 1; }
+//Features { map<string,Feature> feature = 1; } where each map entry is { string key = 1; Feature value = 2; }
+//Feature { oneof kind { BytesList bytes_list = 1; FloatList float_list = 2; Int64List int64_list = 3; } }
+//BytesList { repeated bytes value = 1; }
+//FloatList { repeated float value = 1 [packed = true]; }
+
+static const int PROTO_WIRE_TYPE_LEN = 2;
+
+static void appendVarint(string& s, uint64_t x) {
+  while(x >= 0x80) {
+    s.push_back((char)((x & 0x7F) | 0x80));
+    x >>= 7;
+  }
+  s.push_back((char)x);
+}
+
+static void appendLenField(string& s, int fieldNumber, const char* data, size_t len) {
+  appendVarint(s, ((uint64_t)fieldNumber << 3) | PROTO_WIRE_TYPE_LEN);
+  appendVarint(s, len);
+  s.append(data, len);
+}
+
+static void appendLenField(string& s, int fieldNumber, const string& data) {
+  appendLenField(s, fieldNumber, data.data(), data.size());
+}
+
+TFExampleBuilder::TFExampleBuilder()
+  :features()
+{}
+
+TFExampleBuilder::~TFExampleBuilder()
+{}
+
+void TFExampleBuilder::addBytes(const string& name, const char* data, size_t len) {
+  string bytesList;
+  appendLenField(bytesList, 1, data, len);
+  string feature;
+  appendLenField(feature, 1, bytesList);
+  string entry;
+  appendLenField(entry, 1, name);
+  appendLenField(entry, 2, feature);
+  appendLenField(features, 1, entry);
+}
+
+void TFExampleBuilder::addFloats(const string& name, const float* data, size_t len) {
+  static_assert(sizeof(float) == 4, "");
+  string floatList;
+  appendLenField(floatList, 1, (const char*)data, len * sizeof(float));
+  string feature;
+  appendLenField(feature, 2, floatList);
+  string entry;
+  appendLenField(entry, 1, name);
+  appendLenField(entry, 2, feature);
+  appendLenField(features, 1, entry);
+}
+
+void TFExampleBuilder::clear() {
+  features.clear();
+}
+
+string TFExampleBuilder::serialize() const {
+  string example;
+  appendLenField(example, 1, features);
+  return example;
+}
+
+//TFRecord files-----------------------------------------------------------------------------------------------
+//Each record is the uint64 length, the masked crc32c of the length, the data, and the masked crc32c of the data,
+//all little endian. With ZLIB compression, the whole file is a single zlib stream.
+
+namespace {
+  struct Crc32cTable {
+    uint32_t entries[256];
+    Crc32cTable() {
+      //Reflected Castagnoli polynomial
+      for(uint32_t i = 0; i<256; i++) {
+        uint32_t crc = i;
+        for(int j = 0; j<8; j++)
+          crc = (crc & 1) ? ((crc >> 1) ^ 0x82F63B78U) : (crc >> 1);
+        entries[i] = crc;
+      }
+    }
+  };
+}
+
+uint32_t TFRecordWriter::crc32c(const char* data, size_t len) {
+  static const Crc32cTable table;
+  uint32_t crc = 0xFFFFFFFFU;
+  for(size_t i = 0; i<len; i++)
+    crc = table.entries[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFU;
+}
+
+uint32_t TFRecordWriter::maskedCrc32c(const char* data, size_t len) {
+  uint32_t crc = crc32c(data,len);
+  return ((crc >> 15) | (crc << 17)) + 0xA282EAD8U;
+}
+
+static void appendLittleEndian(string& s, uint64_t x, int numBytes) {
+  for(int i = 0; i<numBytes; i++)
+    s.push_back((char)((x >> (8*i)) & 0xFF));
+}
+
+TFRecordWriter::TFRecordWriter(const string& fName)
+  :fileName(fName),out(),stream(NULL),isOpen(false),outBuf()
+{
+  out.open(fileName, ios::out | ios::binary | ios::trunc);
+  if(!out.good())
+    throw IOError("Could not open " + fileName + " for writing");
+  z_stream* zs = new z_stream();
+  memset(zs,0,sizeof(z_stream));
+  if(deflateInit(zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    delete zs;
+    throw StringError("TFRecordWriter: could not initialize zlib");
+  }
+  stream = zs;
+  isOpen = true;
+  outBuf.resize(1 << 16);
+}
+
+TFRecordWriter::~TFRecordWriter() {
+  z_stream* zs = (z_stream*)stream;
+  deflateEnd(zs);
+  delete zs;
+}
+
+void TFRecordWriter::deflateAndWrite(const char* data, size_t len, int flush) {
+  z_stream* zs = (z_stream*)stream;
+  const size_t maxChunk = (size_t)1 << 30; //zlib lengths are 32 bit
+  while(true) {
+    size_t inLen = std::min(len, maxChunk);
+    int chunkFlush = inLen < len ? Z_NO_FLUSH : flush;
+    //Without ZLIB_CONST, zlib declares next_in non-const even though it never writes through it
+    zs->next_in = const_cast<z_const Bytef*>(reinterpret_cast<const Bytef*>(data));
+    zs->avail_in = (uInt)inLen;
+    int ret;
+    do {
+      zs->next_out = reinterpret_cast<Bytef*>(&outBuf[0]);
+      zs->avail_out = (uInt)outBuf.size();
+      ret = deflate(zs, chunkFlush);
+      if(ret == Z_STREAM_ERROR)
+        throw StringError("TFRecordWriter: zlib error while writing " + fileName);
+      out.write(outBuf.data(), outBuf.size() - zs->avail_out);
+    } while(zs->avail_out == 0);
+    data += inLen;
+    len -= inLen;
+    if(len <= 0)
+      break;
+  }
+  if(!out.good())
+    throw IOError("Error writing " + fileName);
+}
+
+void TFRecordWriter::writeRecord(const char* data, size_t len) {
+  if(!isOpen)
+    throw StringError("TFRecordWriter: writing to " + fileName + " after it was closed");
+  string header;
+  appendLittleEndian(header, len, 8);
+  appendLittleEndian(header, maskedCrc32c(header.data(),8), 4);
+  string footer;
+  appendLittleEndian(footer, maskedCrc32c(data,len), 4);
+  deflateAndWrite(header.data(), header.size(), Z_NO_FLUSH);
+  deflateAndWrite(data, len, Z_NO_FLUSH);
+  deflateAndWrite(footer.data(), footer.size(), Z_NO_FLUSH);
+}
+
+void TFRecordWriter::close() {
+  if(!isOpen)
+    return;
+  isOpen = false;
+  deflateAndWrite(NULL, 0, Z_FINISH);
+  out.close();
+  if(out.fail())
+    throw IOError("Error closing " + fileName);
+}
@@ -0,0 +1,64 @@
+#ifndef TFRECORDWRITE_H
+#define TFRECORDWRITE_H
+
+#include <fstream>
+#include "../core/global.h"
+
+/*
+  Writing of training data in the same format as python/shuffle.py, so that python/train.py can read it
+  with tf.data.TFRecordDataset(fname,compression_type="ZLIB").
+
+  Usage: Add the features of each record to a TFExampleBuilder, then pass the serialized example to
+  TFRecordWriter::writeRecord. Call close when done, which throws IOError if anything failed to be written.
+*/
+
+//Builds a serialized tf.train.Example protobuf, without depending on protobuf or tensorflow.
+class TFExampleBuilder {
+ public:
+  TFExampleBuilder();
+  ~TFExampleBuilder();
+
+  TFExampleBuilder(const TFExampleBuilder&) = delete;
+  TFExampleBuilder& operator=(const TFExampleBuilder&) = delete;
+
+  //Add a feature that is a BytesList with a single entry
+  void addBytes(const string& name, const char* data, size_t len);
+  //Add a feature that is a FloatList, floats are written in native (little endian) byte order
+  void addFloats(const string& name, const float* data, size_t len);
+
+  //Clear all features to start a new example
+  void clear();
+  //The serialized example with all features added so far
+  string serialize() const;
+
+ private:
+  string features;
+};
+
+//Writes a zlib-compressed TFRecord file
+class TFRecordWriter {
+ public:
+  TFRecordWriter(const string& fileName);
+  ~TFRecordWriter();
+
+  TFRecordWriter(const TFRecordWriter&) = delete;
+  TFRecordWriter& operator=(const TFRecordWriter&) = delete;
+
+  void writeRecord(const char* data, size_t len);
+  void close();
+
+  //The crc32c that TFRecord uses, exposed for testing
+  static uint32_t crc32c(const char* data, size_t len);
+  static uint32_t maskedCrc32c(const char* data, size_t len);
+
+ private:
+  string fileName;
+  std::ofstream out;
+  void* stream; //z_stream, kept out of the header
+  bool isOpen;
+  string outBuf;
+
+  void deflateAndWrite(const char* data, size_t len, int flush);
+};
+
+#endif
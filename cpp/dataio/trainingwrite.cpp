@@ -1,6 +1,9 @@
 
 #include "../dataio/trainingwrite.h"
 
+#include <cstring>
+#include <memory>
+
 ValueTargets::ValueTargets()
   :win(0),
    loss(0),
@@ -54,6 +57,7 @@ FinishedGameData::FinishedGameData()
    startBoard(),
    startHist(),
    endHist(),
+   endBoard(),
    startPla(P_BLACK),
    gameHash(),
 
@@ -100,7 +104,7 @@ void FinishedGameData::printDebug(ostream& out) const {
   out << "start" << endl;
   startHist.printDebugInfo(out,startBoard);
   out << "end" << endl;
-  endHist.printDebugInfo(out,endHist.getRecentBoard(0));
+  endHist.printDebugInfo(out,endBoard);
   out << "gameHash " << gameHash << endl;
   out << "hitTurnLimit " << hitTurnLimit << endl;
   out << "numExtraBlack " << numExtraBlack << endl;
@@ -162,20 +166,24 @@ TrainingWriteBuffers::TrainingWriteBuffers(int iVersion, int maxRws, int numBCha
    packedBoardArea((pLen*pLen + 7)/8),
    curRows(0),
    binaryInputNCHWUnpacked(NULL),
+   binaryInputPlanesPacked(NULL),
    binaryInputNCHWPacked({maxRws, numBChannels, packedBoardArea}),
    globalInputNC({maxRws, numFChannels}),
    policyTargetsNCMove({maxRws, POLICY_TARGET_NUM_CHANNELS, NNPos::getPolicySize(pLen)}),
+   sparsePolicyTargets(false),
    globalTargetsNC({maxRws, GLOBAL_TARGET_NUM_CHANNELS}),
    scoreDistrN({maxRws, pLen*pLen*2+NNPos::EXTRA_SCORE_DISTR_RADIUS*2}),
    selfBonusScoreN({maxRws, BONUS_SCORE_RADIUS*2+1}),
    valueTargetsNCHW({maxRws, VALUE_SPATIAL_TARGET_NUM_CHANNELS, pLen, pLen})
 {
   binaryInputNCHWUnpacked = new float[numBChannels * pLen * pLen];
+  binaryInputPlanesPacked = new uint64_t[numBChannels * NNInputs::PACKED_PLANE_WORDS];
 }
 
 TrainingWriteBuffers::~TrainingWriteBuffers()
 {
   delete[] binaryInputNCHWUnpacked;
+  delete[] binaryInputPlanesPacked;
 }
 
 void TrainingWriteBuffers::clear() {
@@ -205,6 +213,18 @@ static void packBits(const float* binaryFloats, int len, uint8_t* bits) {
   }
 }
 
+//Same output as packBits, but from a plane already packed by NNInputs, least-significant-bit-first in 64-bit words.
+//So each output byte is just the corresponding byte of the plane with its bits reversed.
+static void packPlaneBits(const uint64_t* plane, int numBytes, uint8_t* bits) {
+  for(int i = 0; i < numBytes; i++) {
+    uint8_t b = (uint8_t)(plane[i >> 3] >> ((i & 7) * 8));
+    b = (uint8_t)(((b & 0xF0) >> 4) | ((b & 0x0F) << 4));
+    b = (uint8_t)(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+    b = (uint8_t)(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
+    bits[i] = b;
+  }
+}
+
 static void zeroPolicyTarget(int policySize, int16_t* target) {
   for(int pos = 0; pos<policySize; pos++)
     target[pos] = 0;
@@ -292,25 +312,31 @@ void TrainingWriteBuffers::addRow(
     if(inputsVersion == 3) {
       assert(NNInputs::NUM_FEATURES_BIN_V3 == numBinaryChannels);
       assert(NNInputs::NUM_FEATURES_GLOBAL_V3 == numGlobalChannels);
-      NNInputs::fillRowV3(board, hist, nextPlayer, data.drawEquivalentWinsForWhite, posLen, inputsUseNHWC, rowBin, rowGlobal);
+      NNInputs::fillRowV3(board, hist, nextPlayer, data.drawEquivalentWinsForWhite, posLen, inputsUseNHWC, rowBin, rowGlobal, NULL);
     }
     else if(inputsVersion == 4) {
       assert(NNInputs::NUM_FEATURES_BIN_V4 == numBinaryChannels);
       assert(NNInputs::NUM_FEATURES_GLOBAL_V4 == numGlobalChannels);
-      NNInputs::fillRowV4(board, hist, nextPlayer, data.drawEquivalentWinsForWhite, posLen, inputsUseNHWC, rowBin, rowGlobal);
+      NNInputs::fillRowV4(board, hist, nextPlayer, data.drawEquivalentWinsForWhite, posLen, inputsUseNHWC, rowBin, rowGlobal, NULL);
     }
     else if(inputsVersion == 5) {
       assert(NNInputs::NUM_FEATURES_BIN_V5 == numBinaryChannels);
       assert(NNInputs::NUM_FEATURES_GLOBAL_V5 == numGlobalChannels);
-      NNInputs::fillRowV5(board, hist, nextPlayer, data.drawEquivalentWinsForWhite, posLen, inputsUseNHWC, rowBin, rowGlobal);
+      NNInputs::fillRowV5Packed(board, hist, nextPlayer, data.drawEquivalentWinsForWhite, posLen, binaryInputPlanesPacked, rowGlobal);
     }
     else
       assert(false);
 
     //Pack bools bitwise into uint8_t
     uint8_t* rowBinPacked = binaryInputNCHWPacked.data + curRows * numBinaryChannels * packedBoardArea;
-    for(int c = 0; c<numBinaryChannels; c++)
-      packBits(rowBin + c * posArea, posArea, rowBinPacked + c * packedBoardArea);
+    if(inputsVersion == 5) {
+      for(int c = 0; c<numBinaryChannels; c++)
+        packPlaneBits(binaryInputPlanesPacked + c * NNInputs::PACKED_PLANE_WORDS, packedBoardArea, rowBinPacked + c * packedBoardArea);
+    }
+    else {
+      for(int c = 0; c<numBinaryChannels; c++)
+        packBits(rowBin + c * posArea, posArea, rowBinPacked + c * packedBoardArea);
+    }
   }
 
   //Vector for global targets and metadata
@@ -497,8 +523,38 @@ void TrainingWriteBuffers::writeToZipFile(const string& fileName) {
   numBytes = globalInputNC.prepareHeaderWithNumRows(curRows);
   zipFile.writeBuffer("globalInputNC", globalInputNC.dataIncludingHeader, numBytes);
 
-  numBytes = policyTargetsNCMove.prepareHeaderWithNumRows(curRows);
-  zipFile.writeBuffer("policyTargetsNCMove", policyTargetsNCMove.dataIncludingHeader, numBytes);
+  //The zip file only references these buffers, so they need to live until it's closed
+  std::unique_ptr<NumpyBuffer<int64_t>> sparseShape;
+  std::unique_ptr<NumpyBuffer<int32_t>> sparseOffsets;
+  std::unique_ptr<NumpyBuffer<int16_t>> sparseEntries;
+  if(!sparsePolicyTargets) {
+    numBytes = policyTargetsNCMove.prepareHeaderWithNumRows(curRows);
+    zipFile.writeBuffer("policyTargetsNCMove", policyTargetsNCMove.dataIncludingHeader, numBytes);
+  }
+  else {
+    int policySize = NNPos::getPolicySize(posLen);
+    vector<int32_t> offsets;
+    vector<int16_t> entries;
+    encodeSparsePolicyTargets(policyTargetsNCMove.data, curRows, POLICY_TARGET_NUM_CHANNELS, policySize, offsets, entries);
+    int64_t numEntries = (int64_t)entries.size() / 2;
+
+    sparseShape.reset(new NumpyBuffer<int64_t>({3}));
+    sparseShape->data[0] = curRows;
+    sparseShape->data[1] = POLICY_TARGET_NUM_CHANNELS;
+    sparseShape->data[2] = policySize;
+    sparseOffsets.reset(new NumpyBuffer<int32_t>({std::max(curRows,1), POLICY_TARGET_NUM_CHANNELS}));
+    std::copy(offsets.begin(), offsets.end(), sparseOffsets->data);
+    //NumpyBuffer can't be allocated with zero rows, but can still be written with zero rows
+    sparseEntries.reset(new NumpyBuffer<int16_t>({std::max(numEntries,(int64_t)1), 2}));
+    std::copy(entries.begin(), entries.end(), sparseEntries->data);
+
+    numBytes = sparseShape->prepareHeaderWithNumRows(3);
+    zipFile.writeBuffer("policyTargetsSparseShape", sparseShape->dataIncludingHeader, numBytes);
+    numBytes = sparseOffsets->prepareHeaderWithNumRows(curRows);
+    zipFile.writeBuffer("policyTargetsSparseOffsetsNC", sparseOffsets->dataIncludingHeader, numBytes);
+    numBytes = sparseEntries->prepareHeaderWithNumRows(numEntries);
+    zipFile.writeBuffer("policyTargetsSparseEntries", sparseEntries->dataIncludingHeader, numBytes);
+  }
 
   numBytes = globalTargetsNC.prepareHeaderWithNumRows(curRows);
   zipFile.writeBuffer("globalTargetsNC", globalTargetsNC.dataIncludingHeader, numBytes);
@@ -515,6 +571,54 @@ void TrainingWriteBuffers::writeToZipFile(const string& fileName) {
   zipFile.close();
 }
 
+void TrainingWriteBuffers::encodeSparsePolicyTargets(
+  const int16_t* policyTargets, int64_t numRows, int numChannels, int policySize,
+  vector<int32_t>& offsets, vector<int16_t>& entries
+) {
+  offsets.clear();
+  entries.clear();
+  for(int64_t i = 0; i<numRows * numChannels; i++) {
+    assert(entries.size() / 2 <= (size_t)0x7FFFFFFF);
+    offsets.push_back((int32_t)(entries.size() / 2));
+    const int16_t* target = policyTargets + i * policySize;
+    for(int pos = 0; pos<policySize; pos++) {
+      if(target[pos] != 0) {
+        entries.push_back((int16_t)pos);
+        entries.push_back(target[pos]);
+      }
+    }
+  }
+}
+
+void TrainingWriteBuffers::decodeSparsePolicyTargets(
+  const char* offsetsBytes, const char* entriesBytes, int64_t numEntries,
+  int64_t numRows, int numChannels, int policySize,
+  int16_t* policyTargets
+) {
+  int64_t numTargets = numRows * numChannels;
+  for(int64_t i = 0; i<numTargets; i++) {
+    int32_t start;
+    int32_t end;
+    std::memcpy(&start, offsetsBytes + i * sizeof(int32_t), sizeof(int32_t));
+    if(i+1 < numTargets)
+      std::memcpy(&end, offsetsBytes + (i+1) * sizeof(int32_t), sizeof(int32_t));
+    else
+      end = (int32_t)numEntries;
+    if(start < 0 || start > end || end > numEntries)
+      throw IOError("Sparse policy targets have invalid offsets");
+
+    int16_t* target = policyTargets + i * policySize;
+    zeroPolicyTarget(policySize,target);
+    for(int32_t e = start; e<end; e++) {
+      int16_t entry[2];
+      std::memcpy(entry, entriesBytes + e * sizeof(entry), sizeof(entry));
+      if(entry[0] < 0 || entry[0] >= policySize)
+        throw IOError("Sparse policy targets have an invalid pos");
+      target[entry[0]] = entry[1];
+    }
+  }
+}
+
 void TrainingWriteBuffers::writeToTextOstream(ostream& out) {
   int len;
 
@@ -610,8 +714,23 @@ TrainingDataWriter::TrainingDataWriter(ostream* dbgOut, int iVersion, int maxRow
 {}
 
 TrainingDataWriter::TrainingDataWriter(const string& outDir, ostream* dbgOut, int iVersion, int maxRowsPerFile, double firstFileMinRandProp, int posLen, int onlyEvery, const string& randSeed)
-  :outputDir(outDir),inputsVersion(iVersion),rand(randSeed),writeBuffers(NULL),debugOut(dbgOut),debugOnlyWriteEvery(onlyEvery),rowCount(0)
+  :outputDir(outDir),inputsVersion(iVersion),rand(randSeed),writeBuffers(NULL),
+   spareWriteBuffers(NULL),zipWriteThread(),zipWriteMutex(),zipWriteCondVar(),zipWriteBuffers(NULL),
+   zipWriteFileName(),zipWriteShouldStop(false),zipWriteException(),
+   sparsePolicyTargets(false),debugOut(dbgOut),debugOnlyWriteEvery(onlyEvery),rowCount(0)
 {
+  //Check everything before allocating anything or starting zipWriteThread, which would not be cleaned up if we threw later
+  if(maxRowsPerFile <= 0)
+    throw StringError("TrainingDataWriter: maxRowsPerFile must be positive: " + Global::intToString(maxRowsPerFile));
+  if(!(firstFileMinRandProp >= 0 && firstFileMinRandProp <= 1))
+    throw StringError("TrainingDataWriter: firstFileMinRandProp not in [0,1]: " + Global::doubleToString(firstFileMinRandProp));
+  if(posLen <= 0 || posLen > NNPos::MAX_BOARD_LEN)
+    throw StringError("TrainingDataWriter: posLen not in [1," + Global::intToString(NNPos::MAX_BOARD_LEN) + "]: " + Global::intToString(posLen));
+  if(debugOut != NULL && debugOnlyWriteEvery <= 0)
+    throw StringError("TrainingDataWriter: onlyWriteEvery must be positive: " + Global::intToString(debugOnlyWriteEvery));
+  if(debugOut == NULL && outputDir == "")
+    throw StringError("TrainingDataWriter: no output directory or debug output");
+
   int numBinaryChannels;
   int numGlobalChannels;
   //Note that this inputsVersion is for data writing, it might be different than the inputsVersion used
@@ -631,49 +750,146 @@ TrainingDataWriter::TrainingDataWriter(const string& outDir, ostream* dbgOut, in
     numGlobalChannels = NNInputs::NUM_FEATURES_GLOBAL_V5;
   }
 
-  writeBuffers = new TrainingWriteBuffers(inputsVersion, maxRowsPerFile, numBinaryChannels, numGlobalChannels, posLen);
-
-  if(firstFileMinRandProp < 0 || firstFileMinRandProp > 1)
-    throw StringError("TrainingDataWriter: firstFileMinRandProp not in [0,1]: " + Global::doubleToString(firstFileMinRandProp));
   isFirstFile = true;
   if(firstFileMinRandProp >= 1.0)
     firstFileMaxRows = maxRowsPerFile;
   else
     firstFileMaxRows = maxRowsPerFile - (int)(maxRowsPerFile * (1.0-firstFileMinRandProp) * rand.nextDouble());
+
+  writeBuffers = new TrainingWriteBuffers(inputsVersion, maxRowsPerFile, numBinaryChannels, numGlobalChannels, posLen);
+  if(debugOut == NULL) {
+    spareWriteBuffers = new TrainingWriteBuffers(inputsVersion, maxRowsPerFile, numBinaryChannels, numGlobalChannels, posLen);
+    zipWriteThread = std::thread(&TrainingDataWriter::zipWriteLoop, this);
+  }
 }
 
 
 
 TrainingDataWriter::~TrainingDataWriter()
 {
+  if(zipWriteThread.joinable()) {
+    {
+      std::unique_lock<std::mutex> lock(zipWriteMutex);
+      while(zipWriteBuffers != NULL)
+        zipWriteCondVar.wait(lock);
+      zipWriteShouldStop = true;
+      zipWriteCondVar.notify_all();
+    }
+    zipWriteThread.join();
+  }
+  //Nobody is left to rethrow to, so just report it
+  if(zipWriteException) {
+    try {
+      std::rethrow_exception(zipWriteException);
+    }
+    catch(const exception& e) {
+      cerr << "TrainingDataWriter: " << e.what() << endl;
+    }
+    catch(...) {
+      cerr << "TrainingDataWriter: unexpected throw while writing" << endl;
+    }
+  }
   delete writeBuffers;
+  delete spareWriteBuffers;
+}
+
+void TrainingDataWriter::setSparsePolicyTargets(bool b) {
+  sparsePolicyTargets = b;
+}
+
+void TrainingDataWriter::zipWriteLoop() {
+  std::unique_lock<std::mutex> lock(zipWriteMutex);
+  while(true) {
+    while(zipWriteBuffers == NULL && !zipWriteShouldStop)
+      zipWriteCondVar.wait(lock);
+    if(zipWriteBuffers == NULL)
+      break;
+
+    TrainingWriteBuffers* buffers = zipWriteBuffers;
+    string filename = zipWriteFileName;
+    lock.unlock();
+    std::exception_ptr exception;
+    try {
+      string tmpFilename = filename + ".tmp";
+      buffers->writeToZipFile(tmpFilename);
+      if(std::rename(tmpFilename.c_str(),filename.c_str()) != 0)
+        throw IOError("Could not rename " + tmpFilename + " to " + filename);
+    }
+    catch(...) {
+      exception = std::current_exception();
+    }
+    buffers->clear();
+    lock.lock();
+
+    if(exception && !zipWriteException)
+      zipWriteException = exception;
+    zipWriteBuffers = NULL;
+    zipWriteCondVar.notify_all();
+  }
+}
+
+//Wait until zipWriteThread is idle
+void TrainingDataWriter::waitForZipWrite(std::unique_lock<std::mutex>& lock) {
+  while(zipWriteBuffers != NULL)
+    zipWriteCondVar.wait(lock);
+}
+
+void TrainingDataWriter::rethrowZipWriteException(std::unique_lock<std::mutex>& lock) {
+  assert(lock.owns_lock());
+  (void)lock;
+  if(zipWriteException) {
+    std::exception_ptr exception = zipWriteException;
+    zipWriteException = nullptr;
+    std::rethrow_exception(exception);
+  }
 }
 
 void TrainingDataWriter::writeAndClearIfFull() {
   if(writeBuffers->curRows >= writeBuffers->maxRows || (isFirstFile && writeBuffers->curRows >= firstFileMaxRows)) {
-    flushIfNonempty();
+    writeAndClear(false);
   }
 }
 
 void TrainingDataWriter::flushIfNonempty() {
-  if(writeBuffers->curRows > 0) {
-    isFirstFile = false;
+  writeAndClear(true);
+}
 
-    if(debugOut != NULL) {
+void TrainingDataWriter::writeAndClear(bool waitForWrite) {
+  if(debugOut != NULL) {
+    if(writeBuffers->curRows > 0) {
+      isFirstFile = false;
       writeBuffers->writeToTextOstream(*debugOut);
       writeBuffers->clear();
     }
-    else {
-      string filename = outputDir + "/" + Global::uint64ToHexString(rand.nextUInt64()) + ".npz";
-      string tmpFilename = filename + ".tmp";
-      writeBuffers->writeToZipFile(tmpFilename);
-      writeBuffers->clear();
-      std::rename(tmpFilename.c_str(),filename.c_str());
-    }
+    return;
   }
+
+  std::unique_lock<std::mutex> lock(zipWriteMutex);
+  if(writeBuffers->curRows > 0) {
+    isFirstFile = false;
+    string filename = outputDir + "/" + Global::uint64ToHexString(rand.nextUInt64()) + ".npz";
+
+    //Only one file is written at a time, so if the previous one is still in progress, wait for it,
+    //which only happens if rows are added faster than a file can be compressed.
+    //If it failed, still hand off these rows before reporting that, so that writeBuffers has room for more rows.
+    waitForZipWrite(lock);
+    writeBuffers->sparsePolicyTargets = sparsePolicyTargets;
+    zipWriteBuffers = writeBuffers;
+    zipWriteFileName = filename;
+    std::swap(writeBuffers,spareWriteBuffers);
+    zipWriteCondVar.notify_all();
+  }
+  if(waitForWrite)
+    waitForZipWrite(lock);
+  rethrowZipWriteException(lock);
 }
 
 void TrainingDataWriter::writeGame(const FinishedGameData& data) {
+  if(debugOut == NULL) {
+    std::unique_lock<std::mutex> lock(zipWriteMutex);
+    rethrowZipWriteException(lock);
+  }
+
   int numMoves = data.endHist.moveHistory.size() - data.startHist.moveHistory.size();
   assert(numMoves >= 0);
   assert(data.targetWeightByTurn.size() == numMoves);
@@ -1,6 +1,7 @@
 #ifndef TRAINING_WRITE_H
 #define TRAINING_WRITE_H
 
+#include "../core/multithread.h"
 #include "../neuralnet/nninputs.h"
 #include "../neuralnet/nninterface.h"
 #include "../dataio/numpywrite.h"
@@ -51,6 +52,7 @@ struct FinishedGameData {
   Board startBoard; //Board as of the end of startHist, beginning of training period
   BoardHistory startHist; //Board history as of start of training period
   BoardHistory endHist; //Board history as of end of training period
+  Board endBoard; //Board as of the end of endHist
   Player startPla; //Player to move as of end of startHist.
   Hash128 gameHash;
 
@@ -90,6 +92,8 @@ struct TrainingWriteBuffers {
 
   int curRows;
   float* binaryInputNCHWUnpacked;
+  //Scratch for inputs versions with a packed featurizer, NNInputs::PACKED_PLANE_WORDS per channel
+  uint64_t* binaryInputPlanesPacked;
 
   //Input feature planes that have spatial extent, all of which happen to be binary.
   //Packed bitwise, with each (HW) zero-padded to a round byte.
@@ -106,6 +110,14 @@ struct TrainingWriteBuffers {
   //C1: Policy target next turn.
   NumpyBuffer<int16_t> policyTargetsNCMove;
 
+  //If true, writeToZipFile writes policyTargetsNCMove in the following sparse form instead, since nearly all of its
+  //entries are zero. Readers detect the form by the presence of policyTargetsSparseShape.
+  //policyTargetsSparseShape: int64 [3], the shape [N,C,Pos] that policyTargetsNCMove would have had.
+  //policyTargetsSparseOffsetsNC: int32 [N,C], index in policyTargetsSparseEntries of the first entry of each row and channel.
+  //  The entries for each row and channel continue until those of the next, or until the end of the entries.
+  //policyTargetsSparseEntries: int16 [M,2], (pos,value) of each nonzero value, ordered by row, channel, and then pos.
+  bool sparsePolicyTargets;
+
   //Value targets and other metadata, from the perspective of the player to move
   //C0-3: Categorial game result, win,loss,noresult, and also score. Draw is encoded as some blend of win and loss based on drawEquivalentWinsForWhite.
   //C4-7: MCTS win-loss-noresult estimate td-like target, lambda = 35/36, nowFactor = 1/36
@@ -196,6 +208,20 @@ struct TrainingWriteBuffers {
   void writeToZipFile(const string& fileName);
   void writeToTextOstream(ostream& out);
 
+  //Convert numRows rows of dense policy targets to the sparse form described above, replacing the contents of offsets and entries.
+  static void encodeSparsePolicyTargets(
+    const int16_t* policyTargets, int64_t numRows, int numChannels, int policySize,
+    vector<int32_t>& offsets, vector<int16_t>& entries
+  );
+  //Inverse of encodeSparsePolicyTargets, filling numRows rows of dense policy targets.
+  //offsetsBytes and entriesBytes are the raw data of the two arrays, which need not be aligned, as when they are
+  //read in place from an npz file. Throws IOError if the data is inconsistent.
+  static void decodeSparsePolicyTargets(
+    const char* offsetsBytes, const char* entriesBytes, int64_t numEntries,
+    int64_t numRows, int numChannels, int policySize,
+    int16_t* policyTargets
+  );
+
 };
 
 class TrainingDataWriter {
@@ -205,7 +231,11 @@ class TrainingDataWriter {
   TrainingDataWriter(const string& outputDir, ostream* debugOut, int inputsVersion, int maxRowsPerFile, double firstFileMinRandProp, int posLen, int onlyWriteEvery, const string& randSeed);
   ~TrainingDataWriter();
 
+  //Throws if writing a previous file failed
   void writeGame(const FinishedGameData& data);
+  //Write policy targets to files in the sparse form, see TrainingWriteBuffers
+  void setSparsePolicyTargets(bool b);
+  //Write any remaining rows, and wait until all files are completely written. Throws if writing any file failed.
   void flushIfNonempty();
 
  private:
@@ -214,6 +244,20 @@ class TrainingDataWriter {
   Rand rand;
   TrainingWriteBuffers* writeBuffers;
 
+  //When writing to outputDir, compressing and writing a full file happens on zipWriteThread, so that writeGame
+  //doesn't wait on it. Meanwhile writeBuffers is swapped with spareWriteBuffers so that rows can keep being added.
+  //zipWriteBuffers is whichever buffers zipWriteThread is currently writing, or NULL if it is idle.
+  //Anything thrown while writing is kept in zipWriteException and rethrown by the next writeGame or flushIfNonempty.
+  TrainingWriteBuffers* spareWriteBuffers;
+  std::thread zipWriteThread;
+  std::mutex zipWriteMutex;
+  std::condition_variable zipWriteCondVar;
+  TrainingWriteBuffers* zipWriteBuffers;
+  string zipWriteFileName;
+  bool zipWriteShouldStop;
+  std::exception_ptr zipWriteException;
+  bool sparsePolicyTargets;
+
   ostream* debugOut;
   int debugOnlyWriteEvery;
   int64_t rowCount;
@@ -222,6 +266,10 @@ class TrainingDataWriter {
   int firstFileMaxRows;
 
   void writeAndClearIfFull();
+  void writeAndClear(bool waitForWrite);
+  void zipWriteLoop();
+  void waitForZipWrite(std::unique_lock<std::mutex>& lock);
+  void rethrowZipWriteException(std::unique_lock<std::mutex>& lock);
 
 };
 
@@ -29,6 +29,8 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
   bool printRootNNValues;
   bool printScoreNow;
   bool printRootEndingBonus;
+  string loadTreeFile;
+  string saveTreeFile;
   try {
     TCLAP::CmdLine cmd("Run a search on a position from an sgf file", ' ', "1.0",true);
     TCLAP::ValueArg<string> configFileArg("","config","Config file to use (see configs/gtp_example.cfg)",true,string(),"FILE");
@@ -46,6 +48,8 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
     TCLAP::SwitchArg printRootNNValuesArg("","print-root-nn-values","Print root nn values");
     TCLAP::SwitchArg printScoreNowArg("","print-score-now","Print score now");
     TCLAP::SwitchArg printRootEndingBonusArg("","print-root-ending-bonus","Print root ending bonus now");
+    TCLAP::ValueArg<string> loadTreeArg("","load-tree","Resume from a search tree saved for this position",false,string(),"FILE");
+    TCLAP::ValueArg<string> saveTreeArg("","save-tree","Save the search tree after searching",false,string(),"FILE");
     cmd.add(configFileArg);
     cmd.add(modelFileArg);
     cmd.add(sgfFileArg);
@@ -61,6 +65,8 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
     cmd.add(printRootNNValuesArg);
     cmd.add(printScoreNowArg);
     cmd.add(printRootEndingBonusArg);
+    cmd.add(loadTreeArg);
+    cmd.add(saveTreeArg);
     cmd.parse(argc,argv);
     configFile = configFileArg.getValue();
     modelFile = modelFileArg.getValue();
@@ -77,6 +83,8 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
     printRootNNValues = printRootNNValuesArg.getValue();
     printScoreNow = printScoreNowArg.getValue();
     printRootEndingBonus = printRootEndingBonusArg.getValue();
+    loadTreeFile = loadTreeArg.getValue();
+    saveTreeFile = saveTreeArg.getValue();
 
     if(printBranch.length() > 0 && print.length() > 0) {
       cerr << "Error: -print-branch and -print both specified" << endl;
@@ -253,6 +261,11 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
 
   //Search!----------------------------------------------------------------
 
+  if(loadTreeFile != "") {
+    if(!bot->loadTree(loadTreeFile))
+      throw StringError("Search tree in " + loadTreeFile + " does not match the position to analyze");
+  }
+
   ClockTimer timer;
   nnEval->clearStats();
   Loc loc = bot->genMoveSynchronous(bot->getSearch()->rootPla,TimeControls());
@@ -304,6 +317,14 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
 
   sout << "Time taken: " << timer.getSeconds() << "\n";
   sout << "Root visits: " << search->numRootVisits() << "\n";
+  {
+    int64_t numTreeNodes;
+    int64_t numTreeBytes;
+    search->getTreeMemoryUsage(numTreeNodes,numTreeBytes);
+    sout << "Tree nodes: " << numTreeNodes << " bytes: " << numTreeBytes << "\n";
+  }
+  if(search->lastSearchEarlyStopSavedPlayouts > 0)
+    sout << "Stopped early, leader unassailable, saved playouts: " << search->lastSearchEarlyStopSavedPlayouts << "\n";
   sout << "NN rows: " << nnEval->numRowsProcessed() << endl;
   sout << "NN batches: " << nnEval->numBatchesProcessed() << endl;
   sout << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
@@ -314,6 +335,11 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
   search->printTree(sout, search->rootNode, options);
   logger.write(sout.str());
 
+  if(saveTreeFile != "") {
+    bot->saveTree(saveTreeFile);
+    logger.write("Saved search tree to " + saveTreeFile);
+  }
+
   delete bot;
   delete nnEval;
   NeuralNet::globalCleanup();
@@ -0,0 +1,143 @@
+#ifndef BITBOARD_H_
+#define BITBOARD_H_
+
+#include "../core/global.h"
+#include "../game/board.h"
+
+//A set of locations on a board, one bit per location, using the same layout as Loc.
+//Since Loc layout leaves a column of wall between consecutive rows, shifting by 1 or by the row stride
+//(x_size+1) moves every point to its left/right/up/down neighbor without wrapping, and anything that lands
+//on a wall is removed by masking with the set of on-board locations.
+struct Bitboard {
+  static const int NUM_WORDS = (Board::MAX_ARR_SIZE + 63) / 64;
+  uint64_t words[NUM_WORDS];
+
+  inline void clear() {
+    for(int i = 0; i<NUM_WORDS; i++)
+      words[i] = 0;
+  }
+  inline void set(Loc loc) {
+    words[loc >> 6] |= ((uint64_t)1) << (loc & 63);
+  }
+  inline bool test(Loc loc) const {
+    return (words[loc >> 6] >> (loc & 63)) & 1;
+  }
+
+  inline bool isEmpty() const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i];
+    return acc == 0;
+  }
+  inline bool intersects(const Bitboard& other) const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i] & other.words[i];
+    return acc != 0;
+  }
+  //True if every location in this is also in other
+  inline bool isSubsetOf(const Bitboard& other) const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i] & ~other.words[i];
+    return acc == 0;
+  }
+  inline bool operator==(const Bitboard& other) const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i] ^ other.words[i];
+    return acc == 0;
+  }
+
+  inline Bitboard operator|(const Bitboard& other) const {
+    Bitboard ret;
+    for(int i = 0; i<NUM_WORDS; i++)
+      ret.words[i] = words[i] | other.words[i];
+    return ret;
+  }
+  inline Bitboard operator&(const Bitboard& other) const {
+    Bitboard ret;
+    for(int i = 0; i<NUM_WORDS; i++)
+      ret.words[i] = words[i] & other.words[i];
+    return ret;
+  }
+  inline Bitboard andNot(const Bitboard& other) const {
+    Bitboard ret;
+    for(int i = 0; i<NUM_WORDS; i++)
+      ret.words[i] = words[i] & ~other.words[i];
+    return ret;
+  }
+  inline Bitboard& operator|=(const Bitboard& other) {
+    for(int i = 0; i<NUM_WORDS; i++)
+      words[i] |= other.words[i];
+    return *this;
+  }
+
+  static inline int popcount64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+  }
+  inline int count() const {
+    int n = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      n += popcount64(words[i]);
+    return n;
+  }
+  //Lowest location in the set, or NULL_LOC if empty
+  inline Loc lowest() const {
+    for(int i = 0; i<NUM_WORDS; i++) {
+      if(words[i] != 0) {
+        uint64_t w = words[i];
+        return (Loc)(i * 64 + popcount64((w & (~w + 1)) - 1));
+      }
+    }
+    return Board::NULL_LOC;
+  }
+
+  //Call f on every location in the set, in increasing order
+  template<typename F>
+  inline void iterLocs(F f) const {
+    for(int i = 0; i<NUM_WORDS; i++) {
+      uint64_t w = words[i];
+      while(w != 0) {
+        f((Loc)(i * 64 + popcount64((w & (~w + 1)) - 1)));
+        w &= w - 1;
+      }
+    }
+  }
+
+  //All locations in this or adjacent to a location in this, not masked to the board
+  inline Bitboard dilate(int stride) const {
+    Bitboard ret;
+    for(int i = 0; i<NUM_WORDS; i++) {
+      uint64_t w = words[i];
+      uint64_t lo = i > 0 ? words[i-1] : 0;
+      uint64_t hi = i < NUM_WORDS-1 ? words[i+1] : 0;
+      ret.words[i] = w
+        | (w << 1) | (lo >> 63)
+        | (w >> 1) | (hi << 63)
+        | (w << stride) | (lo >> (64-stride))
+        | (w >> stride) | (hi << (64-stride));
+    }
+    return ret;
+  }
+
+  //The connected component of mask containing seed, where seed must be a subset of mask
+  static inline Bitboard floodFill(const Bitboard& seed, const Bitboard& mask, int stride) {
+    Bitboard cur = seed;
+    while(true) {
+      Bitboard next = cur.dilate(stride) & mask;
+      if(next == cur)
+        return cur;
+      cur = next;
+    }
+  }
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include "../core/rand.h"
 #include "../game/board.h"
+#include "../game/bitboard.h"
 
 //STATIC VARS-----------------------------------------------------------------------------
 bool Board::IS_ZOBRIST_INITALIZED = false;
@@ -28,7 +29,7 @@ const Hash128 Board::ZOBRIST_PASS_ENDS_PHASE = //Based on sha256 hash of Board::
 
 Board::Board()
 {
-  init(19,19);
+  init(MAX_LEN,MAX_LEN);
 }
 
 Board::Board(int x, int y)
@@ -38,17 +39,35 @@ Board::Board(int x, int y)
 
 
 Board::Board(const Board& other)
+  :empty_list(other.empty_list)
+{
+  copyArraysFrom(other);
+}
+
+Board& Board::operator=(const Board& other)
+{
+  if(this == &other)
+    return *this;
+  copyArraysFrom(other);
+  empty_list = other.empty_list;
+  return *this;
+}
+
+void Board::copyArraysFrom(const Board& other)
 {
   x_size = other.x_size;
   y_size = other.y_size;
 
-  memcpy(colors, other.colors, sizeof(Color)*MAX_ARR_SIZE);
-  memcpy(chain_data, other.chain_data, sizeof(ChainData)*MAX_ARR_SIZE);
-  memcpy(chain_head, other.chain_head, sizeof(Loc)*MAX_ARR_SIZE);
-  memcpy(next_in_chain, other.next_in_chain, sizeof(Loc)*MAX_ARR_SIZE);
+  //Locations past the last on-board location are always walls, so only the prefix of the arrays up to it needs copying
+  int arrSize = (x_size+1)*(y_size+2)+1;
+  assert(arrSize <= MAX_ARR_SIZE);
+  memcpy(colors, other.colors, sizeof(Color)*arrSize);
+  memset(colors+arrSize, C_WALL, sizeof(Color)*(MAX_ARR_SIZE-arrSize));
+  memcpy(chain_data, other.chain_data, sizeof(ChainData)*arrSize);
+  memcpy(chain_head, other.chain_head, sizeof(Loc)*arrSize);
+  memcpy(next_in_chain, other.next_in_chain, sizeof(Loc)*arrSize);
 
   ko_loc = other.ko_loc;
-  empty_list = other.empty_list;
   pos_hash = other.pos_hash;
   numBlackCaptures = other.numBlackCaptures;
   numWhiteCaptures = other.numWhiteCaptures;
@@ -1093,7 +1112,7 @@ Board::PointList::PointList()
 
 Board::PointList::PointList(const Board::PointList& other)
 {
-  std::memcpy(list_, other.list_, sizeof(list_));
+  std::memcpy(list_, other.list_, sizeof(Loc)*other.size_);
   std::memcpy(indices_, other.indices_, sizeof(indices_));
   size_ = other.size_;
 }
@@ -1102,7 +1121,7 @@ void Board::PointList::operator=(const Board::PointList& other)
 {
   if(this == &other)
     return;
-  std::memcpy(list_, other.list_, sizeof(list_));
+  std::memcpy(list_, other.list_, sizeof(Loc)*other.size_);
   std::memcpy(indices_, other.indices_, sizeof(indices_));
   size_ = other.size_;
 }
@@ -1553,14 +1572,25 @@ void Board::calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTe
     result[i] = C_EMPTY;
   calculateAreaForPla(P_BLACK,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
   calculateAreaForPla(P_WHITE,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+  if(nonPassAliveStones)
+    markNonPassAliveStones(result);
+}
 
-  if(nonPassAliveStones) {
-    for(int y = 0; y < y_size; y++) {
-      for(int x = 0; x < x_size; x++) {
-        Loc loc = Location::getLoc(x,y,x_size);
-        if(result[loc] == C_EMPTY)
-          result[loc] = colors[loc];
-      }
+void Board::calculateAreaReference(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const {
+  for(int i = 0; i<MAX_ARR_SIZE; i++)
+    result[i] = C_EMPTY;
+  calculateAreaForPlaReference(P_BLACK,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+  calculateAreaForPlaReference(P_WHITE,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+  if(nonPassAliveStones)
+    markNonPassAliveStones(result);
+}
+
+void Board::markNonPassAliveStones(Color* result) const {
+  for(int y = 0; y < y_size; y++) {
+    for(int x = 0; x < x_size; x++) {
+      Loc loc = Location::getLoc(x,y,x_size);
+      if(result[loc] == C_EMPTY)
+        result[loc] = colors[loc];
     }
   }
 }
@@ -1575,7 +1605,7 @@ void Board::calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTe
 //The top left corner is black's pass-alive territory. It's also an empty region bordered only by white, but we should not mark
 //it as white's unsafeBigTerritory because it's already marked as black's pass alive territory.
 
-void Board::calculateAreaForPla(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const {
+void Board::calculateAreaForPlaReference(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const {
   Color opp = getOpp(pla);
 
   //First compute all empty-or-opp regions
@@ -2225,3 +2255,191 @@ Board Board::parseBoard(int xSize, int ySize, const string& s) {
   }
   return board;
 }
+
+Loc Board::findLocNeverPassAliveArea(Loc hint) const {
+  auto hasNoAdjacentStones = [this](Loc loc) {
+    for(int i = 0; i<4; i++) {
+      Color c = colors[loc + adj_offsets[i]];
+      if(c == C_BLACK || c == C_WHITE)
+        return false;
+    }
+    return true;
+  };
+  auto isNeverPassAlive = [this,&hasNoAdjacentStones](Loc loc) {
+    if(colors[loc] != C_EMPTY || !hasNoAdjacentStones(loc))
+      return false;
+    for(int i = 0; i<4; i++) {
+      Loc adj = loc + adj_offsets[i];
+      if(colors[adj] == C_EMPTY && hasNoAdjacentStones(adj))
+        return true;
+    }
+    return false;
+  };
+
+  //Usually the previous such location is still one, or one adjacent to it is
+  if(hint > 0 && hint < MAX_ARR_SIZE && colors[hint] == C_EMPTY) {
+    if(isNeverPassAlive(hint))
+      return hint;
+    for(int i = 0; i<4; i++) {
+      Loc adj = hint + adj_offsets[i];
+      if(isNeverPassAlive(adj))
+        return adj;
+    }
+  }
+  for(int y = 0; y < y_size; y++) {
+    for(int x = 0; x < x_size; x++) {
+      Loc loc = Location::getLoc(x,y,x_size);
+      if(isNeverPassAlive(loc))
+        return loc;
+    }
+  }
+  return NULL_LOC;
+}
+
+//Same as calculateAreaForPlaReference, but computing regions, adjacency and the Benson iteration with bitboards rather than
+//by walking chains and regions location by location.
+void Board::calculateAreaForPla(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const {
+  Color opp = getOpp(pla);
+  int stride = x_size+1;
+
+  Bitboard plaStones;
+  Bitboard oppStones;
+  Bitboard empty;
+  plaStones.clear();
+  oppStones.clear();
+  empty.clear();
+  for(int y = 0; y < y_size; y++) {
+    for(int x = 0; x < x_size; x++) {
+      Loc loc = Location::getLoc(x,y,x_size);
+      if(colors[loc] == pla)
+        plaStones.set(loc);
+      else if(colors[loc] == opp)
+        oppStones.set(loc);
+      else
+        empty.set(loc);
+    }
+  }
+  Bitboard emptyOrOpp = empty | oppStones;
+  bool atLeastOnePla = !plaStones.isEmpty();
+
+  //Chains and regions are both bounded in number by half the board
+  const int maxRegions = (MAX_LEN * MAX_LEN + 1)/2 + 1;
+  //Allocated rather than on the stack since this is large and we may be running on a small fiber stack
+  Bitboard* bitboardBuf = new Bitboard[maxRegions * 3];
+
+  //Pla chains, and for each chain, the chain plus all locations adjacent to it
+  int numChains = 0;
+  Bitboard* chains = bitboardBuf;
+  Bitboard* chainAdj = bitboardBuf + maxRegions;
+  int16_t chainIdxByLoc[MAX_ARR_SIZE];
+  {
+    Bitboard remaining = plaStones;
+    while(!remaining.isEmpty()) {
+      Bitboard seed;
+      seed.clear();
+      seed.set(remaining.lowest());
+      int chainIdx = numChains++;
+      assert(numChains <= maxRegions);
+      chains[chainIdx] = Bitboard::floodFill(seed,plaStones,stride);
+      chainAdj[chainIdx] = chains[chainIdx].dilate(stride);
+      chains[chainIdx].iterLocs([&chainIdxByLoc,chainIdx](Loc loc) { chainIdxByLoc[loc] = (int16_t)chainIdx; });
+      remaining = remaining.andNot(chains[chainIdx]);
+    }
+  }
+
+  //Maximal empty-or-opp regions containing at least one empty location, and for each one the pla chains that it is
+  //vital for - every location of the region (only empty locations if multi-stone suicide is illegal) is adjacent to the chain.
+  int numRegions = 0;
+  Bitboard* regions = bitboardBuf + maxRegions * 2;
+  int16_t vitalFor[maxRegions * 4];
+  uint8_t vitalLen[maxRegions];
+  uint8_t numInternalSpacesMax2[maxRegions];
+  bool containsOpp[maxRegions];
+  {
+    Bitboard nearPla = plaStones.dilate(stride);
+    Bitboard remaining = empty;
+    while(!remaining.isEmpty()) {
+      Loc head = remaining.lowest();
+      Bitboard seed;
+      seed.clear();
+      seed.set(head);
+      int regionIdx = numRegions++;
+      assert(numRegions <= maxRegions);
+      const Bitboard& region = regions[regionIdx] = Bitboard::floodFill(seed,emptyOrOpp,stride);
+      remaining = remaining.andNot(region);
+
+      numInternalSpacesMax2[regionIdx] = (uint8_t)std::min(2,region.andNot(nearPla).count());
+      containsOpp[regionIdx] = region.intersects(oppStones);
+
+      Bitboard mustBeAdjacent = isMultiStoneSuicideLegal ? region : (region & empty);
+      uint8_t len = 0;
+      for(int i = 0; i<4; i++) {
+        Loc adj = head + adj_offsets[i];
+        if(colors[adj] != pla)
+          continue;
+        int16_t chainIdx = chainIdxByLoc[adj];
+        bool alreadyPresent = false;
+        for(int j = 0; j<len; j++)
+          alreadyPresent |= (vitalFor[regionIdx*4+j] == chainIdx);
+        if(!alreadyPresent && mustBeAdjacent.isSubsetOf(chainAdj[chainIdx]))
+          vitalFor[regionIdx*4 + len++] = chainIdx;
+      }
+      vitalLen[regionIdx] = len;
+    }
+  }
+
+  //Benson iteration - repeatedly kill chains that don't have at least two vital regions that border only living chains
+  bool chainKilled[maxRegions];
+  bool bordersKilled[maxRegions];
+  int vitalCount[maxRegions];
+  std::fill(chainKilled,chainKilled+numChains,false);
+  std::fill(bordersKilled,bordersKilled+numRegions,false);
+  Bitboard killedStones;
+  killedStones.clear();
+  while(true) {
+    std::fill(vitalCount,vitalCount+numChains,0);
+    for(int i = 0; i<numRegions; i++) {
+      if(bordersKilled[i])
+        continue;
+      for(int j = 0; j<vitalLen[i]; j++)
+        vitalCount[vitalFor[i*4+j]] += 1;
+    }
+
+    bool killedAnything = false;
+    for(int i = 0; i<numChains; i++) {
+      if(!chainKilled[i] && vitalCount[i] < 2) {
+        chainKilled[i] = true;
+        killedAnything = true;
+        killedStones |= chains[i];
+      }
+    }
+    if(!killedAnything)
+      break;
+
+    Bitboard nearKilled = killedStones.dilate(stride);
+    for(int i = 0; i<numRegions; i++)
+      bordersKilled[i] = regions[i].intersects(nearKilled);
+  }
+
+  //Mark result with pass-alive groups
+  for(int i = 0; i<numChains; i++) {
+    if(!chainKilled[i])
+      chains[i].iterLocs([result,pla](Loc loc) { result[loc] = pla; });
+  }
+
+  //Mark result with territory, see calculateAreaForPlaReference for the logic here
+  for(int i = 0; i<numRegions; i++) {
+    bool shouldMark = numInternalSpacesMax2[i] <= 1 && atLeastOnePla && !bordersKilled[i];
+    shouldMark = shouldMark || (safeBigTerritories && atLeastOnePla && !containsOpp[i] && !bordersKilled[i]);
+    if(shouldMark)
+      regions[i].iterLocs([result,pla](Loc loc) { result[loc] = pla; });
+    else if(unsafeBigTerritories && atLeastOnePla && !containsOpp[i]) {
+      regions[i].iterLocs([result,pla](Loc loc) {
+        if(result[loc] == C_EMPTY)
+          result[loc] = pla;
+      });
+    }
+  }
+
+  delete[] bitboardBuf;
+}
@@ -12,6 +12,13 @@
 
 //TYPES AND CONSTANTS-----------------------------------------------------------------
 
+//Maximum board edge length supported, fixed at compile time. Building with a smaller value (e.g. -DCOMPILE_MAX_BOARD_LEN=9
+//for a 9x9-only build) sizes all the board arrays exactly for it, which shrinks Board, BoardHistory and the search
+//and featurization buffers and makes them cheaper to copy and more cache-friendly.
+#ifndef COMPILE_MAX_BOARD_LEN
+#define COMPILE_MAX_BOARD_LEN 19
+#endif
+
 struct Board;
 
 //Player
@@ -74,7 +81,7 @@ struct Board
 
   //Board parameters and Constants----------------------------------------
 
-  static const int MAX_LEN = 19;  //Maximum edge length allowed for the board
+  static const int MAX_LEN = COMPILE_MAX_BOARD_LEN;  //Maximum edge length allowed for the board
   static const int MAX_PLAY_SIZE = MAX_LEN * MAX_LEN;  //Maximum number of playable spaces
   static const int MAX_ARR_SIZE = (MAX_LEN+1)*(MAX_LEN+2)+1; //Maximum size of arrays needed
 
@@ -115,8 +122,9 @@ struct Board
     Loc& operator[](int);
     bool contains(Loc loc) const;
 
-    Loc list_[MAX_PLAY_SIZE];   //Locations in the list
-    int indices_[MAX_ARR_SIZE]; //Maps location to index in the list
+    //Copying only copies the first size_ entries of list_, the rest are undefined
+    Loc list_[MAX_PLAY_SIZE];     //Locations in the list
+    int16_t indices_[MAX_ARR_SIZE]; //Maps location to index in the list
     int size_;
   };
 
@@ -129,9 +137,11 @@ struct Board
   };
 
   //Constructors---------------------------------
-  Board();  //Create Board of size (19,19)
+  Board();  //Create Board of size (MAX_LEN,MAX_LEN)
   Board(int x, int y); //Create Fastboard of size (x,y)
+  //Copying only touches the part of the arrays used by the board's actual size
   Board(const Board& other);
+  Board& operator=(const Board& other);
 
   //Functions------------------------------------
 
@@ -206,6 +216,15 @@ struct Board
   //All other points are marked as C_EMPTY.
   //[result] must be a buffer of size MAX_ARR_SIZE and will get filled with the result
   void calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const;
+  //Same as calculateArea, but using the older and slower implementation that walks chains and regions location by location
+  //rather than using bitboards. For testing.
+  void calculateAreaReference(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const;
+
+  //Cheaply find an empty location that cannot be pass-alive area for either player in calculateArea without big territories:
+  //one that has no adjacent stones and has an adjacent empty location that also has no adjacent stones, so that both of them
+  //are interior points of whatever region they are in. Checks near hint first. Returns NULL_LOC if there is no such location,
+  //in which case the board may or may not be entirely pass-alive.
+  Loc findLocNeverPassAliveArea(Loc hint) const;
 
   //Run some basic sanity checks on the board state, throws an exception if not consistent, for testing/debugging
   void checkConsistency() const;
@@ -237,6 +256,7 @@ struct Board
 
   private:
   void init(int xS, int yS);
+  void copyArraysFrom(const Board& other);
   int countHeuristicConnectionLibertiesX2(Loc loc, Player pla) const;
   bool isLibertyOf(Loc loc, Loc head) const;
   void mergeChains(Loc loc1, Loc loc2);
@@ -256,6 +276,8 @@ struct Board
   bool hasLibertyGainingCaptures(Loc loc) const;
 
   void calculateAreaForPla(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const;
+  void calculateAreaForPlaReference(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const;
+  void markNonPassAliveStones(Color* result) const;
 
   //static void monteCarloOwner(Player player, Board* board, int mc_counts[]);
 };
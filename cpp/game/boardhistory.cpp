@@ -28,18 +28,21 @@ BoardHistory::BoardHistory()
    koHistoryLastClearedBeginningMoveIdx(0),
    initialBoard(),
    initialPla(P_BLACK),
-   recentBoards(),
-   currentRecentBoardIdx(0),
+   recentMoves(),
+   currentRecentMoveIdx(0),
+   numRecentMoves(0),
    consecutiveEndingPasses(0),
    hashesAfterBlackPass(),hashesAfterWhitePass(),
    encorePhase(0),koProhibitHash(),
    koCapturesInEncore(),
    whiteBonusScore(0),
    isGameFinished(false),winner(C_EMPTY),finalWhiteMinusBlackScore(0.0f),
-   isNoResult(false),isResignation(false)
+   isNoResult(false),isResignation(false),
+   notPassAliveWitness(Board::NULL_LOC)
 {
   std::fill(wasEverOccupiedOrPlayed, wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, false);
   std::fill(superKoBanned, superKoBanned+Board::MAX_ARR_SIZE, false);
+  std::fill(superKoBanKnown, superKoBanKnown+Board::MAX_ARR_SIZE, true);
   std::fill(blackKoProhibited, blackKoProhibited+Board::MAX_ARR_SIZE, false);
   std::fill(whiteKoProhibited, whiteKoProhibited+Board::MAX_ARR_SIZE, false);
   std::fill(secondEncoreStartColors, secondEncoreStartColors+Board::MAX_ARR_SIZE, C_EMPTY);
@@ -54,18 +57,21 @@ BoardHistory::BoardHistory(const Board& board, Player pla, const Rules& r, int e
    koHistoryLastClearedBeginningMoveIdx(0),
    initialBoard(),
    initialPla(),
-   recentBoards(),
-   currentRecentBoardIdx(0),
+   recentMoves(),
+   currentRecentMoveIdx(0),
+   numRecentMoves(0),
    consecutiveEndingPasses(0),
    hashesAfterBlackPass(),hashesAfterWhitePass(),
    encorePhase(0),koProhibitHash(),
    koCapturesInEncore(),
    whiteBonusScore(0),
    isGameFinished(false),winner(C_EMPTY),finalWhiteMinusBlackScore(0.0f),
-   isNoResult(false),isResignation(false)
+   isNoResult(false),isResignation(false),
+   notPassAliveWitness(Board::NULL_LOC)
 {
   std::fill(wasEverOccupiedOrPlayed, wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, false);
   std::fill(superKoBanned, superKoBanned+Board::MAX_ARR_SIZE, false);
+  std::fill(superKoBanKnown, superKoBanKnown+Board::MAX_ARR_SIZE, true);
   std::fill(blackKoProhibited, blackKoProhibited+Board::MAX_ARR_SIZE, false);
   std::fill(whiteKoProhibited, whiteKoProhibited+Board::MAX_ARR_SIZE, false);
   std::fill(secondEncoreStartColors, secondEncoreStartColors+Board::MAX_ARR_SIZE, C_EMPTY);
@@ -79,18 +85,21 @@ BoardHistory::BoardHistory(const BoardHistory& other)
    koHistoryLastClearedBeginningMoveIdx(other.koHistoryLastClearedBeginningMoveIdx),
    initialBoard(other.initialBoard),
    initialPla(other.initialPla),
-   currentRecentBoardIdx(other.currentRecentBoardIdx),
+   currentRecentMoveIdx(other.currentRecentMoveIdx),
+   numRecentMoves(other.numRecentMoves),
    consecutiveEndingPasses(other.consecutiveEndingPasses),
    hashesAfterBlackPass(other.hashesAfterBlackPass),hashesAfterWhitePass(other.hashesAfterWhitePass),
    encorePhase(other.encorePhase),koProhibitHash(other.koProhibitHash),
    koCapturesInEncore(other.koCapturesInEncore),
    whiteBonusScore(other.whiteBonusScore),
    isGameFinished(other.isGameFinished),winner(other.winner),finalWhiteMinusBlackScore(other.finalWhiteMinusBlackScore),
-   isNoResult(other.isNoResult),isResignation(other.isResignation)
+   isNoResult(other.isNoResult),isResignation(other.isResignation),
+   notPassAliveWitness(other.notPassAliveWitness)
 {
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_BOARDS-1, recentMoves);
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
+  std::copy(other.superKoBanKnown, other.superKoBanKnown+Board::MAX_ARR_SIZE, superKoBanKnown);
   std::copy(other.blackKoProhibited, other.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
   std::copy(other.whiteKoProhibited, other.whiteKoProhibited+Board::MAX_ARR_SIZE, whiteKoProhibited);
   std::copy(other.secondEncoreStartColors, other.secondEncoreStartColors+Board::MAX_ARR_SIZE, secondEncoreStartColors);
@@ -107,10 +116,12 @@ BoardHistory& BoardHistory::operator=(const BoardHistory& other)
   koHistoryLastClearedBeginningMoveIdx = other.koHistoryLastClearedBeginningMoveIdx;
   initialBoard = other.initialBoard;
   initialPla = other.initialPla;
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
-  currentRecentBoardIdx = other.currentRecentBoardIdx;
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_BOARDS-1, recentMoves);
+  currentRecentMoveIdx = other.currentRecentMoveIdx;
+  numRecentMoves = other.numRecentMoves;
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
+  std::copy(other.superKoBanKnown, other.superKoBanKnown+Board::MAX_ARR_SIZE, superKoBanKnown);
   consecutiveEndingPasses = other.consecutiveEndingPasses;
   hashesAfterBlackPass = other.hashesAfterBlackPass;
   hashesAfterWhitePass = other.hashesAfterWhitePass;
@@ -126,6 +137,7 @@ BoardHistory& BoardHistory::operator=(const BoardHistory& other)
   finalWhiteMinusBlackScore = other.finalWhiteMinusBlackScore;
   isNoResult = other.isNoResult;
   isResignation = other.isResignation;
+  notPassAliveWitness = other.notPassAliveWitness;
 
   return *this;
 }
@@ -136,18 +148,21 @@ BoardHistory::BoardHistory(BoardHistory&& other) noexcept
   koHistoryLastClearedBeginningMoveIdx(other.koHistoryLastClearedBeginningMoveIdx),
   initialBoard(other.initialBoard),
   initialPla(other.initialPla),
-  currentRecentBoardIdx(other.currentRecentBoardIdx),
+  currentRecentMoveIdx(other.currentRecentMoveIdx),
+  numRecentMoves(other.numRecentMoves),
   consecutiveEndingPasses(other.consecutiveEndingPasses),
   hashesAfterBlackPass(std::move(other.hashesAfterBlackPass)),hashesAfterWhitePass(std::move(other.hashesAfterWhitePass)),
   encorePhase(other.encorePhase),koProhibitHash(other.koProhibitHash),
   koCapturesInEncore(std::move(other.koCapturesInEncore)),
   whiteBonusScore(other.whiteBonusScore),
   isGameFinished(other.isGameFinished),winner(other.winner),finalWhiteMinusBlackScore(other.finalWhiteMinusBlackScore),
-  isNoResult(other.isNoResult),isResignation(other.isResignation)
+  isNoResult(other.isNoResult),isResignation(other.isResignation),
+  notPassAliveWitness(other.notPassAliveWitness)
 {
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_BOARDS-1, recentMoves);
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
+  std::copy(other.superKoBanKnown, other.superKoBanKnown+Board::MAX_ARR_SIZE, superKoBanKnown);
   std::copy(other.blackKoProhibited, other.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
   std::copy(other.whiteKoProhibited, other.whiteKoProhibited+Board::MAX_ARR_SIZE, whiteKoProhibited);
   std::copy(other.secondEncoreStartColors, other.secondEncoreStartColors+Board::MAX_ARR_SIZE, secondEncoreStartColors);
@@ -161,10 +176,12 @@ BoardHistory& BoardHistory::operator=(BoardHistory&& other) noexcept
   koHistoryLastClearedBeginningMoveIdx = other.koHistoryLastClearedBeginningMoveIdx;
   initialBoard = other.initialBoard;
   initialPla = other.initialPla;
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
-  currentRecentBoardIdx = other.currentRecentBoardIdx;
+  std::copy(other.recentMoves, other.recentMoves+NUM_RECENT_BOARDS-1, recentMoves);
+  currentRecentMoveIdx = other.currentRecentMoveIdx;
+  numRecentMoves = other.numRecentMoves;
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
+  std::copy(other.superKoBanKnown, other.superKoBanKnown+Board::MAX_ARR_SIZE, superKoBanKnown);
   consecutiveEndingPasses = other.consecutiveEndingPasses;
   hashesAfterBlackPass = std::move(other.hashesAfterBlackPass);
   hashesAfterWhitePass = std::move(other.hashesAfterWhitePass);
@@ -180,6 +197,7 @@ BoardHistory& BoardHistory::operator=(BoardHistory&& other) noexcept
   finalWhiteMinusBlackScore = other.finalWhiteMinusBlackScore;
   isNoResult = other.isNoResult;
   isResignation = other.isResignation;
+  notPassAliveWitness = other.notPassAliveWitness;
 
   return *this;
 }
@@ -192,12 +210,11 @@ void BoardHistory::clear(const Board& board, Player pla, const Rules& r, int ePh
 
   initialBoard = board;
   initialPla = pla;
-  
+
   //This makes it so that if we ask for recent boards with a lookback beyond what we have a history for,
   //we simply return copies of the starting board.
-  for(int i = 0; i<NUM_RECENT_BOARDS; i++)
-    recentBoards[i] = board;
-  currentRecentBoardIdx = 0;
+  currentRecentMoveIdx = 0;
+  numRecentMoves = 0;
 
   for(int y = 0; y<board.y_size; y++) {
     for(int x = 0; x<board.x_size; x++) {
@@ -207,6 +224,7 @@ void BoardHistory::clear(const Board& board, Player pla, const Rules& r, int ePh
   }
 
   std::fill(superKoBanned, superKoBanned+Board::MAX_ARR_SIZE, false);
+  std::fill(superKoBanKnown, superKoBanKnown+Board::MAX_ARR_SIZE, true);
   consecutiveEndingPasses = 0;
   hashesAfterBlackPass.clear();
   hashesAfterWhitePass.clear();
@@ -220,6 +238,7 @@ void BoardHistory::clear(const Board& board, Player pla, const Rules& r, int ePh
   finalWhiteMinusBlackScore = 0.0f;
   isNoResult = false;
   isResignation = false;
+  notPassAliveWitness = Board::NULL_LOC;
 
   if(rules.scoringRule == Rules::SCORING_TERRITORY) {
     //Chill 1 point for every move played
@@ -267,10 +286,16 @@ void BoardHistory::printDebugInfo(ostream& out, const Board& board) const {
 }
 
 
-const Board& BoardHistory::getRecentBoard(int numMovesAgo) const {
+Board BoardHistory::getRecentBoard(const Board& board, int numMovesAgo) const {
   assert(numMovesAgo >= 0 && numMovesAgo < NUM_RECENT_BOARDS);
-  int idx = (currentRecentBoardIdx - numMovesAgo + NUM_RECENT_BOARDS) % NUM_RECENT_BOARDS;
-  return recentBoards[idx];
+  Board recentBoard = board;
+  int numToUndo = std::min(numMovesAgo,numRecentMoves);
+  int idx = currentRecentMoveIdx;
+  for(int i = 0; i<numToUndo; i++) {
+    recentBoard.undo(recentMoves[idx]);
+    idx = (idx + NUM_RECENT_BOARDS-2) % (NUM_RECENT_BOARDS-1);
+  }
+  return recentBoard;
 }
 
 
@@ -294,7 +319,8 @@ bool BoardHistory::koHashOccursInHistory(Hash128 koHash, const KoHashTable* root
      koHistoryLastClearedBeginningMoveIdx == rootKoHashTable->koHistoryLastClearedBeginningMoveIdx
   ) {
     size_t tableSize = rootKoHashTable->size();
-    assert(tableSize < koHashHistory.size());
+    //Equal when this is the root history itself
+    assert(tableSize <= koHashHistory.size());
     if(rootKoHashTable->containsHash(koHash))
       return true;
     start = tableSize;
@@ -430,6 +456,12 @@ void BoardHistory::endAndScoreGameNow(const Board& board) {
 
 
 void BoardHistory::endGameIfAllPassAlive(const Board& board) {
+  //Fast path - almost always there is some location that can't be pass-alive area, and it's usually the same one as last time
+  //or near it, so that this is near-constant time per move for most of a game.
+  notPassAliveWitness = board.findLocNeverPassAliveArea(notPassAliveWitness);
+  if(notPassAliveWitness != Board::NULL_LOC)
+    return;
+
   int boardScore = 0;
   bool nonPassAliveStones = false;
   bool safeBigTerritories = false;
@@ -487,6 +519,32 @@ void BoardHistory::setKoProhibited(Player pla, Loc loc, bool b) {
     assert(false);
 }
 
+//Test whether the next player playing at loc would repeat a position in the history.
+//Only used in the main phase with non-simple ko rules, other cases are computed eagerly in makeBoardMoveAssumeLegal.
+bool BoardHistory::computeSuperKoBanned(const Board& board, Loc loc, const KoHashTable* rootKoHashTable) const {
+  assert(moveHistory.size() > 0);
+  Player nextPla = getOpp(moveHistory[moveHistory.size()-1].pla);
+  //Cannot be superko banned if it's not a pseudolegal move in the first place, or we would already ban the move under simple ko.
+  if(board.colors[loc] != C_EMPTY || board.isIllegalSuicide(loc,nextPla,rules.multiStoneSuicideLegal) || loc == board.ko_loc)
+    return false;
+  //Also cannot be superko banned if a stone was never there or played there before AND the move is not suicide, because that means
+  //the move results in a new stone there and if no stone was ever there in the past the it must be a new position.
+  if(!wasEverOccupiedOrPlayed[loc] && !board.isSuicide(loc,nextPla))
+    return false;
+  Hash128 posHashAfterMove = board.getPosHashAfterMove(loc,nextPla);
+  Hash128 koHashAfterMove = getKoHashAfterMoveNonEncore(rules, posHashAfterMove, getOpp(nextPla));
+  return koHashOccursInHistory(koHashAfterMove,rootKoHashTable);
+}
+
+void BoardHistory::computeAllSuperKoBans(const Board& board, const KoHashTable* rootKoHashTable) const {
+  for(int loc = 0; loc<Board::MAX_ARR_SIZE; loc++) {
+    if(!superKoBanKnown[loc]) {
+      superKoBanned[loc] = computeSuperKoBanned(board,(Loc)loc,rootKoHashTable);
+      superKoBanKnown[loc] = true;
+    }
+  }
+}
+
 bool BoardHistory::isLegal(const Board& board, Loc moveLoc, Player movePla) const {
   //Moves in the encore on ko-prohibited spots are treated as pass-for-ko, so they are legal
   //They might also be simply not even ko-moves, if surrounding moves have caused the move on the
@@ -500,7 +558,7 @@ bool BoardHistory::isLegal(const Board& board, Loc moveLoc, Player movePla) cons
 
   if(!board.isLegal(moveLoc,movePla,rules.multiStoneSuicideLegal))
     return false;
-  if(superKoBanned[moveLoc])
+  if(isSuperKoBanned(board,moveLoc))
     return false;
 
   return true;
@@ -583,9 +641,19 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
       board.clearSimpleKoLoc();
     }
   }
+  //Record enough to undo this move, for reconstructing recent boards
+  Board::MoveRecord moveRecord;
+  moveRecord.pla = movePla;
+  moveRecord.loc = Board::PASS_LOC;
+  moveRecord.ko_loc = koLocBeforeMove;
+  moveRecord.capDirs = 0;
+
   //Otherwise handle regular moves
   if(!wasPassForKo) {
-    board.playMoveAssumeLegal(moveLoc,movePla);
+    if(moveLoc == Board::PASS_LOC)
+      board.playMoveAssumeLegal(moveLoc,movePla);
+    else
+      moveRecord = board.playMoveRecorded(moveLoc,movePla);
 
     if(encorePhase > 0) {
       //Update ko prohibitions and record that this was a ko capture
@@ -613,9 +681,11 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
     }
   }
 
-  //Update recent boards
-  currentRecentBoardIdx = (currentRecentBoardIdx + 1) % NUM_RECENT_BOARDS;
-  recentBoards[currentRecentBoardIdx] = board;
+  //Update recent moves
+  currentRecentMoveIdx = (currentRecentMoveIdx + 1) % (NUM_RECENT_BOARDS-1);
+  recentMoves[currentRecentMoveIdx] = moveRecord;
+  if(numRecentMoves < NUM_RECENT_BOARDS-1)
+    numRecentMoves++;
 
   //Passes clear ko history in the main phase with spight ko rules and in the encore
   //This lifts bans in spight ko rules and lifts 3-fold-repetition checking in the encore for no-resultifying infinite cycles
@@ -633,27 +703,11 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
   if(moveLoc != Board::PASS_LOC)
     wasEverOccupiedOrPlayed[moveLoc] = true;
 
-  //Mark all locations that are superko-illegal for the next player, by iterating and testing each point.
+  //Superko-illegal locations for the next player are determined lazily in isSuperKoBanned.
   Player nextPla = getOpp(movePla);
   if(encorePhase <= 0 && rules.koRule != Rules::KO_SIMPLE) {
     assert(koProhibitHash == Hash128());
-    for(int y = 0; y<board.y_size; y++) {
-      for(int x = 0; x<board.x_size; x++) {
-        Loc loc = Location::getLoc(x,y,board.x_size);
-        //Cannot be superko banned if it's not a pseudolegal move in the first place, or we would already ban the move under simple ko.
-        if(board.colors[loc] != C_EMPTY || board.isIllegalSuicide(loc,nextPla,rules.multiStoneSuicideLegal) || loc == board.ko_loc)
-          superKoBanned[loc] = false;
-        //Also cannot be superko banned if a stone was never there or played there before AND the move is not suicide, because that means
-        //the move results in a new stone there and if no stone was ever there in the past the it must be a new position.
-        else if(!wasEverOccupiedOrPlayed[loc] && !board.isSuicide(loc,nextPla))
-          superKoBanned[loc] = false;
-        else {
-          Hash128 posHashAfterMove = board.getPosHashAfterMove(loc,nextPla);
-          Hash128 koHashAfterMove = getKoHashAfterMoveNonEncore(rules, posHashAfterMove, getOpp(nextPla));
-          superKoBanned[loc] = koHashOccursInHistory(koHashAfterMove,rootKoHashTable);
-        }
-      }
-    }
+    std::fill(superKoBanKnown, superKoBanKnown+Board::MAX_ARR_SIZE, false);
   }
   else if(encorePhase > 0) {
     //During the encore, only one capture of each ko in a given position by a given player
@@ -706,6 +760,7 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
           std::copy(board.colors, board.colors+Board::MAX_ARR_SIZE, secondEncoreStartColors);
 
         std::fill(superKoBanned, superKoBanned+Board::MAX_ARR_SIZE, false);
+        std::fill(superKoBanKnown, superKoBanKnown+Board::MAX_ARR_SIZE, true);
         consecutiveEndingPasses = 0;
         hashesAfterBlackPass.clear();
         hashesAfterWhitePass.clear();
@@ -734,69 +789,113 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
 }
 
 
+const int32_t KoHashTable::EMPTY_SLOT;
+const size_t KoHashTable::MIN_TABLE_SIZE;
+
 KoHashTable::KoHashTable()
-  :koHashHistorySortedByLowBits(),
-   koHistoryLastClearedBeginningMoveIdx(0)
-{
-  idxTable = new uint16_t[TABLE_SIZE];
-}
-KoHashTable::~KoHashTable() {
-  delete[] idxTable;
-}
+  :koHashHistoryInOrder(),
+   koHistoryLastClearedBeginningMoveIdx(0),
+   slotHashes(MIN_TABLE_SIZE),
+   slotCounts(MIN_TABLE_SIZE,EMPTY_SLOT),
+   numSlotsUsed(0)
+{}
+KoHashTable::~KoHashTable()
+{}
 
 size_t KoHashTable::size() const {
-  return koHashHistorySortedByLowBits.size();
+  return koHashHistoryInOrder.size();
 }
 
 void KoHashTable::recompute(const BoardHistory& history) {
-  koHashHistorySortedByLowBits = history.koHashHistory;
-  koHistoryLastClearedBeginningMoveIdx = history.koHistoryLastClearedBeginningMoveIdx;
+  const vector<Hash128>& koHashHistory = history.koHashHistory;
+  if(koHistoryLastClearedBeginningMoveIdx != history.koHistoryLastClearedBeginningMoveIdx) {
+    truncate(0);
+    koHistoryLastClearedBeginningMoveIdx = history.koHistoryLastClearedBeginningMoveIdx;
+  }
 
-  auto cmpFirstByLowBits = [](const Hash128& a, const Hash128& b) {
-    if((a.hash0 & TABLE_MASK) < (b.hash0 & TABLE_MASK))
-      return true;
-    if((a.hash0 & TABLE_MASK) > (b.hash0 & TABLE_MASK))
-      return false;
-    return a < b;
-  };
-
-  std::sort(koHashHistorySortedByLowBits.begin(),koHashHistorySortedByLowBits.end(),cmpFirstByLowBits);
-
-  //Just in case, since we're using 16 bits for indices.
-  assert(koHashHistorySortedByLowBits.size() < 30000);
-  uint16_t size = (uint16_t)koHashHistorySortedByLowBits.size();
-
-  uint16_t idx = 0;
-  for(uint32_t bits = 0; bits<TABLE_SIZE; bits++) {
-    while(idx < size && ((koHashHistorySortedByLowBits[idx].hash0 & TABLE_MASK) < bits))
-      idx++;
-    idxTable[bits] = idx;
+  //Find how much of the table still agrees with the history. Usually the history differs only by moves made or
+  //undone at the end, so this is just a cheap linear comparison and we touch only the hashes at the end.
+  size_t commonSize = std::min(koHashHistoryInOrder.size(), koHashHistory.size());
+  for(size_t i = 0; i<commonSize; i++) {
+    if(koHashHistoryInOrder[i] != koHashHistory[i]) {
+      commonSize = i;
+      break;
+    }
+  }
+  truncate(commonSize);
+  for(size_t i = commonSize; i<koHashHistory.size(); i++)
+    append(koHashHistory[i]);
+}
+
+//Returns the slot containing hash if present (possibly with count 0), else the empty slot where it would go.
+size_t KoHashTable::findSlot(Hash128 hash) const {
+  size_t mask = slotCounts.size()-1;
+  size_t slot = (size_t)hash.hash0 & mask;
+  while(slotCounts[slot] != EMPTY_SLOT && slotHashes[slot] != hash)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+void KoHashTable::append(Hash128 hash) {
+  koHashHistoryInOrder.push_back(hash);
+  size_t slot = findSlot(hash);
+  if(slotCounts[slot] == EMPTY_SLOT) {
+    slotHashes[slot] = hash;
+    slotCounts[slot] = 0;
+    numSlotsUsed++;
+  }
+  slotCounts[slot]++;
+  //Keep the load factor at most 1/2 so that probe sequences stay short
+  if(numSlotsUsed * 2 > slotCounts.size())
+    rehash();
+}
+
+void KoHashTable::truncate(size_t newSize) {
+  assert(newSize <= koHashHistoryInOrder.size());
+  while(koHashHistoryInOrder.size() > newSize) {
+    size_t slot = findSlot(koHashHistoryInOrder.back());
+    assert(slotCounts[slot] > 0);
+    slotCounts[slot]--;
+    koHashHistoryInOrder.pop_back();
   }
 }
 
-bool KoHashTable::containsHash(Hash128 hash) const {
-  uint32_t bits = hash.hash0 & TABLE_MASK;
-  size_t idx = idxTable[bits];
-  size_t size = koHashHistorySortedByLowBits.size();
-  while(idx < size && ((koHashHistorySortedByLowBits[idx].hash0 & TABLE_MASK) == bits)) {
-    if(hash == koHashHistorySortedByLowBits[idx])
-      return true;
-    idx++;
+//Rebuild the table with only the hashes that are still present, growing it if needed.
+void KoHashTable::rehash() {
+  vector<Hash128> oldHashes;
+  vector<int32_t> oldCounts;
+  std::swap(oldHashes,slotHashes);
+  std::swap(oldCounts,slotCounts);
+
+  size_t numPresent = 0;
+  for(size_t i = 0; i<oldCounts.size(); i++)
+    if(oldCounts[i] > 0)
+      numPresent++;
+  size_t tableSize = MIN_TABLE_SIZE;
+  while(tableSize < numPresent * 4)
+    tableSize *= 2;
+
+  slotHashes.assign(tableSize,Hash128());
+  slotCounts.assign(tableSize,EMPTY_SLOT);
+  numSlotsUsed = 0;
+  for(size_t i = 0; i<oldCounts.size(); i++) {
+    if(oldCounts[i] > 0) {
+      size_t slot = findSlot(oldHashes[i]);
+      slotHashes[slot] = oldHashes[i];
+      slotCounts[slot] = oldCounts[i];
+      numSlotsUsed++;
+    }
   }
-  return false;
 }
 
-int KoHashTable::numberOfOccurrencesOfHash(Hash128 hash) const {
-  uint32_t bits = hash.hash0 & TABLE_MASK;
-  size_t idx = idxTable[bits];
-  size_t size = koHashHistorySortedByLowBits.size();
-  int count = 0;
-  while(idx < size && ((koHashHistorySortedByLowBits[idx].hash0 & TABLE_MASK) == bits)) {
-    if(hash == koHashHistorySortedByLowBits[idx])
-      count++;
-    idx++;
-  }
-  return count;
+bool KoHashTable::containsHash(Hash128 hash) const {
+  return numberOfOccurrencesOfHash(hash) > 0;
 }
 
+int KoHashTable::numberOfOccurrencesOfHash(Hash128 hash) const {
+  size_t slot = findSlot(hash);
+  if(slotCounts[slot] == EMPTY_SLOT)
+    return 0;
+  return slotCounts[slot];
+}
 
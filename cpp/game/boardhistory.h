@@ -23,15 +23,21 @@ struct BoardHistory {
   Board initialBoard;
   Player initialPla;
 
+  //Recent boards are not stored, but reconstructed on demand by undoing recent moves from the current board.
+  //This is a ring buffer of the records of the last NUM_RECENT_BOARDS-1 moves, of which numRecentMoves are valid.
   static const int NUM_RECENT_BOARDS = 6;
-  Board recentBoards[NUM_RECENT_BOARDS];
-  int currentRecentBoardIdx;
+  Board::MoveRecord recentMoves[NUM_RECENT_BOARDS-1];
+  int currentRecentMoveIdx;
+  int numRecentMoves;
 
   //Did this board location ever have a stone there before, or was it ever played?
   //(Also includes locations of suicides)
   bool wasEverOccupiedOrPlayed[Board::MAX_ARR_SIZE];
-  //Locations where the next player is not allowed to play due to superko
-  bool superKoBanned[Board::MAX_ARR_SIZE];
+  //Locations where the next player is not allowed to play due to superko.
+  //In the main phase with non-simple ko rules, this is computed lazily per location on first query since only a few
+  //locations are usually ever queried, and is only valid where superKoBanKnown is true. Use isSuperKoBanned to query it.
+  mutable bool superKoBanned[Board::MAX_ARR_SIZE];
+  mutable bool superKoBanKnown[Board::MAX_ARR_SIZE];
 
   //Number of consecutive passes made that count for ending the game or phase
   int consecutiveEndingPasses;
@@ -67,6 +73,10 @@ struct BoardHistory {
   //True if this game is supposed to be ended but it was by resignation rather than an actual end position
   bool isResignation;
 
+  //Last location found by endGameIfAllPassAlive that showed the board was not all pass-alive, or NULL_LOC.
+  //Only a hint for where to look first next time, so it doesn't matter if it's stale.
+  Loc notPassAliveWitness;
+
   BoardHistory();
   ~BoardHistory();
 
@@ -87,11 +97,28 @@ struct BoardHistory {
   float currentSelfKomi(Player pla, double drawEquivalentWinsForWhite) const;
 
   //Returns a reference a recent board state, where 0 is the current board, 1 is 1 move ago, etc.
-  //Requires that numMovesAgo < NUM_RECENT_BOARDS
-  const Board& getRecentBoard(int numMovesAgo) const;
+  //Reconstruct the board as of numMovesAgo moves ago, where board is the current board.
+  //Requires that numMovesAgo < NUM_RECENT_BOARDS. If fewer moves than that were made since the last clear, returns
+  //the board as of the clear.
+  Board getRecentBoard(const Board& board, int numMovesAgo) const;
 
   //Check if a move on the board is legal, taking into account the full game state and superko
   bool isLegal(const Board& board, Loc moveLoc, Player movePla) const;
+  //Check if the next player is banned from playing at loc due to superko, or in the encore due to a repeated ko capture.
+  //board must be the current board of this history.
+  //Lazily computes and caches the result, so concurrent calls on the same history are not threadsafe unless
+  //computeAllSuperKoBans was called first, after which all queries are read-only until the next move.
+  //Computing lazily here searches the whole history, so callers that have a rootKoHashTable should fill in the bans
+  //with computeAllSuperKoBans first.
+  bool isSuperKoBanned(const Board& board, Loc loc) const {
+    if(!superKoBanKnown[loc]) {
+      superKoBanned[loc] = computeSuperKoBanned(board,loc,NULL);
+      superKoBanKnown[loc] = true;
+    }
+    return superKoBanned[loc];
+  }
+  //rootKoHashTable is optional and if provided will speed up the superko searches
+  void computeAllSuperKoBans(const Board& board, const KoHashTable* rootKoHashTable) const;
   //Check if passing right now would end the current phase of play
   bool passWouldEndPhase(const Board& board, Player movePla) const;
 
@@ -101,7 +128,9 @@ struct BoardHistory {
   //This allows for robustness when this code is being used for analysis or with external data sources.
   void makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable);
 
-  //Slightly expensive, check if the entire game is all pass-alive-territory, and if so, declare the game finished
+  //Check if the entire game is all pass-alive-territory, and if so, declare the game finished.
+  //Usually cheap, since the board is usually quickly and incrementally shown not to be all pass-alive, but expensive when
+  //close to that, since it falls back to the full area calculation.
   void endGameIfAllPassAlive(const Board& board);
   //Score the board as-is. If the game is already finished, and is NOT a no-result, then this should be idempotent.
   void endAndScoreGameNow(const Board& board);
@@ -112,6 +141,7 @@ struct BoardHistory {
   void printDebugInfo(ostream& out, const Board& board) const;
 
 private:
+  bool computeSuperKoBanned(const Board& board, Loc loc, const KoHashTable* rootKoHashTable) const;
   bool koHashOccursInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const;
   int numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const;
   void setKoProhibited(Player pla, Loc loc, bool b);
@@ -121,13 +151,21 @@ private:
   bool wouldBeSimpleSpightOrEncoreEndingPass(Loc moveLoc, Player movePla, Hash128 koHashAfterMove) const;
 };
 
+//Multiset of the ko hashes of a history, as an open addressing hash table with linear probing.
+//Supports appending and truncating, so that following a history as moves are made or undone is cheap.
 struct KoHashTable {
-  uint16_t* idxTable;
-  vector<Hash128> koHashHistorySortedByLowBits;
+  //The ko hashes currently in the table, in the order of the history they came from
+  vector<Hash128> koHashHistoryInOrder;
   int koHistoryLastClearedBeginningMoveIdx;
 
-  static const int TABLE_SIZE = 1 << 10;
-  static const uint64_t TABLE_MASK = TABLE_SIZE-1;
+  //Slots of the table. A count of EMPTY_SLOT means the slot was never used, a count of 0 means the hash was
+  //present in the past but got truncated away, and the slot is kept so that probing sequences remain valid.
+  vector<Hash128> slotHashes;
+  vector<int32_t> slotCounts;
+  size_t numSlotsUsed;
+
+  static const int32_t EMPTY_SLOT = -1;
+  static const size_t MIN_TABLE_SIZE = 1 << 10;
 
   KoHashTable();
   ~KoHashTable();
@@ -137,10 +175,18 @@ struct KoHashTable {
 
   size_t size() const;
 
+  //Make the table contain exactly the ko hashes of history. Incremental - only the hashes that differ from the
+  //ones currently in the table are removed or added.
   void recompute(const BoardHistory& history);
+  void append(Hash128 hash);
+  void truncate(size_t newSize);
+
   bool containsHash(Hash128 hash) const;
   int numberOfOccurrencesOfHash(Hash128 hash) const;
 
+ private:
+  size_t findSlot(Hash128 hash) const;
+  void rehash();
 };
 
 
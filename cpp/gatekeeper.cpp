@@ -125,7 +125,7 @@ namespace {
         }
         else {
           BoardHistory hist = data->endHist;
-          Board endBoard = hist.getRecentBoard(0);
+          Board endBoard = data->endBoard;
           //Force game end just in caseif we crossed a move limit
           if(!hist.isGameFinished)
             hist.endAndScoreGameNow(endBoard);
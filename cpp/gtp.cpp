@@ -150,6 +150,8 @@ int MainCmds::gtp(int argc, const char* const* argv) {
     "time_left",
     "final_score",
     "final_status_list",
+    "save_tree",
+    "load_tree",
   };
 
   logger.write("Beginning main protocol loop");
@@ -266,7 +268,7 @@ int MainCmds::gtp(int argc, const char* const* argv) {
         responseIsError = true;
         response = "Expected single int argument for boardsize but got '" + Global::concat(pieces," ") + "'";
       }
-      else if(newBSize < 9 || newBSize > 19) {
+      else if(newBSize < 9 || newBSize > Board::MAX_LEN) {
         responseIsError = true;
         response = "unacceptable size";
       }
@@ -597,6 +599,14 @@ int MainCmds::gtp(int argc, const char* const* argv) {
           sout << "\n";
           sout << "Time taken: " << timer.getSeconds() << "\n";
           sout << "Root visits: " << search->numRootVisits() << "\n";
+          {
+            int64_t numTreeNodes;
+            int64_t numTreeBytes;
+            search->getTreeMemoryUsage(numTreeNodes,numTreeBytes);
+            sout << "Tree nodes: " << numTreeNodes << " bytes: " << numTreeBytes << "\n";
+          }
+          if(search->lastSearchEarlyStopSavedPlayouts > 0)
+            sout << "Stopped early, leader unassailable, saved playouts: " << search->lastSearchEarlyStopSavedPlayouts << "\n";
           sout << "NN rows: " << nnEval->numRowsProcessed() << endl;
           sout << "NN batches: " << nnEval->numBatchesProcessed() << endl;
           sout << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
@@ -623,6 +633,44 @@ int MainCmds::gtp(int argc, const char* const* argv) {
       response = Global::trim(sout.str());
     }
 
+    else if(command == "save_tree") {
+      if(pieces.size() < 1) {
+        responseIsError = true;
+        response = "Expected file name argument for save_tree but got '" + Global::concat(pieces," ") + "'";
+      }
+      else {
+        string fileName = Global::concat(pieces," ");
+        try {
+          bot->saveTree(fileName);
+        }
+        catch(const StringError& e) {
+          responseIsError = true;
+          response = e.what();
+        }
+      }
+    }
+
+    else if(command == "load_tree") {
+      if(pieces.size() < 1) {
+        responseIsError = true;
+        response = "Expected file name argument for load_tree but got '" + Global::concat(pieces," ") + "'";
+      }
+      else {
+        string fileName = Global::concat(pieces," ");
+        try {
+          if(!bot->loadTree(fileName)) {
+            responseIsError = true;
+            response = "Search tree in " + fileName + " does not match the current position";
+          }
+        }
+        catch(const StringError& e) {
+          responseIsError = true;
+          response = e.what();
+        }
+        maybeStartPondering = true;
+      }
+    }
+
     else if(command == "place_free_handicap") {
       int n;
       if(pieces.size() != 1) {
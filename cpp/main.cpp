@@ -17,7 +17,10 @@ static void printHelp() {
   cout << "runsearchtestsv3" << endl;
   cout << "runselfplayinittests" << endl;
   cout << "lzcost" << endl;
+  cout << "benchboard" << endl;
+  cout << "shuffle" << endl;
   cout << "writeSearchValueTimeseries" << endl;
+  cout << "exportgamerecords" << endl;
   cout << "sandbox" << endl;
   cout << "version" << endl;
 }
@@ -57,8 +60,14 @@ int main(int argc, const char* argv[]) {
     return MainCmds::runselfplayinittests(argc-1,&argv[1]);
   else if(cmdArg == "lzcost")
     return MainCmds::lzcost(argc-1,&argv[1]);
+  else if(cmdArg == "benchboard")
+    return MainCmds::benchboard(argc-1,&argv[1]);
+  else if(cmdArg == "shuffle")
+    return MainCmds::shuffle(argc-1,&argv[1]);
   else if(cmdArg == "writeSearchValueTimeseries")
     return MainCmds::writeSearchValueTimeseries(argc-1,&argv[1]);
+  else if(cmdArg == "exportgamerecords")
+    return MainCmds::exportgamerecords(argc-1,&argv[1]);
   else if(cmdArg == "sandbox")
     return MainCmds::sandbox();
   else if(cmdArg == "version") {
@@ -15,7 +15,10 @@ namespace MainCmds {
   int runselfplayinittests(int argc, const char* const* argv);
 
   int lzcost(int argc, const char* const* argv);
+  int benchboard(int argc, const char* const* argv);
+  int shuffle(int argc, const char* const* argv);
   int writeSearchValueTimeseries(int argc, const char* const* argv);
+  int exportgamerecords(int argc, const char* const* argv);
 
   int sandbox();
 }
@@ -3,6 +3,7 @@
 #include "core/timer.h"
 #include "core/test.h"
 #include "dataio/sgf.h"
+#include "dataio/gamerecord.h"
 #include "search/asyncbot.h"
 #include "program/setup.h"
 #include "main.h"
@@ -274,3 +275,58 @@ int MainCmds::writeSearchValueTimeseries(int argc, const char* const* argv) {
 
   return 0;
 }
+
+int MainCmds::exportgamerecords(int argc, const char* const* argv) {
+  Board::initHash();
+  ScoreValue::initTables();
+
+  vector<string> recordFiles;
+  string outputFile;
+  try {
+    TCLAP::CmdLine cmd("Export binary game records written by selfplay as sgfs, one per line", ' ', "1.0",true);
+    TCLAP::MultiArg<string> recordFileArg("","record-file","Game record file to export",true,"FILE");
+    TCLAP::ValueArg<string> outputFileArg("","output-sgfs","Output .sgfs file",true,string(),"FILE");
+    cmd.add(recordFileArg);
+    cmd.add(outputFileArg);
+    cmd.parse(argc,argv);
+    recordFiles = recordFileArg.getValue();
+    outputFile = outputFileArg.getValue();
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  ofstream out(outputFile);
+  int64_t numExported = 0;
+  for(size_t i = 0; i<recordFiles.size(); i++) {
+    GameRecordReader* reader;
+    try {
+      reader = new GameRecordReader(recordFiles[i]);
+    }
+    catch(const IOError& e) {
+      cout << "Skipping file: " << e.message << endl;
+      continue;
+    }
+    if(!reader->hasIndex())
+      cout << "Note: " << recordFiles[i] << " was not closed, exporting its " << reader->getNumRecords() << " complete records" << endl;
+    GameRecord record;
+    for(uint64_t idx = 0; idx<reader->getNumRecords(); idx++) {
+      try {
+        reader->read(idx,record);
+      }
+      catch(const IOError& e) {
+        cout << "Skipping record: " << e.message << endl;
+        continue;
+      }
+      record.writeSgf(out);
+      out << endl;
+      numExported++;
+    }
+    delete reader;
+  }
+  out.close();
+
+  cout << "Exported " << numExported << " games" << endl;
+  return 0;
+}
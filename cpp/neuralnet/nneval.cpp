@@ -7,6 +7,7 @@
 NNResultBuf::NNResultBuf()
   :clientWaitingForResult(),resultMutex(),hasResult(false),includeOwnerMap(false),
    rowBinSize(0),rowGlobalSize(0),rowBin(NULL),rowGlobal(NULL),
+   rowBinPackedSize(0),rowBinPacked(NULL),
    result(nullptr),errorLogLockout(false)
 {}
 
@@ -16,6 +17,8 @@ NNResultBuf::~NNResultBuf()
     delete[] rowBin;
   if(rowGlobal != NULL)
     delete[] rowGlobal;
+  if(rowBinPacked != NULL)
+    delete[] rowBinPacked;
 }
 
 //-------------------------------------------------------------------------------------
@@ -53,6 +56,7 @@ NNEvaluator::NNEvaluator(
   bool rExactPosLen,
   bool iUseNHWC,
   int nnCacheSizePowerOfTwo,
+  int ladderCacheSizePowerOfTwo,
   int nnMutexPoolSizePowerofTwo,
   bool skipNeuralNet,
   float nnPolicyTemp
@@ -65,6 +69,7 @@ NNEvaluator::NNEvaluator(
    inputsUseNHWC(iUseNHWC),
    loadedModel(NULL),
    nnCacheTable(NULL),
+   ladderCache(NULL),
    debugSkipNeuralNet(skipNeuralNet),
    nnPolicyInvTemperature(1.0/nnPolicyTemp),
    serverThreads(),
@@ -99,6 +104,8 @@ NNEvaluator::NNEvaluator(
 
   if(nnCacheSizePowerOfTwo >= 0)
     nnCacheTable = new NNCacheTable(nnCacheSizePowerOfTwo,nnMutexPoolSizePowerofTwo);
+  if(ladderCacheSizePowerOfTwo >= 0)
+    ladderCache = new LadderCache(ladderCacheSizePowerOfTwo,nnMutexPoolSizePowerofTwo);
 
   if(!debugSkipNeuralNet) {
     loadedModel = NeuralNet::loadModelFile(modelFileName, modelFileIdx);
@@ -136,6 +143,7 @@ NNEvaluator::~NNEvaluator()
   loadedModel = NULL;
 
   delete nnCacheTable;
+  delete ladderCache;
 }
 
 string NNEvaluator::getModelName() const {
@@ -169,6 +177,8 @@ void NNEvaluator::clearStats() {
 void NNEvaluator::clearCache() {
   if(nnCacheTable != NULL)
     nnCacheTable->clear();
+  if(ladderCache != NULL)
+    ladderCache->clear();
 }
 
 static void serveEvals(
@@ -272,7 +282,7 @@ void NNEvaluator::serve(
         NNResultBuf* resultBuf = buf.resultBufs[row];
         buf.resultBufs[row] = NULL;
 
-        unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
+        unique_lock<boost::fibers::mutex> resultLock(resultBuf->resultMutex);
         assert(resultBuf->hasResult == false);
         resultBuf->result = std::make_shared<NNOutput>();
         float* policyProbs = resultBuf->result->policyProbs;
@@ -345,9 +355,13 @@ void NNEvaluator::serve(
       float* rowInput = NeuralNet::getRowInplace(buf.inputBuffers,row);
       float* rowGlobalInput = NeuralNet::getRowGlobalInplace(buf.inputBuffers,row);
 
-      const float* rowBin = buf.resultBufs[row]->rowBin;
       const float* rowGlobal = buf.resultBufs[row]->rowGlobal;
-      std::copy(rowBin,rowBin+rowBinLen,rowInput);
+      if(inputsVersion == 5)
+        NNInputs::unpackRowBin(buf.resultBufs[row]->rowBinPacked,numSpatialFeatures,posLen,inputsUseNHWC,rowInput);
+      else {
+        const float* rowBin = buf.resultBufs[row]->rowBin;
+        std::copy(rowBin,rowBin+rowBinLen,rowInput);
+      }
       std::copy(rowGlobal,rowGlobal+rowGlobalLen,rowGlobalInput);
     }
 
@@ -362,7 +376,7 @@ void NNEvaluator::serve(
       NNResultBuf* resultBuf = buf.resultBufs[row];
       buf.resultBufs[row] = NULL;
 
-      unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
+      unique_lock<boost::fibers::mutex> resultLock(resultBuf->resultMutex);
       assert(resultBuf->hasResult == false);
       resultBuf->result = std::shared_ptr<NNOutput>(outputBuf[row]);
       resultBuf->hasResult = true;
@@ -429,14 +443,27 @@ void NNEvaluator::evaluate(
   buf.includeOwnerMap = includeOwnerMap;
 
   if(!debugSkipNeuralNet) {
-    int rowBinLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * posLen * posLen;
-    if(buf.rowBin == NULL) {
-      buf.rowBin = new float[rowBinLen];
-      buf.rowBinSize = rowBinLen;
+    if(inputsVersion == 5) {
+      int rowBinPackedLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * NNInputs::PACKED_PLANE_WORDS;
+      if(buf.rowBinPacked == NULL) {
+        buf.rowBinPacked = new uint64_t[rowBinPackedLen];
+        buf.rowBinPackedSize = rowBinPackedLen;
+      }
+      else {
+        if(buf.rowBinPackedSize != rowBinPackedLen)
+          throw StringError("Cannot reuse an nnResultBuf with a different posLen or model version");
+      }
     }
     else {
-      if(buf.rowBinSize != rowBinLen)
-        throw StringError("Cannot reuse an nnResultBuf with a different posLen or model version");
+      int rowBinLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * posLen * posLen;
+      if(buf.rowBin == NULL) {
+        buf.rowBin = new float[rowBinLen];
+        buf.rowBinSize = rowBinLen;
+      }
+      else {
+        if(buf.rowBinSize != rowBinLen)
+          throw StringError("Cannot reuse an nnResultBuf with a different posLen or model version");
+      }
     }
 
     if(inputsVersion == 1)
@@ -453,7 +480,7 @@ void NNEvaluator::evaluate(
         if(buf.rowGlobalSize != rowGlobalLen)
           throw StringError("Cannot reuse an nnResultBuf with a different posLen or model version");
       }
-      NNInputs::fillRowV3(board, history, nextPlayer, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, buf.rowBin, buf.rowGlobal);
+      NNInputs::fillRowV3(board, history, nextPlayer, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, buf.rowBin, buf.rowGlobal, ladderCache);
     }
     else if(inputsVersion == 4) {
       int rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
@@ -465,7 +492,7 @@ void NNEvaluator::evaluate(
         if(buf.rowGlobalSize != rowGlobalLen)
           throw StringError("Cannot reuse an nnResultBuf with a different posLen or model version");
       }
-      NNInputs::fillRowV4(board, history, nextPlayer, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, buf.rowBin, buf.rowGlobal);
+      NNInputs::fillRowV4(board, history, nextPlayer, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, buf.rowBin, buf.rowGlobal, ladderCache);
     }
     else if(inputsVersion == 5) {
       int rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
@@ -477,7 +504,7 @@ void NNEvaluator::evaluate(
         if(buf.rowGlobalSize != rowGlobalLen)
           throw StringError("Cannot reuse an nnResultBuf with a different posLen or model version");
       }
-      NNInputs::fillRowV5(board, history, nextPlayer, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, buf.rowBin, buf.rowGlobal);
+      NNInputs::fillRowV5Packed(board, history, nextPlayer, drawEquivalentWinsForWhite, posLen, buf.rowBinPacked, buf.rowGlobal);
     }
     else
       assert(false);
@@ -502,7 +529,7 @@ void NNEvaluator::evaluate(
   //circular buffer.
   assert(!overlooped);
 
-  unique_lock<std::mutex> resultLock(buf.resultMutex);
+  unique_lock<boost::fibers::mutex> resultLock(buf.resultMutex);
   while(!buf.hasResult)
     buf.clientWaitingForResult.wait(resultLock);
   resultLock.unlock();
@@ -2,6 +2,8 @@
 #define NNEVAL_H
 
 #include <memory>
+#include <boost/fiber/mutex.hpp>
+#include <boost/fiber/condition_variable.hpp>
 
 #include "../core/global.h"
 #include "../core/logger.h"
@@ -41,15 +43,22 @@ class NNCacheTable {
 };
 
 //Each thread should allocate and re-use one of these
+//Waiting for the result uses fiber-aware synchronization, so that when evaluate is called from within a
+//boost::fibers fiber (such as the multiple-games-per-thread mode of selfplay), only that fiber suspends while the
+//other fibers on the same OS thread keep running. From an ordinary thread, this behaves like a normal condition variable.
 struct NNResultBuf {
-  condition_variable clientWaitingForResult;
-  mutex resultMutex;
+  boost::fibers::condition_variable clientWaitingForResult;
+  boost::fibers::mutex resultMutex;
   bool hasResult;
   bool includeOwnerMap;
   int rowBinSize;
   int rowGlobalSize;
   float* rowBin;
   float* rowGlobal;
+  //For inputs versions with a packed featurizer, spatial features are kept packed here instead of in rowBin,
+  //and are only expanded to floats when copied into the batch for the backend.
+  int rowBinPackedSize;
+  uint64_t* rowBinPacked;
   shared_ptr<NNOutput> result;
   bool errorLogLockout; //error flag to restrict log to 1 error to prevent spam
 
@@ -82,6 +91,7 @@ class NNEvaluator {
     bool requireExactPosLen,
     bool inputsUseNHWC,
     int nnCacheSizePowerOfTwo,
+    int ladderCacheSizePowerOfTwo, //negative to not cache ladder search results
     int nnMutexPoolSizePowerofTwo,
     bool debugSkipNeuralNet,
     float nnPolicyTemperature
@@ -99,7 +109,7 @@ class NNEvaluator {
   //Queue a position for the next neural net batch evaluation and wait for it. Upon evaluation, result
   //will be supplied in NNResultBuf& buf, the shared_ptr there can grabbed via std::move if desired.
   //logStream is for some error logging, can be NULL.
-  //This function is threadsafe.
+  //This function is threadsafe, and if called from within a boost::fibers fiber, suspends only that fiber while waiting.
   void evaluate(
     Board& board,
     const BoardHistory& history,
@@ -147,6 +157,7 @@ class NNEvaluator {
 
   LoadedModel* loadedModel;
   NNCacheTable* nnCacheTable;
+  LadderCache* ladderCache;
 
   bool debugSkipNeuralNet;
   float nnPolicyInvTemperature;
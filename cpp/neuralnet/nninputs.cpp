@@ -97,7 +97,9 @@ double ScoreValue::whiteScoreMeanSqOfScoreGridded(double finalWhiteMinusBlackSco
 
 static bool scoreValueTablesInitialized = false;
 static double* expectedSVTable = NULL;
-static const int svTableAssumedBSize = NNPos::MAX_BOARD_LEN;
+//The table and the scaling in expectedWhiteScoreValue are calibrated for 19x19, so this stays fixed regardless of
+//the max board size that was compiled in.
+static const int svTableAssumedBSize = 19;
 static const int svTableMeanRadius = svTableAssumedBSize*svTableAssumedBSize + NNPos::EXTRA_SCORE_DISTR_RADIUS;
 static const int svTableMeanLen = svTableMeanRadius*2;
 static const int svTableStdevLen = svTableAssumedBSize*svTableAssumedBSize + NNPos::EXTRA_SCORE_DISTR_RADIUS;
@@ -117,14 +119,14 @@ void ScoreValue::initTables() {
     double w = exp(-0.5 * xInStdevs * xInStdevs);
     normalPDF[i-minStdevSteps] = w;
   }
-  //Precompute scorevalue at increments of 1/stepsPerUnit points
-  Board board(svTableAssumedBSize,svTableAssumedBSize);
+  //Precompute scorevalue at increments of 1/stepsPerUnit points, as whiteScoreValueOfScoreSmoothNoDrawAdjust would
+  //on a board of svTableAssumedBSize, which need not fit within Board::MAX_LEN
   int minSVSteps = - (svTableMeanRadius*stepsPerUnit + stepsPerUnit/2 + boundStdevs * svTableStdevLen * stepsPerUnit);
   int maxSVSteps = -minSVSteps;
   double* svPrecomp = new double[(maxSVSteps-minSVSteps)+1];
   for(int i = minSVSteps; i <= maxSVSteps; i++) {
     double mean = (double)i / stepsPerUnit;
-    double sv = whiteScoreValueOfScoreSmoothNoDrawAdjust(mean, 0.0, 1.0, board);
+    double sv = atan(mean / svTableAssumedBSize) * twoOverPi;
     svPrecomp[i-minSVSteps] = sv;
   }
 
@@ -263,22 +265,124 @@ static void setRowBinV3(float* rowBin, int pos, int feature, float value, int po
 static void setRowBinV4(float* rowBin, int pos, int feature, float value, int posStride, int featureStride) {
   rowBin[pos * posStride + feature * featureStride] = value;
 }
-static void setRowBinV5(float* rowBin, int pos, int feature, float value, int posStride, int featureStride) {
-  rowBin[pos * posStride + feature * featureStride] = value;
+static inline void setRowBinPacked(uint64_t* rowBinPacked, int pos, int feature) {
+  rowBinPacked[feature * NNInputs::PACKED_PLANE_WORDS + (pos >> 6)] |= ((uint64_t)1) << (pos & 63);
+}
+
+void NNInputs::unpackRowBin(const uint64_t* rowBinPacked, int numFeatures, int posLen, bool useNHWC, float* rowBin) {
+  int posArea = posLen * posLen;
+  //Expand one 64-bit word at a time with a branch-free inner loop over its bits, which compilers vectorize
+  for(int feature = 0; feature < numFeatures; feature++) {
+    const uint64_t* plane = rowBinPacked + feature * PACKED_PLANE_WORDS;
+    if(useNHWC) {
+      float* dst = rowBin + feature;
+      for(int pos0 = 0; pos0 < posArea; pos0 += 64) {
+        uint64_t word = plane[pos0 >> 6];
+        int len = std::min(64, posArea - pos0);
+        for(int i = 0; i < len; i++)
+          dst[(pos0 + i) * numFeatures] = (float)((word >> i) & 1);
+      }
+    }
+    else {
+      float* dst = rowBin + feature * posArea;
+      for(int pos0 = 0; pos0 < posArea; pos0 += 64) {
+        uint64_t word = plane[pos0 >> 6];
+        int len = std::min(64, posArea - pos0);
+        for(int i = 0; i < len; i++)
+          dst[pos0 + i] = (float)((word >> i) & 1);
+      }
+    }
+  }
+}
+
+
+LadderCache::Entry::Entry()
+  :posHash(),head(Board::NULL_LOC),valid(false),laddered(false),numWorkingMoves(0)
+{}
+
+LadderCache::LadderCache(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo) {
+  if(sizePowerOfTwo < 0 || sizePowerOfTwo > 63)
+    throw StringError("LadderCache: Invalid sizePowerOfTwo: " + Global::intToString(sizePowerOfTwo));
+  if(mutexPoolSizePowerOfTwo < 0 || mutexPoolSizePowerOfTwo > 31)
+    throw StringError("LadderCache: Invalid mutexPoolSizePowerOfTwo: " + Global::intToString(mutexPoolSizePowerOfTwo));
+  tableSize = ((uint64_t)1) << sizePowerOfTwo;
+  tableMask = tableSize-1;
+  entries = new Entry[tableSize];
+  uint32_t mutexPoolSize = ((uint32_t)1) << mutexPoolSizePowerOfTwo;
+  mutexPoolMask = mutexPoolSize-1;
+  mutexPool = new MutexPool(mutexPoolSize);
+}
+LadderCache::~LadderCache() {
+  delete[] entries;
+  delete mutexPool;
+}
+
+Hash128 LadderCache::getPosHash(const Board& board) {
+  //Ladder search does not depend on the player to move or the rules, but does depend on the ko point
+  Hash128 hash = board.pos_hash;
+  if(board.ko_loc != Board::NULL_LOC)
+    hash ^= Board::ZOBRIST_KO_LOC_HASH[board.ko_loc];
+  return hash;
+}
+
+bool LadderCache::get(Hash128 posHash, Loc head, bool& laddered, vector<Loc>& workingMoves) {
+  uint64_t idx = (posHash.hash0 + (uint64_t)head * 0x9E3779B97F4A7C15ULL) & tableMask;
+  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
+  Entry& entry = entries[idx];
+  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if(!entry.valid || entry.head != head || entry.posHash != posHash)
+    return false;
+  laddered = entry.laddered;
+  workingMoves.clear();
+  for(int i = 0; i<entry.numWorkingMoves; i++)
+    workingMoves.push_back(entry.workingMoves[i]);
+  return true;
+}
+
+void LadderCache::set(Hash128 posHash, Loc head, bool laddered, const vector<Loc>& workingMoves) {
+  assert(workingMoves.size() <= 2);
+  uint64_t idx = (posHash.hash0 + (uint64_t)head * 0x9E3779B97F4A7C15ULL) & tableMask;
+  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
+  Entry& entry = entries[idx];
+  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  entry.posHash = posHash;
+  entry.head = head;
+  entry.valid = true;
+  entry.laddered = laddered;
+  entry.numWorkingMoves = (uint8_t)workingMoves.size();
+  for(size_t i = 0; i<workingMoves.size(); i++)
+    entry.workingMoves[i] = workingMoves[i];
+}
+
+void LadderCache::clear() {
+  for(size_t idx = 0; idx<tableSize; idx++) {
+    Entry& entry = entries[idx];
+    uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
+    std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+    std::lock_guard<std::mutex> lock(mutex);
+    entry.valid = false;
+  }
 }
 
 
 //Calls f on each location that is part of an inescapable atari, or a group that can be put into inescapable atari
-static void iterLadders(const Board& board, int posLen, std::function<void(Loc,int,const vector<Loc>&)> f) {
+//If ladderCache is not NULL, results are looked up and stored there per chain.
+static void iterLadders(const Board& board, int posLen, LadderCache* ladderCache, std::function<void(Loc,int,const vector<Loc>&)> f) {
   int xSize = board.x_size;
   int ySize = board.y_size;
 
   auto chainHeadsSolved = new Loc[xSize*ySize];
   auto chainHeadsSolvedValue = new bool[xSize*ySize];
   int numChainHeadsSolved = 0;
-  Board copy(board);
+  //Only make the copy to search on once we actually need to search
+  Board* copy = NULL;
   vector<Loc> buf;
   vector<Loc> workingMoves;
+  Hash128 ladderHash = ladderCache == NULL ? Hash128() : LadderCache::getPosHash(board);
 
   for(int y = 0; y<ySize; y++) {
     for(int x = 0; x<xSize; x++) {
@@ -301,13 +405,21 @@ static void iterLadders(const Board& board, int posLen, std::function<void(Loc,i
             }
           }
           if(!alreadySolved) {
-            //Perform search on copy so as not to mess up tracking of solved heads
             bool laddered;
-            if(libs == 1)
-              laddered = copy.searchIsLadderCaptured(loc,true,buf);
-            else {
-              workingMoves.clear();
-              laddered = copy.searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+            if(ladderCache == NULL || !ladderCache->get(ladderHash,head,laddered,workingMoves)) {
+              //Perform search on copy so as not to mess up tracking of solved heads
+              if(copy == NULL)
+                copy = new Board(board);
+              if(libs == 1) {
+                laddered = copy->searchIsLadderCaptured(loc,true,buf);
+                workingMoves.clear();
+              }
+              else {
+                workingMoves.clear();
+                laddered = copy->searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+              }
+              if(ladderCache != NULL)
+                ladderCache->set(ladderHash,head,laddered,workingMoves);
             }
 
             chainHeadsSolved[numChainHeadsSolved] = head;
@@ -320,6 +432,7 @@ static void iterLadders(const Board& board, int posLen, std::function<void(Loc,i
       }
     }
   }
+  delete copy;
   delete[]chainHeadsSolved;
   delete[]chainHeadsSolvedValue;
 }
@@ -465,7 +578,7 @@ void NNInputs::fillRowV0(
       }
     }
   };
-  iterLadders(board, posLen, addLadderFeature);
+  iterLadders(board, posLen, NULL, addLadderFeature);
 }
 
 
@@ -493,7 +606,7 @@ Hash128 NNInputs::getHashV1(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc)
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc)
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
       }
     }
@@ -502,7 +615,7 @@ Hash128 NNInputs::getHashV1(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
         if(hist.blackKoProhibited[loc])
           hash ^= Board::ZOBRIST_KO_MARK_HASH[loc][P_BLACK];
@@ -589,7 +702,7 @@ void NNInputs::fillRowV1(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc) {
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
           setRowV1(row,pos,9, 1.0f, posStride, featureStride);
         }
@@ -600,7 +713,7 @@ void NNInputs::fillRowV1(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc]) {
+        if(hist.isSuperKoBanned(board,loc)) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
           setRowV1(row,pos,9, 1.0f, posStride, featureStride);
         }
@@ -661,7 +774,7 @@ void NNInputs::fillRowV1(
       }
     }
   };
-  iterLadders(board, posLen, addLadderFeature);
+  iterLadders(board, posLen, NULL, addLadderFeature);
 }
 
 
@@ -691,7 +804,7 @@ Hash128 NNInputs::getHashV2(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc)
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc)
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
       }
     }
@@ -700,7 +813,7 @@ Hash128 NNInputs::getHashV2(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
         if(hist.blackKoProhibited[loc])
           hash ^= Board::ZOBRIST_KO_MARK_HASH[loc][P_BLACK];
@@ -784,7 +897,7 @@ void NNInputs::fillRowV2(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc) {
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
           setRowV2(row,pos,6, 1.0f, posStride, featureStride);
         }
@@ -795,7 +908,7 @@ void NNInputs::fillRowV2(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc]) {
+        if(hist.isSuperKoBanned(board,loc)) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
           setRowV2(row,pos,6, 1.0f, posStride, featureStride);
         }
@@ -855,9 +968,9 @@ void NNInputs::fillRowV2(
     }
   };
 
-  iterLadders(board, posLen, addLadderFeature);
+  iterLadders(board, posLen, NULL, addLadderFeature);
 
-  const Board& prevBoard = hist.getRecentBoard(1);
+  Board prevBoard = hist.getRecentBoard(board,1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,row](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -865,9 +978,9 @@ void NNInputs::fillRowV2(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowV2(row,pos,13,1.0, posStride, featureStride);
   };
-  iterLadders(prevBoard, posLen, addPrevLadderFeature);
+  iterLadders(prevBoard, posLen, NULL, addPrevLadderFeature);
 
-  const Board& prevPrevBoard = hist.getRecentBoard(2);
+  Board prevPrevBoard = hist.getRecentBoard(board,2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,row](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -875,7 +988,7 @@ void NNInputs::fillRowV2(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowV2(row,pos,14,1.0, posStride, featureStride);
   };
-  iterLadders(prevPrevBoard, posLen, addPrevPrevLadderFeature);
+  iterLadders(prevPrevBoard, posLen, NULL, addPrevPrevLadderFeature);
 
 }
 
@@ -906,7 +1019,7 @@ Hash128 NNInputs::getHashV3(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc)
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc)
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
       }
     }
@@ -915,7 +1028,7 @@ Hash128 NNInputs::getHashV3(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
         if(hist.blackKoProhibited[loc])
           hash ^= Board::ZOBRIST_KO_MARK_HASH[loc][P_BLACK];
@@ -949,7 +1062,8 @@ Hash128 NNInputs::getHashV3(
 
 void NNInputs::fillRowV3(
   const Board& board, const BoardHistory& hist, Player nextPlayer,
-  double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
+  double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal,
+  LadderCache* ladderCache
 ) {
   assert(posLen <= NNPos::MAX_BOARD_LEN);
   assert(board.x_size <= posLen);
@@ -1008,7 +1122,7 @@ void NNInputs::fillRowV3(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc) {
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
           setRowBinV3(rowBin,pos,6, 1.0f, posStride, featureStride);
         }
@@ -1021,7 +1135,7 @@ void NNInputs::fillRowV3(
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
         int pos = NNPos::locToPos(loc,xSize,posLen);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           setRowBinV3(rowBin,pos,6, 1.0f, posStride, featureStride);
         if((pla == P_BLACK && hist.blackKoProhibited[loc]) || (pla == P_WHITE && hist.whiteKoProhibited[loc]))
           setRowBinV3(rowBin,pos,7, 1.0f, posStride, featureStride);
@@ -1093,9 +1207,9 @@ void NNInputs::fillRowV3(
     }
   };
 
-  iterLadders(board, posLen, addLadderFeature);
+  iterLadders(board, posLen, ladderCache, addLadderFeature);
 
-  const Board& prevBoard = hist.getRecentBoard(1);
+  Board prevBoard = hist.getRecentBoard(board,1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -1103,9 +1217,9 @@ void NNInputs::fillRowV3(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV3(rowBin,pos,15, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevBoard, posLen, addPrevLadderFeature);
+  iterLadders(prevBoard, posLen, ladderCache, addPrevLadderFeature);
 
-  const Board& prevPrevBoard = hist.getRecentBoard(2);
+  Board prevPrevBoard = hist.getRecentBoard(board,2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -1113,7 +1227,7 @@ void NNInputs::fillRowV3(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV3(rowBin,pos,16, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevPrevBoard, posLen, addPrevPrevLadderFeature);
+  iterLadders(prevPrevBoard, posLen, ladderCache, addPrevPrevLadderFeature);
 
   //Features 18,19 - current territory
   Color area[Board::MAX_ARR_SIZE];
@@ -1297,7 +1411,7 @@ Hash128 NNInputs::getHashV4(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc)
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc)
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
       }
     }
@@ -1306,7 +1420,7 @@ Hash128 NNInputs::getHashV4(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
         if(hist.blackKoProhibited[loc])
           hash ^= Board::ZOBRIST_KO_MARK_HASH[loc][P_BLACK];
@@ -1340,7 +1454,8 @@ Hash128 NNInputs::getHashV4(
 
 void NNInputs::fillRowV4(
   const Board& board, const BoardHistory& hist, Player nextPlayer,
-  double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
+  double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal,
+  LadderCache* ladderCache
 ) {
   assert(posLen <= NNPos::MAX_BOARD_LEN);
   assert(board.x_size <= posLen);
@@ -1399,7 +1514,7 @@ void NNInputs::fillRowV4(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc) {
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
           setRowBinV4(rowBin,pos,6, 1.0f, posStride, featureStride);
         }
@@ -1412,7 +1527,7 @@ void NNInputs::fillRowV4(
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
         int pos = NNPos::locToPos(loc,xSize,posLen);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           setRowBinV4(rowBin,pos,6, 1.0f, posStride, featureStride);
         if((pla == P_BLACK && hist.blackKoProhibited[loc]) || (pla == P_WHITE && hist.whiteKoProhibited[loc]))
           setRowBinV4(rowBin,pos,7, 1.0f, posStride, featureStride);
@@ -1484,9 +1599,9 @@ void NNInputs::fillRowV4(
     }
   };
 
-  iterLadders(board, posLen, addLadderFeature);
+  iterLadders(board, posLen, ladderCache, addLadderFeature);
 
-  const Board& prevBoard = hist.getRecentBoard(1);
+  Board prevBoard = hist.getRecentBoard(board,1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -1494,9 +1609,9 @@ void NNInputs::fillRowV4(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV4(rowBin,pos,15, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevBoard, posLen, addPrevLadderFeature);
+  iterLadders(prevBoard, posLen, ladderCache, addPrevLadderFeature);
 
-  const Board& prevPrevBoard = hist.getRecentBoard(2);
+  Board prevPrevBoard = hist.getRecentBoard(board,2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
     (void)workingMoves;
     (void)loc;
@@ -1504,7 +1619,7 @@ void NNInputs::fillRowV4(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV4(rowBin,pos,16, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevPrevBoard, posLen, addPrevPrevLadderFeature);
+  iterLadders(prevPrevBoard, posLen, ladderCache, addPrevPrevLadderFeature);
 
   //Features 18,19 - pass alive territory and stones
   Color area[Board::MAX_ARR_SIZE];
@@ -1680,7 +1795,7 @@ Hash128 NNInputs::getHashV5(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc)
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc)
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
       }
     }
@@ -1689,7 +1804,7 @@ Hash128 NNInputs::getHashV5(
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc])
+        if(hist.isSuperKoBanned(board,loc))
           hash ^= Board::ZOBRIST_KO_LOC_HASH[loc];
         if(hist.blackKoProhibited[loc])
           hash ^= Board::ZOBRIST_KO_MARK_HASH[loc][P_BLACK];
@@ -1721,14 +1836,14 @@ Hash128 NNInputs::getHashV5(
   return hash;
 }
 
-void NNInputs::fillRowV5(
+void NNInputs::fillRowV5Packed(
   const Board& board, const BoardHistory& hist, Player nextPlayer,
-  double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
+  double drawEquivalentWinsForWhite, int posLen, uint64_t* rowBinPacked, float* rowGlobal
 ) {
   assert(posLen <= NNPos::MAX_BOARD_LEN);
   assert(board.x_size <= posLen);
   assert(board.y_size <= posLen);
-  std::fill(rowBin,rowBin+NUM_FEATURES_BIN_V5*posLen*posLen,false);
+  std::fill(rowBinPacked,rowBinPacked+NUM_FEATURES_BIN_V5*PACKED_PLANE_WORDS,(uint64_t)0);
   std::fill(rowGlobal,rowGlobal+NUM_FEATURES_GLOBAL_V5,0.0f);
 
   Player pla = nextPlayer;
@@ -1736,32 +1851,21 @@ void NNInputs::fillRowV5(
   int xSize = board.x_size;
   int ySize = board.y_size;
 
-  int featureStride;
-  int posStride;
-  if(useNHWC) {
-    featureStride = 1;
-    posStride = NNInputs::NUM_FEATURES_BIN_V5;
-  }
-  else {
-    featureStride = posLen * posLen;
-    posStride = 1;
-  }
-
   for(int y = 0; y<ySize; y++) {
     for(int x = 0; x<xSize; x++) {
       int pos = NNPos::xyToPos(x,y,posLen);
       Loc loc = Location::getLoc(x,y,xSize);
 
       //Feature 0 - on board
-      setRowBinV5(rowBin,pos,0, 1.0f, posStride, featureStride);
+      setRowBinPacked(rowBinPacked,pos,0);
 
       Color stone = board.colors[loc];
 
       //Features 1,2 - pla,opp stone
       if(stone == pla)
-        setRowBinV5(rowBin,pos,1, 1.0f, posStride, featureStride);
+        setRowBinPacked(rowBinPacked,pos,1);
       else if(stone == opp)
-        setRowBinV5(rowBin,pos,2, 1.0f, posStride, featureStride);
+        setRowBinPacked(rowBinPacked,pos,2);
     }
   }
 
@@ -1769,14 +1873,14 @@ void NNInputs::fillRowV5(
   if(hist.encorePhase == 0) {
     if(board.ko_loc != Board::NULL_LOC) {
       int pos = NNPos::locToPos(board.ko_loc,xSize,posLen);
-      setRowBinV5(rowBin,pos,3, 1.0f, posStride, featureStride);
+      setRowBinPacked(rowBinPacked,pos,3);
     }
     for(int y = 0; y<ySize; y++) {
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
-        if(hist.superKoBanned[loc] && loc != board.ko_loc) {
+        if(hist.isSuperKoBanned(board,loc) && loc != board.ko_loc) {
           int pos = NNPos::locToPos(loc,xSize,posLen);
-          setRowBinV5(rowBin,pos,3, 1.0f, posStride, featureStride);
+          setRowBinPacked(rowBinPacked,pos,3);
         }
       }
     }
@@ -1787,12 +1891,12 @@ void NNInputs::fillRowV5(
       for(int x = 0; x<xSize; x++) {
         Loc loc = Location::getLoc(x,y,xSize);
         int pos = NNPos::locToPos(loc,xSize,posLen);
-        if(hist.superKoBanned[loc])
-          setRowBinV5(rowBin,pos,3, 1.0f, posStride, featureStride);
+        if(hist.isSuperKoBanned(board,loc))
+          setRowBinPacked(rowBinPacked,pos,3);
         if((pla == P_BLACK && hist.blackKoProhibited[loc]) || (pla == P_WHITE && hist.whiteKoProhibited[loc]))
-          setRowBinV5(rowBin,pos,4, 1.0f, posStride, featureStride);
+          setRowBinPacked(rowBinPacked,pos,4);
         if((pla == P_BLACK && hist.whiteKoProhibited[loc]) || (pla == P_WHITE && hist.blackKoProhibited[loc]))
-          setRowBinV5(rowBin,pos,5, 1.0f, posStride, featureStride);
+          setRowBinPacked(rowBinPacked,pos,5);
       }
     }
   }
@@ -1806,7 +1910,7 @@ void NNInputs::fillRowV5(
       rowGlobal[0] = 1.0;
     else if(prev1Loc != Board::NULL_LOC) {
       int pos = NNPos::locToPos(prev1Loc,xSize,posLen);
-      setRowBinV5(rowBin,pos,6, 1.0f, posStride, featureStride);
+      setRowBinPacked(rowBinPacked,pos,6);
     }
     if(moveHistoryLen >= 2 && moveHistory[moveHistoryLen-2].pla == pla) {
       Loc prev2Loc = moveHistory[moveHistoryLen-2].loc;
@@ -1814,7 +1918,7 @@ void NNInputs::fillRowV5(
         rowGlobal[1] = 1.0;
       else if(prev2Loc != Board::NULL_LOC) {
         int pos = NNPos::locToPos(prev2Loc,xSize,posLen);
-        setRowBinV5(rowBin,pos,7, 1.0f, posStride, featureStride);
+        setRowBinPacked(rowBinPacked,pos,7);
       }
       if(moveHistoryLen >= 3 && moveHistory[moveHistoryLen-3].pla == opp) {
         Loc prev3Loc = moveHistory[moveHistoryLen-3].loc;
@@ -1822,7 +1926,7 @@ void NNInputs::fillRowV5(
           rowGlobal[2] = 1.0;
         else if(prev3Loc != Board::NULL_LOC) {
           int pos = NNPos::locToPos(prev3Loc,xSize,posLen);
-          setRowBinV5(rowBin,pos,8, 1.0f, posStride, featureStride);
+          setRowBinPacked(rowBinPacked,pos,8);
         }
         if(moveHistoryLen >= 4 && moveHistory[moveHistoryLen-4].pla == pla) {
           Loc prev4Loc = moveHistory[moveHistoryLen-4].loc;
@@ -1830,7 +1934,7 @@ void NNInputs::fillRowV5(
             rowGlobal[3] = 1.0;
           else if(prev4Loc != Board::NULL_LOC) {
             int pos = NNPos::locToPos(prev4Loc,xSize,posLen);
-            setRowBinV5(rowBin,pos,9, 1.0f, posStride, featureStride);
+            setRowBinPacked(rowBinPacked,pos,9);
           }
           if(moveHistoryLen >= 5 && moveHistory[moveHistoryLen-5].pla == opp) {
             Loc prev5Loc = moveHistory[moveHistoryLen-5].loc;
@@ -1838,7 +1942,7 @@ void NNInputs::fillRowV5(
               rowGlobal[4] = 1.0;
             else if(prev5Loc != Board::NULL_LOC) {
               int pos = NNPos::locToPos(prev5Loc,xSize,posLen);
-              setRowBinV5(rowBin,pos,10, 1.0f, posStride, featureStride);
+              setRowBinPacked(rowBinPacked,pos,10);
             }
           }
         }
@@ -1853,9 +1957,9 @@ void NNInputs::fillRowV5(
         Loc loc = Location::getLoc(x,y,xSize);
         int pos = NNPos::locToPos(loc,xSize,posLen);
         if(hist.secondEncoreStartColors[loc] == pla)
-          setRowBinV5(rowBin,pos,11, 1.0f, posStride, featureStride);
+          setRowBinPacked(rowBinPacked,pos,11);
         else if(hist.secondEncoreStartColors[loc] == opp)
-          setRowBinV5(rowBin,pos,12, 1.0f, posStride, featureStride);
+          setRowBinPacked(rowBinPacked,pos,12);
       }
     }
   }
@@ -1905,3 +2009,12 @@ void NNInputs::fillRowV5(
     rowGlobal[11] = 1.0f;
 
 }
+
+void NNInputs::fillRowV5(
+  const Board& board, const BoardHistory& hist, Player nextPlayer,
+  double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
+) {
+  uint64_t rowBinPacked[NUM_FEATURES_BIN_V5*PACKED_PLANE_WORDS];
+  fillRowV5Packed(board,hist,nextPlayer,drawEquivalentWinsForWhite,posLen,rowBinPacked,rowGlobal);
+  unpackRowBin(rowBinPacked,NUM_FEATURES_BIN_V5,posLen,useNHWC,rowBin);
+}
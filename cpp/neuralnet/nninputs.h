@@ -7,10 +7,11 @@
 #include "../game/board.h"
 #include "../game/rules.h"
 #include "../game/boardhistory.h"
+#include "../search/mutexpool.h"
 
 namespace NNPos {
-  //Currently, neural net policy output can handle a max of 19x19 boards.
-  const int MAX_BOARD_LEN = 19;
+  //Neural net inputs and policy output can handle boards up to the max board size that we are compiled for.
+  const int MAX_BOARD_LEN = Board::MAX_LEN;
   const int MAX_BOARD_AREA = MAX_BOARD_LEN * MAX_BOARD_LEN;
   //Policy output adds +1 for the pass move
   const int MAX_NN_POLICY_SIZE = MAX_BOARD_AREA + 1;
@@ -24,6 +25,42 @@ namespace NNPos {
   int getPolicySize(int posLen);
 }
 
+//Thread-safe cache of ladder search results for chains with 1 or 2 liberties, keyed by the exact board position
+//(stones and ko point) and the chain head. When featurizing many positions of a search tree, the previous boards
+//whose ladders are featurized are usually the current boards of earlier featurizations, so most lookups hit.
+class LadderCache {
+  struct Entry {
+    Hash128 posHash;
+    Loc head;
+    bool valid;
+    bool laddered;
+    uint8_t numWorkingMoves;
+    Loc workingMoves[2];
+    Entry();
+  };
+
+  Entry* entries;
+  MutexPool* mutexPool;
+  uint64_t tableSize;
+  uint64_t tableMask;
+  uint32_t mutexPoolMask;
+
+ public:
+  LadderCache(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo);
+  ~LadderCache();
+
+  LadderCache(const LadderCache& other) = delete;
+  LadderCache& operator=(const LadderCache& other) = delete;
+
+  //The hash of everything about a board that ladder search results depend on
+  static Hash128 getPosHash(const Board& board);
+
+  //These are thread-safe. For get, returns false if not found, leaving laddered and workingMoves unspecified.
+  bool get(Hash128 posHash, Loc head, bool& laddered, vector<Loc>& workingMoves);
+  void set(Hash128 posHash, Loc head, bool laddered, const vector<Loc>& workingMoves);
+  void clear();
+};
+
 namespace NNInputs {
   const int NUM_SYMMETRY_BOOLS = 3;
   const int NUM_SYMMETRY_COMBINATIONS = 8;
@@ -82,7 +119,8 @@ namespace NNInputs {
   );
   void fillRowV3(
     const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
-    double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
+    double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal,
+    LadderCache* ladderCache
   );
 
   Hash128 getHashV4(
@@ -91,7 +129,8 @@ namespace NNInputs {
   );
   void fillRowV4(
     const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
-    double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
+    double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal,
+    LadderCache* ladderCache
   );
 
   Hash128 getHashV5(
@@ -103,6 +142,18 @@ namespace NNInputs {
     double drawEquivalentWinsForWhite, int posLen, bool useNHWC, float* rowBin, float* rowGlobal
   );
 
+  //Spatial features packed as bits rather than floats. Each feature plane is PACKED_PLANE_WORDS words, with the bit for
+  //NNPos pos in word pos/64 at bit pos%64 (least significant first). Bits past posLen*posLen are zero.
+  const int PACKED_PLANE_WORDS = (NNPos::MAX_BOARD_AREA + 63) / 64;
+
+  //Same as fillRowV5 but fills NUM_FEATURES_BIN_V5 packed planes rather than floats
+  void fillRowV5Packed(
+    const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
+    double drawEquivalentWinsForWhite, int posLen, uint64_t* rowBinPacked, float* rowGlobal
+  );
+  //Expand packed planes to the 0-1 floats that the unpacked fillRow functions produce, in NHWC or NCHW order
+  void unpackRowBin(const uint64_t* rowBinPacked, int numFeatures, int posLen, bool useNHWC, float* rowBin);
+
 }
 
 struct NNOutput {
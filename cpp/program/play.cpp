@@ -108,7 +108,7 @@ void GameInitializer::initShared(ConfigParser& cfg) {
   if(allowedMultiStoneSuicideLegals.size() <= 0)
     throw IOError("multiStoneSuicideLegals must have at least one value in " + cfg.getFileName());
 
-  allowedBSizes = cfg.getInts("bSizes", 9, 19);
+  allowedBSizes = cfg.getInts("bSizes", 9, Board::MAX_LEN);
   allowedBSizeRelProbs = cfg.getDoubles("bSizeRelProbs",0.0,1e100);
 
   komiMean = cfg.getFloat("komiMean",-60.0f,60.0f);
@@ -1116,6 +1116,7 @@ FinishedGameData* Play::runGame(
   }
 
   gameData->endHist = hist;
+  gameData->endBoard = board;
   if(hist.isGameFinished)
     gameData->hitTurnLimit = false;
   else
@@ -67,6 +67,7 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
       requireExactPosLen,
       inputsUseNHWC,
       cfg.getInt("nnCacheSizePowerOfTwo", -1, 48),
+      cfg.contains("ladderCacheSizePowerOfTwo") ? cfg.getInt("ladderCacheSizePowerOfTwo", -1, 48) : 16,
       cfg.getInt("nnMutexPoolSizePowerOfTwo", -1, 24),
       debugSkipNeuralNet,
       nnPolicyTemperature
@@ -167,6 +168,18 @@ vector<SearchParams> Setup::loadParams(
     if(cfg.contains("lagBuffer"+idxStr)) params.lagBuffer = cfg.getDouble("lagBuffer"+idxStr, 0.0, 3600.0);
     else if(cfg.contains("lagBuffer"))   params.lagBuffer = cfg.getDouble("lagBuffer",        0.0, 3600.0);
     else                                 params.lagBuffer = 0.0;
+    if(cfg.contains("dynamicTimeControls"+idxStr)) params.dynamicTimeControls = cfg.getBool("dynamicTimeControls"+idxStr);
+    else if(cfg.contains("dynamicTimeControls"))   params.dynamicTimeControls = cfg.getBool("dynamicTimeControls");
+
+    if(cfg.contains("maxTreeBytes"+idxStr)) params.maxTreeBytes = cfg.getInt64("maxTreeBytes"+idxStr, (int64_t)1 << 20, (int64_t)1 << 60);
+    else if(cfg.contains("maxTreeBytes"))   params.maxTreeBytes = cfg.getInt64("maxTreeBytes",        (int64_t)1 << 20, (int64_t)1 << 60);
+
+    if(cfg.contains("stopWhenLeaderUnassailable"+idxStr)) params.stopWhenLeaderUnassailable = cfg.getBool("stopWhenLeaderUnassailable"+idxStr);
+    else if(cfg.contains("stopWhenLeaderUnassailable"))   params.stopWhenLeaderUnassailable = cfg.getBool("stopWhenLeaderUnassailable");
+    if(cfg.contains("unassailableBudgetScale"+idxStr)) params.unassailableBudgetScale = cfg.getDouble("unassailableBudgetScale"+idxStr, 0.0, 1.0);
+    else if(cfg.contains("unassailableBudgetScale"))   params.unassailableBudgetScale = cfg.getDouble("unassailableBudgetScale",        0.0, 1.0);
+    if(cfg.contains("unassailableUtilityMargin"+idxStr)) params.unassailableUtilityMargin = cfg.getDouble("unassailableUtilityMargin"+idxStr, 0.0, 1.0e10);
+    else if(cfg.contains("unassailableUtilityMargin"))   params.unassailableUtilityMargin = cfg.getDouble("unassailableUtilityMargin",        0.0, 1.0e10);
 
     if(cfg.contains("searchFactorAfterOnePass"+idxStr)) params.searchFactorAfterOnePass = cfg.getDouble("searchFactorAfterOnePass"+idxStr, 0.0, 1.0);
     else if(cfg.contains("searchFactorAfterOnePass"))   params.searchFactorAfterOnePass = cfg.getDouble("searchFactorAfterOnePass",        0.0, 1.0);
@@ -4,6 +4,7 @@
 #include "core/rand.h"
 #include "core/elo.h"
 #include "core/fancymath.h"
+#include "core/bloomfilter.h"
 #include "game/board.h"
 #include "game/rules.h"
 #include "game/boardhistory.h"
@@ -21,6 +22,7 @@ int MainCmds::runtests(int argc, const char* const* argv) {
   Rand::runTests();
   FancyMath::runTests();
   ComputeElos::runTests();
+  BloomFilter::runTests();
   
 
   Tests::runBoardIOTests();
@@ -33,6 +35,9 @@ int MainCmds::runtests(int argc, const char* const* argv) {
   Tests::runBoardUndoTest();
   Tests::runBoardStressTest();
 
+  Tests::runSgfTests();
+  Tests::runDataIOTests();
+
   cout << "All tests passed" << endl;
   return 0;
 }
@@ -253,7 +253,7 @@ int MainCmds::sandbox() {
     float* rowGlobalInput = NeuralNet::getRowGlobalInplace(inputBuffers,i);
 
     double drawEquivalentWinsForWhite = 0.5;
-    NNInputs::fillRowV3(board, hist, pla, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, row, rowGlobalInput);
+    NNInputs::fillRowV3(board, hist, pla, drawEquivalentWinsForWhite, posLen, inputsUseNHWC, row, rowGlobalInput, NULL);
     // if(i % 3 == 0)
       // NNInputs::fillRowV3(board, hist, pla, row);
     // else if(i % 3 == 1)
@@ -79,6 +79,14 @@ void AsyncBot::clearSearch() {
   stopAndWait();
   search->clearSearch();
 }
+void AsyncBot::saveTree(const string& fileName) {
+  stopAndWait();
+  search->saveTree(fileName);
+}
+bool AsyncBot::loadTree(const string& fileName) {
+  stopAndWait();
+  return search->loadTree(fileName,*logger);
+}
 
 bool AsyncBot::makeMove(Loc moveLoc, Player movePla) {
   stopAndWait();
@@ -30,6 +30,11 @@ class AsyncBot {
   void setParams(SearchParams params);
   void clearSearch();
 
+  //Save or load the search tree, see search.h
+  //Calling either of these will stop any ongoing search, waiting for a full stop.
+  void saveTree(const string& fileName);
+  bool loadTree(const string& fileName);
+
   //Updates position and preserves the relevant subtree of search
   //Will stop any ongoing search, waiting for a full stop.
   //If the move is not legal for the current player, returns false and does nothing, else returns true
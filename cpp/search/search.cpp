@@ -1,6 +1,8 @@
 
 #include <inttypes.h>
 #include <algorithm>
+#include <fstream>
+#include <map>
 #include "../search/search.h"
 #include "../core/fancymath.h"
 #include "../core/timer.h"
@@ -57,6 +59,7 @@ SearchNode::SearchNode(Search& search, SearchThread& thread, Loc moveLoc)
   :lockIdx(),nextPla(thread.pla),prevMoveLoc(moveLoc),
    nnOutput(),
    children(NULL),numChildren(0),childrenCapacity(0),
+   collapsedStats(NULL),
    stats(),virtualLosses(0)
 {
   statsLock.clear();
@@ -68,6 +71,7 @@ SearchNode::~SearchNode() {
       delete children[i];
   }
   delete[] children;
+  delete collapsedStats;
 }
 
 SearchNode::SearchNode(SearchNode&& other) noexcept
@@ -80,6 +84,8 @@ SearchNode::SearchNode(SearchNode&& other) noexcept
   other.children = NULL;
   numChildren = other.numChildren;
   childrenCapacity = other.childrenCapacity;
+  collapsedStats = other.collapsedStats;
+  other.collapsedStats = NULL;
 }
 SearchNode& SearchNode::operator=(SearchNode&& other) noexcept {
   lockIdx = other.lockIdx;
@@ -90,6 +96,9 @@ SearchNode& SearchNode::operator=(SearchNode&& other) noexcept {
   other.children = NULL;
   numChildren = other.numChildren;
   childrenCapacity = other.childrenCapacity;
+  delete collapsedStats;
+  collapsedStats = other.collapsedStats;
+  other.collapsedStats = NULL;
   stats = other.stats;
   virtualLosses = other.virtualLosses;
   return *this;
@@ -173,6 +182,7 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   );
 
   rootNode = NULL;
+  lastSearchEarlyStopSavedPlayouts = 0;
   mutexPool = new MutexPool(params.mutexPoolSize);
 
   rootHistory.clear(rootBoard,rootPla,Rules(),0);
@@ -619,6 +629,40 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
   runWholeSearch(logger,shouldStopNow,recordUtilities,pondering,TimeControls(),1.0);
 }
 
+//When the tree exceeds maxTreeBytes, prune it down to this proportion of maxTreeBytes.
+static const double TREE_PRUNE_TARGET_PROP = 0.75;
+//With stopWhenLeaderUnassailable, check whether the leader can still be overtaken every this many playouts.
+static const int64_t UNASSAILABLE_CHECK_INTERVAL = 16;
+
+//With dynamicTimeControls, check whether to stop or keep going every this many playouts.
+static const int64_t TIME_CHECK_INTERVAL = 8;
+//Never stop for stability before this proportion of the recommended time.
+static const double TIME_EARLY_STOP_MIN_PROP = 0.25;
+//The best move is stable if it has not changed for this proportion of the time used so far...
+static const double TIME_STABLE_PROP = 0.5;
+//...and it has at least this many times the visits of the runner-up, and the runner-up does not threaten it (see below).
+static const double TIME_STABLE_VISIT_RATIO = 3.0;
+//The best move is unstable if it changed within this proportion of the time used so far...
+static const double TIME_UNSTABLE_RECENT_PROP = 0.25;
+//...or if the runner-up has at least this proportion of its visits...
+static const double TIME_CLOSE_VISIT_RATIO = 0.8;
+//...or if the runner-up threatens it, having a utility better by at least this margin with at least this proportion of its visits,
+//so that a barely explored move whose utility is better mostly by noise does not keep the search going.
+static const double TIME_THREAT_UTILITY_MARGIN = 0.03;
+static const double TIME_THREAT_MIN_VISIT_RATIO = 0.2;
+//Never extend beyond this many times the recommended time (nor beyond the time control's max time).
+static const double TIME_MAX_EXTENSION_FACTOR = 3.0;
+
+struct SearchTimeState {
+  std::mutex mutex;
+  double tcMin;
+  double tcRec;
+  double tcMax;
+  Loc leaderLoc;
+  double leaderChangeTime;
+  bool extended;
+};
+
 void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, vector<double>* recordUtilities, bool pondering, const TimeControls& tc, double searchFactor) {
 
   ClockTimer timer;
@@ -635,12 +679,18 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
   double_t maxTime = pondering ? searchParams.maxTimePondering : searchParams.maxTime;
 
   //Apply time controls
-  {
-    double tcMin;
-    double tcRec;
-    double tcMax;
-    tc.getTime(rootBoard,rootHistory,searchParams.lagBuffer,tcMin,tcRec,tcMax);
-    //Right now, just always use the recommended time.
+  double tcMin;
+  double tcRec;
+  double tcMax;
+  tc.getTime(rootBoard,rootHistory,searchParams.lagBuffer,tcMin,tcRec,tcMax);
+  //Only manage time dynamically if the time control actually binds
+  const bool useTimeManagement = searchParams.dynamicTimeControls && !pondering && tcRec < maxTime;
+  if(useTimeManagement) {
+    //The loop below enforces the hard cap, shouldStopForTime decides where to stop before it.
+    tcMax = std::min(maxTime, std::min(tcMax, std::max(tcMin, tcRec * TIME_MAX_EXTENSION_FACTOR)));
+    maxTime = tcMax;
+  }
+  else {
     maxTime = std::min(tcRec,maxTime);
   }
   
@@ -658,11 +708,38 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
       maxTime = maxTime * searchFactor;
     }
   }
+
+  SearchTimeState timeState;
+  timeState.tcMin = tcMin * searchFactor;
+  timeState.tcRec = tcRec * searchFactor;
+  timeState.tcMax = tcMax * searchFactor;
+  timeState.leaderLoc = Board::NULL_LOC;
+  timeState.leaderChangeTime = 0.0;
+  timeState.extended = false;
   
   beginSearch(logger);
   int64_t numNonPlayoutVisits = numRootVisits();
 
-  auto searchLoop = [this,&timer,&numPlayoutsShared,numNonPlayoutVisits,&logger,&shouldStopNow,&recordUtilities,maxVisits,maxPlayouts,maxTime](int threadIdx) {
+  //Pondering has no particular move to make, so there is nothing to gain from stopping early.
+  const bool checkUnassailable = searchParams.stopWhenLeaderUnassailable && !pondering;
+  std::atomic<int64_t> earlyStopSavedPlayouts(0);
+
+  //Each playout adds at most one node, so we can bound the tree size without walking it until the bound hits the cap.
+  const int64_t maxTreeBytes = searchParams.maxTreeBytes;
+  const int64_t bytesPerNewNodeBound = sizeof(SearchNode) + sizeof(NNOutput) + 2 * sizeof(SearchNode*) + 64;
+  int64_t treeBytesAtLastCount = 0;
+  int64_t numPlayoutsAtLastCount = 0;
+  if(maxTreeBytes < (((int64_t)1) << 60)) {
+    int64_t numNodes;
+    getTreeMemoryUsage(numNodes,treeBytesAtLastCount);
+  }
+  std::atomic<bool> shouldPauseForPruning(false);
+
+  auto searchLoop = [
+    this,&timer,&numPlayoutsShared,numNonPlayoutVisits,&logger,&shouldStopNow,&recordUtilities,maxVisits,maxPlayouts,maxTime,
+    maxTreeBytes,bytesPerNewNodeBound,&treeBytesAtLastCount,&numPlayoutsAtLastCount,&shouldPauseForPruning,
+    checkUnassailable,&earlyStopSavedPlayouts,useTimeManagement,&timeState
+  ](int threadIdx) {
     SearchThread* stbuf = new SearchThread(threadIdx,*this,&logger);
     
     int64_t numPlayouts = numPlayoutsShared.load(std::memory_order_relaxed);
@@ -678,6 +755,11 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
           break;
         }
 
+        if(treeBytesAtLastCount + (numPlayouts - numPlayoutsAtLastCount) * bytesPerNewNodeBound >= maxTreeBytes)
+          shouldPauseForPruning.store(true,std::memory_order_relaxed);
+        if(shouldPauseForPruning.load(std::memory_order_relaxed))
+          break;
+
         runSinglePlayout(*stbuf);
 
         numPlayouts = numPlayoutsShared.fetch_add((int64_t)1, std::memory_order_relaxed);
@@ -690,6 +772,28 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
           }
         }
 
+        //Each value of numPlayouts is seen by exactly one thread, so exactly one thread does each check
+        if(checkUnassailable && numPlayouts % UNASSAILABLE_CHECK_INTERVAL == 0) {
+          int64_t remainingPlayouts = std::min(maxPlayouts - numPlayouts, maxVisits - numPlayouts - numNonPlayoutVisits);
+          if(maxTime < 1.0e12) {
+            double timeUsed = timer.getSeconds();
+            if(timeUsed > 0.0) {
+              double remainingPlayoutsByTime = ceil(numPlayouts / timeUsed * std::max(0.0, maxTime - timeUsed));
+              if(remainingPlayoutsByTime < remainingPlayouts)
+                remainingPlayouts = (int64_t)remainingPlayoutsByTime;
+            }
+          }
+          if(remainingPlayouts > 0 && isRootLeaderUnassailable(remainingPlayouts)) {
+            earlyStopSavedPlayouts.store(remainingPlayouts,std::memory_order_relaxed);
+            shouldStopNow.store(true,std::memory_order_relaxed);
+          }
+        }
+
+        if(useTimeManagement && numPlayouts % TIME_CHECK_INTERVAL == 0) {
+          if(shouldStopForTime(timeState, timer.getSeconds(), logger))
+            shouldStopNow.store(true,std::memory_order_relaxed);
+        }
+
       }
     }
     catch(const exception& e) {
@@ -711,17 +815,208 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
     delete stbuf;
   };
 
-  if(searchParams.numThreads <= 1)
-    searchLoop(0);
-  else {
-    std::thread* threads = new std::thread[searchParams.numThreads-1];
-    for(int i = 0; i<searchParams.numThreads-1; i++)
-      threads[i] = std::thread(searchLoop,i+1);
-    searchLoop(0);
-    for(int i = 0; i<searchParams.numThreads-1; i++)
-      threads[i].join();
-    delete[] threads;
+  while(true) {
+    if(searchParams.numThreads <= 1)
+      searchLoop(0);
+    else {
+      std::thread* threads = new std::thread[searchParams.numThreads-1];
+      for(int i = 0; i<searchParams.numThreads-1; i++)
+        threads[i] = std::thread(searchLoop,i+1);
+      searchLoop(0);
+      for(int i = 0; i<searchParams.numThreads-1; i++)
+        threads[i].join();
+      delete[] threads;
+    }
+
+    if(!shouldPauseForPruning.load(std::memory_order_relaxed) || shouldStopNow.load(std::memory_order_relaxed))
+      break;
+
+    //All threads are stopped, so we can safely prune the tree, and then resume searching.
+    //Prune down to somewhat below the cap so that we don't immediately have to pause again.
+    int64_t numNodes;
+    getTreeMemoryUsage(numNodes,treeBytesAtLastCount);
+    if(treeBytesAtLastCount >= maxTreeBytes * TREE_PRUNE_TARGET_PROP) {
+      pruneTreeToBytes((int64_t)(maxTreeBytes * TREE_PRUNE_TARGET_PROP), logger);
+      getTreeMemoryUsage(numNodes,treeBytesAtLastCount);
+    }
+    numPlayoutsAtLastCount = numPlayoutsShared.load(std::memory_order_relaxed);
+    shouldPauseForPruning.store(false,std::memory_order_relaxed);
+
+    //If we can't get any further below the cap than this, there's nothing more we can do, so just keep searching.
+    if(treeBytesAtLastCount >= maxTreeBytes * TREE_PRUNE_TARGET_PROP) {
+      logger.write("Warning: could not prune search tree below maxTreeBytes, continuing without pruning");
+      treeBytesAtLastCount = -(((int64_t)1) << 61);
+    }
+  }
+
+  lastSearchEarlyStopSavedPlayouts = earlyStopSavedPlayouts.load(std::memory_order_relaxed);
+  if(useTimeManagement && timeState.extended && timer.getSeconds() >= maxTime)
+    logger.write("Time: stopped at max time " + Global::strprintf("%.2f",maxTime) + "s, best move never settled");
+}
+
+//Tracks how recently the best root move changed, and decides whether to stop the search within [tcMin,tcMax].
+//Stops early (after the min time) when the best move is stable, and keeps going past the recommended time when it is not.
+bool Search::shouldStopForTime(SearchTimeState& timeState, double timeUsed, Logger& logger) const {
+  vector<Loc> childLocs;
+  vector<int64_t> childVisits;
+  vector<double> childUtilities;
+  getRootChildStats(childLocs,childVisits,childUtilities);
+  int numChildren = (int)childLocs.size();
+  if(numChildren <= 0)
+    return false;
+
+  int leaderIdx = 0;
+  for(int i = 1; i<numChildren; i++) {
+    if(childVisits[i] > childVisits[leaderIdx])
+      leaderIdx = i;
+  }
+  int runnerUpIdx = -1;
+  for(int i = 0; i<numChildren; i++) {
+    if(i != leaderIdx && (runnerUpIdx < 0 || childVisits[i] > childVisits[runnerUpIdx]))
+      runnerUpIdx = i;
+  }
+  int64_t leaderVisits = childVisits[leaderIdx];
+  int64_t runnerUpVisits = runnerUpIdx < 0 ? 0 : childVisits[runnerUpIdx];
+  double leaderUtility = childUtilities[leaderIdx];
+  double runnerUpUtility = runnerUpIdx < 0 ? -1e30 : childUtilities[runnerUpIdx];
+
+  lock_guard<std::mutex> lock(timeState.mutex);
+  if(childLocs[leaderIdx] != timeState.leaderLoc) {
+    timeState.leaderLoc = childLocs[leaderIdx];
+    timeState.leaderChangeTime = timeUsed;
+  }
+  double timeSinceChange = timeUsed - timeState.leaderChangeTime;
+
+  int decision = getTimeDecision(
+    timeUsed, timeSinceChange, timeState.tcMin, timeState.tcRec,
+    leaderVisits, leaderUtility, runnerUpVisits, runnerUpUtility
+  );
+  if(decision == TIME_CONTINUE)
+    return false;
+
+  auto logDecision = [&](const string& what) {
+    logger.write(
+      "Time: " + what + " at " + Global::strprintf("%.2f",timeUsed) + "s" +
+      " (min " + Global::strprintf("%.2f",timeState.tcMin) + " rec " + Global::strprintf("%.2f",timeState.tcRec) +
+      " max " + Global::strprintf("%.2f",timeState.tcMax) + "), best move " + Location::toString(childLocs[leaderIdx],rootBoard) +
+      " visits " + Global::int64ToString(leaderVisits) + " vs " + Global::int64ToString(runnerUpVisits) +
+      ", unchanged for " + Global::strprintf("%.2f",timeSinceChange) + "s"
+    );
+  };
+
+  if(decision == TIME_STOP_STABLE) {
+    logDecision("stopping early, best move is stable,");
+    return true;
+  }
+  if(decision == TIME_EXTEND) {
+    if(!timeState.extended) {
+      timeState.extended = true;
+      logDecision("extending past recommended time, best move is unstable,");
+    }
+    return false;
+  }
+  logDecision(timeState.extended ? "stopping after extending, best move settled," : "stopping at recommended time");
+  return true;
+}
+
+int Search::getTimeDecision(
+  double timeUsed, double timeSinceChange, double tcMin, double tcRec,
+  int64_t leaderVisits, double leaderUtility, int64_t runnerUpVisits, double runnerUpUtility
+) {
+  if(timeUsed < tcMin)
+    return TIME_CONTINUE;
+
+  bool runnerUpThreatens =
+    runnerUpVisits > 0 &&
+    runnerUpVisits >= leaderVisits * TIME_THREAT_MIN_VISIT_RATIO &&
+    runnerUpUtility >= leaderUtility + TIME_THREAT_UTILITY_MARGIN;
+
+  if(timeUsed < tcRec) {
+    bool stable =
+      timeUsed >= tcRec * TIME_EARLY_STOP_MIN_PROP &&
+      timeSinceChange >= timeUsed * TIME_STABLE_PROP &&
+      leaderVisits >= runnerUpVisits * TIME_STABLE_VISIT_RATIO &&
+      !runnerUpThreatens;
+    if(stable)
+      return TIME_STOP_STABLE;
+    return TIME_CONTINUE;
+  }
+
+  bool unstable =
+    timeSinceChange < timeUsed * TIME_UNSTABLE_RECENT_PROP ||
+    runnerUpVisits >= leaderVisits * TIME_CLOSE_VISIT_RATIO ||
+    runnerUpThreatens;
+  if(unstable)
+    return TIME_EXTEND;
+  return TIME_STOP;
+}
+
+//Snapshot of the visits and utilities (from the root player's perspective) of the root's children.
+//Children without any visits yet are given a utility of 1e30 so that they are never assumed to be bad.
+void Search::getRootChildStats(vector<Loc>& locs, vector<int64_t>& visits, vector<double>& utilities) const {
+  locs.clear();
+  visits.clear();
+  utilities.clear();
+  if(rootNode == NULL)
+    return;
+  const SearchNode& node = *rootNode;
+  std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
+  lock_guard<std::mutex> lock(mutex);
+
+  int numChildren = node.numChildren;
+  for(int i = 0; i<numChildren; i++) {
+    const SearchNode* child = node.children[i];
+    while(child->statsLock.test_and_set(std::memory_order_acquire));
+    int64_t childVisits = child->stats.visits;
+    double resultUtilitySum = child->stats.getResultUtilitySum(searchParams);
+    double scoreMeanSum = child->stats.scoreMeanSum;
+    double scoreMeanSqSum = child->stats.scoreMeanSqSum;
+    double valueSumWeight = child->stats.valueSumWeight;
+    child->statsLock.clear(std::memory_order_release);
+
+    locs.push_back(child->prevMoveLoc);
+    visits.push_back(childVisits);
+    if(childVisits <= 0 || valueSumWeight <= 0.0)
+      utilities.push_back(1e30);
+    else {
+      double utility = getUtility(resultUtilitySum, scoreMeanSum, scoreMeanSqSum, valueSumWeight);
+      utilities.push_back(rootPla == P_WHITE ? utility : -utility);
+    }
+  }
+}
+
+//The leader is unassailable if no other child, nor any unexpanded move, could reach the leader's visits even if it received
+//the entire remaining budget (scaled by unassailableBudgetScale). Children with utility worse than the leader's by more than
+//unassailableUtilityMargin are assumed to not be able to attract the remaining budget at all.
+bool Search::isRootLeaderUnassailable(int64_t remainingPlayouts) const {
+  vector<Loc> childLocs;
+  vector<int64_t> childVisits;
+  vector<double> childUtilities;
+  getRootChildStats(childLocs,childVisits,childUtilities);
+  int numChildren = (int)childLocs.size();
+  if(numChildren <= 0)
+    return false;
+
+  int leaderIdx = 0;
+  for(int i = 1; i<numChildren; i++) {
+    if(childVisits[i] > childVisits[leaderIdx])
+      leaderIdx = i;
+  }
+
+  int64_t leaderVisits = childVisits[leaderIdx];
+  double challengerBudget = remainingPlayouts * searchParams.unassailableBudgetScale;
+  //Unexpanded moves start from zero visits
+  if(challengerBudget >= leaderVisits)
+    return false;
+  for(int i = 0; i<numChildren; i++) {
+    if(i == leaderIdx)
+      continue;
+    if(childUtilities[i] < childUtilities[leaderIdx] - searchParams.unassailableUtilityMargin)
+      continue;
+    if(childVisits[i] + challengerBudget >= leaderVisits)
+      return false;
   }
+  return true;
 }
 
 
@@ -729,6 +1024,8 @@ void Search::beginSearch(Logger& logger) {
   if(rootBoard.x_size > posLen || rootBoard.y_size > posLen)
     throw StringError("Search got from NNEval posLen = " + Global::intToString(posLen) + " but was asked to search board with larger x or y size");
   rootBoard.checkConsistency();
+  //Search threads read the root history concurrently, so make sure its lazily-computed superko bans are all filled in now.
+  rootHistory.computeAllSuperKoBans(rootBoard,rootKoHashTable);
 
   numSearchesBegun++;
   computeRootValues(logger);
@@ -827,6 +1124,404 @@ int64_t Search::numRootVisits() {
   return n;
 }
 
+//An nnOutput that is also held by the nn cache or by another node is not counted, since the tree releasing it would
+//not free it, and the nn cache's memory is already bounded by its own size.
+static int64_t getNodeOwnNNOutputBytes(const SearchNode& node) {
+  int64_t bytes = 0;
+  if(node.nnOutput != nullptr && node.nnOutput.use_count() == 1) {
+    bytes += sizeof(NNOutput);
+    if(node.nnOutput->whiteOwnerMap != NULL)
+      bytes += (int64_t)node.nnOutput->posLen * node.nnOutput->posLen * sizeof(float);
+  }
+  return bytes;
+}
+
+static int64_t getNodeOwnBytes(const SearchNode& node) {
+  int64_t bytes = sizeof(SearchNode) + (int64_t)node.childrenCapacity * sizeof(SearchNode*);
+  bytes += getNodeOwnNNOutputBytes(node);
+  if(node.collapsedStats != NULL)
+    bytes += sizeof(NodeStats);
+  return bytes;
+}
+
+//Bytes of a node after collapseNodesRec turns it into a stub
+static int64_t getCollapsedNodeBytes(const SearchNode& node) {
+  return sizeof(SearchNode) + getNodeOwnNNOutputBytes(node) + sizeof(NodeStats);
+}
+
+static void getTreeMemoryUsageRec(const SearchNode& node, int64_t& numNodes, int64_t& numBytes) {
+  numNodes += 1;
+  numBytes += getNodeOwnBytes(node);
+  for(int i = 0; i<node.numChildren; i++)
+    getTreeMemoryUsageRec(*(node.children[i]), numNodes, numBytes);
+}
+
+void Search::getTreeMemoryUsage(int64_t& numNodes, int64_t& numBytes) const {
+  numNodes = 0;
+  numBytes = 0;
+  if(rootNode != NULL)
+    getTreeMemoryUsageRec(*rootNode, numNodes, numBytes);
+}
+
+//For pruning, each non-root node's visits are capped by its parent's so that the set of nodes with visits <= some threshold
+//is always a union of whole subtrees.
+namespace {
+  struct PruneCandidate {
+    int64_t visits;
+    int64_t parentVisits;
+    int64_t fullBytes;
+    int64_t collapsedBytes;
+  };
+}
+
+static void gatherPruneCandidatesRec(const SearchNode& node, int64_t nodeVisits, vector<PruneCandidate>& buf) {
+  for(int i = 0; i<node.numChildren; i++) {
+    const SearchNode& child = *(node.children[i]);
+    int64_t childVisits = std::min(child.stats.visits, nodeVisits);
+    PruneCandidate candidate;
+    candidate.visits = childVisits;
+    candidate.parentVisits = nodeVisits;
+    candidate.fullBytes = getNodeOwnBytes(child);
+    candidate.collapsedBytes = getCollapsedNodeBytes(child);
+    buf.push_back(candidate);
+    gatherPruneCandidatesRec(child, childVisits, buf);
+  }
+}
+
+//A collapsed node keeps its stats and visits so its parent's stats and selection are unaffected, and its nnOutput, but loses its
+//children. It records its stats at this point in collapsedStats, so that if later visited again and it regrows a subtree,
+//recomputeNodeStats can combine them with the values of the regrown subtree for the visits since, rather than replacing the
+//values of all the visits it had with those of the far smaller regrown subtree.
+static void collapseNodesRec(SearchNode& node, int64_t nodeVisits, int64_t threshold) {
+  for(int i = 0; i<node.numChildren; i++) {
+    SearchNode& child = *(node.children[i]);
+    int64_t childVisits = std::min(child.stats.visits, nodeVisits);
+    if(childVisits > threshold)
+      collapseNodesRec(child, childVisits, threshold);
+    else {
+      for(int j = 0; j<child.numChildren; j++)
+        delete child.children[j];
+      delete[] child.children;
+      child.children = NULL;
+      child.numChildren = 0;
+      child.childrenCapacity = 0;
+      if(child.collapsedStats == NULL)
+        child.collapsedStats = new NodeStats();
+      *(child.collapsedStats) = child.stats;
+    }
+  }
+}
+
+void Search::pruneTreeToBytes(int64_t targetBytes, Logger& logger) {
+  if(rootNode == NULL)
+    return;
+  int64_t numNodesBefore;
+  int64_t numBytesBefore;
+  getTreeMemoryUsage(numNodesBefore,numBytesBefore);
+
+  vector<PruneCandidate> candidates;
+  int64_t rootVisits = rootNode->stats.visits;
+  gatherPruneCandidatesRec(*rootNode, rootVisits, candidates);
+
+  int64_t rootBytes = getNodeOwnBytes(*rootNode);
+  auto getBytesAfterCollapse = [&candidates,rootBytes](int64_t threshold) {
+    int64_t bytes = rootBytes;
+    for(size_t i = 0; i<candidates.size(); i++) {
+      const PruneCandidate& candidate = candidates[i];
+      if(candidate.parentVisits <= threshold)
+        continue;
+      bytes += candidate.visits > threshold ? candidate.fullBytes : candidate.collapsedBytes;
+    }
+    return bytes;
+  };
+
+  //Binary search for the smallest visit threshold that gets us under the target
+  vector<int64_t> thresholds;
+  thresholds.reserve(candidates.size());
+  for(size_t i = 0; i<candidates.size(); i++)
+    thresholds.push_back(candidates[i].visits);
+  std::sort(thresholds.begin(),thresholds.end());
+  thresholds.erase(std::unique(thresholds.begin(),thresholds.end()),thresholds.end());
+  if(thresholds.size() <= 0)
+    return;
+
+  size_t lo = 0;
+  size_t hi = thresholds.size()-1;
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if(getBytesAfterCollapse(thresholds[mid]) <= targetBytes)
+      hi = mid;
+    else
+      lo = mid+1;
+  }
+  int64_t threshold = thresholds[lo];
+  collapseNodesRec(*rootNode, rootVisits, threshold);
+
+  int64_t numNodesAfter;
+  int64_t numBytesAfter;
+  getTreeMemoryUsage(numNodesAfter,numBytesAfter);
+  logger.write(
+    "Pruned search tree nodes with <= " + Global::int64ToString(threshold) + " visits, from " +
+    Global::int64ToString(numNodesBefore) + " nodes " + Global::int64ToString(numBytesBefore) + " bytes to " +
+    Global::int64ToString(numNodesAfter) + " nodes " + Global::int64ToString(numBytesAfter) + " bytes"
+  );
+}
+
+//Tree checkpointing----------------------------------------------------------------------------
+//File format (native endianness):
+//  magic, version, posLen, policySize, root situation hash (hash0, hash1)
+//  numNNOutputs, then each distinct NNOutput: nnHash, values, policyProbs[policySize], ownerMapLen, whiteOwnerMap[ownerMapLen]
+//  the nodes in preorder: nextPla, prevMoveLoc, nnOutput index or -1, numChildren, stats, hasCollapsedStats, [collapsedStats]
+//Distinct nodes sharing the same NNOutput (e.g. via transpositions hitting the nn cache) store it only once.
+
+static const char TREE_FILE_MAGIC[8] = {'K','G','T','R','E','E','\0','\0'};
+static const int32_t TREE_FILE_VERSION = 2;
+
+static Hash128 getRootSituationHash(const Search& search) {
+  return NNInputs::getHashV5(search.rootBoard, search.rootHistory, search.rootPla, search.searchParams.drawEquivalentWinsForWhite);
+}
+
+template <typename T>
+static void writeBinary(ostream& out, const T& x) {
+  out.write((const char*)&x, sizeof(T));
+}
+template <typename T>
+static void readBinary(istream& in, T& x, const string& fileName) {
+  in.read((char*)&x, sizeof(T));
+  if(!in)
+    throw StringError("Search tree file " + fileName + " is truncated or unreadable");
+}
+
+static void gatherNNOutputsRec(
+  const SearchNode& node, vector<const NNOutput*>& nnOutputs, std::map<const NNOutput*,int32_t>& nnOutputIdxs
+) {
+  const NNOutput* nnOutput = node.nnOutput.get();
+  if(nnOutput != NULL && nnOutputIdxs.find(nnOutput) == nnOutputIdxs.end()) {
+    nnOutputIdxs[nnOutput] = (int32_t)nnOutputs.size();
+    nnOutputs.push_back(nnOutput);
+  }
+  for(int i = 0; i<node.numChildren; i++)
+    gatherNNOutputsRec(*(node.children[i]), nnOutputs, nnOutputIdxs);
+}
+
+static void writeNodeStats(ostream& out, const NodeStats& stats) {
+  writeBinary(out, stats.visits);
+  writeBinary(out, stats.winValueSum);
+  writeBinary(out, stats.noResultValueSum);
+  writeBinary(out, stats.scoreMeanSum);
+  writeBinary(out, stats.scoreMeanSqSum);
+  writeBinary(out, stats.valueSumWeight);
+}
+static void readNodeStats(istream& in, NodeStats& stats, const string& fileName) {
+  readBinary(in, stats.visits, fileName);
+  readBinary(in, stats.winValueSum, fileName);
+  readBinary(in, stats.noResultValueSum, fileName);
+  readBinary(in, stats.scoreMeanSum, fileName);
+  readBinary(in, stats.scoreMeanSqSum, fileName);
+  readBinary(in, stats.valueSumWeight, fileName);
+}
+
+static void writeNodesRec(ostream& out, const SearchNode& node, const std::map<const NNOutput*,int32_t>& nnOutputIdxs) {
+  writeBinary(out, (int8_t)node.nextPla);
+  writeBinary(out, (int16_t)node.prevMoveLoc);
+  int32_t nnOutputIdx = node.nnOutput == nullptr ? -1 : nnOutputIdxs.find(node.nnOutput.get())->second;
+  writeBinary(out, nnOutputIdx);
+  writeBinary(out, (uint16_t)node.numChildren);
+  writeNodeStats(out, node.stats);
+  writeBinary(out, (int8_t)(node.collapsedStats != NULL));
+  if(node.collapsedStats != NULL)
+    writeNodeStats(out, *(node.collapsedStats));
+  for(int i = 0; i<node.numChildren; i++)
+    writeNodesRec(out, *(node.children[i]), nnOutputIdxs);
+}
+
+void Search::saveTree(const string& fileName) const {
+  if(rootNode == NULL)
+    throw StringError("Cannot save search tree to " + fileName + ", there is no search tree");
+
+  vector<const NNOutput*> nnOutputs;
+  std::map<const NNOutput*,int32_t> nnOutputIdxs;
+  gatherNNOutputsRec(*rootNode, nnOutputs, nnOutputIdxs);
+
+  ofstream out(fileName, std::ios::out | std::ios::binary);
+  if(!out)
+    throw StringError("Could not open file for writing search tree: " + fileName);
+
+  out.write(TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC));
+  writeBinary(out, TREE_FILE_VERSION);
+  writeBinary(out, (int32_t)posLen);
+  writeBinary(out, (int32_t)policySize);
+  Hash128 rootHash = getRootSituationHash(*this);
+  writeBinary(out, rootHash.hash0);
+  writeBinary(out, rootHash.hash1);
+
+  writeBinary(out, (int64_t)nnOutputs.size());
+  for(size_t i = 0; i<nnOutputs.size(); i++) {
+    const NNOutput& nnOutput = *(nnOutputs[i]);
+    writeBinary(out, nnOutput.nnHash.hash0);
+    writeBinary(out, nnOutput.nnHash.hash1);
+    writeBinary(out, nnOutput.whiteWinProb);
+    writeBinary(out, nnOutput.whiteLossProb);
+    writeBinary(out, nnOutput.whiteNoResultProb);
+    writeBinary(out, nnOutput.whiteScoreMean);
+    writeBinary(out, nnOutput.whiteScoreMeanSq);
+    out.write((const char*)nnOutput.policyProbs, sizeof(float) * policySize);
+    int32_t ownerMapLen = nnOutput.whiteOwnerMap == NULL ? 0 : nnOutput.posLen * nnOutput.posLen;
+    writeBinary(out, (int32_t)nnOutput.posLen);
+    writeBinary(out, ownerMapLen);
+    if(ownerMapLen > 0)
+      out.write((const char*)nnOutput.whiteOwnerMap, sizeof(float) * ownerMapLen);
+  }
+
+  writeNodesRec(out, *rootNode, nnOutputIdxs);
+
+  out.close();
+  if(!out)
+    throw StringError("Error when writing search tree to " + fileName);
+}
+
+//board and hist are the position that this node's move is made from, or the position of the node itself if it is the root
+static SearchNode* readNodesRec(
+  istream& in, Search& search, SearchThread& dummyThread, const Board& board, const BoardHistory& hist, bool isRoot,
+  Player expectedPla, const vector<shared_ptr<NNOutput>>& nnOutputs, const string& fileName
+) {
+  int8_t nextPla;
+  int16_t prevMoveLoc;
+  int32_t nnOutputIdx;
+  uint16_t numChildren;
+  readBinary(in, nextPla, fileName);
+  readBinary(in, prevMoveLoc, fileName);
+  readBinary(in, nnOutputIdx, fileName);
+  readBinary(in, numChildren, fileName);
+  if(nextPla != expectedPla)
+    throw StringError("Search tree file " + fileName + " has a node with an unexpected player to move");
+  if(isRoot && prevMoveLoc != Board::NULL_LOC)
+    throw StringError("Search tree file " + fileName + " has a root node with a move");
+  if(!isRoot && !hist.isLegal(board, (Loc)prevMoveLoc, getOpp(expectedPla)))
+    throw StringError("Search tree file " + fileName + " has a node with an illegal move");
+  if(nnOutputIdx < -1 || nnOutputIdx >= (int64_t)nnOutputs.size())
+    throw StringError("Search tree file " + fileName + " has a node with an invalid nnOutput index");
+  if(numChildren > search.policySize || (numChildren > 0 && nnOutputIdx < 0))
+    throw StringError("Search tree file " + fileName + " has a node with an invalid number of children");
+
+  dummyThread.pla = (Player)nextPla;
+  SearchNode* node = new SearchNode(search, dummyThread, (Loc)prevMoveLoc);
+  try {
+    if(nnOutputIdx >= 0)
+      node->nnOutput = nnOutputs[nnOutputIdx];
+    readNodeStats(in, node->stats, fileName);
+    int8_t hasCollapsedStats;
+    readBinary(in, hasCollapsedStats, fileName);
+    if(hasCollapsedStats != 0) {
+      node->collapsedStats = new NodeStats();
+      readNodeStats(in, *(node->collapsedStats), fileName);
+    }
+    if(numChildren > 0) {
+      //The position at this node, that the children's moves are made from
+      Board nodeBoard = board;
+      BoardHistory nodeHist = hist;
+      if(!isRoot)
+        nodeHist.makeBoardMoveAssumeLegal(nodeBoard, (Loc)prevMoveLoc, getOpp(expectedPla), NULL);
+      node->children = new SearchNode*[numChildren];
+      node->childrenCapacity = numChildren;
+      for(int i = 0; i<numChildren; i++) {
+        node->children[i] = readNodesRec(in, search, dummyThread, nodeBoard, nodeHist, false, getOpp((Player)nextPla), nnOutputs, fileName);
+        node->numChildren = i+1;
+      }
+    }
+  }
+  catch(...) {
+    delete node;
+    throw;
+  }
+  return node;
+}
+
+bool Search::loadTree(const string& fileName, Logger& logger) {
+  ifstream in(fileName, std::ios::in | std::ios::binary);
+  if(!in)
+    throw StringError("Could not open search tree file: " + fileName);
+
+  char magic[sizeof(TREE_FILE_MAGIC)];
+  in.read(magic, sizeof(magic));
+  if(!in || !std::equal(magic, magic + sizeof(magic), TREE_FILE_MAGIC))
+    throw StringError("File is not a search tree file: " + fileName);
+  int32_t version;
+  int32_t filePosLen;
+  int32_t filePolicySize;
+  Hash128 fileRootHash;
+  readBinary(in, version, fileName);
+  if(version != TREE_FILE_VERSION)
+    throw StringError("Search tree file " + fileName + " has unsupported version " + Global::intToString(version));
+  readBinary(in, filePosLen, fileName);
+  readBinary(in, filePolicySize, fileName);
+  readBinary(in, fileRootHash.hash0, fileName);
+  readBinary(in, fileRootHash.hash1, fileName);
+
+  if(filePosLen != posLen || filePolicySize != policySize) {
+    logger.write(
+      "Not loading search tree from " + fileName + ", it was saved with posLen " + Global::intToString(filePosLen) +
+      " but the current neural net uses posLen " + Global::intToString(posLen)
+    );
+    return false;
+  }
+  Hash128 rootHash = getRootSituationHash(*this);
+  if(fileRootHash != rootHash) {
+    ostringstream sout;
+    sout << "Not loading search tree from " << fileName << ", it was saved for root hash " << fileRootHash
+         << " but the current root hash is " << rootHash;
+    logger.write(sout.str());
+    return false;
+  }
+
+  int64_t numNNOutputs;
+  readBinary(in, numNNOutputs, fileName);
+  if(numNNOutputs < 0)
+    throw StringError("Search tree file " + fileName + " has an invalid number of nnOutputs");
+  vector<shared_ptr<NNOutput>> nnOutputs;
+  for(int64_t i = 0; i<numNNOutputs; i++) {
+    shared_ptr<NNOutput> nnOutput = std::make_shared<NNOutput>();
+    readBinary(in, nnOutput->nnHash.hash0, fileName);
+    readBinary(in, nnOutput->nnHash.hash1, fileName);
+    readBinary(in, nnOutput->whiteWinProb, fileName);
+    readBinary(in, nnOutput->whiteLossProb, fileName);
+    readBinary(in, nnOutput->whiteNoResultProb, fileName);
+    readBinary(in, nnOutput->whiteScoreMean, fileName);
+    readBinary(in, nnOutput->whiteScoreMeanSq, fileName);
+    std::fill(nnOutput->policyProbs, nnOutput->policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+    in.read((char*)nnOutput->policyProbs, sizeof(float) * policySize);
+    int32_t nnPosLen;
+    int32_t ownerMapLen;
+    readBinary(in, nnPosLen, fileName);
+    readBinary(in, ownerMapLen, fileName);
+    if(nnPosLen != posLen || (ownerMapLen != 0 && ownerMapLen != posLen * posLen))
+      throw StringError("Search tree file " + fileName + " has an nnOutput of invalid size");
+    nnOutput->posLen = nnPosLen;
+    if(ownerMapLen > 0) {
+      nnOutput->whiteOwnerMap = new float[ownerMapLen];
+      in.read((char*)nnOutput->whiteOwnerMap, sizeof(float) * ownerMapLen);
+    }
+    if(!in)
+      throw StringError("Search tree file " + fileName + " is truncated or unreadable");
+    nnOutputs.push_back(nnOutput);
+  }
+
+  SearchThread dummyThread(-1, *this, &logger);
+  SearchNode* node = readNodesRec(in, *this, dummyThread, rootBoard, rootHistory, true, rootPla, nnOutputs, fileName);
+
+  clearSearch();
+  rootNode = node;
+
+  int64_t numNodes;
+  int64_t numBytes;
+  getTreeMemoryUsage(numNodes,numBytes);
+  logger.write(
+    "Loaded search tree from " + fileName + " with " + Global::int64ToString(rootNode->stats.visits) + " root visits, " +
+    Global::int64ToString(numNodes) + " nodes " + Global::int64ToString(numBytes) + " bytes"
+  );
+  return true;
+}
+
 //Assumes node is locked
 void Search::maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool isRoot) const {
   if(!isRoot)
@@ -1442,6 +2137,19 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
 
   while(node.statsLock.test_and_set(std::memory_order_acquire));
   node.stats.visits += numVisitsToAdd;
+  //If this node's subtree was pruned, the values above only reflect the regrown subtree, so use them only for the visits since
+  //then, with the same weight per visit as it had when it was pruned.
+  if(node.collapsedStats != NULL && node.collapsedStats->visits > 0 && node.collapsedStats->valueSumWeight > 0.0) {
+    const NodeStats& collapsedStats = *(node.collapsedStats);
+    int64_t visitsSinceCollapse = std::max(node.stats.visits - collapsedStats.visits, (int64_t)0);
+    double newWeight = visitsSinceCollapse * collapsedStats.valueSumWeight / collapsedStats.visits;
+    double scale = newWeight / valueSumWeight;
+    winValueSum = collapsedStats.winValueSum + winValueSum * scale;
+    noResultValueSum = collapsedStats.noResultValueSum + noResultValueSum * scale;
+    scoreMeanSum = collapsedStats.scoreMeanSum + scoreMeanSum * scale;
+    scoreMeanSqSum = collapsedStats.scoreMeanSqSum + scoreMeanSqSum * scale;
+    valueSumWeight = collapsedStats.valueSumWeight + newWeight;
+  }
   //It's possible that these values are a bit wrong if there's a race and two threads each try to update this
   //each of them only having some of the latest updates for all the children. We just accept this and let the
   //error persist, it will get fixed the next time a visit comes through here and the values will at least
@@ -1482,6 +2190,8 @@ void Search::initNodeNNOutput(
   bool isRoot, bool skipCache, int32_t virtualLossesToSubtract, bool isReInit
 ) {
   bool includeOwnerMap = isRoot;
+  //Featurizing queries the superko bans, so fill them in using the root ko hash table rather than the whole history
+  thread.history.computeAllSuperKoBans(thread.board,rootKoHashTable);
   nnEvaluator->evaluate(
     thread.board, thread.history, thread.pla,
     searchParams.drawEquivalentWinsForWhite,
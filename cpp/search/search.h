@@ -19,6 +19,7 @@ struct SearchNode;
 struct SearchThread;
 struct Search;
 struct DistributionTable;
+struct SearchTimeState;
 
 struct NodeStats {
   int64_t visits;
@@ -54,6 +55,10 @@ struct SearchNode {
   uint16_t numChildren;
   uint16_t childrenCapacity;
 
+  //Stats as of when this node's subtree was pruned to save memory, or NULL if it never was, see Search::pruneTreeToBytes.
+  //Only set while no search threads are running.
+  NodeStats* collapsedStats;
+
   //Lightweight mutable---------------------------------------------------------------
   //Protected under statsLock
   NodeStats stats;
@@ -126,6 +131,10 @@ struct Search {
   //Mutable---------------------------------------------------------------
   SearchNode* rootNode;
 
+  //Stats about the most recent runWholeSearch
+  //Estimated number of playouts of budget left unused due to stopWhenLeaderUnassailable, or 0 if the search was not stopped early.
+  int64_t lastSearchEarlyStopSavedPlayouts;
+
   //Services--------------------------------------------------------------
   MutexPool* mutexPool;
   NNEvaluator* nnEvaluator; //externally owned
@@ -182,6 +191,18 @@ struct Search {
     vector<Loc>& locs, vector<double>& playSelectionValues, int64_t& unreducedNumVisitsBuf, double scaleMaxToAtLeast
   ) const;
 
+  //Decisions of dynamicTimeControls, returned by getTimeDecision
+  static constexpr int TIME_CONTINUE = 0;
+  static constexpr int TIME_STOP_STABLE = 1; //stop before the recommended time, the best move is stable
+  static constexpr int TIME_EXTEND = 2; //keep going past the recommended time, the best move is unstable
+  static constexpr int TIME_STOP = 3; //stop at or after the recommended time
+  //What dynamicTimeControls decides given the time used, how long ago the best move last changed, and the visits
+  //and utilities (from the root player's perspective) of the best move and the runner-up. Exposed for testing.
+  static int getTimeDecision(
+    double timeUsed, double timeSinceChange, double tcMin, double tcRec,
+    int64_t leaderVisits, double leaderUtility, int64_t runnerUpVisits, double runnerUpUtility
+  );
+
   //Useful utility function exposed for outside use
   static uint32_t chooseIndexWithTemperature(Rand& rand, const double* relativeProbs, int numRelativeProbs, double temperature);
 
@@ -228,6 +249,19 @@ struct Search {
 
   int64_t numRootVisits();
 
+  //Count the nodes in the tree and estimate the bytes of memory they use, including their nnOutputs.
+  //Not threadsafe, should only be called when no search is running.
+  void getTreeMemoryUsage(int64_t& numNodes, int64_t& numBytes) const;
+
+  //Save the search tree to a binary file, including the nnOutputs of the nodes, so that it can be reloaded later.
+  //Not threadsafe, should only be called when no search is running. Throws StringError on failure.
+  void saveTree(const string& fileName) const;
+  //Load a search tree saved by saveTree, replacing the current tree, if it was saved from the same root position
+  //and nn board size as the current one. Returns false and leaves the current tree unchanged if not.
+  //Not threadsafe, should only be called when no search is running. Throws StringError if the file is corrupt,
+  //including if any move in the tree is illegal in the position it is made from.
+  bool loadTree(const string& fileName, Logger& logger);
+
   //Helpers-----------------------------------------------------------------------
 private:
   void maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool isRoot) const;
@@ -262,6 +296,10 @@ private:
   double getExploreSelectionValue(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const;
   double getNewExploreSelectionValue(const SearchNode& parent, int movePos, int64_t totalChildVisits, double fpuValue) const;
 
+  void getRootChildStats(vector<Loc>& locs, vector<int64_t>& visits, vector<double>& utilities) const;
+  bool isRootLeaderUnassailable(int64_t remainingPlayouts) const;
+  bool shouldStopForTime(SearchTimeState& timeState, double timeUsed, Logger& logger) const;
+
   double getReducedPlaySelectionValue(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double bestChildExploreSelectionValue) const;
 
   void updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int32_t virtualLossesToSubtract, bool isRoot);
@@ -286,6 +324,8 @@ private:
     bool isRoot, int32_t virtualLossesToSubtract
   );
 
+  void pruneTreeToBytes(int64_t targetBytes, Logger& logger);
+
   void printTreeHelper(
     ostream& out, const SearchNode* node, const PrintTreeOptions& options,
     string& prefix, int64_t origVisits, int depth, double policyProb, double valueWeight
@@ -41,6 +41,11 @@ SearchParams::SearchParams()
    maxPlayoutsPondering(((int64_t)1) << 50),
    maxTimePondering(1.0e20),
    lagBuffer(0.0),
+   dynamicTimeControls(false),
+   maxTreeBytes(((int64_t)1) << 60),
+   stopWhenLeaderUnassailable(false),
+   unassailableBudgetScale(1.0),
+   unassailableUtilityMargin(1.0e10),
    searchFactorAfterOnePass(1.0),
    searchFactorAfterTwoPass(1.0)
 {}
@@ -61,6 +61,19 @@ struct SearchParams {
 
   //Amount of time to reserve for lag when using a time control
   double lagBuffer;
+  //When using a time control, stop before the recommended time (down to the min time) if the best move is stable, and extend
+  //toward the max time if the best move changed recently or is close, rather than always using the recommended time.
+  bool dynamicTimeControls;
+
+  //Memory cap on the search tree. When exceeded, low-visit subtrees are collapsed into stub nodes that drop their children
+  //but keep their nnOutput and stats, with a frozen copy of the stats so that a regrown subtree adds to them.
+  //Only nnOutputs owned by the tree alone count towards the cap, not ones also held by the nn cache or other nodes.
+  int64_t maxTreeBytes;
+
+  //Early stopping when the most-visited root child can no longer be overtaken within the remaining visits/playouts/time.
+  bool stopWhenLeaderUnassailable;
+  double unassailableBudgetScale; //Assume only this proportion of the remaining budget could go to a single challenger, lower is more aggressive
+  double unassailableUtilityMargin; //Children with utility worse than the leader's by more than this are not considered challengers
 
   //Human-friendliness
   double searchFactorAfterOnePass; //Multiply playouts and visits and time by this much after a pass by the opponent
@@ -5,6 +5,7 @@
 #include "core/threadsafequeue.h"
 #include "dataio/sgf.h"
 #include "dataio/trainingwrite.h"
+#include "dataio/gamerecord.h"
 #include "dataio/loadmodel.h"
 #include "search/asyncbot.h"
 #include "program/setup.h"
@@ -18,6 +19,7 @@ using namespace std;
 #include <tclap/CmdLine.h>
 
 #include <chrono>
+#include <boost/fiber/all.hpp>
 
 #include <csignal>
 static std::atomic<bool> sigReceived(false);
@@ -52,12 +54,13 @@ namespace {
     TrainingDataWriter* tdataWriter;
     TrainingDataWriter* vdataWriter;
     ofstream* sgfOut;
+    GameRecordWriter* recordOut;
     Rand rand;
 
   public:
     NetAndStuff(
       ConfigParser& cfg, const string& name, NNEvaluator* neval, int maxDQueueSize,
-      TrainingDataWriter* tdWriter, TrainingDataWriter* vdWriter, ofstream* sOut, double vProp
+      TrainingDataWriter* tdWriter, TrainingDataWriter* vdWriter, ofstream* sOut, GameRecordWriter* rOut, double vProp
     )
       :modelName(name),
        nnEval(neval),
@@ -69,6 +72,7 @@ namespace {
        tdataWriter(tdWriter),
        vdataWriter(vdWriter),
        sgfOut(sOut),
+       recordOut(rOut),
        rand()
     {
       vector<SearchParams> paramss = Setup::loadParams(cfg);
@@ -90,6 +94,8 @@ namespace {
       delete vdataWriter;
       if(sgfOut != NULL)
         delete sgfOut;
+      if(recordOut != NULL)
+        delete recordOut;
     }
 
     void runWriteDataLoop(Logger& logger) {
@@ -112,6 +118,8 @@ namespace {
           WriteSgf::writeSgf(*sgfOut,data->bName,data->wName,data->startHist.rules,data->endHist,data);
           (*sgfOut) << endl;
         }
+        if(recordOut != NULL)
+          recordOut->writeGame(*data);
         delete data;
       }
 
@@ -119,6 +127,8 @@ namespace {
       vdataWriter->flushIfNonempty();
       if(sgfOut != NULL)
         sgfOut->close();
+      if(recordOut != NULL)
+        recordOut->close();
     }
 
     //NOT threadsafe - needs to be externally synchronized
@@ -201,6 +211,10 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
 
   //Load runner settings
   const int numGameThreads = cfg.getInt("numGameThreads",1,16384);
+  //Optionally run many games per OS thread, each one in its own fiber that suspends while waiting on the neural net
+  const int numGamesPerGameThread = cfg.contains("numGamesPerGameThread") ? cfg.getInt("numGamesPerGameThread",1,65536) : 1;
+  const int gameFiberStackSizeKB = cfg.contains("gameFiberStackSizeKB") ? cfg.getInt("gameFiberStackSizeKB",64,65536) : 1024;
+  const int numGamesConcurrent = numGameThreads * numGamesPerGameThread;
   const string searchRandSeedBase = Global::uint64ToHexString(seedRand.nextUInt64());
 
   //Width of the board to use when writing data, typically 19
@@ -210,6 +224,10 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
   const int maxRowsPerTrainFile = cfg.getInt("maxRowsPerTrainFile",1,100000000);
   const int maxRowsPerValFile = cfg.getInt("maxRowsPerValFile",1,100000000);
   const double firstFileRandMinProp = cfg.getDouble("firstFileRandMinProp",0.0,1.0);
+  //Write policy targets as only their nonzero entries, which shuffle.py and the shuffle command know how to read
+  const bool dataSparsePolicyTargets = cfg.contains("dataSparsePolicyTargets") ? cfg.getBool("dataSparsePolicyTargets") : false;
+  //Write finished games as sgf text, as compact binary game records that the exportgamerecords command can turn into sgfs, or both
+  const string gameOutputFormat = cfg.contains("gameOutputFormat") ? cfg.getString("gameOutputFormat",{"sgf","record","both"}) : "sgf";
 
   const double validationProp = cfg.getDouble("validationProp",0.0,0.5);
 
@@ -305,8 +323,8 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
   };
 
   auto loadLatestNeuralNet =
-    [inputsVersion,maxDataQueueSize,maxRowsPerTrainFile,maxRowsPerValFile,firstFileRandMinProp,dataPosLen,
-     &modelsDir,&outputDir,&logger,&cfg,validationProp,numGameThreads](const string* lastNetName) -> NetAndStuff* {
+    [inputsVersion,maxDataQueueSize,maxRowsPerTrainFile,maxRowsPerValFile,firstFileRandMinProp,dataPosLen,dataSparsePolicyTargets,gameOutputFormat,
+     &modelsDir,&outputDir,&logger,&cfg,validationProp,numGamesConcurrent](const string* lastNetName) -> NetAndStuff* {
 
     string modelName;
     string modelFile;
@@ -322,7 +340,7 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
 
     bool debugSkipNeuralNetDefault = (modelFile == "/dev/null");
     // * 2 + 16 just in case to have plenty of room
-    int maxConcurrentEvals = cfg.getInt("numSearchThreads") * numGameThreads * 2 + 16;
+    int maxConcurrentEvals = cfg.getInt("numSearchThreads") * numGamesConcurrent * 2 + 16;
 
     Rand rand;
     vector<NNEvaluator*> nnEvals = Setup::initializeNNEvaluators({modelName},{modelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefault);
@@ -331,7 +349,8 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
     logger.write("Loaded latest neural net " + modelName + " from: " + modelFile);
 
     string modelOutputDir = outputDir + "/" + modelName;
-    string sgfOutputDir = modelOutputDir + "/sgfs";
+    string sgfOutputDir = gameOutputFormat != "record" ? modelOutputDir + "/sgfs" : string();
+    string recordOutputDir = gameOutputFormat != "sgf" ? modelOutputDir + "/records" : string();
     string tdataOutputDir = modelOutputDir + "/tdata";
     string vdataOutputDir = modelOutputDir + "/vdata";
     assert(outputDir != string());
@@ -343,7 +362,10 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
       bool success = false;
       try {
         MakeDir::make(modelOutputDir);
-        MakeDir::make(sgfOutputDir);
+        if(sgfOutputDir.length() > 0)
+          MakeDir::make(sgfOutputDir);
+        if(recordOutputDir.length() > 0)
+          MakeDir::make(recordOutputDir);
         MakeDir::make(tdataOutputDir);
         MakeDir::make(vdataOutputDir);
         success = true;
@@ -379,8 +401,11 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
       tdataOutputDir, inputsVersion, maxRowsPerTrainFile, firstFileRandMinProp, dataPosLen, Global::uint64ToHexString(rand.nextUInt64()));
     TrainingDataWriter* vdataWriter = new TrainingDataWriter(
       vdataOutputDir, inputsVersion, maxRowsPerValFile, firstFileRandMinProp, dataPosLen, Global::uint64ToHexString(rand.nextUInt64()));
+    tdataWriter->setSparsePolicyTargets(dataSparsePolicyTargets);
+    vdataWriter->setSparsePolicyTargets(dataSparsePolicyTargets);
     ofstream* sgfOut = sgfOutputDir.length() > 0 ? (new ofstream(sgfOutputDir + "/" + Global::uint64ToHexString(rand.nextUInt64()) + ".sgfs")) : NULL;
-    NetAndStuff* newNet = new NetAndStuff(cfg, modelName, nnEval, maxDataQueueSize, tdataWriter, vdataWriter, sgfOut, validationProp);
+    GameRecordWriter* recordOut = recordOutputDir.length() > 0 ? (new GameRecordWriter(recordOutputDir + "/" + Global::uint64ToHexString(rand.nextUInt64()) + ".grec")) : NULL;
+    NetAndStuff* newNet = new NetAndStuff(cfg, modelName, nnEval, maxDataQueueSize, tdataWriter, vdataWriter, sgfOut, recordOut, validationProp);
     return newNet;
   };
 
@@ -549,9 +574,31 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
   };
 
 
+  //Each OS thread runs numGamesPerGameThread games as fibers under the default round-robin scheduler. Fibers
+  //never migrate between threads, and only yield to each other while waiting for neural net evaluations,
+  //so the thread-affine locking elsewhere (which is never held across an evaluation) stays valid.
+  auto gameThreadLoop = [&gameLoop,numGamesPerGameThread,gameFiberStackSizeKB](int threadIdx) {
+    if(numGamesPerGameThread <= 1) {
+      gameLoop(threadIdx);
+      return;
+    }
+    vector<boost::fibers::fiber> fibers;
+    for(int i = 0; i<numGamesPerGameThread; i++) {
+      int gameLoopIdx = threadIdx * numGamesPerGameThread + i;
+      fibers.push_back(boost::fibers::fiber(
+        std::allocator_arg,
+        boost::fibers::protected_fixedsize_stack((size_t)gameFiberStackSizeKB * 1024),
+        gameLoop,
+        gameLoopIdx
+      ));
+    }
+    for(int i = 0; i<numGamesPerGameThread; i++)
+      fibers[i].join();
+  };
+
   vector<std::thread> threads;
   for(int i = 0; i<numGameThreads; i++) {
-    threads.push_back(std::thread(gameLoop,i));
+    threads.push_back(std::thread(gameThreadLoop,i));
   }
   std::thread modelLoadLoopThread(modelLoadLoop);
 
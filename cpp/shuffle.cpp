@@ -0,0 +1,735 @@
+#include "core/global.h"
+#include "core/makedir.h"
+#include "core/rand.h"
+#include "core/timer.h"
+#include "dataio/numpyread.h"
+#include "dataio/numpywrite.h"
+#include "dataio/tfrecordwrite.h"
+#include "dataio/trainingwrite.h"
+#include "main.h"
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstring>
+#include <memory>
+#include <boost/filesystem.hpp>
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+//Native replacement for python/shuffle.py's sharding and merging.
+//Pass 1 scatters every row of every input npz file to a randomly chosen shard file in the tmp dir.
+//Pass 2 loads one shard at a time per thread, shuffles it in memory, and writes it out the same way as
+//python/shuffle.py, as a zlib-compressed TFRecord file of one tf.train.Example per batch, along with a json file
+//recording its number of rows and batches. Rows beyond the last whole batch are dropped, as in python/shuffle.py.
+//So the memory used is about one input file plus one output file per thread, regardless of the total data size.
+//Input files with sparse policy targets (see TrainingWriteBuffers) are expanded, the output is always dense.
+
+static const int NUM_SHUFFLE_ARRAYS = 7;
+static const char* SHUFFLE_ARRAY_NAMES[NUM_SHUFFLE_ARRAYS] = {
+  "binaryInputNCHWPacked",
+  "globalInputNC",
+  "policyTargetsNCMove",
+  "globalTargetsNC",
+  "scoreDistrN",
+  "selfBonusScoreN",
+  "valueTargetsNCHW",
+};
+
+//The same arrays with the same types as TrainingWriteBuffers, with the leading dimension being the number of rows
+struct ShuffleBuffers {
+  int64_t numRows;
+  NumpyBuffer<uint8_t> binaryInputNCHWPacked;
+  NumpyBuffer<float> globalInputNC;
+  NumpyBuffer<int16_t> policyTargetsNCMove;
+  NumpyBuffer<float> globalTargetsNC;
+  NumpyBuffer<int8_t> scoreDistrN;
+  NumpyBuffer<int8_t> selfBonusScoreN;
+  NumpyBuffer<int8_t> valueTargetsNCHW;
+
+  ShuffleBuffers(int64_t nRows, const vector<vector<int64_t>>& rowShapes);
+  ~ShuffleBuffers();
+  ShuffleBuffers(const ShuffleBuffers&) = delete;
+  ShuffleBuffers& operator=(const ShuffleBuffers&) = delete;
+
+  char* getData(int arrayIdx);
+  const string& getDtype(int arrayIdx) const;
+  int64_t getRowBytes(int arrayIdx);
+  //Write the rows in batches as tf.train.Examples, returns the number of batches written
+  int64_t writeToTFRecordFile(const string& fileName, int64_t batchSize);
+};
+
+static vector<int64_t> withNumRows(int64_t numRows, const vector<int64_t>& rowShape) {
+  vector<int64_t> shape;
+  //NumpyBuffer can't be allocated with zero rows, but can still be written with zero rows
+  shape.push_back(std::max(numRows,(int64_t)1));
+  shape.insert(shape.end(),rowShape.begin(),rowShape.end());
+  return shape;
+}
+
+ShuffleBuffers::ShuffleBuffers(int64_t nRows, const vector<vector<int64_t>>& rowShapes)
+  :numRows(nRows),
+   binaryInputNCHWPacked(withNumRows(nRows,rowShapes[0])),
+   globalInputNC(withNumRows(nRows,rowShapes[1])),
+   policyTargetsNCMove(withNumRows(nRows,rowShapes[2])),
+   globalTargetsNC(withNumRows(nRows,rowShapes[3])),
+   scoreDistrN(withNumRows(nRows,rowShapes[4])),
+   selfBonusScoreN(withNumRows(nRows,rowShapes[5])),
+   valueTargetsNCHW(withNumRows(nRows,rowShapes[6]))
+{}
+
+ShuffleBuffers::~ShuffleBuffers()
+{}
+
+char* ShuffleBuffers::getData(int arrayIdx) {
+  switch(arrayIdx) {
+  case 0: return (char*)binaryInputNCHWPacked.data;
+  case 1: return (char*)globalInputNC.data;
+  case 2: return (char*)policyTargetsNCMove.data;
+  case 3: return (char*)globalTargetsNC.data;
+  case 4: return (char*)scoreDistrN.data;
+  case 5: return (char*)selfBonusScoreN.data;
+  case 6: return (char*)valueTargetsNCHW.data;
+  default: assert(false); return NULL;
+  }
+}
+
+const string& ShuffleBuffers::getDtype(int arrayIdx) const {
+  switch(arrayIdx) {
+  case 0: return binaryInputNCHWPacked.dtype;
+  case 1: return globalInputNC.dtype;
+  case 2: return policyTargetsNCMove.dtype;
+  case 3: return globalTargetsNC.dtype;
+  case 4: return scoreDistrN.dtype;
+  case 5: return selfBonusScoreN.dtype;
+  case 6: return valueTargetsNCHW.dtype;
+  default: assert(false); return binaryInputNCHWPacked.dtype;
+  }
+}
+
+int64_t ShuffleBuffers::getRowBytes(int arrayIdx) {
+  switch(arrayIdx) {
+  case 0: return binaryInputNCHWPacked.getActualDataLen(1) * sizeof(uint8_t);
+  case 1: return globalInputNC.getActualDataLen(1) * sizeof(float);
+  case 2: return policyTargetsNCMove.getActualDataLen(1) * sizeof(int16_t);
+  case 3: return globalTargetsNC.getActualDataLen(1) * sizeof(float);
+  case 4: return scoreDistrN.getActualDataLen(1) * sizeof(int8_t);
+  case 5: return selfBonusScoreN.getActualDataLen(1) * sizeof(int8_t);
+  case 6: return valueTargetsNCHW.getActualDataLen(1) * sizeof(int8_t);
+  default: assert(false); return 0;
+  }
+}
+
+//Feature names used by python/shuffle.py and python/train.py, in the same order as SHUFFLE_ARRAY_NAMES
+static const char* TFRECORD_FEATURE_NAMES[NUM_SHUFFLE_ARRAYS] = {
+  "binchwp",
+  "ginc",
+  "ptncm",
+  "gtnc",
+  "sdn",
+  "sbsn",
+  "vtnchw",
+};
+
+//python/shuffle.py writes every array but binaryInputNCHWPacked as floats
+template <typename T>
+static void addFloatRows(
+  TFExampleBuilder& example, int arrayIdx, NumpyBuffer<T>& buf, int64_t startRow, int64_t numRowsToAdd, vector<float>& tmp
+) {
+  int64_t rowLen = buf.getActualDataLen(1);
+  tmp.resize(rowLen * numRowsToAdd);
+  const T* src = buf.data + rowLen * startRow;
+  for(size_t i = 0; i<tmp.size(); i++)
+    tmp[i] = (float)src[i];
+  example.addFloats(TFRECORD_FEATURE_NAMES[arrayIdx], tmp.data(), tmp.size());
+}
+
+int64_t ShuffleBuffers::writeToTFRecordFile(const string& fileName, int64_t batchSize) {
+  TFRecordWriter writer(fileName);
+  TFExampleBuilder example;
+  vector<float> tmp;
+  int64_t numBatches = numRows / batchSize;
+  for(int64_t b = 0; b<numBatches; b++) {
+    int64_t start = b * batchSize;
+    example.clear();
+    int64_t binaryRowBytes = getRowBytes(0);
+    example.addBytes(TFRECORD_FEATURE_NAMES[0], (const char*)binaryInputNCHWPacked.data + start * binaryRowBytes, batchSize * binaryRowBytes);
+    addFloatRows(example, 1, globalInputNC, start, batchSize, tmp);
+    addFloatRows(example, 2, policyTargetsNCMove, start, batchSize, tmp);
+    addFloatRows(example, 3, globalTargetsNC, start, batchSize, tmp);
+    addFloatRows(example, 4, scoreDistrN, start, batchSize, tmp);
+    addFloatRows(example, 5, selfBonusScoreN, start, batchSize, tmp);
+    addFloatRows(example, 6, valueTargetsNCHW, start, batchSize, tmp);
+    string serialized = example.serialize();
+    writer.writeRecord(serialized.data(), serialized.size());
+  }
+  writer.close();
+  return numBatches;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+//Shape of one array of an npz file, without reading its data
+struct NpyHeader {
+  string dtype;
+  vector<int64_t> shape;
+};
+
+//Files written with sparse policy targets have these instead of policyTargetsNCMove, see TrainingWriteBuffers
+static const int POLICY_TARGETS_ARRAY_IDX = 2;
+static bool hasSparsePolicyTargets(const ZipReader& zip) {
+  return !zip.contains(SHUFFLE_ARRAY_NAMES[POLICY_TARGETS_ARRAY_IDX]) && zip.contains("policyTargetsSparseShape");
+}
+
+//View of an array in an npz file, in place if it is stored without compression, else decompressed into buf
+static NumpyArrayView readNpzArray(const ZipReader& zip, const string& name, string& buf) {
+  if(zip.isStored(name))
+    return NumpyArrayView(zip.getStoredData(name),zip.getSize(name));
+  zip.readAll(name,buf);
+  return NumpyArrayView(buf.data(),buf.size());
+}
+
+//The dense shape [N,C,Pos] of sparse policy targets
+static vector<int64_t> readSparsePolicyTargetsShape(const ZipReader& zip) {
+  string buf;
+  NumpyArrayView view = readNpzArray(zip,"policyTargetsSparseShape",buf);
+  if(view.dtype != NumpyBuffer<int64_t>({1}).dtype || view.shape != vector<int64_t>({3}))
+    throw IOError(zip.getFileName() + ": policyTargetsSparseShape has a different dtype or shape than expected");
+  vector<int64_t> shape(3);
+  std::memcpy(shape.data(),view.getRowBytes(0,3),3 * sizeof(int64_t));
+  for(int i = 0; i<3; i++) {
+    if(shape[i] < 0 || shape[i] > 0x7FFFFFFF)
+      throw IOError(zip.getFileName() + ": policyTargetsSparseShape has an invalid shape");
+  }
+  return shape;
+}
+
+//Expand sparse policy targets into buf as a whole npy file, just as if policyTargetsNCMove had been stored
+static NumpyArrayView readSparsePolicyTargets(const ZipReader& zip, string& buf) {
+  vector<int64_t> shape = readSparsePolicyTargetsShape(zip);
+  string offsetsBuf;
+  string entriesBuf;
+  NumpyArrayView offsets = readNpzArray(zip,"policyTargetsSparseOffsetsNC",offsetsBuf);
+  NumpyArrayView entries = readNpzArray(zip,"policyTargetsSparseEntries",entriesBuf);
+  if(offsets.dtype != NumpyBuffer<int32_t>({1}).dtype || offsets.shape != vector<int64_t>({shape[0],shape[1]}))
+    throw IOError(zip.getFileName() + ": policyTargetsSparseOffsetsNC has a different dtype or shape than expected");
+  if(entries.dtype != NumpyBuffer<int16_t>({1}).dtype || entries.shape.size() != 2 || entries.shape[1] != 2)
+    throw IOError(zip.getFileName() + ": policyTargetsSparseEntries has a different dtype or shape than expected");
+
+  NumpyBuffer<int16_t> policyTargets({std::max(shape[0],(int64_t)1),shape[1],shape[2]});
+  TrainingWriteBuffers::decodeSparsePolicyTargets(
+    offsets.data, entries.data, entries.numRows, shape[0], (int)shape[1], (int)shape[2], policyTargets.data
+  );
+  uint64_t numBytes = policyTargets.prepareHeaderWithNumRows(shape[0]);
+  buf.assign((const char*)policyTargets.dataIncludingHeader,numBytes);
+  return NumpyArrayView(buf.data(),buf.size());
+}
+
+//Read just the headers of all the arrays in an npz file
+static void readNpzHeaders(const string& fileName, vector<NpyHeader>& headers) {
+  headers.clear();
+  ZipReader zip(fileName);
+  bool sparsePolicyTargets = hasSparsePolicyTargets(zip);
+  //Our own headers are exactly 256 bytes, numpy's are usually smaller, but read more to be safe
+  char buf[4096];
+  for(int i = 0; i<NUM_SHUFFLE_ARRAYS; i++) {
+    NpyHeader header;
+    if(i == POLICY_TARGETS_ARRAY_IDX && sparsePolicyTargets) {
+      header.dtype = NumpyBuffer<int16_t>({1}).dtype;
+      header.shape = readSparsePolicyTargetsShape(zip);
+      headers.push_back(header);
+      continue;
+    }
+    ZipMemberReader reader(zip,SHUFFLE_ARRAY_NAMES[i]);
+    uint64_t len = reader.read(buf,sizeof(buf));
+    NumpyArrayView::parseHeader(buf,len,header.dtype,header.shape);
+    if(header.shape.size() <= 0)
+      throw IOError(fileName + ": " + SHUFFLE_ARRAY_NAMES[i] + " has no leading dimension");
+    headers.push_back(header);
+  }
+}
+
+//Get views of all the arrays in an npz file. Arrays stored without compression are accessed in place,
+//others are decompressed into bufs, as are sparse policy targets.
+static void readNpzArrays(const ZipReader& zip, vector<string>& bufs, vector<NumpyArrayView>& views) {
+  bufs.resize(NUM_SHUFFLE_ARRAYS);
+  views.resize(NUM_SHUFFLE_ARRAYS);
+  bool sparsePolicyTargets = hasSparsePolicyTargets(zip);
+  for(int i = 0; i<NUM_SHUFFLE_ARRAYS; i++) {
+    if(i == POLICY_TARGETS_ARRAY_IDX && sparsePolicyTargets)
+      views[i] = readSparsePolicyTargets(zip,bufs[i]);
+    else
+      views[i] = readNpzArray(zip,SHUFFLE_ARRAY_NAMES[i],bufs[i]);
+  }
+}
+
+//Check that an npz file has the same dtypes and per-row shapes as the reference, and that all its arrays have the same
+//number of rows. Returns the number of rows.
+static int64_t checkNpzHeaders(
+  const string& fileName, const vector<string>& dtypes, const vector<vector<int64_t>>& shapes,
+  const vector<string>& refDtypes, const vector<vector<int64_t>>& refRowShapes
+) {
+  int64_t numRows = shapes[0][0];
+  for(int i = 0; i<NUM_SHUFFLE_ARRAYS; i++) {
+    vector<int64_t> rowShape(shapes[i].begin()+1,shapes[i].end());
+    if(dtypes[i] != refDtypes[i] || rowShape != refRowShapes[i])
+      throw IOError(fileName + ": " + SHUFFLE_ARRAY_NAMES[i] + " has a different dtype or shape than expected");
+    if(shapes[i][0] != numRows)
+      throw IOError(fileName + ": " + SHUFFLE_ARRAY_NAMES[i] + " has a different number of rows than the other arrays");
+  }
+  return numRows;
+}
+
+//A string as a json string literal, with its quotes
+static string toJsonString(const string& s) {
+  static const char* hexDigits = "0123456789abcdef";
+  string out = "\"";
+  for(size_t i = 0; i<s.size(); i++) {
+    unsigned char c = (unsigned char)s[i];
+    if(c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    }
+    else if(c < 0x20) {
+      out += "\\u00";
+      out += hexDigits[c >> 4];
+      out += hexDigits[c & 0xF];
+    }
+    else
+      out += (char)c;
+  }
+  out += "\"";
+  return out;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+int MainCmds::shuffle(int argc, const char* const* argv) {
+  cerr << "Command: ";
+  for(int i = 0; i<argc; i++)
+    cerr << argv[i] << " ";
+  cerr << endl;
+
+  vector<string> dataDirs;
+  int64_t minRows;
+  int64_t maxRows;
+  int64_t keepTargetRows;
+  double expandWindowPerRow;
+  double taperWindowExponent;
+  string outDir;
+  string outTmpDir;
+  int64_t approxRowsPerOutFile;
+  int64_t batchSize;
+  int numThreads;
+  string seed;
+  try {
+    TCLAP::CmdLine cmd("Shuffle training data npz files", ' ', "1.0",true);
+    TCLAP::MultiArg<string> dataDirArg("","data-dir","Directory of training data npz files, searched recursively",true,"DIR");
+    TCLAP::ValueArg<int64_t> minRowsArg("","min-rows","Minimum training rows to use",true,0,"ROWS");
+    TCLAP::ValueArg<int64_t> maxRowsArg("","max-rows","Maximum training rows to use",true,0,"ROWS");
+    TCLAP::ValueArg<int64_t> keepTargetRowsArg("","keep-target-rows","Target number of rows to actually keep in the final data set",false,-1,"ROWS");
+    TCLAP::ValueArg<double> expandWindowPerRowArg("","expand-window-per-row","Beyond min rows, initially expand the window by this much every post-random data row",true,0.0,"FLOAT");
+    TCLAP::ValueArg<double> taperWindowExponentArg("","taper-window-exponent","Make the window size asymtotically grow as this power of the data rows",true,0.0,"FLOAT");
+    TCLAP::ValueArg<string> outDirArg("","out-dir","Dir to output shuffled tfrecord files, must not already exist",true,string(),"DIR");
+    TCLAP::ValueArg<string> outTmpDirArg("","out-tmp-dir","Dir to use as scratch space for shards",true,string(),"DIR");
+    TCLAP::ValueArg<int64_t> approxRowsPerOutFileArg("","approx-rows-per-out-file","Number of rows per output tfrecord file",true,0,"ROWS");
+    TCLAP::ValueArg<int64_t> batchSizeArg("","batch-size","Batch size to write training examples in",true,0,"ROWS");
+    TCLAP::ValueArg<int> numThreadsArg("","num-threads","Number of threads to read, shuffle and write with",true,1,"THREADS");
+    TCLAP::ValueArg<string> seedArg("","seed","Random seed, random if not specified",false,string(),"SEED");
+    cmd.add(dataDirArg);
+    cmd.add(minRowsArg);
+    cmd.add(maxRowsArg);
+    cmd.add(keepTargetRowsArg);
+    cmd.add(expandWindowPerRowArg);
+    cmd.add(taperWindowExponentArg);
+    cmd.add(outDirArg);
+    cmd.add(outTmpDirArg);
+    cmd.add(approxRowsPerOutFileArg);
+    cmd.add(batchSizeArg);
+    cmd.add(numThreadsArg);
+    cmd.add(seedArg);
+    cmd.parse(argc,argv);
+    dataDirs = dataDirArg.getValue();
+    minRows = minRowsArg.getValue();
+    maxRows = maxRowsArg.getValue();
+    keepTargetRows = keepTargetRowsArg.getValue();
+    expandWindowPerRow = expandWindowPerRowArg.getValue();
+    taperWindowExponent = taperWindowExponentArg.getValue();
+    outDir = outDirArg.getValue();
+    outTmpDir = outTmpDirArg.getValue();
+    approxRowsPerOutFile = approxRowsPerOutFileArg.getValue();
+    batchSize = batchSizeArg.getValue();
+    numThreads = numThreadsArg.getValue();
+    seed = seedArg.getValue();
+
+    if(approxRowsPerOutFile <= 0)
+      throw TCLAP::ArgException("Must be positive","approx-rows-per-out-file");
+    if(batchSize <= 0)
+      throw TCLAP::ArgException("Must be positive","batch-size");
+    if(numThreads <= 0)
+      throw TCLAP::ArgException("Must be positive","num-threads");
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  if(seed == "")
+    seed = Global::uint64ToHexString(Rand().nextUInt64());
+
+  namespace bfs = boost::filesystem;
+
+  //Collect npz files, oldest first-----------------------------------------------------------------
+  auto npzFilter = [](const string& name) {
+    return Global::isSuffix(name,".npz");
+  };
+  vector<string> npzFiles;
+  for(size_t i = 0; i<dataDirs.size(); i++)
+    Global::collectFiles(dataDirs[i], npzFilter, npzFiles);
+  cerr << "Found " << npzFiles.size() << " npz files" << endl;
+
+  vector<std::pair<time_t,string>> npzFilesByTime;
+  for(size_t i = 0; i<npzFiles.size(); i++)
+    npzFilesByTime.push_back(std::make_pair(bfs::last_write_time(bfs::path(npzFiles[i])),npzFiles[i]));
+  std::stable_sort(npzFilesByTime.begin(),npzFilesByTime.end());
+
+  //Read headers and choose the window, same as python/shuffle.py-----------------------------------
+  //The dtypes and per-row shapes of every array, taken from the first good file
+  vector<string> refDtypes;
+  vector<vector<int64_t>> refRowShapes;
+  vector<int64_t> refRowBytes;
+  int64_t totalRowBytes = 0;
+
+  int64_t numRowsTotal = 0;
+  int64_t numRandomRowsCapped = 0;
+  int64_t numPostRandomRows = 0;
+  const double windowTaperOffset = (double)minRows;
+  auto numUsableRows = [&]() {
+    return numRandomRowsCapped + numPostRandomRows;
+  };
+  auto numDesiredRows = [&]() {
+    double powerLawX = (double)(numUsableRows() - minRows) + windowTaperOffset;
+    double unscaledPowerLaw = pow(powerLawX,taperWindowExponent) - pow(windowTaperOffset,taperWindowExponent);
+    double scaledPowerLaw = unscaledPowerLaw / (taperWindowExponent * pow(windowTaperOffset,taperWindowExponent-1.0));
+    return (int64_t)(scaledPowerLaw * expandWindowPerRow + (double)minRows);
+  };
+
+  struct FileWithRowRange {
+    string fileName;
+    int64_t startRow;
+    int64_t endRow;
+  };
+  vector<FileWithRowRange> filesWithRowRange;
+  for(size_t i = 0; i<npzFilesByTime.size(); i++) {
+    const string& fileName = npzFilesByTime[i].second;
+    vector<NpyHeader> headers;
+    int64_t numRows;
+    try {
+      readNpzHeaders(fileName,headers);
+      vector<string> dtypes;
+      vector<vector<int64_t>> shapes;
+      for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++) {
+        dtypes.push_back(headers[a].dtype);
+        shapes.push_back(headers[a].shape);
+      }
+      if(refDtypes.size() <= 0) {
+        for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++)
+          refRowShapes.push_back(vector<int64_t>(headers[a].shape.begin()+1,headers[a].shape.end()));
+        ShuffleBuffers typeBuffers(1,refRowShapes);
+        for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++) {
+          refDtypes.push_back(typeBuffers.getDtype(a));
+          refRowBytes.push_back(typeBuffers.getRowBytes(a));
+          totalRowBytes += refRowBytes[a];
+        }
+      }
+      numRows = checkNpzHeaders(fileName,dtypes,shapes,refDtypes,refRowShapes);
+    }
+    catch(const IOError& e) {
+      cerr << "WARNING: bad file, skipping it: " << fileName << " (" << e.message << ")" << endl;
+      continue;
+    }
+
+    filesWithRowRange.push_back(FileWithRowRange{fileName, numRowsTotal, numRowsTotal + numRows});
+    numRowsTotal += numRows;
+    if(fileName.find("random") == string::npos)
+      numPostRandomRows += numRows;
+    else
+      numRandomRowsCapped = std::min(numRandomRowsCapped + numRows, minRows);
+
+    //If we already have a window size bigger than max, then just stop
+    if(numDesiredRows() >= maxRows)
+      break;
+  }
+
+  if(bfs::exists(bfs::path(outDir))) {
+    cerr << outDir << " already exists" << endl;
+    return 1;
+  }
+  MakeDir::make(outDir);
+
+  if(numRowsTotal <= 0) {
+    cerr << "No rows found" << endl;
+    return 0;
+  }
+  if(numRowsTotal < minRows) {
+    cerr << "Not enough rows (fewer than " << minRows << ")" << endl;
+    return 0;
+  }
+  cerr << "Total rows found: " << numRowsTotal << " (" << numUsableRows() << " usable)" << endl;
+
+  //Take the most recent files until we have the desired number of rows
+  int64_t desiredNumRows = numDesiredRows();
+  desiredNumRows = std::max(desiredNumRows,minRows);
+  desiredNumRows = std::min(desiredNumRows,maxRows);
+  cerr << "Desired num rows: " << desiredNumRows << " / " << numRowsTotal << endl;
+
+  vector<FileWithRowRange> desiredFiles;
+  int64_t numDesiredFilesRows = 0;
+  for(int i = (int)filesWithRowRange.size()-1; i >= 0; i--) {
+    const FileWithRowRange& f = filesWithRowRange[i];
+    desiredFiles.push_back(f);
+    numDesiredFilesRows += f.endRow - f.startRow;
+    cerr << "Using: " << f.fileName << " (" << f.startRow << "-" << f.endRow << ") ("
+         << numDesiredFilesRows << "/" << desiredNumRows << " desired rows)" << endl;
+    if(numDesiredFilesRows >= desiredNumRows)
+      break;
+  }
+
+  int64_t approxRowsToKeep = numDesiredFilesRows;
+  if(keepTargetRows >= 0)
+    approxRowsToKeep = std::min(approxRowsToKeep,keepTargetRows);
+  double keepProb = (double)approxRowsToKeep / (double)numDesiredFilesRows;
+
+  int numOutFiles = (int)round((double)approxRowsToKeep / (double)approxRowsPerOutFile);
+  numOutFiles = std::max(numOutFiles,1);
+  cerr << "Writing " << numOutFiles << " output files" << endl;
+
+  MakeDir::make(outTmpDir);
+  vector<string> shardFiles;
+  for(int k = 0; k<numOutFiles; k++)
+    shardFiles.push_back(outTmpDir + "/" + "shuf" + Global::intToString(k) + ".bin");
+  //Shards not yet consumed are left behind when we fail, so clean them up. Removing a missing file is harmless.
+  auto removeShardFiles = [&]() {
+    for(int k = 0; k<numOutFiles; k++)
+      std::remove(shardFiles[k].c_str());
+  };
+
+  std::mutex coutMutex;
+  //Errors other than bad input files stop all threads, and the first is rethrown once they are joined
+  std::atomic<bool> anyThreadFailed(false);
+  std::exception_ptr firstException;
+  auto recordException = [&]() {
+    std::lock_guard<std::mutex> lock(coutMutex);
+    if(!firstException)
+      firstException = std::current_exception();
+    anyThreadFailed.store(true);
+  };
+
+  //Pass 1: scatter rows into shards-----------------------------------------------------------------
+  //Each shard is just the raw bytes of each row of each array in turn, with rows written in blocks by input file.
+  {
+    ClockTimer timer;
+    vector<std::unique_ptr<ofstream>> shardOuts;
+    vector<std::unique_ptr<std::mutex>> shardMutexes;
+    for(int k = 0; k<numOutFiles; k++) {
+      std::unique_ptr<ofstream> out(new ofstream(shardFiles[k], ios::out | ios::binary | ios::trunc));
+      if(!out->good()) {
+        shardOuts.clear();
+        removeShardFiles();
+        throw IOError("Could not open shard file " + shardFiles[k]);
+      }
+      shardOuts.push_back(std::move(out));
+      shardMutexes.push_back(std::unique_ptr<std::mutex>(new std::mutex()));
+    }
+
+    std::atomic<int64_t> nextFileIdx(0);
+    std::atomic<int64_t> numRowsScattered(0);
+    auto scatterLoop = [&](int threadIdx) {
+      try {
+        Rand rand(seed + ":scatter:" + Global::intToString(threadIdx));
+        vector<string> bufs;
+        vector<NumpyArrayView> views;
+        vector<string> shardBufs(numOutFiles);
+        while(!anyThreadFailed.load()) {
+          int64_t fileIdx = nextFileIdx.fetch_add(1);
+          if(fileIdx >= (int64_t)desiredFiles.size())
+            break;
+          const string& fileName = desiredFiles[fileIdx].fileName;
+          int64_t numKept = 0;
+          try {
+            ZipReader zip(fileName);
+            readNpzArrays(zip,bufs,views);
+            vector<string> dtypes;
+            vector<vector<int64_t>> shapes;
+            for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++) {
+              dtypes.push_back(views[a].dtype);
+              shapes.push_back(views[a].shape);
+            }
+            int64_t numRows = checkNpzHeaders(fileName,dtypes,shapes,refDtypes,refRowShapes);
+
+            for(int k = 0; k<numOutFiles; k++)
+              shardBufs[k].clear();
+            for(int64_t r = 0; r<numRows; r++) {
+              if(keepProb < 1.0 && !rand.nextBool(keepProb))
+                continue;
+              string& shardBuf = shardBufs[rand.nextUInt((uint32_t)numOutFiles)];
+              for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++)
+                shardBuf.append(views[a].getRowBytes(r,1), refRowBytes[a]);
+              numKept++;
+            }
+          }
+          catch(const IOError& e) {
+            std::lock_guard<std::mutex> lock(coutMutex);
+            cerr << "WARNING: bad file, skipping it: " << fileName << " (" << e.message << ")" << endl;
+            continue;
+          }
+          //Free the input before we write
+          for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++)
+            string().swap(bufs[a]);
+
+          for(int k = 0; k<numOutFiles; k++) {
+            if(shardBufs[k].size() <= 0)
+              continue;
+            std::lock_guard<std::mutex> lock(*shardMutexes[k]);
+            shardOuts[k]->write(shardBufs[k].data(),shardBufs[k].size());
+            if(!shardOuts[k]->good())
+              throw IOError("Error writing shard file " + shardFiles[k]);
+          }
+          numRowsScattered.fetch_add(numKept);
+        }
+      }
+      catch(...) {
+        recordException();
+      }
+    };
+
+    vector<std::thread> threads;
+    for(int i = 0; i<numThreads; i++)
+      threads.push_back(std::thread(scatterLoop,i));
+    for(int i = 0; i<numThreads; i++)
+      threads[i].join();
+
+    shardOuts.clear();
+    shardMutexes.clear();
+    if(firstException) {
+      removeShardFiles();
+      std::rethrow_exception(firstException);
+    }
+    cerr << "Done sharding " << numRowsScattered.load() << " rows from " << desiredFiles.size() << " files, time taken "
+         << timer.getSeconds() << endl;
+  }
+
+  //Pass 2: shuffle each shard in memory and write it-----------------------------------------------
+  {
+    ClockTimer timer;
+    vector<int64_t> numRowsByOutFile(numOutFiles,0);
+    std::atomic<int> nextOutIdx(0);
+    auto mergeLoop = [&](int threadIdx) {
+      try {
+        Rand rand(seed + ":merge:" + Global::intToString(threadIdx));
+        string shardBuf;
+        vector<int64_t> perm;
+        while(!anyThreadFailed.load()) {
+          int k = nextOutIdx.fetch_add(1);
+          if(k >= numOutFiles)
+            break;
+
+          {
+            ifstream in(shardFiles[k], ios::in | ios::binary | ios::ate);
+            if(!in.good())
+              throw IOError("Could not open shard file " + shardFiles[k]);
+            int64_t numBytes = (int64_t)in.tellg();
+            in.seekg(0);
+            shardBuf.resize(numBytes);
+            in.read(&shardBuf[0],numBytes);
+            if(!in.good() && numBytes > 0)
+              throw IOError("Error reading shard file " + shardFiles[k]);
+          }
+          std::remove(shardFiles[k].c_str());
+          if(shardBuf.size() % totalRowBytes != 0)
+            throw IOError("Shard file " + shardFiles[k] + " does not contain a whole number of rows");
+          int64_t numRows = (int64_t)shardBuf.size() / totalRowBytes;
+
+          perm.resize(numRows);
+          for(int64_t i = 0; i<numRows; i++)
+            perm[i] = i;
+          for(int64_t i = numRows-1; i > 0; i--)
+            std::swap(perm[i],perm[rand.nextUInt64((uint64_t)(i+1))]);
+
+          ShuffleBuffers buffers(numRows,refRowShapes);
+          char* dsts[NUM_SHUFFLE_ARRAYS];
+          for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++)
+            dsts[a] = buffers.getData(a);
+          for(int64_t i = 0; i<numRows; i++) {
+            const char* src = shardBuf.data() + perm[i] * totalRowBytes;
+            for(int a = 0; a<NUM_SHUFFLE_ARRAYS; a++) {
+              std::memcpy(dsts[a] + i * refRowBytes[a], src, refRowBytes[a]);
+              src += refRowBytes[a];
+            }
+          }
+          string().swap(shardBuf);
+
+          string fileName = outDir + "/data" + Global::intToString(k) + ".tfrecord";
+          string tmpFileName = fileName + ".tmp";
+          int64_t numBatches = buffers.writeToTFRecordFile(tmpFileName,batchSize);
+          if(std::rename(tmpFileName.c_str(),fileName.c_str()) != 0)
+            throw IOError("Could not rename " + tmpFileName + " to " + fileName);
+
+          string jsonFileName = outDir + "/data" + Global::intToString(k) + ".json";
+          ofstream jsonOut(jsonFileName);
+          jsonOut << "{\"num_rows\": " << numRows << ", \"num_batches\": " << numBatches << "}" << endl;
+          jsonOut.close();
+          if(jsonOut.fail())
+            throw IOError("Error writing " + jsonFileName);
+          numRowsByOutFile[k] = numBatches * batchSize;
+        }
+      }
+      catch(...) {
+        recordException();
+      }
+    };
+
+    vector<std::thread> threads;
+    for(int i = 0; i<numThreads; i++)
+      threads.push_back(std::thread(mergeLoop,i));
+    for(int i = 0; i<numThreads; i++)
+      threads[i].join();
+    if(firstException) {
+      removeShardFiles();
+      std::rethrow_exception(firstException);
+    }
+
+    int64_t numRowsWritten = 0;
+    for(int k = 0; k<numOutFiles; k++)
+      numRowsWritten += numRowsByOutFile[k];
+    cerr << "Done merging " << numRowsWritten << " rows into " << numOutFiles << " files, time taken "
+         << timer.getSeconds() << endl;
+  }
+
+  //Record which files and rows went into this data set, same as python/shuffle.py
+  {
+    int64_t rangeStart = desiredFiles[0].startRow;
+    int64_t rangeEnd = desiredFiles[0].endRow;
+    for(size_t i = 0; i<desiredFiles.size(); i++) {
+      rangeStart = std::min(rangeStart,desiredFiles[i].startRow);
+      rangeEnd = std::max(rangeEnd,desiredFiles[i].endRow);
+    }
+    string jsonFileName = outDir + ".json";
+    ofstream out(jsonFileName);
+    out << "{\"files\": [";
+    for(size_t i = 0; i<filesWithRowRange.size(); i++) {
+      if(i > 0)
+        out << ", ";
+      out << "[" << toJsonString(filesWithRowRange[i].fileName) << ", [" << filesWithRowRange[i].startRow << ", " << filesWithRowRange[i].endRow << "]]";
+    }
+    out << "], \"range\": [" << rangeStart << ", " << rangeEnd << "]}" << endl;
+    out.close();
+    if(out.fail())
+      throw IOError("Error writing " + jsonFileName);
+  }
+
+  cerr << "Done" << endl;
+  return 0;
+}
@@ -14,6 +14,10 @@ void Tests::runBoardAreaTests() {
       bool unsafeBigTerritories = (mode >= 4);
       Board copy(board);
       copy.calculateArea(result,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+      Color referenceResult[Board::MAX_ARR_SIZE];
+      copy.calculateAreaReference(referenceResult,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+      for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+        testAssert(result[i] == referenceResult[i]);
       out << "Safe big territories " << safeBigTerritories << " "
       << "Unsafe big territories " << unsafeBigTerritories << " "
       << "Non pass alive stones " << nonPassAliveStones << " "
@@ -1292,4 +1296,44 @@ NonPassAliveSelfConn white
 )%%";
     expect(name,out,expected);
   }
+
+  //============================================================================
+  {
+    //Compare against the reference implementation on random boards of all sizes and densities
+    Rand rand("Bitboard area random boards");
+    for(int rep = 0; rep<3000; rep++) {
+      int xSize = 1 + rand.nextUInt(Board::MAX_LEN);
+      int ySize = 1 + rand.nextUInt(Board::MAX_LEN);
+      Board board(xSize,ySize);
+      double blackProb = rand.nextDouble();
+      int numMoves = (int)(rand.nextDouble() * xSize * ySize * 1.5);
+      for(int i = 0; i<numMoves; i++) {
+        Loc loc = Location::getLoc(rand.nextUInt(xSize),rand.nextUInt(ySize),xSize);
+        Player pla = rand.nextBool(blackProb) ? P_BLACK : P_WHITE;
+        if(board.isLegal(loc,pla,true))
+          board.playMoveAssumeLegal(loc,pla);
+      }
+      for(int mode = 0; mode < 16; mode++) {
+        bool multiStoneSuicideLegal = (mode & 1) != 0;
+        bool nonPassAliveStones = (mode & 2) != 0;
+        bool safeBigTerritories = (mode & 4) != 0;
+        bool unsafeBigTerritories = (mode & 8) != 0;
+        Color result[Board::MAX_ARR_SIZE];
+        Color referenceResult[Board::MAX_ARR_SIZE];
+        board.calculateArea(result,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+        board.calculateAreaReference(referenceResult,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+        for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+          testAssert(result[i] == referenceResult[i]);
+
+        //Locations found this way must never be pass-alive area, regardless of the hint
+        if(!safeBigTerritories && !unsafeBigTerritories) {
+          Loc hint = rand.nextBool(0.5) ? Board::NULL_LOC : Location::getLoc(rand.nextUInt(xSize),rand.nextUInt(ySize),xSize);
+          Loc witness = board.findLocNeverPassAliveArea(hint);
+          if(witness != Board::NULL_LOC)
+            testAssert(result[witness] == C_EMPTY);
+        }
+      }
+    }
+  }
+
 }
@@ -1249,6 +1249,18 @@ void Tests::runBoardStressTest() {
     for(int i = 0; i<numBoards; i++)
       copies[i] = boards[i];
 
+    //Copying only copies the used prefix of the arrays, so also check copying over a board of a different size
+    if(n % 500 == 0) {
+      for(int i = 0; i<numBoards; i++) {
+        Board other = boards[(i+1) % numBoards];
+        other = boards[i];
+        other.checkConsistency();
+        testAssert(other.pos_hash == boards[i].pos_hash);
+        for(int j = 0; j<Board::MAX_ARR_SIZE; j++)
+          testAssert(other.colors[j] == boards[i].colors[j]);
+      }
+    }
+
     bool isLegal[numBoards];
     bool suc[numBoards];
     for(int i = 0; i<numBoards; i++) {
@@ -0,0 +1,955 @@
+#include "../tests/tests.h"
+#include "../dataio/numpywrite.h"
+#include "../dataio/numpyread.h"
+#include "../dataio/tfrecordwrite.h"
+#include "../dataio/datapool.h"
+#include "../dataio/lzparse.h"
+#include "../dataio/rowwrite.h"
+#include "../main.h"
+#include <fstream>
+#include <map>
+#include <set>
+#include <zlib.h>
+#include <boost/filesystem.hpp>
+using namespace TestCommon;
+
+namespace bfs = boost::filesystem;
+
+static string readFileBytes(const string& fileName) {
+  std::ifstream in(fileName, std::ios::in | std::ios::binary);
+  testAssert(in.good());
+  return string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+static string inflateZlib(const string& compressed) {
+  z_stream zs;
+  memset(&zs,0,sizeof(z_stream));
+  testAssert(inflateInit(&zs) == Z_OK);
+  zs.next_in = const_cast<z_const Bytef*>(reinterpret_cast<const Bytef*>(compressed.data()));
+  zs.avail_in = (uInt)compressed.size();
+  string result;
+  char buf[4096];
+  int ret;
+  do {
+    zs.next_out = reinterpret_cast<Bytef*>(buf);
+    zs.avail_out = sizeof(buf);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    testAssert(ret == Z_OK || ret == Z_STREAM_END);
+    result.append(buf, sizeof(buf) - zs.avail_out);
+  } while(ret != Z_STREAM_END);
+  testAssert(zs.avail_in == 0);
+  inflateEnd(&zs);
+  return result;
+}
+
+static uint64_t readLittleEndian(const string& s, size_t pos, int numBytes) {
+  testAssert(pos + numBytes <= s.size());
+  uint64_t x = 0;
+  for(int i = 0; i<numBytes; i++)
+    x |= (uint64_t)(uint8_t)s[pos+i] << (8*i);
+  return x;
+}
+
+//Split a decompressed TFRecord file into its records, checking the lengths and crcs
+static vector<string> splitTFRecords(const string& data) {
+  vector<string> records;
+  size_t pos = 0;
+  while(pos < data.size()) {
+    uint64_t len = readLittleEndian(data,pos,8);
+    testAssert(readLittleEndian(data,pos+8,4) == TFRecordWriter::maskedCrc32c(data.data()+pos,8));
+    pos += 12;
+    testAssert(pos + len + 4 <= data.size());
+    testAssert(readLittleEndian(data,pos+len,4) == TFRecordWriter::maskedCrc32c(data.data()+pos,len));
+    records.push_back(data.substr(pos,len));
+    pos += len + 4;
+  }
+  return records;
+}
+
+static uint64_t readVarint(const string& s, size_t& pos) {
+  uint64_t x = 0;
+  for(int shift = 0; ; shift += 7) {
+    testAssert(pos < s.size() && shift < 64);
+    uint8_t b = (uint8_t)s[pos++];
+    x |= (uint64_t)(b & 0x7F) << shift;
+    if((b & 0x80) == 0)
+      return x;
+  }
+}
+
+//Parse a protobuf message consisting only of length-delimited fields into (field number, contents) pairs
+static vector<std::pair<int,string>> parseLenFields(const string& s) {
+  vector<std::pair<int,string>> fields;
+  size_t pos = 0;
+  while(pos < s.size()) {
+    uint64_t tag = readVarint(s,pos);
+    testAssert((tag & 7) == 2);
+    uint64_t len = readVarint(s,pos);
+    testAssert(pos + len <= s.size());
+    fields.push_back(std::make_pair((int)(tag >> 3), s.substr(pos,len)));
+    pos += len;
+  }
+  return fields;
+}
+
+//Parse a serialized tf.train.Example into the raw bytes of each feature, and whether it is a float list
+static std::map<string,std::pair<bool,string>> parseTFExample(const string& serialized) {
+  std::map<string,std::pair<bool,string>> result;
+  vector<std::pair<int,string>> example = parseLenFields(serialized);
+  testAssert(example.size() == 1 && example[0].first == 1);
+  vector<std::pair<int,string>> entries = parseLenFields(example[0].second);
+  for(size_t i = 0; i<entries.size(); i++) {
+    testAssert(entries[i].first == 1);
+    vector<std::pair<int,string>> entry = parseLenFields(entries[i].second);
+    testAssert(entry.size() == 2 && entry[0].first == 1 && entry[1].first == 2);
+    vector<std::pair<int,string>> feature = parseLenFields(entry[1].second);
+    testAssert(feature.size() == 1 && (feature[0].first == 1 || feature[0].first == 2));
+    vector<std::pair<int,string>> list = parseLenFields(feature[0].second);
+    testAssert(list.size() == 1 && list[0].first == 1);
+    testAssert(result.find(entry[0].second) == result.end());
+    result[entry[0].second] = std::make_pair(feature[0].first == 2, list[0].second);
+  }
+  return result;
+}
+
+static vector<float> bytesToFloats(const string& s) {
+  testAssert(s.size() % sizeof(float) == 0);
+  vector<float> floats(s.size() / sizeof(float));
+  memcpy(floats.data(), s.data(), s.size());
+  return floats;
+}
+
+//Write an npz file like TrainingWriteBuffers does, but with small made-up shapes, where every value of each row
+//is derived from that row's id so that rows can be recognized after shuffling
+static void writeTestShuffleNpz(const string& fileName, int firstRowId, int numRows) {
+  NumpyBuffer<uint8_t> binaryInputNCHWPacked({numRows,2,3});
+  NumpyBuffer<float> globalInputNC({numRows,2});
+  NumpyBuffer<int16_t> policyTargetsNCMove({numRows,1,4});
+  NumpyBuffer<float> globalTargetsNC({numRows,3});
+  NumpyBuffer<int8_t> scoreDistrN({numRows,4});
+  NumpyBuffer<int8_t> selfBonusScoreN({numRows,2});
+  NumpyBuffer<int8_t> valueTargetsNCHW({numRows,1,2,2});
+  for(int r = 0; r<numRows; r++) {
+    int id = firstRowId + r;
+    for(int i = 0; i<6; i++) binaryInputNCHWPacked.data[r*6+i] = (uint8_t)(id + i);
+    for(int i = 0; i<2; i++) globalInputNC.data[r*2+i] = (float)(id + i);
+    for(int i = 0; i<4; i++) policyTargetsNCMove.data[r*4+i] = (int16_t)(id * 10 + i);
+    for(int i = 0; i<3; i++) globalTargetsNC.data[r*3+i] = (float)(id + i) * 0.5f;
+    for(int i = 0; i<4; i++) scoreDistrN.data[r*4+i] = (int8_t)(id % 100 + i);
+    for(int i = 0; i<2; i++) selfBonusScoreN.data[r*2+i] = (int8_t)(id % 50 - i);
+    for(int i = 0; i<4; i++) valueTargetsNCHW.data[r*4+i] = (int8_t)(id % 30 + i);
+  }
+
+  ZipFile zipFile(fileName);
+  uint64_t numBytes;
+  numBytes = binaryInputNCHWPacked.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("binaryInputNCHWPacked", binaryInputNCHWPacked.dataIncludingHeader, numBytes);
+  numBytes = globalInputNC.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("globalInputNC", globalInputNC.dataIncludingHeader, numBytes);
+  numBytes = policyTargetsNCMove.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("policyTargetsNCMove", policyTargetsNCMove.dataIncludingHeader, numBytes);
+  numBytes = globalTargetsNC.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("globalTargetsNC", globalTargetsNC.dataIncludingHeader, numBytes);
+  numBytes = scoreDistrN.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("scoreDistrN", scoreDistrN.dataIncludingHeader, numBytes);
+  numBytes = selfBonusScoreN.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("selfBonusScoreN", selfBonusScoreN.dataIncludingHeader, numBytes);
+  numBytes = valueTargetsNCHW.prepareHeaderWithNumRows(numRows);
+  zipFile.writeBuffer("valueTargetsNCHW", valueTargetsNCHW.dataIncludingHeader, numBytes);
+  zipFile.close();
+}
+
+static void appendLittleEndian(string& s, uint64_t x, int numBytes) {
+  for(int i = 0; i<numBytes; i++)
+    s.push_back((char)((x >> (8*i)) & 0xFF));
+}
+
+static string deflateRaw(const string& data) {
+  z_stream zs;
+  memset(&zs,0,sizeof(z_stream));
+  testAssert(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  string result(deflateBound(&zs,(uLong)data.size()), '\0');
+  zs.next_in = const_cast<z_const Bytef*>(reinterpret_cast<const Bytef*>(data.data()));
+  zs.avail_in = (uInt)data.size();
+  zs.next_out = reinterpret_cast<Bytef*>(&result[0]);
+  zs.avail_out = (uInt)result.size();
+  testAssert(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+  result.resize(result.size() - zs.avail_out);
+  deflateEnd(&zs);
+  return result;
+}
+
+struct TestZipMember {
+  string name;
+  string data;
+  bool deflated;
+};
+
+//Build a zip file by hand, so that the reader is tested against zips that ZipFile would not write.
+//With zip64, the sizes and offsets are all given in zip64 extra fields and records, as for a zip over 4GB.
+static string buildTestZip(const vector<TestZipMember>& members, bool zip64) {
+  string zip;
+  string centralDir;
+  for(size_t i = 0; i<members.size(); i++) {
+    const TestZipMember& member = members[i];
+    string compressed = member.deflated ? deflateRaw(member.data) : member.data;
+    uint32_t crc = (uint32_t)crc32(0L, reinterpret_cast<const Bytef*>(member.data.data()), (uInt)member.data.size());
+    int method = member.deflated ? 8 : 0;
+    uint64_t localOffset = zip.size();
+
+    string localExtra;
+    string centralExtra;
+    if(zip64) {
+      appendLittleEndian(localExtra, 0x0001, 2);
+      appendLittleEndian(localExtra, 16, 2);
+      appendLittleEndian(localExtra, member.data.size(), 8);
+      appendLittleEndian(localExtra, compressed.size(), 8);
+      appendLittleEndian(centralExtra, 0x0001, 2);
+      appendLittleEndian(centralExtra, 24, 2);
+      appendLittleEndian(centralExtra, member.data.size(), 8);
+      appendLittleEndian(centralExtra, compressed.size(), 8);
+      appendLittleEndian(centralExtra, localOffset, 8);
+    }
+
+    appendLittleEndian(zip, 0x04034b50, 4);
+    appendLittleEndian(zip, zip64 ? 45 : 20, 2);
+    appendLittleEndian(zip, 0, 2); //flags
+    appendLittleEndian(zip, method, 2);
+    appendLittleEndian(zip, 0, 4); //time and date
+    appendLittleEndian(zip, crc, 4);
+    appendLittleEndian(zip, zip64 ? 0xFFFFFFFFULL : compressed.size(), 4);
+    appendLittleEndian(zip, zip64 ? 0xFFFFFFFFULL : member.data.size(), 4);
+    appendLittleEndian(zip, member.name.size(), 2);
+    appendLittleEndian(zip, localExtra.size(), 2);
+    zip += member.name;
+    zip += localExtra;
+    zip += compressed;
+
+    appendLittleEndian(centralDir, 0x02014b50, 4);
+    appendLittleEndian(centralDir, zip64 ? 45 : 20, 2);
+    appendLittleEndian(centralDir, zip64 ? 45 : 20, 2);
+    appendLittleEndian(centralDir, 0, 2); //flags
+    appendLittleEndian(centralDir, method, 2);
+    appendLittleEndian(centralDir, 0, 4); //time and date
+    appendLittleEndian(centralDir, crc, 4);
+    appendLittleEndian(centralDir, zip64 ? 0xFFFFFFFFULL : compressed.size(), 4);
+    appendLittleEndian(centralDir, zip64 ? 0xFFFFFFFFULL : member.data.size(), 4);
+    appendLittleEndian(centralDir, member.name.size(), 2);
+    appendLittleEndian(centralDir, centralExtra.size(), 2);
+    appendLittleEndian(centralDir, 0, 2); //comment length
+    appendLittleEndian(centralDir, 0, 2); //disk
+    appendLittleEndian(centralDir, 0, 6); //attributes
+    appendLittleEndian(centralDir, zip64 ? 0xFFFFFFFFULL : localOffset, 4);
+    centralDir += member.name;
+    centralDir += centralExtra;
+  }
+
+  uint64_t dirOffset = zip.size();
+  zip += centralDir;
+  if(zip64) {
+    uint64_t end64Offset = zip.size();
+    appendLittleEndian(zip, 0x06064b50, 4);
+    appendLittleEndian(zip, 44, 8);
+    appendLittleEndian(zip, 45, 2);
+    appendLittleEndian(zip, 45, 2);
+    appendLittleEndian(zip, 0, 8); //disks
+    appendLittleEndian(zip, members.size(), 8);
+    appendLittleEndian(zip, members.size(), 8);
+    appendLittleEndian(zip, centralDir.size(), 8);
+    appendLittleEndian(zip, dirOffset, 8);
+    appendLittleEndian(zip, 0x07064b50, 4);
+    appendLittleEndian(zip, 0, 4);
+    appendLittleEndian(zip, end64Offset, 8);
+    appendLittleEndian(zip, 1, 4);
+  }
+  appendLittleEndian(zip, 0x06054b50, 4);
+  appendLittleEndian(zip, 0, 4); //disks
+  appendLittleEndian(zip, zip64 ? 0xFFFF : members.size(), 2);
+  appendLittleEndian(zip, zip64 ? 0xFFFF : members.size(), 2);
+  appendLittleEndian(zip, zip64 ? 0xFFFFFFFFULL : centralDir.size(), 4);
+  appendLittleEndian(zip, zip64 ? 0xFFFFFFFFULL : dirOffset, 4);
+  appendLittleEndian(zip, 0, 2); //comment length
+  return zip;
+}
+
+static void writeFileBytes(const string& fileName, const string& bytes) {
+  std::ofstream out(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size());
+  out.close();
+  testAssert(!out.fail());
+}
+
+static string makeTestNpy(int numRows) {
+  NumpyBuffer<float> buf({numRows,3});
+  for(int i = 0; i<numRows*3; i++)
+    buf.data[i] = (float)i * 0.25f;
+  uint64_t numBytes = buf.prepareHeaderWithNumRows(numRows);
+  return string(reinterpret_cast<const char*>(buf.dataIncludingHeader), numBytes);
+}
+
+static void checkTestNpyView(const NumpyArrayView& view, int numRows) {
+  testAssert(view.dtype == "<f4");
+  testAssert(view.shape == vector<int64_t>({numRows,3}));
+  testAssert(view.numRows == numRows);
+  vector<float> alignedBuf;
+  const float* rows = view.getRows<float>(1,numRows-1,alignedBuf);
+  testAssert(reinterpret_cast<uintptr_t>(rows) % alignof(float) == 0);
+  //Copied only if the rows within the buffer were misaligned
+  bool misaligned = reinterpret_cast<uintptr_t>(view.getRowBytes(1,numRows-1)) % alignof(float) != 0;
+  testAssert(misaligned == (reinterpret_cast<const char*>(rows) != view.getRowBytes(1,numRows-1)));
+  for(int i = 0; i<(numRows-1)*3; i++)
+    testAssert(rows[i] == (float)(i+3) * 0.25f);
+}
+
+static void runZipReaderTests() {
+  TestCommon::TempDir tempDir("zipread");
+  const bfs::path& tmpDir = tempDir.path;
+  const int numRows = 5;
+  string npy = makeTestNpy(numRows);
+  string text;
+  for(int i = 0; i<200; i++)
+    text += "row " + Global::intToString(i % 7) + "\n";
+
+  for(int zip64 = 0; zip64<2; zip64++) {
+    //Names of odd lengths so that stored data lands misaligned in the file
+    vector<TestZipMember> members = {
+      {"a.npy", npy, false},
+      {"bb.npy", npy, true},
+      {"c", text, true},
+      {"empty", "", false},
+    };
+    string fileName = (tmpDir / ("test" + Global::intToString(zip64) + ".zip")).string();
+    writeFileBytes(fileName, buildTestZip(members,zip64 != 0));
+
+    ZipReader zip(fileName);
+    testAssert(zip.getNames() == vector<string>({"a.npy","bb.npy","c","empty"}));
+    testAssert(zip.contains("c") && !zip.contains("d"));
+    testAssert(zip.isStored("a.npy") && !zip.isStored("bb.npy"));
+    testAssert(zip.getSize("bb.npy") == npy.size());
+
+    //Stored in place, without copying the file
+    const char* stored = zip.getStoredData("a.npy");
+    testAssert(string(stored,npy.size()) == npy);
+    checkTestNpyView(NumpyArrayView(stored,npy.size()), numRows);
+
+    string buf;
+    zip.readAll("bb.npy",buf);
+    testAssert(buf == npy);
+    checkTestNpyView(NumpyArrayView(buf.data(),buf.size()), numRows);
+    zip.readAll("empty",buf);
+    testAssert(buf == "");
+
+    //Decompressing in uneven pieces gives the same bytes
+    ZipMemberReader reader(zip,"c");
+    string pieces;
+    char piece[37];
+    while(true) {
+      uint64_t numRead = reader.read(piece,sizeof(piece));
+      pieces.append(piece,numRead);
+      if(numRead < sizeof(piece))
+        break;
+    }
+    testAssert(pieces == text);
+
+    bool threw = false;
+    try {
+      zip.getStoredData("c");
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+  }
+
+  auto expectIOError = [&](const string& desc, std::function<void()> f) {
+    bool threw = false;
+    try {
+      f();
+    }
+    catch(const IOError&) {
+      threw = true;
+    }
+    if(!threw)
+      cout << "Expected IOError: " << desc << endl;
+    testAssert(threw);
+  };
+
+  //Malformed npy headers
+  expectIOError("not npy", [&]() { NumpyArrayView("hello world",11); });
+  expectIOError("truncated header", [&]() { NumpyArrayView(npy.data(),20); });
+  expectIOError("truncated data", [&]() { NumpyArrayView(npy.data(),npy.size()-1); });
+  {
+    string bad = npy;
+    size_t idx = bad.find("'shape'");
+    testAssert(idx != string::npos);
+    bad[idx+1] = 'x';
+    expectIOError("no shape", [&]() { NumpyArrayView(bad.data(),bad.size()); });
+  }
+  {
+    string bad = npy;
+    size_t idx = bad.find("False");
+    testAssert(idx != string::npos);
+    bad.replace(idx,5,"True ");
+    expectIOError("fortran order", [&]() { NumpyArrayView(bad.data(),bad.size()); });
+  }
+
+  //Malformed zips
+  string good = buildTestZip({{"a.npy", npy, false}, {"c", text, true}}, false);
+  string badFileName = (tmpDir / "bad.zip").string();
+  auto expectZipIOError = [&](const string& desc, const string& bytes, const string& member) {
+    writeFileBytes(badFileName, bytes);
+    expectIOError(desc, [&]() {
+      ZipReader zip(badFileName);
+      string buf;
+      zip.readAll(member,buf);
+    });
+  };
+  expectZipIOError("too short", good.substr(0,10), "c");
+  expectZipIOError("no end record", good.substr(0,good.size()-4), "c");
+  {
+    string bad = good;
+    bad[good.size()-3] ^= 0x40; //high byte of the central directory offset
+    expectZipIOError("bad central directory offset", bad, "c");
+  }
+  {
+    string bad = good;
+    bad[0] = 'X'; //local header signature of a.npy
+    expectZipIOError("bad local header", bad, "a.npy");
+  }
+  {
+    string bad = good;
+    bad[30 + 5 + npy.size() - 1] ^= 0x1; //last byte of the stored data of a.npy
+    expectZipIOError("bad crc", bad, "a.npy");
+  }
+  {
+    string bad = good;
+    bad[30 + 5 + npy.size() + 30 + 1 + 2] ^= 0x55; //within the deflated data of c, after its local header
+    expectZipIOError("bad deflate data", bad, "c");
+  }
+  expectZipIOError("missing member", good, "d");
+}
+
+static void runTFRecordTests() {
+  //Standard check value for crc32c
+  testAssert(TFRecordWriter::crc32c("123456789",9) == 0xE3069283U);
+
+  //Example { features { feature { key: "a" value { bytes_list { value: "xy" } } } } }
+  TFExampleBuilder example;
+  example.addBytes("a","xy",2);
+  const char expected[] = {0x0a,0x0d, 0x0a,0x0b, 0x0a,0x01,'a', 0x12,0x06, 0x0a,0x04, 0x0a,0x02,'x','y'};
+  testAssert(example.serialize() == string(expected,sizeof(expected)));
+
+  example.clear();
+  float floats[3] = {1.0f,-2.5f,3.0f};
+  example.addFloats("f",floats,3);
+  std::map<string,std::pair<bool,string>> parsed = parseTFExample(example.serialize());
+  testAssert(parsed.size() == 1);
+  testAssert(parsed["f"].first);
+  testAssert(bytesToFloats(parsed["f"].second) == vector<float>(floats,floats+3));
+}
+
+static void runShuffleTests() {
+  TestCommon::TempDir tempDir("shuffle");
+  const bfs::path& tmpDir = tempDir.path;
+  bfs::create_directories(tmpDir / "data");
+  const int numInputFiles = 3;
+  const int rowsPerInputFile = 37;
+  for(int i = 0; i<numInputFiles; i++)
+    writeTestShuffleNpz((tmpDir / "data" / ("d" + Global::intToString(i) + ".npz")).string(), i * rowsPerInputFile, rowsPerInputFile);
+
+  const int batchSize = 8;
+  string outDir = (tmpDir / "out").string();
+  vector<string> args = {
+    "shuffle",
+    "-data-dir", (tmpDir / "data").string(),
+    "-min-rows", "10",
+    "-max-rows", "1000",
+    "-expand-window-per-row", "1.0",
+    "-taper-window-exponent", "1.0",
+    "-out-dir", outDir,
+    "-out-tmp-dir", (tmpDir / "tmp").string(),
+    "-approx-rows-per-out-file", "50",
+    "-batch-size", Global::intToString(batchSize),
+    "-num-threads", "2",
+    "-seed", "abc",
+  };
+  vector<const char*> argv;
+  for(size_t i = 0; i<args.size(); i++)
+    argv.push_back(args[i].c_str());
+  testAssert(MainCmds::shuffle((int)argv.size(),argv.data()) == 0);
+
+  //111 rows in 2 output files, with the rows beyond the last whole batch of each dropped
+  int64_t totalRows = 0;
+  int64_t totalBatches = 0;
+  std::set<int> seenIds;
+  for(int k = 0; k<2; k++) {
+    string prefix = outDir + "/data" + Global::intToString(k);
+    testAssert(!bfs::exists(prefix + ".tfrecord.tmp"));
+    vector<string> records = splitTFRecords(inflateZlib(readFileBytes(prefix + ".tfrecord")));
+
+    string json = readFileBytes(prefix + ".json");
+    int64_t numRows = 0;
+    int64_t numBatches = 0;
+    testAssert(sscanf(json.c_str(),"{\"num_rows\": %lld, \"num_batches\": %lld}",(long long*)&numRows,(long long*)&numBatches) == 2);
+    testAssert(numBatches == numRows / batchSize);
+    testAssert((int64_t)records.size() == numBatches);
+    totalRows += numRows;
+    totalBatches += numBatches;
+
+    for(size_t b = 0; b<records.size(); b++) {
+      std::map<string,std::pair<bool,string>> features = parseTFExample(records[b]);
+      testAssert(features.size() == 7);
+      testAssert(!features["binchwp"].first);
+      const string& binchwp = features["binchwp"].second;
+      testAssert(binchwp.size() == batchSize * 6);
+      vector<float> ginc = bytesToFloats(features["ginc"].second);
+      vector<float> ptncm = bytesToFloats(features["ptncm"].second);
+      vector<float> gtnc = bytesToFloats(features["gtnc"].second);
+      vector<float> sdn = bytesToFloats(features["sdn"].second);
+      vector<float> sbsn = bytesToFloats(features["sbsn"].second);
+      vector<float> vtnchw = bytesToFloats(features["vtnchw"].second);
+      testAssert(ginc.size() == batchSize * 2 && ptncm.size() == batchSize * 4 && gtnc.size() == batchSize * 3);
+      testAssert(sdn.size() == batchSize * 4 && sbsn.size() == batchSize * 2 && vtnchw.size() == batchSize * 4);
+      for(int r = 0; r<batchSize; r++) {
+        int id = (int)ginc[r*2];
+        testAssert(id >= 0 && id < numInputFiles * rowsPerInputFile);
+        testAssert(seenIds.find(id) == seenIds.end());
+        seenIds.insert(id);
+        //Every array of the row must have stayed together
+        for(int i = 0; i<6; i++) testAssert((uint8_t)binchwp[r*6+i] == (uint8_t)(id + i));
+        for(int i = 0; i<2; i++) testAssert(ginc[r*2+i] == (float)(id + i));
+        for(int i = 0; i<4; i++) testAssert(ptncm[r*4+i] == (float)(id * 10 + i));
+        for(int i = 0; i<3; i++) testAssert(gtnc[r*3+i] == (float)(id + i) * 0.5f);
+        for(int i = 0; i<4; i++) testAssert(sdn[r*4+i] == (float)(id % 100 + i));
+        for(int i = 0; i<2; i++) testAssert(sbsn[r*2+i] == (float)(id % 50 - i));
+        for(int i = 0; i<4; i++) testAssert(vtnchw[r*4+i] == (float)(id % 30 + i));
+      }
+    }
+  }
+  testAssert(!bfs::exists(outDir + "/data2.tfrecord"));
+  testAssert(totalRows == numInputFiles * rowsPerInputFile);
+  testAssert((int64_t)seenIds.size() == totalBatches * batchSize);
+  testAssert(bfs::exists(outDir + ".json"));
+}
+
+//Adds rows 0 to numRows-1, each holding its index in every column, to a ShardedDataPool, with numThreads threads
+//each adding a contiguous range of them. Returns the indices of the rows in the order they were written, and in
+//numWrittenBeforeFinish, how many were evicted before emptying the pool.
+static vector<int> runTestDataPool(
+  const string& seed, size_t poolCapacity, int numShards, int numRows, int numThreads, size_t& numWrittenBeforeFinish
+) {
+  const size_t rowWidth = 3;
+  std::mutex writtenMutex;
+  vector<int> written;
+  std::function<void(const float*,size_t)> writeRow = [&](const float* rows, size_t numRowsToWrite) {
+    std::lock_guard<std::mutex> lock(writtenMutex);
+    for(size_t i = 0; i<numRowsToWrite; i++) {
+      const float* row = rows + i * rowWidth;
+      //Every column of the row must have stayed together
+      for(size_t j = 1; j<rowWidth; j++)
+        testAssert(row[j] == row[0]);
+      written.push_back((int)row[0]);
+    }
+  };
+
+  ShardedDataPool dataPool(rowWidth,poolCapacity,1,numShards,writeRow);
+  auto addLoop = [&](int threadIdx) {
+    Rand rand(seed + ":" + Global::intToString(threadIdx));
+    float row[rowWidth];
+    for(int r = threadIdx * numRows / numThreads; r < (threadIdx+1) * numRows / numThreads; r++) {
+      std::fill(row, row + rowWidth, (float)r);
+      dataPool.addRow(row,rand);
+    }
+  };
+  vector<std::thread> threads;
+  for(int i = 0; i<numThreads; i++)
+    threads.push_back(std::thread(addLoop,i));
+  for(int i = 0; i<numThreads; i++)
+    threads[i].join();
+
+  numWrittenBeforeFinish = written.size();
+  Rand rand(seed + ":finish");
+  dataPool.finishAndWritePool(rand);
+
+  //Every row is written exactly once
+  vector<int> sorted = written;
+  std::sort(sorted.begin(),sorted.end());
+  testAssert((int)sorted.size() == numRows);
+  for(int i = 0; i<numRows; i++)
+    testAssert(sorted[i] == i);
+  return written;
+}
+
+static void runDataPoolTests() {
+  const size_t poolCapacity = 50;
+  const int numShards = 4;
+  const int numRows = 500;
+
+  //With one thread adding, sharding and eviction depend only on the seed
+  size_t numEarly = 0;
+  size_t numEarly2 = 0;
+  vector<int> order = runTestDataPool("abc",poolCapacity,numShards,numRows,1,numEarly);
+  testAssert(runTestDataPool("abc",poolCapacity,numShards,numRows,1,numEarly2) == order);
+  testAssert(numEarly2 == numEarly);
+  testAssert(runTestDataPool("abd",poolCapacity,numShards,numRows,1,numEarly2) != order);
+
+  //Shards only evict once full, and at least every row beyond the total capacity must be evicted
+  testAssert(numEarly >= numRows - poolCapacity && numEarly < (size_t)numRows);
+  //The rows are shuffled, not written in the order they were added
+  testAssert(!std::is_sorted(order.begin(),order.end()));
+  testAssert(!std::is_sorted(order.begin(),order.begin() + numEarly));
+
+  //Every shard gets room for one row, even with less capacity than shards
+  runTestDataPool("abc",2,numShards,numRows,1,numEarly);
+  testAssert(numEarly == numRows - numShards);
+
+  //Many threads adding at once still write every row exactly once
+  runTestDataPool("abc",poolCapacity,numShards,numRows,4,numEarly);
+}
+
+//Leela Zero's encoding of the stones of one color: 90 hex digits for points 0-359, each digit's high bit being its
+//first point, then 0 or 1 for point 360. Point y*19+x is (x,y).
+static string encodeLZStonesLine(const Board& board, Color color) {
+  string line;
+  for(int i = 0; i<90; i++) {
+    int digit = 0;
+    for(int j = 0; j<4; j++) {
+      int point = i*4+j;
+      if(board.colors[Location::getLoc(point % 19, point / 19, 19)] == color)
+        digit |= 0x8 >> j;
+    }
+    line.push_back("0123456789abcdef"[digit]);
+  }
+  line.push_back(board.colors[Location::getLoc(18,18,19)] == color ? '1' : '0');
+  return line;
+}
+
+static string joinLines(const vector<string>& lines, const string& lineEnd) {
+  string s;
+  for(size_t i = 0; i<lines.size(); i++)
+    s += lines[i] + lineEnd;
+  return s;
+}
+
+static void writeGzFile(const string& fileName, const string& text) {
+  gzFile out = gzopen(fileName.c_str(),"wb");
+  testAssert(out != NULL);
+  testAssert(gzwrite(out,text.data(),(unsigned int)text.size()) == (int)text.size());
+  testAssert(gzclose(out) == Z_OK);
+}
+
+static void runLZParseTests() {
+  TestCommon::TempDir tempDir("lzparse");
+  const bfs::path& tmpDir = tempDir.path;
+
+  //A short game with a capture and a pass, with stones on the last point and on both sides of the 64-point boundary
+  //between words. Black moved last, so white is to move.
+  Board board(19,19);
+  board.setStone(Location::getLoc(18,18,19),P_BLACK);
+  board.setStone(Location::getLoc(7,3,19),P_BLACK);
+  board.setStone(Location::getLoc(6,3,19),P_WHITE);
+  board.setStone(Location::getLoc(0,0,19),P_WHITE);
+  const vector<Move> gameMoves = {
+    Move(Location::getLoc(1,0,19),P_BLACK),
+    Move(Location::getLoc(15,15,19),P_WHITE),
+    Move(Location::getLoc(0,1,19),P_BLACK),
+    Move(Board::PASS_LOC,P_WHITE),
+    Move(Location::getLoc(10,10,19),P_BLACK),
+    Move(Location::getLoc(9,10,19),P_WHITE),
+    Move(Location::getLoc(16,3,19),P_BLACK),
+  };
+  //Most recent first, as in the data
+  vector<Board> boards = {board};
+  for(size_t i = 0; i<gameMoves.size(); i++) {
+    board.playMoveAssumeLegal(gameMoves[i].loc,gameMoves[i].pla);
+    boards.insert(boards.begin(),board);
+  }
+  testAssert(boards[4].colors[Location::getLoc(0,0,19)] == C_EMPTY);
+
+  const int nextPolicyPoint = 16*19+4;
+  string policyLine;
+  for(int i = 0; i<362; i++)
+    policyLine += (i == nextPolicyPoint ? string("0.5") : Global::intToString(i % 7) + "e-3") + (i < 361 ? " " : "");
+
+  string sample;
+  for(int i = 0; i<LZSample::NUM_HISTORY; i++)
+    sample += encodeLZStonesLine(boards[i],P_WHITE) + "\n";
+  for(int i = 0; i<LZSample::NUM_HISTORY; i++)
+    sample += encodeLZStonesLine(boards[i],P_BLACK) + "\n";
+  sample += "1\n";
+  sample += policyLine + "\n";
+  sample += "-1\n";
+
+  //Decoding, with a second copy of the sample in windows line endings
+  {
+    string crlfSample = joinLines(Global::split(sample,'\n'),"\r\n");
+    string fileName = (tmpDir / "good.gz").string();
+    writeGzFile(fileName, sample + "\n" + crlfSample);
+    int numSamples = 0;
+    LZSample::iterSamples(fileName, [&](const LZSample& lz, const string& name, int sampleCount) {
+      testAssert(name == fileName);
+      testAssert(sampleCount == numSamples);
+      numSamples++;
+
+      for(int i = 0; i<LZSample::NUM_HISTORY; i++) {
+        for(int point = 0; point<LZSample::NUM_POINTS; point++) {
+          Color color = boards[i].colors[Location::getLoc(point % 19, point / 19, 19)];
+          testAssert(((lz.plaStones[i][point / 64] >> (point % 64)) & 1) == (color == P_WHITE ? 1U : 0U));
+          testAssert(((lz.oppStones[i][point / 64] >> (point % 64)) & 1) == (color == P_BLACK ? 1U : 0U));
+        }
+      }
+      testAssert(lz.pla == P_WHITE);
+      testAssert(!lz.plaWon);
+      for(int i = 0; i<362; i++)
+        testAssert(lz.policy[i] == (i == nextPolicyPoint ? 0.5f : (float)((i % 7) * 1e-3)));
+
+      Board parsedBoard;
+      BoardHistory hist;
+      vector<Move> moves;
+      float policyTarget[362];
+      Player nextPlayer;
+      Player winner;
+      lz.parse(parsedBoard,hist,moves,policyTarget,nextPlayer,winner);
+      for(int y = 0; y<19; y++)
+        for(int x = 0; x<19; x++)
+          testAssert(parsedBoard.colors[Location::getLoc(x,y,19)] == board.colors[Location::getLoc(x,y,19)]);
+      testAssert(moves.size() == 8);
+      for(size_t i = 0; i<gameMoves.size(); i++)
+        testAssert(moves[i].loc == gameMoves[i].loc && moves[i].pla == gameMoves[i].pla);
+      //The next move is the argmax of the policy
+      testAssert(moves[7].loc == Location::getLoc(4,16,19) && moves[7].pla == P_WHITE);
+      testAssert(hist.moveHistory.size() == gameMoves.size());
+      for(int i = 0; i<362; i++)
+        testAssert(policyTarget[i] == lz.policy[i]);
+      testAssert(nextPlayer == P_WHITE);
+      testAssert(winner == P_BLACK);
+    });
+    testAssert(numSamples == 2);
+  }
+
+  //Bad samples come after a good one, which is still handed over before the error
+  vector<string> lines = Global::split(sample,'\n');
+  testAssert(lines.size() == 19);
+  auto expectLZError = [&](const string& desc, const vector<string>& badLines, const string& expectedMessage) {
+    string fileName = (tmpDir / "bad.gz").string();
+    writeGzFile(fileName, sample + joinLines(badLines,"\n"));
+    int numSamples = 0;
+    string message;
+    try {
+      LZSample::iterSamples(fileName, [&](const LZSample&, const string&, int) { numSamples++; });
+    }
+    catch(const IOError& e) {
+      message = e.message;
+    }
+    if(message != fileName + " sample 1: " + expectedMessage)
+      cout << desc << ": got \"" << message << "\"" << endl;
+    testAssert(message == fileName + " sample 1: " + expectedMessage);
+    testAssert(numSamples == 1);
+  };
+  auto withLine = [&](int idx, const string& line) {
+    vector<string> badLines = lines;
+    badLines[idx] = line;
+    return badLines;
+  };
+
+  expectLZError("truncated", vector<string>(lines.begin(),lines.end()-1), "Truncated leela zero sample");
+  expectLZError("truncated stones", vector<string>(lines.begin(),lines.begin()+5), "Truncated leela zero sample");
+  expectLZError("bad hex", withLine(3, "g" + lines[3].substr(1)), "Bad leela zero hex char");
+  expectLZError("uppercase hex", withLine(9, lines[9].substr(0,40) + "A" + lines[9].substr(41)), "Bad leela zero hex char");
+  expectLZError("short stones", withLine(0, lines[0].substr(1)), "Bad leela zero stones line length");
+  expectLZError("bad last stone", withLine(15, lines[15].substr(0,90) + "2"), "Bad leela zero last stone char");
+  expectLZError("bad side", withLine(16, "2"), "Bad leela zero side to move");
+  expectLZError("long side", withLine(16, "10"), "Bad leela zero side to move");
+  expectLZError("short policy", withLine(17, policyLine.substr(0,policyLine.rfind(' '))), "Bad leela zero policy");
+  expectLZError("long policy", withLine(17, policyLine + " 0"), "Bad leela zero policy, too many values");
+  expectLZError("bad policy", withLine(17, "x" + policyLine), "Bad leela zero policy");
+  expectLZError("bad result", withLine(18, "0"), "Bad leela zero result");
+
+  {
+    string fileName = (tmpDir / "missing.gz").string();
+    string message;
+    try {
+      LZSample::iterSamples(fileName, [&](const LZSample&, const string&, int) {});
+    }
+    catch(const IOError& e) {
+      message = e.message;
+    }
+    testAssert(message == "Could not open " + fileName);
+  }
+}
+
+//Rows of an npz written by NpzRowWriter, unpacked back into the float rows of the h5 format
+static vector<vector<float>> readNpzRowsAsFloat(const string& fileName) {
+  using namespace RowWrite;
+  ZipReader zip(fileName);
+  std::map<string,string> bufs;
+  std::map<string,NumpyArrayView> views;
+  const vector<string> names = {
+    "binaryInputNCHWPacked", "globalInputNC", "policyTargetsNMove", "globalTargetsNC", "rankN",
+    "recentCapturesNPos", "nextMovesNC", "sgfHashN2", "includeHistoryNC"
+  };
+  testAssert(zip.getNames() == names);
+  for(const string& name: names) {
+    zip.readAll(name,bufs[name]);
+    views[name] = NumpyArrayView(bufs[name].data(),bufs[name].size());
+  }
+  int64_t numRows = views["rankN"].numRows;
+  testAssert(views["binaryInputNCHWPacked"].shape == vector<int64_t>({numRows, numBinaryFeatures, npzPackedBoardArea}));
+  testAssert(views["sgfHashN2"].shape == vector<int64_t>({numRows, 2}));
+  testAssert(views["nextMovesNC"].shape == vector<int64_t>({numRows, nextMovesLen}));
+
+  vector<uint8_t> u8Buf;
+  vector<int8_t> i8Buf;
+  vector<int16_t> i16Buf;
+  vector<uint64_t> u64Buf;
+  vector<float> floatBuf;
+  vector<vector<float>> rows;
+  for(int64_t n = 0; n<numRows; n++) {
+    vector<float> row(totalRowLen,0.0f);
+
+    const uint8_t* packed = views["binaryInputNCHWPacked"].getRows<uint8_t>(n,1,u8Buf);
+    for(int c = 0; c<numBinaryFeatures; c++) {
+      const uint8_t* plane = packed + c * npzPackedBoardArea;
+      for(int pos = 0; pos<npzPosArea; pos++) {
+        if(plane[pos / 8] & (0x80 >> (pos % 8)))
+          row[inputStart + pos * numFeatures + c] = 1.0f;
+      }
+      //Padding to a round byte is zero
+      for(int pos = npzPosArea; pos<npzPackedBoardArea * 8; pos++)
+        testAssert((plane[pos / 8] & (0x80 >> (pos % 8))) == 0);
+    }
+    float komi = views["globalInputNC"].getRows<float>(n,1,floatBuf)[0];
+    for(int pos = 0; pos<npzPosArea; pos++)
+      row[inputStart + pos * numFeatures + numBinaryFeatures] = komi;
+
+    const float* policy = views["policyTargetsNMove"].getRows<float>(n,1,floatBuf);
+    std::copy(policy, policy + policyTargetLen, row.begin() + policyTargetStart);
+
+    const float* global = views["globalTargetsNC"].getRows<float>(n,1,floatBuf);
+    row[valueTargetStart] = global[0];
+    row[targetWeightsStart] = global[1];
+    row[sideStart] = global[2];
+    row[turnNumberStart] = global[3];
+    row[turnNumberStart+1] = global[4];
+
+    int rankOneHot = views["rankN"].getRows<int8_t>(n,1,i8Buf)[0];
+    testAssert(rankOneHot >= -1 && rankOneHot < rankLen);
+    if(rankOneHot != -1)
+      row[rankStart + rankOneHot] = 1.0f;
+
+    const int8_t* recentCaptures = views["recentCapturesNPos"].getRows<int8_t>(n,1,i8Buf);
+    for(int i = 0; i<recentCapturesLen; i++)
+      row[recentCapturesStart + i] = recentCaptures[i];
+    const int16_t* nextMoves = views["nextMovesNC"].getRows<int16_t>(n,1,i16Buf);
+    for(int i = 0; i<nextMovesLen; i++)
+      row[nextMovesStart + i] = nextMoves[i];
+
+    const uint64_t* sgfHash = views["sgfHashN2"].getRows<uint64_t>(n,1,u64Buf);
+    uint64_t hash0 = sgfHash[0];
+    uint64_t hash1 = sgfHash[1];
+    for(int i = 0; i<4; i++) {
+      row[sgfHashStart + i] = (float)((hash1 >> (16 * i)) & 0xFFFF);
+      row[sgfHashStart + 4 + i] = (float)((hash0 >> (16 * i)) & 0xFFFF);
+    }
+
+    const uint8_t* includeHistory = views["includeHistoryNC"].getRows<uint8_t>(n,1,u8Buf);
+    for(int i = 0; i<includeHistoryLen; i++)
+      row[includeHistoryStart + i] = includeHistory[i];
+
+    rows.push_back(row);
+  }
+  return rows;
+}
+
+//Featurize rows from a random game as the write tool does, write them as npz, and check that unpacking the npz gives
+//back the same float rows, which are what the h5 format stores as-is.
+static void runRowWriteTests() {
+  using namespace RowWrite;
+  TestCommon::TempDir tempDir("rowwrite");
+  const bfs::path& tmpDir = tempDir.path;
+  Rand rand("write output format tests");
+  const bool multiStoneSuicideLegal = false;
+  Rules rules;
+  rules.koRule = Rules::KO_SIMPLE;
+  rules.scoringRule = Rules::SCORING_AREA;
+  rules.multiStoneSuicideLegal = multiStoneSuicideLegal;
+  rules.komi = 7.5f;
+
+  //A random game long enough to have captures, and with some passes
+  vector<Move> moves;
+  {
+    Board board(maxBoardSize,maxBoardSize);
+    Player pla = P_BLACK;
+    for(int i = 0; i<240; i++) {
+      Loc loc = Board::PASS_LOC;
+      if(rand.nextUInt(20) != 0) {
+        for(int tries = 0; tries<100; tries++) {
+          Loc l = Location::getLoc(rand.nextUInt(maxBoardSize),rand.nextUInt(maxBoardSize),maxBoardSize);
+          if(board.isLegal(l,pla,multiStoneSuicideLegal)) {
+            loc = l;
+            break;
+          }
+        }
+      }
+      board.playMoveAssumeLegal(loc,pla);
+      moves.push_back(Move(loc,pla));
+      pla = getOpp(pla);
+    }
+  }
+
+  //Rows every so often, and at the very end where there are fewer than nextMovesLen moves left
+  vector<vector<float>> rows;
+  {
+    Board board(maxBoardSize,maxBoardSize);
+    BoardHistory hist(board,P_BLACK,rules,0);
+    for(int j = 0; j<moves.size(); j++) {
+      if(j % 19 == 0 || j == moves.size() - 1) {
+        float policyTarget[policyTargetLen];
+        for(int k = 0; k<policyTargetLen; k++)
+          policyTarget[k] = (float)rand.nextDouble();
+        float valueTarget = (float)((int)rand.nextUInt(3) - 1);
+        int rankOneHot = (int)rand.nextUInt(rankLen+1) - 1;
+        Hash128 sgfHash(rand.nextUInt64(),rand.nextUInt64());
+        vector<float> row(totalRowLen,0.0f);
+        fillRow(board,hist,moves,j,moves[j].pla,policyTarget,valueTarget,TARGET_NEXT_MOVE,rankOneHot,sgfHash,row.data(),rand,false);
+        rows.push_back(row);
+      }
+      hist.makeBoardMoveAssumeLegal(board,moves[j].loc,moves[j].pla,NULL);
+    }
+  }
+  const size_t numRows = rows.size();
+
+  //npz, with rows split over several files and a partial last file
+  {
+    const int rowsPerFile = 5;
+    string prefix = (tmpDir / "rows").string();
+    NpzRowWriter npzWriter(prefix,rowsPerFile);
+    for(size_t i = 0; i<numRows; i++)
+      npzWriter.addRow(rows[i].data());
+    npzWriter.flush();
+    npzWriter.flush();
+    int numFiles = (int)((numRows + rowsPerFile - 1) / rowsPerFile);
+    testAssert(npzWriter.numFilesWritten == numFiles);
+
+    size_t rowIdx = 0;
+    for(int f = 0; f<numFiles; f++) {
+      string fileName = prefix + "." + Global::intToString(f) + ".npz";
+      vector<vector<float>> readRows = readNpzRowsAsFloat(fileName);
+      testAssert(readRows.size() == std::min((size_t)rowsPerFile, numRows - rowIdx));
+      for(size_t i = 0; i<readRows.size(); i++)
+        testAssert(readRows[i] == rows[rowIdx + i]);
+      rowIdx += readRows.size();
+    }
+    testAssert(rowIdx == numRows);
+    testAssert(!bfs::exists(prefix + "." + Global::intToString(numFiles) + ".npz"));
+  }
+}
+
+void Tests::runDataIOTests() {
+  runZipReaderTests();
+  runTFRecordTests();
+  runShuffleTests();
+  runDataPoolTests();
+  runLZParseTests();
+  runRowWriteTests();
+}
@@ -292,11 +292,11 @@ void Tests::runNNInputsV3V4Tests() {
                      float* rowBin, float* rowGlobal) {
     if(version == 3) {
       hash = NNInputs::getHashV3(board,hist,nextPla,drawEquivalentWinsForWhite);
-      NNInputs::fillRowV3(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,rowBin,rowGlobal);
+      NNInputs::fillRowV3(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,rowBin,rowGlobal,NULL);
     }
     else if(version == 4) {
       hash = NNInputs::getHashV4(board,hist,nextPla,drawEquivalentWinsForWhite);
-      NNInputs::fillRowV4(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,rowBin,rowGlobal);
+      NNInputs::fillRowV4(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,rowBin,rowGlobal,NULL);
     }
     else if(version == 5) {
       hash = NNInputs::getHashV5(board,hist,nextPla,drawEquivalentWinsForWhite);
@@ -791,4 +791,133 @@ xxx..xx
     delete sgf;
 
   }
+
+  {
+    const char* name = "NN Inputs V3V4 ladder cache gives identical rows";
+    cout << "-----------------------------------------------------------------" <<  endl;
+    cout << name << endl;
+    cout << "-----------------------------------------------------------------" <<  endl;
+
+    const string sgfStr = "(;FF[4]GM[1]SZ[13]PB[s75411712-d5152283-b8c128]PW[s78621440-d5365731-b8c128]HA[0]KM[7.5]RU[koPOSITIONALscoreAREAsui0]RE[B+11.5];B[ck];W[lb];B[ke];W[ld];B[jd];W[kc];B[jc];W[jb];B[ib];W[kk];B[ki];W[kh];B[ja];W[le];B[ic];W[kf];B[lj];W[li];B[kj];W[lk];B[jk];W[jl];B[ik];W[mj];B[kb];W[jj];B[ji];W[ij];B[ii];W[hj];B[lh];W[mi];B[kg];W[jg];B[jh];W[lg];B[hk];W[hi];B[mh];W[gk];B[mk];W[il];B[jf];W[lf];B[ig];W[cc];B[dc];W[cd];B[ed];W[kd];B[dj];W[el];B[eg];W[de];B[ee];W[ec];B[je];W[db];B[fc];W[eb];B[bj];W[fd];B[gc];W[cl];B[df];W[dd];B[cf];W[dl];B[gh];W[fk];B[la];W[hh];B[hg];W[fi];B[gg];W[mc];B[bk];W[fb];B[gb];W[ei];B[gi];W[fe];B[ef];W[ej];B[gj];W[hl];B[bh];W[mg];B[be];W[bd];B[ad];W[bb];B[ae];W[di];B[me];W[ci];B[bi];W[bl];B[ab];W[ba];B[ac];W[ml];B[ga];W[fa];B[al];W[bc];B[bf];W[mj];B[mi];W[mb];B[ge];W[mk];B[dk];W[md];B[ek];W[fj];B[jb];W[fh];B[ff];W[bm];B[ka];W[ce];B[ak];W[cj];B[ch];W[];B[id];W[fl];B[hc];W[am];B[ik];W[jk];B[ma];W[];B[mm];W[gl];B[aa];W[ca];B[dh];W[fg];B[];W[lm];B[bg];W[];B[hd];W[];B[ag];W[];B[hf];W[];B[gd];W[];B[ih];W[];B[li];W[];B[hb];W[];B[af];W[];B[ia];W[];B[kl];W[];B[])";
+
+    CompactSgf* sgf = CompactSgf::parse(sgfStr);
+
+    for(int version = minVersion; version <= 4; version++) {
+      Board board;
+      Player nextPla;
+      BoardHistory hist;
+      Rules initialRules;
+      sgf->setupInitialBoardAndHist(initialRules, board, nextPla, hist);
+      vector<Move>& moves = sgf->moves;
+
+      int posLen = 13;
+      double drawEquivalentWinsForWhite = 0.0;
+      bool inputsUseNHWC = true;
+      LadderCache ladderCache(12,4);
+
+      int numFeaturesBin;
+      int numFeaturesGlobal;
+      float* rowBin;
+      float* rowGlobal;
+      allocateRows(version,posLen,numFeaturesBin,numFeaturesGlobal,rowBin,rowGlobal);
+      float* cachedRowBin;
+      float* cachedRowGlobal;
+      allocateRows(version,posLen,numFeaturesBin,numFeaturesGlobal,cachedRowBin,cachedRowGlobal);
+
+      int numDifferingRows = 0;
+      for(size_t i = 0; i<moves.size(); i++) {
+        assert(hist.isLegal(board,moves[i].loc,moves[i].pla));
+        hist.makeBoardMoveAssumeLegal(board,moves[i].loc,moves[i].pla,NULL);
+        nextPla = getOpp(moves[i].pla);
+
+        Hash128 hash;
+        fillRows(version,hash,board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,rowBin,rowGlobal);
+        //Fill twice, so that the second fill comes entirely from the cache
+        for(int rep = 0; rep < 2; rep++) {
+          if(version == 3)
+            NNInputs::fillRowV3(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,cachedRowBin,cachedRowGlobal,&ladderCache);
+          else
+            NNInputs::fillRowV4(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,inputsUseNHWC,cachedRowBin,cachedRowGlobal,&ladderCache);
+          bool differs = false;
+          for(int j = 0; j<numFeaturesBin*posLen*posLen; j++)
+            differs = differs || rowBin[j] != cachedRowBin[j];
+          for(int j = 0; j<numFeaturesGlobal; j++)
+            differs = differs || rowGlobal[j] != cachedRowGlobal[j];
+          if(differs)
+            numDifferingRows++;
+        }
+      }
+      cout << "VERSION " << version << " moves " << moves.size() << " differing rows " << numDifferingRows << endl;
+
+      delete[] rowBin;
+      delete[] rowGlobal;
+      delete[] cachedRowBin;
+      delete[] cachedRowGlobal;
+    }
+
+    delete sgf;
+  }
+
+  {
+    const char* name = "NN Inputs V5 packed planes unpack to the same rows in NHWC and NCHW";
+    cout << "-----------------------------------------------------------------" <<  endl;
+    cout << name << endl;
+    cout << "-----------------------------------------------------------------" <<  endl;
+
+    const string sgfStr = "(;FF[4]GM[1]SZ[9]HA[0]KM[7];B[ee];W[cg];B[dc];W[gd];B[fc];W[ge];B[gf];W[hf];B[gg];W[hg];B[gh];W[hh];B[fd];W[ce];B[cd];W[de];B[bd];W[eg];B[df];W[ef];B[ff];W[cf];B[fg];W[ed];B[be];W[bf];B[];W[])";
+    CompactSgf* sgf = CompactSgf::parse(sgfStr);
+
+    //Use a posLen larger than the board so that padding is covered too
+    for(int posLen = 9; posLen <= 19; posLen += 10) {
+      Board board;
+      Player nextPla;
+      BoardHistory hist;
+      Rules initialRules;
+      sgf->setupInitialBoardAndHist(initialRules, board, nextPla, hist);
+      vector<Move>& moves = sgf->moves;
+
+      double drawEquivalentWinsForWhite = 0.5;
+      int posArea = posLen*posLen;
+      int numFeaturesBin = NNInputs::NUM_FEATURES_BIN_V5;
+      uint64_t* rowBinPacked = new uint64_t[numFeaturesBin*NNInputs::PACKED_PLANE_WORDS];
+      float* rowGlobal = new float[NNInputs::NUM_FEATURES_GLOBAL_V5];
+      float* rowBinNHWC = new float[numFeaturesBin*posArea];
+      float* rowBinNCHW = new float[numFeaturesBin*posArea];
+
+      int numDifferingRows = 0;
+      int numBitsSet = 0;
+      for(size_t i = 0; i<moves.size(); i++) {
+        assert(hist.isLegal(board,moves[i].loc,moves[i].pla));
+        hist.makeBoardMoveAssumeLegal(board,moves[i].loc,moves[i].pla,NULL);
+        nextPla = getOpp(moves[i].pla);
+
+        NNInputs::fillRowV5Packed(board,hist,nextPla,drawEquivalentWinsForWhite,posLen,rowBinPacked,rowGlobal);
+        NNInputs::unpackRowBin(rowBinPacked,numFeaturesBin,posLen,true,rowBinNHWC);
+        NNInputs::unpackRowBin(rowBinPacked,numFeaturesBin,posLen,false,rowBinNCHW);
+        bool differs = false;
+        for(int c = 0; c<numFeaturesBin; c++) {
+          for(int pos = 0; pos<NNInputs::PACKED_PLANE_WORDS*64; pos++) {
+            bool bit = ((rowBinPacked[c*NNInputs::PACKED_PLANE_WORDS + (pos >> 6)] >> (pos & 63)) & 1) != 0;
+            numBitsSet += bit ? 1 : 0;
+            if(pos >= posArea) {
+              differs = differs || bit;
+              continue;
+            }
+            float expected = bit ? 1.0f : 0.0f;
+            differs = differs || rowBinNHWC[pos*numFeaturesBin+c] != expected || rowBinNCHW[c*posArea+pos] != expected;
+          }
+        }
+        if(differs)
+          numDifferingRows++;
+      }
+      cout << "posLen " << posLen << " moves " << moves.size() << " bits set " << numBitsSet << " differing rows " << numDifferingRows << endl;
+
+      delete[] rowBinPacked;
+      delete[] rowGlobal;
+      delete[] rowBinNHWC;
+      delete[] rowBinNCHW;
+    }
+
+    delete sgf;
+  }
 }
@@ -2175,18 +2175,19 @@ isResignation: 0
     rules.multiStoneSuicideLegal = true;
     BoardHistory hist(board,P_BLACK,rules,0);
     BoardHistory hist2(board,P_BLACK,rules,0);
+    Board copy = board;
 
     auto compareHists = [&]() {
       out << hist.moveHistory.size() << " " << hist2.moveHistory.size() << endl;
       out << hist.koHashHistory.size() << " " << hist2.koHashHistory.size() << endl;
       out << hist.koHashHistory[0] << " " << hist2.koHashHistory[0] << endl;
       out << hist.koHistoryLastClearedBeginningMoveIdx << " " << hist2.koHistoryLastClearedBeginningMoveIdx << endl;
-      out << hist.getRecentBoard(0).pos_hash <<  " " << hist2.getRecentBoard(0).pos_hash << endl;
-      out << hist.getRecentBoard(1).pos_hash <<  " " << hist2.getRecentBoard(1).pos_hash << endl;
-      out << hist.getRecentBoard(2).pos_hash <<  " " << hist2.getRecentBoard(2).pos_hash << endl;
-      out << hist.getRecentBoard(3).pos_hash <<  " " << hist2.getRecentBoard(3).pos_hash << endl;
-      out << hist.getRecentBoard(4).pos_hash <<  " " << hist2.getRecentBoard(4).pos_hash << endl;
-      out << hist.getRecentBoard(5).pos_hash <<  " " << hist2.getRecentBoard(5).pos_hash << endl;
+      out << hist.getRecentBoard(copy,0).pos_hash <<  " " << hist2.getRecentBoard(board,0).pos_hash << endl;
+      out << hist.getRecentBoard(copy,1).pos_hash <<  " " << hist2.getRecentBoard(board,1).pos_hash << endl;
+      out << hist.getRecentBoard(copy,2).pos_hash <<  " " << hist2.getRecentBoard(board,2).pos_hash << endl;
+      out << hist.getRecentBoard(copy,3).pos_hash <<  " " << hist2.getRecentBoard(board,3).pos_hash << endl;
+      out << hist.getRecentBoard(copy,4).pos_hash <<  " " << hist2.getRecentBoard(board,4).pos_hash << endl;
+      out << hist.getRecentBoard(copy,5).pos_hash <<  " " << hist2.getRecentBoard(board,5).pos_hash << endl;
 
       for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
         assert(hist.wasEverOccupiedOrPlayed[i] == hist2.wasEverOccupiedOrPlayed[i]);
@@ -2229,7 +2230,6 @@ isResignation: 0
 
     };
 
-    Board copy = board;
     makeMoveAssertLegal(hist, copy, Board::PASS_LOC, P_BLACK, __LINE__);
     makeMoveAssertLegal(hist, copy, Board::PASS_LOC, P_WHITE, __LINE__);
 
@@ -2347,6 +2347,101 @@ HASH: 606D9A510521DC164FB55D2EECB54AEB
     expect(name,out,expected);
   }
 
+  {
+    //Check the incremental KoHashTable against a brute force count, under random appends, truncations
+    //and recomputations to histories sharing various prefixes.
+    Rand rand("KoHashTable incremental test");
+    vector<Hash128> pool;
+    for(int i = 0; i<2000; i++)
+      pool.push_back(Hash128(rand.nextUInt64(),rand.nextUInt64()));
+
+    KoHashTable table;
+    BoardHistory hist;
+    vector<Hash128>& expectedHashes = hist.koHashHistory;
+    for(int rep = 0; rep<3000; rep++) {
+      int r = rand.nextUInt(10);
+      if(r < 6) {
+        int n = rand.nextUInt(20);
+        for(int j = 0; j<n; j++) {
+          //Draw mostly from a small part of the pool so that repeated hashes are common
+          Hash128 hash = pool[rand.nextUInt(rand.nextBool(0.5) ? 30 : (uint32_t)pool.size())];
+          expectedHashes.push_back(hash);
+          table.append(hash);
+        }
+      }
+      else if(r < 8) {
+        size_t newSize = rand.nextUInt((uint32_t)expectedHashes.size()+1);
+        expectedHashes.resize(newSize);
+        table.truncate(newSize);
+      }
+      else {
+        size_t commonSize = rand.nextUInt((uint32_t)expectedHashes.size()+1);
+        expectedHashes.resize(commonSize);
+        int n = rand.nextUInt(40);
+        for(int j = 0; j<n; j++)
+          expectedHashes.push_back(pool[rand.nextUInt((uint32_t)pool.size())]);
+        if(rand.nextBool(0.1))
+          hist.koHistoryLastClearedBeginningMoveIdx++;
+        table.recompute(hist);
+        testAssert(table.koHistoryLastClearedBeginningMoveIdx == hist.koHistoryLastClearedBeginningMoveIdx);
+      }
+
+      testAssert(table.size() == expectedHashes.size());
+      for(int j = 0; j<50; j++) {
+        Hash128 hash = pool[rand.nextUInt((uint32_t)pool.size())];
+        int count = (int)std::count(expectedHashes.begin(),expectedHashes.end(),hash);
+        testAssert(table.numberOfOccurrencesOfHash(hash) == count);
+        testAssert(table.containsHash(hash) == (count > 0));
+      }
+    }
+
+    //Grow the table well past its initial size and shrink it again
+    table.truncate(0);
+    for(size_t i = 0; i<pool.size(); i++)
+      table.append(pool[i]);
+    table.truncate(pool.size()/2);
+    for(size_t i = 0; i<pool.size(); i++)
+      testAssert(table.numberOfOccurrencesOfHash(pool[i]) == (i < pool.size()/2 ? 1 : 0));
+  }
+
+  {
+    //Check that recent boards reconstructed by undoing moves match snapshots of the board taken as moves were made,
+    //including through passes, suicides, and pass-for-ko in the encore.
+    Rand rand("Recent board reconstruction test");
+    for(int rep = 0; rep<200; rep++) {
+      Rules rules;
+      rules.koRule = rand.nextBool(0.5) ? Rules::KO_SIMPLE : Rules::KO_POSITIONAL;
+      rules.scoringRule = rand.nextBool(0.5) ? Rules::SCORING_AREA : Rules::SCORING_TERRITORY;
+      rules.multiStoneSuicideLegal = rand.nextBool(0.5);
+      Board board(5,5);
+      Player pla = P_BLACK;
+      BoardHistory hist(board,pla,rules,0);
+      vector<Board> snapshots;
+      snapshots.push_back(board);
+      for(int turn = 0; turn<150 && !hist.isGameFinished; turn++) {
+        vector<Loc> legalMoves;
+        for(Loc loc = 0; loc<Board::MAX_ARR_SIZE; loc++)
+          if(board.colors[loc] != C_WALL && loc != Board::NULL_LOC && hist.isLegal(board,loc,pla))
+            legalMoves.push_back(loc);
+        Loc loc = Board::PASS_LOC;
+        if(legalMoves.size() > 0 && rand.nextBool(0.9))
+          loc = legalMoves[rand.nextUInt((uint32_t)legalMoves.size())];
+        hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+        pla = getOpp(pla);
+        snapshots.push_back(board);
+
+        for(int i = 0; i<BoardHistory::NUM_RECENT_BOARDS; i++) {
+          const Board& expected = snapshots[std::max(0,(int)snapshots.size()-1-i)];
+          Board recent = hist.getRecentBoard(board,i);
+          recent.checkConsistency();
+          testAssert(boardsSeemEqual(recent,expected));
+          testAssert(recent.pos_hash == expected.pos_hash);
+          testAssert(recent.ko_loc == expected.ko_loc);
+        }
+      }
+    }
+  }
+
 
        
 }
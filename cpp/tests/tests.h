@@ -2,6 +2,7 @@
 #define TESTS_H
 
 #include <sstream>
+#include <boost/filesystem.hpp>
 #include "../core/global.h"
 #include "../core/rand.h"
 #include "../core/test.h"
@@ -25,6 +26,9 @@ namespace Tests {
   //testscore.cpp
   void runScoreTests();
 
+  //testdataio.cpp
+  void runDataIOTests();
+
   //testnninputs.cpp
   void runNNInputsV2Tests();
   void runNNInputsV3V4Tests();
@@ -34,6 +38,9 @@ namespace Tests {
   void runSearchTests(const string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
   void runSearchTestsV3(const string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
 
+  //testsgf.cpp
+  void runSgfTests();
+
   //testtime.cpp
   void runTimeControlsTests();
   
@@ -44,6 +51,25 @@ namespace Tests {
 
 namespace TestCommon {
 
+  //A fresh uniquely-named directory under the system temp dir, removed along with its contents when this goes out of
+  //scope, including when a test throws.
+  struct TempDir {
+    boost::filesystem::path path;
+
+    TempDir(const string& name)
+      :path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("katagotest-" + name + "-%%%%-%%%%-%%%%"))
+    {
+      boost::filesystem::create_directories(path);
+    }
+    ~TempDir() {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(path,ec);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+  };
+
   inline bool boardsSeemEqual(const Board& b1, const Board& b2) {
     for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
       if(b1.colors[i] != b2.colors[i])
@@ -3,8 +3,11 @@
 #include "../dataio/sgf.h"
 #include <algorithm>
 #include <iterator>
+#include <boost/filesystem.hpp>
 using namespace TestCommon;
 
+namespace bfs = boost::filesystem;
+
 static string getSearchRandSeed() {
   static int seedCounter = 0;
   return string("testSearchSeed") + Global::intToString(seedCounter++);
@@ -127,6 +130,7 @@ static NNEvaluator* startNNEval(
   bool requireExactPosLen = false;
   //bool inputsUseNHWC = true;
   int nnCacheSizePowerOfTwo = 16;
+  int ladderCacheSizePowerOfTwo = 16;
   int nnMutexPoolSizePowerOfTwo = 12;
   int maxConcurrentEvals = 1024;
   //bool debugSkipNeuralNet = false;
@@ -141,6 +145,7 @@ static NNEvaluator* startNNEval(
     requireExactPosLen,
     inputsUseNHWC,
     nnCacheSizePowerOfTwo,
+    ladderCacheSizePowerOfTwo,
     nnMutexPoolSizePowerOfTwo,
     debugSkipNeuralNet,
     nnPolicyTemperature
@@ -866,5 +871,324 @@ o..oo.x
 
   }
 
+  {
+    cout << "===================================================================" << endl;
+    cout << "Testing pruning of search tree to stay within maxTreeBytes" << endl;
+    cout << "===================================================================" << endl;
+
+    //Quiet logger, since the pruning log messages depend on struct sizes
+    Logger quietLogger;
+    quietLogger.setLogToStdout(false);
+
+    Rules rules = Rules::getTrompTaylorish();
+    Board board = Board::parseBoard(9,9,R"%%(
+.........
+.........
+..x..o...
+.........
+..x...o..
+...o.....
+..o.x.x..
+.........
+.........
+)%%");
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    //First search without any cap, with its own nnEval so that neither search depends on what the other left in the nn cache
+    SearchParams params;
+    params.maxVisits = 3000;
+    NNEvaluator* unprunedNNEval = startNNEval(modelFile,logger,"seed1",NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    Search* unprunedSearch = new Search(params, unprunedNNEval, "autoSearchRandSeed");
+    unprunedSearch->setPosition(nextPla,board,hist);
+    unprunedSearch->runWholeSearch(nextPla,quietLogger,NULL);
+    int64_t numNodes;
+    int64_t unprunedNumBytes;
+    unprunedSearch->getTreeMemoryUsage(numNodes,unprunedNumBytes);
+
+    //Then with the same seed and a cap below that size, relative to it so that the test does not depend on struct sizes
+    params.maxTreeBytes = unprunedNumBytes * 17 / 20;
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"seed1",NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,quietLogger,NULL);
+
+    int64_t numBytes;
+    search->getTreeMemoryUsage(numNodes,numBytes);
+    testAssert(numBytes < params.maxTreeBytes);
+    testAssert(search->numRootVisits() == params.maxVisits);
+    cout << "Root visits " << search->numRootVisits() << " within tree memory cap " << (numBytes < params.maxTreeBytes) << endl;
+
+    PrintTreeOptions options;
+    options = options.maxDepth(1);
+    search->printTree(cout, search->rootNode, options);
+
+    //Pruned nodes keep the values of all their visits, so the result should be close to that of the unpruned search
+    {
+      double winValue, lossValue, noResultValue, staticScoreValue, dynamicScoreValue, expectedScore;
+      double unprunedWinValue, unprunedLossValue, unprunedNoResultValue, unprunedStaticScoreValue, unprunedDynamicScoreValue, unprunedExpectedScore;
+      testAssert(search->getRootValues(winValue,lossValue,noResultValue,staticScoreValue,dynamicScoreValue,expectedScore));
+      testAssert(unprunedSearch->getRootValues(
+        unprunedWinValue,unprunedLossValue,unprunedNoResultValue,unprunedStaticScoreValue,unprunedDynamicScoreValue,unprunedExpectedScore
+      ));
+      cout << "Root win value within 0.01 of unpruned search " << (std::fabs(winValue - unprunedWinValue) < 0.01) << endl;
+      cout << "Root expected score within 0.1 of unpruned search " << (std::fabs(expectedScore - unprunedExpectedScore) < 0.1) << endl;
+      cout << "Same chosen move as unpruned search " << (search->getChosenMoveLoc() == unprunedSearch->getChosenMoveLoc()) << endl;
+    }
+    delete unprunedSearch;
+    delete unprunedNNEval;
+
+    cout << "Continue searching after making a move, the tree should remain within the cap" << endl;
+    Loc moveLoc = search->getChosenMoveLoc();
+    search->makeMove(moveLoc,nextPla);
+    nextPla = getOpp(nextPla);
+    search->runWholeSearch(nextPla,quietLogger,NULL);
+    search->getTreeMemoryUsage(numNodes,numBytes);
+    testAssert(numBytes < params.maxTreeBytes);
+    testAssert(search->numRootVisits() == params.maxVisits);
+    cout << "Root visits " << search->numRootVisits() << " within tree memory cap " << (numBytes < params.maxTreeBytes) << endl;
+
+    delete search;
+    delete nnEval;
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Testing saving and reloading the search tree" << endl;
+    cout << "===================================================================" << endl;
+
+    //Quiet logger, since the load log messages depend on struct sizes
+    Logger quietLogger;
+    quietLogger.setLogToStdout(false);
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"seed1",NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    SearchParams params;
+    params.maxVisits = 200;
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    Rules rules = Rules::getTrompTaylorish();
+
+    Board board = Board::parseBoard(7,7,R"%%(
+.......
+.......
+..x.o..
+...o...
+..x.x..
+.......
+.......
+)%%");
+    Player nextPla = P_WHITE;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+
+    PrintTreeOptions options;
+    options = options.maxDepth(2);
+    ostringstream origOut;
+    search->printTree(origOut, search->rootNode, options);
+    int64_t origNumNodes;
+    int64_t origNumBytes;
+    search->getTreeMemoryUsage(origNumNodes,origNumBytes);
+
+    TestCommon::TempDir tempDir("searchtree");
+    const bfs::path& tmpDir = tempDir.path;
+    string fileName = (tmpDir / "tree.bin").string();
+    search->saveTree(fileName);
+
+    Search* search2 = new Search(params, nnEval, "autoSearchRandSeed");
+    search2->setPosition(nextPla,board,hist);
+    bool suc = search2->loadTree(fileName,quietLogger);
+    testAssert(suc);
+    ostringstream loadedOut;
+    search2->printTree(loadedOut, search2->rootNode, options);
+    int64_t loadedNumNodes;
+    int64_t loadedNumBytes;
+    search2->getTreeMemoryUsage(loadedNumNodes,loadedNumBytes);
+    testAssert(origOut.str() == loadedOut.str());
+    testAssert(origNumNodes == loadedNumNodes);
+    cout << loadedOut.str();
+
+    cout << "Resume searching the reloaded tree" << endl;
+    SearchParams params2 = params;
+    params2.maxVisits = 400;
+    search2->setParamsNoClearing(params2);
+    search2->runWholeSearch(nextPla,logger,NULL);
+    testAssert(search2->numRootVisits() == 400);
+    cout << "Root visits " << search2->numRootVisits() << endl;
+
+    cout << "Loading into a different position should fail and leave the tree alone" << endl;
+    search2->makeMove(Location::getLoc(3,4,board.x_size),nextPla);
+    int64_t visitsBefore = search2->numRootVisits();
+    suc = search2->loadTree(fileName,quietLogger);
+    testAssert(!suc);
+    testAssert(search2->numRootVisits() == visitsBefore);
+    cout << "Load succeeded " << suc << endl;
+
+    cout << "Loading a tree with an illegal move should throw and leave the tree alone" << endl;
+    auto expectIllegalMoveLoadFails = [&](const string& desc) {
+      string badFileName = (tmpDir / "badtree.bin").string();
+      search->saveTree(badFileName);
+      Search* search3 = new Search(params, nnEval, "autoSearchRandSeed");
+      search3->setPosition(nextPla,board,hist);
+      bool threw = false;
+      try {
+        search3->loadTree(badFileName,quietLogger);
+      }
+      catch(const StringError& e) {
+        threw = true;
+        testAssert(string(e.what()).find("illegal move") != string::npos);
+      }
+      testAssert(threw);
+      testAssert(search3->rootNode == NULL);
+      cout << desc << " threw " << threw << endl;
+      delete search3;
+    };
+    //A child of a non-pass child, whose move is not a pass either
+    SearchNode* child = NULL;
+    SearchNode* grandchild = NULL;
+    for(int i = 0; i<search->rootNode->numChildren && grandchild == NULL; i++) {
+      SearchNode* c = search->rootNode->children[i];
+      for(int j = 0; j<c->numChildren && c->prevMoveLoc != Board::PASS_LOC; j++) {
+        if(c->children[j]->prevMoveLoc != Board::PASS_LOC) {
+          child = c;
+          grandchild = c->children[j];
+          break;
+        }
+      }
+    }
+    testAssert(grandchild != NULL);
+    Loc childLoc = child->prevMoveLoc;
+    Loc grandchildLoc = grandchild->prevMoveLoc;
+
+    //Onto a stone of the root position
+    child->prevMoveLoc = Location::getLoc(2,2,board.x_size);
+    expectIllegalMoveLoadFails("Child move onto an existing stone");
+    child->prevMoveLoc = childLoc;
+    //Onto the stone just placed by its parent's move, which is empty in the root position
+    grandchild->prevMoveLoc = childLoc;
+    expectIllegalMoveLoadFails("Grandchild move onto its parent's stone");
+    grandchild->prevMoveLoc = grandchildLoc;
+
+    delete search;
+    delete search2;
+    delete nnEval;
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Testing stopping early when the leader is unassailable" << endl;
+    cout << "===================================================================" << endl;
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"seed1",NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    SearchParams params;
+    params.maxVisits = 1000;
+    Rules rules = Rules::getTrompTaylorish();
+
+    Board board = Board::parseBoard(7,7,R"%%(
+.......
+.......
+..x.o..
+...o...
+..x.x..
+.......
+.......
+)%%");
+    Player nextPla = P_WHITE;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    auto getMostVisitedLoc = [](const Search* search) {
+      const SearchNode* root = search->rootNode;
+      Loc bestLoc = Board::NULL_LOC;
+      int64_t bestVisits = -1;
+      for(int i = 0; i<root->numChildren; i++) {
+        if(root->children[i]->stats.visits > bestVisits) {
+          bestVisits = root->children[i]->stats.visits;
+          bestLoc = root->children[i]->prevMoveLoc;
+        }
+      }
+      return bestLoc;
+    };
+
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    testAssert(search->numRootVisits() == 1000);
+    testAssert(search->lastSearchEarlyStopSavedPlayouts == 0);
+    Loc fullLoc = getMostVisitedLoc(search);
+
+    SearchParams params2 = params;
+    params2.stopWhenLeaderUnassailable = true;
+    Search* search2 = new Search(params2, nnEval, "autoSearchRandSeed");
+    search2->setPosition(nextPla,board,hist);
+    search2->runWholeSearch(nextPla,logger,NULL);
+    Loc earlyLoc = getMostVisitedLoc(search2);
+    //The early-stopped search is a prefix of the full search, so the leader must be the same
+    testAssert(earlyLoc == fullLoc);
+    testAssert(search2->lastSearchEarlyStopSavedPlayouts > 0);
+    testAssert(search2->numRootVisits() + search2->lastSearchEarlyStopSavedPlayouts == 1000);
+    cout << "Full search visits " << search->numRootVisits() << " most visited " << Location::toString(fullLoc,board) << endl;
+    cout << "Early stop visits " << search2->numRootVisits() << " most visited " << Location::toString(earlyLoc,board)
+         << " saved playouts " << search2->lastSearchEarlyStopSavedPlayouts << endl;
+
+    SearchParams params3 = params2;
+    params3.unassailableBudgetScale = 0.5;
+    params3.unassailableUtilityMargin = 0.1;
+    Search* search3 = new Search(params3, nnEval, "autoSearchRandSeed");
+    search3->setPosition(nextPla,board,hist);
+    search3->runWholeSearch(nextPla,logger,NULL);
+    testAssert(search3->numRootVisits() <= search2->numRootVisits());
+    cout << "Aggressive early stop visits " << search3->numRootVisits() << " most visited " << Location::toString(getMostVisitedLoc(search3),board)
+         << " saved playouts " << search3->lastSearchEarlyStopSavedPlayouts << endl;
+
+    delete search;
+    delete search2;
+    delete search3;
+    delete nnEval;
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Testing dynamic time control stop and extend decisions" << endl;
+    cout << "===================================================================" << endl;
+
+    auto decisionToString = [](int decision) {
+      switch(decision) {
+      case Search::TIME_CONTINUE: return "continue";
+      case Search::TIME_STOP_STABLE: return "stop early";
+      case Search::TIME_EXTEND: return "extend";
+      case Search::TIME_STOP: return "stop";
+      default: testAssert(false); return "";
+      }
+    };
+    //Time window of min 1s, recommended 10s
+    auto test = [&](const string& desc, int expected, double timeUsed, double timeSinceChange,
+                    int64_t leaderVisits, double leaderUtility, int64_t runnerUpVisits, double runnerUpUtility) {
+      int decision = Search::getTimeDecision(
+        timeUsed, timeSinceChange, 1.0, 10.0, leaderVisits, leaderUtility, runnerUpVisits, runnerUpUtility
+      );
+      cout << desc << ": " << decisionToString(decision) << endl;
+      testAssert(decision == expected);
+    };
+
+    test("Before min time even if stable", Search::TIME_CONTINUE, 0.9, 0.9, 1000, 0.1, 10, 0.0);
+    test("Before 25% of recommended time even if stable", Search::TIME_CONTINUE, 2.0, 2.0, 1000, 0.1, 10, 0.0);
+    test("Stable leader", Search::TIME_STOP_STABLE, 4.0, 3.0, 1000, 0.1, 100, 0.0);
+    test("Leader changed too recently to be stable", Search::TIME_CONTINUE, 4.0, 1.0, 1000, 0.1, 100, 0.0);
+    test("Runner-up too close in visits to be stable", Search::TIME_CONTINUE, 4.0, 3.0, 1000, 0.1, 400, 0.0);
+    test("Runner-up slightly better in utility, still stable", Search::TIME_STOP_STABLE, 4.0, 3.0, 1000, 0.1, 250, 0.11);
+    test("Runner-up much better in utility with a fair share of visits", Search::TIME_CONTINUE, 4.0, 3.0, 1000, 0.1, 250, 0.2);
+    test("Settled at recommended time", Search::TIME_STOP, 10.0, 8.0, 1000, 0.1, 300, 0.0);
+    test("Leader changed recently at recommended time", Search::TIME_EXTEND, 10.0, 1.0, 1000, 0.1, 300, 0.0);
+    test("Runner-up close in visits at recommended time", Search::TIME_EXTEND, 10.0, 8.0, 1000, 0.1, 850, 0.0);
+    test("Runner-up slightly better in utility at recommended time", Search::TIME_STOP, 10.0, 8.0, 1000, 0.1, 300, 0.12);
+    test("Runner-up much better in utility but barely visited", Search::TIME_STOP, 10.0, 8.0, 1000, 0.1, 50, 0.5);
+    test("Runner-up much better in utility with a fair share of visits", Search::TIME_EXTEND, 10.0, 8.0, 1000, 0.1, 300, 0.2);
+    test("Runner-up without any visits", Search::TIME_STOP, 10.0, 8.0, 1000, 0.1, 0, 1e30);
+    cout << endl;
+  }
+
   NeuralNet::globalCleanup();
 }
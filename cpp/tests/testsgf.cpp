@@ -0,0 +1,110 @@
+#include "../tests/tests.h"
+#include "../dataio/sgf.h"
+using namespace TestCommon;
+
+static void checkSameAsCompactSgf(const StreamedSgf& streamed, const string& sgfStr) {
+  testAssert(string(streamed.text,streamed.textLen) == sgfStr);
+  CompactSgf* sgf = CompactSgf::parse(sgfStr);
+  testAssert(streamed.bSize == sgf->bSize);
+  testAssert(streamed.depth == sgf->depth);
+  testAssert(streamed.komi == sgf->komi);
+  testAssert(streamed.hash == sgf->hash);
+  testAssert(streamed.placements.size() == sgf->placements.size());
+  for(size_t i = 0; i<sgf->placements.size(); i++) {
+    testAssert(streamed.placements[i].loc == sgf->placements[i].loc);
+    testAssert(streamed.placements[i].pla == sgf->placements[i].pla);
+  }
+  testAssert(streamed.moves.size() == sgf->moves.size());
+  for(size_t i = 0; i<sgf->moves.size(); i++) {
+    testAssert(streamed.moves[i].loc == sgf->moves[i].loc);
+    testAssert(streamed.moves[i].pla == sgf->moves[i].pla);
+  }
+  const char* keys[4] = {"PB","C","RU","KM"};
+  for(int i = 0; i<4; i++) {
+    testAssert(streamed.hasRootProperty(keys[i]) == sgf->rootNode.hasProperty(keys[i]));
+    if(sgf->rootNode.hasProperty(keys[i]))
+      testAssert(streamed.getRootProperty(keys[i]) == sgf->rootNode.getSingleProperty(keys[i]));
+  }
+
+  Rules initialRules;
+  Board board;
+  Player nextPla;
+  BoardHistory hist;
+  Board streamedBoard;
+  Player streamedNextPla;
+  BoardHistory streamedHist;
+  sgf->setupInitialBoardAndHist(initialRules,board,nextPla,hist);
+  streamed.setupInitialBoardAndHist(initialRules,streamedBoard,streamedNextPla,streamedHist);
+  testAssert(boardsSeemEqual(board,streamedBoard));
+  testAssert(nextPla == streamedNextPla);
+  testAssert(hist.rules.koRule == streamedHist.rules.koRule);
+  testAssert(hist.rules.scoringRule == streamedHist.rules.scoringRule);
+  testAssert(hist.rules.multiStoneSuicideLegal == streamedHist.rules.multiStoneSuicideLegal);
+  testAssert(hist.rules.komi == streamedHist.rules.komi);
+  delete sgf;
+}
+
+void Tests::runSgfTests() {
+  vector<string> sgfStrs = {
+    "(;FF[4]GM[1]SZ[19]KM[7.5]PB[black];B[pd];W[dp];B[pp];W[];B[tt])",
+    //Root placements and moves, escapes, rules, and a smaller board
+    "(;FF[4]SZ[9]KM[0.5]RU[Chinese]C[a \\] b\\\\]AB[cc][gg]AW[ee]W[cg];B[gc]W[dd];W[])",
+    //Variations, where the deepest line is not the first
+    "(;SZ[13]KM[6];B[dd](;W[jj];B[dj])(;W[dj];B[jj];W[jd](;B[gg])(;B[jg];W[gg]))(;W[gg];B[jj];W[jd];B[gc]))",
+    "(;KM[-3]\n;B[aa]\n)",
+  };
+  string malformed = "(;SZ[19]KM[7.5];B[zz])";
+
+  string text;
+  for(size_t i = 0; i<sgfStrs.size(); i++) {
+    text += sgfStrs[i] + "\n";
+    if(i == 1)
+      text += malformed + "\n";
+  }
+
+  //Parse all of it in one piece
+  {
+    SgfStreamParser parser(text.data(),text.size(),"test");
+    StreamedSgf streamed;
+    for(size_t i = 0; i<sgfStrs.size(); i++) {
+      if(i == 2) {
+        bool threw = false;
+        try {
+          parser.next(streamed);
+        }
+        catch(const IOError&) {
+          threw = true;
+        }
+        testAssert(threw);
+      }
+      testAssert(parser.next(streamed));
+      checkSameAsCompactSgf(streamed,sgfStrs[i]);
+    }
+    testAssert(!parser.next(streamed));
+  }
+
+  //Parse it split into pieces
+  for(int numPieces = 1; numPieces <= 8; numPieces++) {
+    vector<size_t> bounds = SgfStreamParser::splitOnGameBoundaries(text.data(),text.size(),numPieces);
+    testAssert(bounds.front() == 0);
+    testAssert(bounds.back() == text.size());
+    testAssert(bounds.size() >= 2 && bounds.size() <= numPieces + 1);
+    int numParsed = 0;
+    for(size_t i = 0; i+1<bounds.size(); i++) {
+      testAssert(bounds[i] < bounds[i+1]);
+      testAssert(bounds[i] == 0 || (text[bounds[i]] == '(' && text[bounds[i]-1] == '\n'));
+      SgfStreamParser parser(text.data() + bounds[i],bounds[i+1] - bounds[i],"test");
+      StreamedSgf streamed;
+      while(true) {
+        try {
+          if(!parser.next(streamed))
+            break;
+          numParsed++;
+        }
+        catch(const IOError&) {
+        }
+      }
+    }
+    testAssert(numParsed == sgfStrs.size());
+  }
+}
@@ -3,8 +3,72 @@ using namespace TestCommon;
 
 #include "../neuralnet/nneval.h"
 #include "../dataio/trainingwrite.h"
+#include "../dataio/gamerecord.h"
+#include "../dataio/sgf.h"
+#include "../dataio/numpyread.h"
 #include "../program/play.h"
 
+#include <boost/filesystem.hpp>
+
+namespace bfs = boost::filesystem;
+
+//Game records should read back as written, with or without their index, and export the same sgf as selfplay writes
+static void checkGameRecordRoundTrip(const FinishedGameData& gameData) {
+  std::ostringstream sgfOut;
+  WriteSgf::writeSgf(sgfOut,gameData.bName,gameData.wName,gameData.startHist.rules,gameData.endHist,&gameData);
+
+  std::ostringstream recordOut;
+  {
+    GameRecordWriter writer(&recordOut);
+    writer.writeGame(gameData);
+    writer.writeGame(gameData);
+    writer.close();
+  }
+  string bytes = recordOut.str();
+  testAssert(bytes.size() < 2 * sgfOut.str().size());
+
+  for(int closed = 0; closed<2; closed++) {
+    //Drop the index and the end of the second record, as if the writer had been killed
+    size_t len = closed ? bytes.size() : bytes.size() - 8*4 - 5;
+    GameRecordReader reader(bytes.data(),len,"test");
+    testAssert(reader.hasIndex() == (closed != 0));
+    testAssert(reader.getNumRecords() == (closed ? 2 : 1));
+    for(uint64_t idx = 0; idx<reader.getNumRecords(); idx++) {
+      GameRecord record;
+      reader.read(idx,record);
+      testAssert(record.gameHash == gameData.gameHash);
+      testAssert(record.moves.size() == gameData.endHist.moveHistory.size());
+      std::ostringstream exportOut;
+      record.writeSgf(exportOut);
+      testAssert(exportOut.str() == sgfOut.str());
+
+      Board board;
+      Player nextPla;
+      BoardHistory hist;
+      record.setupBoardAndHist(board,nextPla,hist,(int)record.moves.size());
+      testAssert(board.pos_hash == gameData.endBoard.pos_hash);
+      testAssert(hist.encorePhase == gameData.endHist.encorePhase);
+    }
+  }
+
+  //An index offset so large that adding to it would wrap around
+  {
+    string bad = bytes;
+    size_t firstOffsetPos = bad.size() - 8 - 8 - 2*8;
+    for(int i = 0; i<8; i++)
+      bad[firstOffsetPos+i] = (char)(i == 0 ? 0xFC : 0xFF);
+    bool threw = false;
+    try {
+      GameRecordReader reader(bad.data(),bad.size(),"test");
+    }
+    catch(const IOError& e) {
+      threw = true;
+      testAssert(e.message == "test has a bad game record index");
+    }
+    testAssert(threw);
+  }
+}
+
 static NNEvaluator* startNNEval(
   const string& modelFile, const string& seed, Logger& logger,
   int defaultSymmetry, bool inputsUseNHWC, bool cudaUseNHWC, bool cudaUseFP16
@@ -16,6 +80,7 @@ static NNEvaluator* startNNEval(
   int posLen = NNPos::MAX_BOARD_LEN;
   bool requireExactPosLen = false;
   int nnCacheSizePowerOfTwo = 16;
+  int ladderCacheSizePowerOfTwo = 16;
   int nnMutexPoolSizePowerOfTwo = 12;
   bool debugSkipNeuralNet = modelFile == "/dev/null";
   double nnPolicyTemperature = 1.0;
@@ -29,6 +94,7 @@ static NNEvaluator* startNNEval(
     requireExactPosLen,
     inputsUseNHWC,
     nnCacheSizePowerOfTwo,
+    ladderCacheSizePowerOfTwo,
     nnMutexPoolSizePowerOfTwo,
     debugSkipNeuralNet,
     nnPolicyTemperature
@@ -53,6 +119,52 @@ static NNEvaluator* startNNEval(
   return nnEval;
 }
 
+static FinishedGameData* runTestGame(
+  const string& seedBase, const Rules& rules, double drawEquivalentWinsForWhite, int posLen, Logger& logger
+) {
+  NNEvaluator* nnEval = startNNEval("/dev/null",seedBase+"nneval",logger,0,true,false,false);
+
+  SearchParams params;
+  params.maxVisits = 100;
+  params.drawEquivalentWinsForWhite = drawEquivalentWinsForWhite;
+
+  MatchPairer::BotSpec botSpec;
+  botSpec.botIdx = 0;
+  botSpec.botName = string("test");
+  botSpec.nnEval = nnEval;
+  botSpec.baseParams = params;
+
+  Board initialBoard(5,5);
+  Player initialPla = P_BLACK;
+  int initialEncorePhase = 0;
+  BoardHistory initialHist(initialBoard,initialPla,rules,initialEncorePhase);
+
+  ExtraBlackAndKomi extraBlackAndKomi = ExtraBlackAndKomi(0,rules.komi,rules.komi);
+  bool doEndGameIfAllPassAlive = true;
+  bool clearBotAfterSearch = true;
+  int maxMovesPerGame = 40;
+  vector<std::atomic<bool>*> stopConditions;
+  FancyModes fancyModes;
+  fancyModes.initGamesWithPolicy = true;
+  fancyModes.forkSidePositionProb = 0.10;
+  bool recordFullData = true;
+  Rand rand(seedBase+"play");
+  FinishedGameData* gameData = Play::runGame(
+    initialBoard,initialPla,initialHist,extraBlackAndKomi,
+    botSpec,botSpec,
+    seedBase+"search",
+    doEndGameIfAllPassAlive, clearBotAfterSearch,
+    logger, false, false,
+    maxMovesPerGame, stopConditions,
+    fancyModes, recordFullData, posLen,
+    true,
+    rand,
+    NULL
+  );
+  delete nnEval;
+  return gameData;
+}
+
 void Tests::runTrainingWriteTests() {
   cout << "Running training write tests" << endl;
   string tensorflowGpuVisibleDeviceList = "";
@@ -71,57 +183,17 @@ void Tests::runTrainingWriteTests() {
 
   auto run = [&](const string& seedBase, const Rules& rules, double drawEquivalentWinsForWhite, int inputsVersion) {
     TrainingDataWriter dataWriter(&cout,inputsVersion, maxRows, firstFileMinRandProp, posLen, debugOnlyWriteEvery, seedBase+"dwriter");
-
-    NNEvaluator* nnEval = startNNEval("/dev/null",seedBase+"nneval",logger,0,true,false,false);
-
-    SearchParams params;
-    params.maxVisits = 100;
-    params.drawEquivalentWinsForWhite = drawEquivalentWinsForWhite;
-
-    MatchPairer::BotSpec botSpec;
-    botSpec.botIdx = 0;
-    botSpec.botName = string("test");
-    botSpec.nnEval = nnEval;
-    botSpec.baseParams = params;
-
-    Board initialBoard(5,5);
-    Player initialPla = P_BLACK;
-    int initialEncorePhase = 0;
-    BoardHistory initialHist(initialBoard,initialPla,rules,initialEncorePhase);
-
-    ExtraBlackAndKomi extraBlackAndKomi = ExtraBlackAndKomi(0,rules.komi,rules.komi);
-    bool doEndGameIfAllPassAlive = true;
-    bool clearBotAfterSearch = true;
-    int maxMovesPerGame = 40;
-    vector<std::atomic<bool>*> stopConditions;
-    FancyModes fancyModes;
-    fancyModes.initGamesWithPolicy = true;
-    fancyModes.forkSidePositionProb = 0.10;
-    bool recordFullData = true;
-    Rand rand(seedBase+"play");
-    FinishedGameData* gameData = Play::runGame(
-      initialBoard,initialPla,initialHist,extraBlackAndKomi,
-      botSpec,botSpec,
-      seedBase+"search",
-      doEndGameIfAllPassAlive, clearBotAfterSearch,
-      logger, false, false,
-      maxMovesPerGame, stopConditions,
-      fancyModes, recordFullData, posLen,
-      true,
-      rand,
-      NULL
-    );
+    FinishedGameData* gameData = runTestGame(seedBase,rules,drawEquivalentWinsForWhite,posLen,logger);
 
     cout << "seedBase: " << seedBase << endl;
-    cout << gameData->startHist.getRecentBoard(0) << endl;
-    gameData->endHist.printDebugInfo(cout,gameData->endHist.getRecentBoard(0));
+    cout << gameData->startBoard << endl;
+    gameData->endHist.printDebugInfo(cout,gameData->endBoard);
 
     dataWriter.writeGame(*gameData);
+    checkGameRecordRoundTrip(*gameData);
     delete gameData;
 
     dataWriter.flushIfNonempty();
-
-    delete nnEval;
     cout << endl;
   };
 
@@ -143,6 +215,146 @@ void Tests::runTrainingWriteTests() {
   inputsVersion = 5;
   run("testtrainingwrite-tt-v5",Rules::getTrompTaylorish(),0.5,inputsVersion);
 
+  {
+    cout << "Sparse policy targets" << endl;
+    const int numRows = 3;
+    const int numChannels = 2;
+    const int policySize = 6;
+    const int16_t policyTargets[numRows * numChannels * policySize] = {
+      0, 5, 0, 0, 12, 0,
+      1, 1, 1, 1, 1, 1,
+      0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0,
+      -3, 0, 0, 0, 0, 40,
+      0, 0, 7, 0, 0, 0,
+    };
+    vector<int32_t> offsets;
+    vector<int16_t> entries;
+    TrainingWriteBuffers::encodeSparsePolicyTargets(policyTargets, numRows, numChannels, policySize, offsets, entries);
+    cout << "Offsets:";
+    for(size_t i = 0; i<offsets.size(); i++)
+      cout << " " << offsets[i];
+    cout << endl;
+    cout << "Entries:";
+    for(size_t i = 0; i<entries.size(); i += 2)
+      cout << " (" << entries[i] << "," << entries[i+1] << ")";
+    cout << endl;
+
+    int16_t decoded[numRows * numChannels * policySize];
+    TrainingWriteBuffers::decodeSparsePolicyTargets(
+      (const char*)offsets.data(), (const char*)entries.data(), (int64_t)entries.size() / 2,
+      numRows, numChannels, policySize, decoded
+    );
+    for(int i = 0; i<numRows * numChannels * policySize; i++)
+      testAssert(decoded[i] == policyTargets[i]);
+
+    //Decoding just the first row uses only a prefix of the offsets
+    TrainingWriteBuffers::decodeSparsePolicyTargets(
+      (const char*)offsets.data(), (const char*)entries.data(), offsets[numChannels],
+      1, numChannels, policySize, decoded
+    );
+    for(int i = 0; i<numChannels * policySize; i++)
+      testAssert(decoded[i] == policyTargets[i]);
+
+    entries[0] = policySize;
+    bool threw = false;
+    try {
+      TrainingWriteBuffers::decodeSparsePolicyTargets(
+        (const char*)offsets.data(), (const char*)entries.data(), (int64_t)entries.size() / 2,
+        numRows, numChannels, policySize, decoded
+      );
+    }
+    catch(const IOError& e) {
+      cout << "Bad pos: " << e.message << endl;
+      threw = true;
+    }
+    testAssert(threw);
+    cout << endl;
+  }
+
+  {
+    cout << "Writing npz files in the background" << endl;
+    FinishedGameData* gameData = runTestGame("testtrainingwrite-zip",Rules::getTrompTaylorish(),0.5,posLen,logger);
+    TestCommon::TempDir tempDir("trainingwrite");
+    const bfs::path& tmpDir = tempDir.path;
+
+    //Reads every npz file in dir, checking that none is left half-written, and returns the row counts
+    auto readRowCounts = [](const bfs::path& dir) {
+      vector<int64_t> rowCounts;
+      for(bfs::directory_iterator iter(dir); iter != bfs::directory_iterator(); ++iter) {
+        testAssert(iter->path().extension() == ".npz");
+        ZipReader zip(iter->path().string());
+        string buf;
+        zip.readAll("globalTargetsNC",buf);
+        NumpyArrayView view(buf.data(),buf.size());
+        rowCounts.push_back(view.numRows);
+      }
+      std::sort(rowCounts.begin(),rowCounts.end());
+      return rowCounts;
+    };
+
+    //Small files, so that writing a game hands off several of them to the background thread
+    const int zipMaxRows = 7;
+    {
+      TrainingDataWriter zipWriter(tmpDir.string(), inputsVersion, zipMaxRows, 1.0, posLen, "zipwriter");
+      zipWriter.writeGame(*gameData);
+      zipWriter.writeGame(*gameData);
+      zipWriter.flushIfNonempty();
+    }
+    vector<int64_t> rowCounts = readRowCounts(tmpDir);
+    int64_t totalRows = 0;
+    for(size_t i = 0; i<rowCounts.size(); i++) {
+      //Every file is full except possibly the one written by the final flush
+      testAssert(rowCounts[i] == zipMaxRows || i == 0);
+      totalRows += rowCounts[i];
+    }
+    testAssert(rowCounts.size() > 2);
+    cout << "Files " << rowCounts.size() << " rows " << totalRows << endl;
+
+    //A failure on the background thread is thrown from the next write or flush, rather than being lost
+    bfs::path missingDir = tmpDir / "missing";
+    {
+      TrainingDataWriter zipWriter(missingDir.string(), inputsVersion, zipMaxRows, 1.0, posLen, "zipwriter");
+      bool threw = false;
+      try {
+        zipWriter.writeGame(*gameData);
+        zipWriter.writeGame(*gameData);
+        zipWriter.flushIfNonempty();
+      }
+      catch(const StringError&) {
+        threw = true;
+      }
+      testAssert(threw);
+      cout << "Background write to missing directory threw" << endl;
+
+      //Once reported, the failure is cleared and the writer works again
+      bfs::create_directories(missingDir);
+      zipWriter.writeGame(*gameData);
+      zipWriter.flushIfNonempty();
+      testAssert(readRowCounts(missingDir).size() > 0);
+    }
+
+    //Bad arguments throw before the background thread is started
+    auto testBadArgs = [&](int badMaxRows, double badMinRandProp, int badPosLen) {
+      bool threw = false;
+      try {
+        TrainingDataWriter zipWriter(tmpDir.string(), inputsVersion, badMaxRows, badMinRandProp, badPosLen, "zipwriter");
+      }
+      catch(const StringError& e) {
+        cout << e.message << endl;
+        threw = true;
+      }
+      testAssert(threw);
+    };
+    testBadArgs(0, 1.0, posLen);
+    testBadArgs(zipMaxRows, 1.5, posLen);
+    testBadArgs(zipMaxRows, -0.1, posLen);
+    testBadArgs(zipMaxRows, 1.0, NNPos::MAX_BOARD_LEN + 1);
+
+    delete gameData;
+    cout << endl;
+  }
+
   NeuralNet::globalCleanup();
 }
 
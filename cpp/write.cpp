@@ -1,13 +1,19 @@
 #include "core/global.h"
+#include "core/bloomfilter.h"
+#include "core/multithread.h"
 #include "core/rand.h"
+#include "core/threadsafequeue.h"
 #include "game/board.h"
 #include "neuralnet/nninputs.h"
 #include "dataio/sgf.h"
 #include "dataio/lzparse.h"
 #include "dataio/datapool.h"
+#include "dataio/numpywrite.h"
+#include "dataio/rowwrite.h"
 #include "program/gitinfo.h"
 #include <fstream>
 #include <algorithm>
+#include <cstring>
 
 #include <H5Cpp.h>
 using namespace H5;
@@ -15,58 +21,7 @@ using namespace H5;
 #define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
 #include <tclap/CmdLine.h>
 
-//Data and feature row parameters
-static const int maxBoardSize = NNPos::MAX_BOARD_LEN;
-static const int numFeatures = NNInputs::NUM_FEATURES_V2;
-
-//Different segments of the data row
-static const int inputStart = 0;
-static const int inputLen = maxBoardSize * maxBoardSize * numFeatures;
-
-static const int policyTargetStart = inputStart + inputLen;
-static const int policyTargetLen = maxBoardSize * maxBoardSize + 1; //+1 for pass move
-
-static const int ladderTargetStart = policyTargetStart + policyTargetLen;
-static const int ladderTargetLen = 0;
-// static const int ladderTargetLen = maxBoardSize * maxBoardSize;
-
-static const int valueTargetStart = ladderTargetStart + ladderTargetLen;
-static const int valueTargetLen = 1;
-
-static const int targetWeightsStart = valueTargetStart + valueTargetLen;
-static const int targetWeightsLen = 1;
-
-static const int rankStart = targetWeightsStart + targetWeightsLen;
-static const int rankLenGoGoD = 1; //pro
-static const int rankLenKGS = 9; //1d-9d
-static const int rankLenFox = 17 + 9; //17k-9d
-static const int rankLenOGSPre2014 = 19 + 9; //19k-9d
-
-static const int rankStartGoGoD = 0;
-static const int rankStartKGS = rankLenGoGoD;
-static const int rankStartFox = rankLenGoGoD + rankLenKGS;
-static const int rankStartOGSPre2014 = rankLenGoGoD + rankLenKGS + rankLenFox;
-static const int rankLen = rankLenGoGoD + rankLenKGS + rankLenFox + rankLenOGSPre2014;
-
-static const int sideStart = rankStart + rankLen;
-static const int sideLen = 1;
-
-static const int turnNumberStart = sideStart + sideLen;
-static const int turnNumberLen = 2;
-
-static const int recentCapturesStart = turnNumberStart + turnNumberLen;
-static const int recentCapturesLen = maxBoardSize * maxBoardSize;
-
-static const int nextMovesStart = recentCapturesStart + recentCapturesLen;
-static const int nextMovesLen = 12;
-
-static const int sgfHashStart = nextMovesStart + nextMovesLen;
-static const int sgfHashLen = 8;
-
-static const int includeHistoryStart = sgfHashStart + sgfHashLen;
-static const int includeHistoryLen = 5;
-
-static const int totalRowLen = includeHistoryStart + includeHistoryLen;
+using namespace RowWrite;
 
 //HDF5 parameters
 static const int chunkHeight = 6000;
@@ -81,7 +36,11 @@ static const int SOURCE_FOX = 2;
 static const int SOURCE_OGSPre2014 = 3;
 static const int SOURCE_LEELAZERO = 4;
 static const int SOURCE_UNKNOWN = 5;
-static bool emittedSourceWarningYet = false;
+//Files are processed on many worker threads at once, so each message, which may span several lines, is printed
+//whole while holding this
+static std::mutex outputMutex;
+
+static std::atomic<bool> emittedSourceWarningYet(false);
 static int parseSource(const string& fileName) {
   if(fileName.find("GoGoD") != string::npos)
     return SOURCE_GOGOD;
@@ -92,11 +51,11 @@ static int parseSource(const string& fileName) {
   else if(fileName.find("OGSPre2014") != string::npos)
     return SOURCE_OGSPre2014;
   else {
-    if(!emittedSourceWarningYet) {
+    if(!emittedSourceWarningYet.exchange(true)) {
+      std::lock_guard<std::mutex> lock(outputMutex);
       cerr << "Note: unknown source for sgf " << fileName << endl;
       cerr << "There is some hardcoded logic for applying different filter conditions for known data sources (e.g. KGS, GoGoD, etc). If you would like to do filtering of your own, you can manually modify the parseSource function in write.cpp and/or add appropriate sources for your data, and add whatever conditions you like at appropriate points in the rest of write.cpp." << endl;
       cerr << "Suppressing further warnings for unknown sgf sources" << endl;
-      emittedSourceWarningYet = true;
     }
     return SOURCE_UNKNOWN;
   }
@@ -152,93 +111,6 @@ static int computeRankOneHot(int source, int rank) {
 }
 
 
-static const int TARGET_NEXT_MOVE = 0;
-
-
-static void fillRow(const Board& board, const BoardHistory& hist, const vector<Move>& moves, int nextMoveIdx, Player nextPlayer,
-                    const float* policyTarget, float valueTarget,
-                    int target, int rankOneHot, Hash128 sgfHash, float* row, Rand& rand, bool alwaysHistory) {
-  assert(nextMoveIdx < moves.size());
-
-  Player pla = nextPlayer;
-  int xSize = board.x_size;
-  int ySize = board.y_size;
-  int posLen = NNPos::MAX_BOARD_LEN;
-
-  bool inputsUseNHWC = true;
-  NNInputs::fillRowV2(board,hist,nextPlayer,posLen,inputsUseNHWC,row);
-
-  //Optionally some stuff we can multiply the history planes by to randomly exclude history from a few training samples
-  bool includeHistory[5];
-  includeHistory[0] = alwaysHistory || rand.nextDouble() < 0.95;
-  includeHistory[1] = alwaysHistory || (includeHistory[0] && rand.nextDouble() < 0.98);
-  includeHistory[2] = alwaysHistory || (includeHistory[1] && rand.nextDouble() < 0.98);
-  includeHistory[3] = alwaysHistory || (includeHistory[2] && rand.nextDouble() < 0.98);
-  includeHistory[4] = alwaysHistory || (includeHistory[3] && rand.nextDouble() < 0.98);
-  for(int i = 0; i<5; i++)
-    row[includeHistoryStart+i] = (includeHistory[i] ? 1.0f : 0.0f);
-
-  if(target == TARGET_NEXT_MOVE) {
-    for(int i = 0; i<policyTargetLen; i++)
-      row[policyTargetStart + i] = policyTarget[i];
-  }
-
-  //Value target, +1 or -1
-  row[valueTargetStart] = valueTarget;
-
-  //Weight of the row, currently always 1.0
-  row[targetWeightsStart] = 1.0;
-
-  //One-hot indicating rank
-  if(rankOneHot != -1)
-    row[rankStart + rankOneHot] = 1.0;
-
-  //Indicate the side to move, black = 0, white = 1
-  if(pla == P_BLACK)
-    row[sideStart] = 0.0;
-  else
-    row[sideStart] = 1.0;
-
-  //Record what turn out of what turn it is
-  row[turnNumberStart] = nextMoveIdx;
-  row[turnNumberStart+1] = moves.size();
-
-  //Record recent captures, by marking any positions where stones vanished between one board and the next
-  for(int i = (int)BoardHistory::NUM_RECENT_BOARDS-2; i >= 0; i--) {
-    const Board& b = hist.getRecentBoard(i);
-    const Board& bPrev = hist.getRecentBoard(i+1);
-    for(int y = 0; y<ySize; y++) {
-      for(int x = 0; x<xSize; x++) {
-        Loc loc = Location::getLoc(x,y,xSize);
-        if(b.colors[loc] == C_EMPTY && bPrev.colors[loc] != C_EMPTY) {
-          int pos = NNPos::xyToPos(x,y,posLen);
-          row[recentCapturesStart+pos] = i+1;
-        }
-      }
-    }
-  }
-
-  //Record next moves
-  for(int i = 0; i<nextMovesLen; i++) {
-    int idx = nextMoveIdx + i;
-    if(idx >= moves.size())
-      row[nextMovesStart+i] = NNPos::locToPos(Board::NULL_LOC,xSize,posLen);
-    else {
-      row[nextMovesStart+i] = NNPos::locToPos(moves[idx].loc,xSize,posLen);
-    }
-  }
-
-  //Record 16-bit chunks of sgf hash, so that later we can identify where this training example came from
-  row[sgfHashStart+0] = (float)((sgfHash.hash1 >> 0) & 0xFFFF);
-  row[sgfHashStart+1] = (float)((sgfHash.hash1 >> 16) & 0xFFFF);
-  row[sgfHashStart+2] = (float)((sgfHash.hash1 >> 32) & 0xFFFF);
-  row[sgfHashStart+3] = (float)((sgfHash.hash1 >> 48) & 0xFFFF);
-  row[sgfHashStart+4] = (float)((sgfHash.hash0 >> 0) & 0xFFFF);
-  row[sgfHashStart+5] = (float)((sgfHash.hash0 >> 16) & 0xFFFF);
-  row[sgfHashStart+6] = (float)((sgfHash.hash0 >> 32) & 0xFFFF);
-  row[sgfHashStart+7] = (float)((sgfHash.hash0 >> 48) & 0xFFFF);
-}
-
 static uint64_t parseHex64(const string& str) {
   assert(str.length() == 16);
   uint64_t x = 0;
@@ -426,12 +298,29 @@ namespace {
     map<int,int64_t> countByOppRank;
     map<string,int64_t> countByUser;
     map<int,int64_t> countByHandicap;
+    //Rows that would have been used except that their position was (probably) already used
+    int64_t numDuplicatesDropped;
 
     Stats()
-      :count(),countBySource(),countByRank(),countByOppRank(),countByUser(),countByHandicap() {
+      :count(),countBySource(),countByRank(),countByOppRank(),countByUser(),countByHandicap(),numDuplicatesDropped() {
 
     }
 
+    void add(const Stats& other) {
+      count += other.count;
+      numDuplicatesDropped += other.numDuplicatesDropped;
+      for(auto const& kv: other.countBySource)
+        countBySource[kv.first] += kv.second;
+      for(auto const& kv: other.countByRank)
+        countByRank[kv.first] += kv.second;
+      for(auto const& kv: other.countByOppRank)
+        countByOppRank[kv.first] += kv.second;
+      for(auto const& kv: other.countByUser)
+        countByUser[kv.first] += kv.second;
+      for(auto const& kv: other.countByHandicap)
+        countByHandicap[kv.first] += kv.second;
+    }
+
     void print() {
       cout << "Count: " << count << endl;
       cout << "Sources:" << endl;
@@ -498,6 +387,7 @@ static void iterSgfMoves(
           wRank = parseRank(root.getSingleProperty("WR"),isGoGoD);
       }
       catch(const IOError &e) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cout << "Warning: " << sgf->fileName << ": " << e.message << endl;
       }
       try {
@@ -505,6 +395,7 @@ static void iterSgfMoves(
           bRank = parseRank(root.getSingleProperty("BR"),isGoGoD);
       }
       catch(const IOError &e) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cout << "Warning: " << sgf->fileName << ": " << e.message << endl;
       }
     }
@@ -543,6 +434,7 @@ static void iterSgfMoves(
     }
   }
   catch(const IOError &e) {
+    std::lock_guard<std::mutex> lock(outputMutex);
     cout << "Skipping sgf file: " << sgf->fileName << ": " << e.message << endl;
     return;
   }
@@ -556,6 +448,7 @@ static void iterSgfMoves(
     Move m = placements[j];
     bool suc = initialBoard.setStone(m.loc,m.pla);
     if(!suc) {
+      std::lock_guard<std::mutex> lock(outputMutex);
       cout << sgf->fileName << endl;
       cout << ("Illegal stone placement " + Global::intToString(j)) << endl;
       cout << initialBoard << endl;
@@ -573,6 +466,7 @@ static void iterSgfMoves(
         break;
       bool suc = initialBoard.playMove(m.loc,m.pla,multiStoneSuicideLegal);
       if(!suc) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cout << sgf->fileName << endl;
         cout << ("Illegal move! " + Global::intToString(j)) << endl;
         cout << initialBoard << endl;
@@ -598,6 +492,7 @@ static void iterSgfMoves(
       //Not actually sure how this happens. It's a large number of games, but still only a tiny percentage,
       //and it often happens well into the middle of the game, and definitely before the end of the game.
       if(source != SOURCE_FOX) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cout << sgf->fileName << endl;
         cout << ("Multiple moves in a row by same player at " + Global::intToString(j)) << endl;
         cout << board << endl;
@@ -628,6 +523,7 @@ static void iterSgfMoves(
     Move mv = moves[j];
     bool suc = board.isLegal(mv.loc,mv.pla,multiStoneSuicideLegal);
     if(!suc) {
+      std::lock_guard<std::mutex> lock(outputMutex);
       cout << sgf->fileName << endl;
       cout << ("Illegal move! " + Global::intToString(j)) << endl;
       cout << board << endl;
@@ -641,150 +537,34 @@ static void iterSgfMoves(
   return;
 }
 
-static void iterSgfsAndLZMoves(
-  vector<CompactSgf*>& sgfs, vector<string>& lzFiles,
-  uint64_t shardSeed, int numShards,
-  const size_t& numMovesUsed, const size_t& curDataSetRow,
-  Stats& total, double keepProb, Rand& keepRand,
-  HandleRowFunc f
-) {
-
-  size_t numMovesItered = 0;
-  size_t numMovesIteredOrSkipped = 0;
-
-  for(int shard = 0; shard < numShards; shard++) {
-    Rand shardRand(shardSeed);
-
-    HandleRowFunc g =
-      [f,shard,numShards,&shardRand,&numMovesIteredOrSkipped,&numMovesItered,&total,keepProb,&keepRand](
-        const Board& board, const BoardHistory& hist, int source, int rank, int oppRank, const string& user, int handicap, const string& date,
-        const vector<Move>& moves, int moveIdx,
-        Player nextPlayer, const float* policyTarget, float valueTarget, Hash128 sgfHash
-      ) {
-      //Only use this move if it's within our shard.
-      numMovesIteredOrSkipped++;
-      if(numShards <= 1 || shard == shardRand.nextUInt(numShards)) {
-        numMovesItered++;
-
-        total.count += 1;
-        total.countBySource[source] += 1;
-        total.countByRank[rank] += 1;
-        total.countByOppRank[oppRank] += 1;
-        total.countByUser[user] += 1;
-        total.countByHandicap[handicap] += 1;
-
-        if(keepProb >= 1.0 || (keepRand.nextDouble() < keepProb)) {
-          f(board,hist,source,rank,oppRank,user,handicap,date,moves,moveIdx,nextPlayer,policyTarget,valueTarget,sgfHash);
-        }
-      }
-    };
-
-    for(int i = 0; i<sgfs.size(); i++) {
-      if(i % 5000 == 0)
-        cout << "Shard " << shard << " "
-             << "processed " << i << "/" << sgfs.size() << " sgfs, "
-             << "itered " << numMovesItered << " moves, "
-             << "used " << numMovesUsed << " moves, "
-             << "written " << curDataSetRow << " rows..." << endl;
-
-      iterSgfMoves(sgfs[i],g);
-    }
-
-    Board board;
-    BoardHistory hist;
-    vector<Move> moves;
-    const string lzname = string("Leela Zero");
-    const string lzdate = string("No date");
-    std::function<void(const LZSample& sample, const string& fileName, int sampleCount)> h =
-      [f,shard,numShards,&shardRand,&numMovesIteredOrSkipped,&numMovesItered,&lzname,&lzdate,&board,&hist,&moves,&total,keepProb,&keepRand]
-      (const LZSample& sample, const string& fileName, int sampleCount) {
-      //Only use this move if it's within our shard.
-      numMovesIteredOrSkipped++;
-      if(numShards <= 1 || shard == shardRand.nextUInt(numShards)) {
-        numMovesItered++;
-
-        int source = SOURCE_LEELAZERO;
-        //Leela zero is pro
-        int rank = 8;
-        int oppRank = 8;
-        const string& user = lzname;
-        //Leela zero games have no handicap
-        int handicap = 0;
-
-        total.count += 1;
-        total.countBySource[source] += 1;
-        total.countByRank[rank] += 1;
-        total.countByOppRank[oppRank] += 1;
-        total.countByUser[user] += 1;
-        total.countByHandicap[handicap] += 1;
-
-        if(keepProb >= 1.0 || (keepRand.nextDouble() < keepProb)) {
-          assert(policyTargetLen == 362);
-          float policyTarget[362];
-          Player nextPlayer;
-          Player winner;
-          try {
-            sample.parse(board,hist,moves,policyTarget,nextPlayer,winner);
-          }
-          catch(const IOError &e) {
-            cout << "Error reading: " << fileName << " sample " << sampleCount << ": " << e.message << endl;
-            return;
-          }
-
-          float valueTarget = 0.0;
-          if(winner == nextPlayer)
-            valueTarget = 1.0;
-          else if(winner == getOpp(nextPlayer))
-            valueTarget = -1.0;
-
-          //The "next" move is always the end of the sample's reported move history
-          int moveIdx = moves.size()-1;
-
-          // for(int n = 7; n >= 0; n--) {
-          //   cout << boards[n] << endl;
-          //   cout << Location::toString(moves[7-n].loc,19) << " " << (int)moves[7-n].pla << endl;
-          // }
-          // for(int y = 0; y<19; y++) {
-          //   for(int x = 0; x<19; x++) {
-          //     printf("%3.0f ", policyTarget[y*19+x]*100.0);
-          //   }
-          //   cout << endl;
-          // }
-          // cout << "Value target " << valueTarget << endl;
-          // cout << "Self komi " << selfKomi << endl;
-
-          Hash128 sgfHash = Hash128(0,0);
-          f(board,hist,source,rank,oppRank,user,handicap,lzdate,moves,moveIdx,nextPlayer,policyTarget,valueTarget,sgfHash);
-        }
-      }
-    };
+//Whether a move belongs to the given shard. Decided by hashing rather than by a random stream over all moves in order,
+//so that it doesn't depend on what order the worker threads happen to reach the moves in.
+static bool isInShard(uint64_t shardSeed, int shard, int numShards, uint64_t gameId, int moveIdx) {
+  if(numShards <= 1)
+    return true;
+  uint64_t h = Hash::murmurMix(shardSeed ^ Hash::murmurMix(gameId + (uint64_t)moveIdx * 0x9E3779B97F4A7C15ULL));
+  return (int)(h % (uint64_t)numShards) == shard;
+}
 
-    for(int i = 0; i<lzFiles.size(); i++) {
-      if(i % 50 == 0)
-        cout << "Shard " << shard << " "
-             << "processed " << i << "/" << lzFiles.size() << " lz files, "
-             << "itered " << numMovesItered << " moves, "
-             << "used " << numMovesUsed << " moves, "
-             << "written " << curDataSetRow << " rows..." << endl;
-      LZSample::iterSamples(lzFiles[i],h);
-    }
+//Beyond its capacity, the filter of position hashes increasingly mistakes new positions for used ones, which with
+//-dedup-positions drops them, and which makes the count of unique positions an undercount.
+static void warnIfPosHashesOverCapacity(const BloomFilter& posHashes, uint64_t posHashCapacity) {
+  if(posHashes.getNumAdded() > posHashCapacity) {
+    cout << "WARNING: " << posHashes.getNumAdded() << " unique pos hashes exceeds -pos-hash-capacity " << posHashCapacity
+         << ", false positive rate is now about " << posHashes.getApproxFalsePositiveRate()
+         << ", consider raising -pos-hash-capacity" << endl;
   }
-
-  assert(numMovesIteredOrSkipped == numMovesItered * numShards);
-  cout << "Over all shards, numMovesItered = " << numMovesItered
-       << " numMovesIteredOrSkipped = " << numMovesIteredOrSkipped
-       << " numMovesItered*numShards = " << (numMovesItered * numShards) << endl;
 }
 
 static void maybeUseRow(
   const Board& board, const BoardHistory& hist, int source, int rank, int oppRank, const string& user, int handicap,
   const string& date, const vector<Move>& movesBuf, int moveIdx,
   Player nextPlayer, const float* policyTarget, float valueTarget, Hash128 sgfHash,
-  DataPool& dataPool,
+  ShardedDataPool& dataPool, float* rowBuf,
   Rand& rand, int minRank, int minOppRank, int maxHandicap, int target,
   bool alwaysHistory, bool includePasses,
   const set<string>& excludeUsers, bool fancyConditions, double fancyPosKeepFactor,
-  set<uint64_t>& posHashes, Stats& used
+  bool dedupPositions, BloomFilter& posHashes, Stats& used
 ) {
   //For now, only generate training rows for non-passes
   //Also only use moves by this player if that player meets rank threshold
@@ -836,11 +616,20 @@ static void maybeUseRow(
       }
     }
 
+    //Record the position, and if deduplicating, skip it if it was (probably) used already
     if(canUse) {
-      float* newRow = dataPool.addNewRow(rand);
+      bool isNewPos = posHashes.add(board.pos_hash.hash0);
+      if(dedupPositions && !isNewPos) {
+        canUse = false;
+        used.numDuplicatesDropped += 1;
+      }
+    }
 
-      fillRow(board,hist,movesBuf,moveIdx,nextPlayer,policyTarget,valueTarget,target,rankOneHot,sgfHash,newRow,rand,alwaysHistory);
-      posHashes.insert(board.pos_hash.hash0);
+    if(canUse) {
+      //Fill the row locally and only then copy it into the pool, so that the pool is locked only briefly
+      std::memset(rowBuf,0,sizeof(float)*totalRowLen);
+      fillRow(board,hist,movesBuf,moveIdx,nextPlayer,policyTarget,valueTarget,target,rankOneHot,sgfHash,rowBuf,rand,alwaysHistory);
+      dataPool.addRow(rowBuf,rand);
 
       used.count += 1;
       used.countBySource[source] += 1;
@@ -852,63 +641,311 @@ static void maybeUseRow(
   }
 }
 
+//Write numRows rows to the end of dataSet, which currently has startRow rows
+static void appendH5Rows(DataSet* dataSet, size_t startRow, const float* rows, size_t numRows) {
+  hsize_t newDims[h5Dimension] = {startRow+numRows,totalRowLen};
+  dataSet->extend(newDims);
+  DataSpace fileSpace = dataSet->getSpace();
+  hsize_t memDims[h5Dimension] = {numRows,totalRowLen};
+  DataSpace memSpace(h5Dimension,memDims);
+  hsize_t start[h5Dimension] = {startRow,0};
+  hsize_t count[h5Dimension] = {numRows,totalRowLen};
+  fileSpace.selectHyperslab(H5S_SELECT_SET, count, start);
+  dataSet->write(rows, PredType::NATIVE_FLOAT, memSpace, fileSpace);
+}
 
+//Parse, replay, and featurize sgfs and LZ files on numThreads worker threads, each taking one whole file at a time.
+//Rows go into a ShardedDataPool for shuffling, and a single writer thread writes rows evicted from it to either the
+//dataSet or the npzWriter, whichever is not NULL. Throws the first error from processing or writing once all threads are done.
+//Each of numShards passes re-reads all the files but uses only the moves that hash into that shard, which
+//spreads out the moves of each game further than the pool alone would.
 static void processData(
-  vector<CompactSgf*>& sgfs, vector<string>& lzFiles, DataSet* dataSet,
+  const vector<string>& sgfFiles, const vector<string>& lzFiles, DataSet* dataSet, NpzRowWriter* npzWriter,
+  const set<Hash128>& excludeHashes, vector<char>& sgfFileUsed,
   size_t poolSize,
-  uint64_t shardSeed, int numShards,
+  uint64_t shardSeed, int numShards, int numThreads,
   Rand& rand, double keepProb,
   int minRank, int minOppRank, int maxHandicap, int target,
   bool alwaysHistory, bool includePasses,
   const set<string>& excludeUsers, bool fancyConditions, double fancyPosKeepFactor,
-  set<uint64_t>& posHashes, Stats& total, Stats& used
+  bool dedupPositions, BloomFilter& posHashes, Stats& total, Stats& used
 ) {
-  size_t curDataSetRow = 0;
-  std::function<void(const float*,size_t)> writeRow = [&curDataSetRow,&dataSet](const float* rows, size_t numRows) {
-    hsize_t newDims[h5Dimension] = {curDataSetRow+numRows,totalRowLen};
-    dataSet->extend(newDims);
-    DataSpace fileSpace = dataSet->getSpace();
-    hsize_t memDims[h5Dimension] = {numRows,totalRowLen};
-    DataSpace memSpace(h5Dimension,memDims);
-    hsize_t start[h5Dimension] = {curDataSetRow,0};
-    hsize_t count[h5Dimension] = {numRows,totalRowLen};
-    fileSpace.selectHyperslab(H5S_SELECT_SET, count, start);
-    dataSet->write(rows, PredType::NATIVE_FLOAT, memSpace, fileSpace);
-    curDataSetRow += numRows;
-  };
+  //Single writer---------------------------------------------------------------------------------
+  //HDF5 is not thread-safe, so one thread does all the writing, taking copies of rows evicted from the pool off a
+  //bounded queue. NULL signals the end. For h5, it writes whole chunks at a time, since writing part of a compressed chunk
+  //means decompressing and recompressing all of it.
+  std::atomic<size_t> curDataSetRow(0);
+  const int numPoolShards = numThreads * 4;
+  const size_t writeBufCapacity = std::max((size_t)(chunkHeight / numPoolShards), (size_t)64);
+  ThreadSafeQueue<vector<float>*> writeQueue(numPoolShards);
+  //If writing fails, the writer records the error and keeps discarding whatever it pops so that nothing blocks on the
+  //queue, the workers stop taking new files, and the error is rethrown once all the threads are joined.
+  std::atomic<bool> writeFailed(false);
+  std::exception_ptr writeException;
+  auto writeLoop = [&dataSet,&npzWriter,&curDataSetRow,&writeQueue,&writeFailed,&writeException]() {
+    vector<float> chunkBuf;
+    chunkBuf.reserve((size_t)chunkHeight * totalRowLen);
+    auto writeChunk = [&]() {
+      size_t numRows = chunkBuf.size() / totalRowLen;
+      if(numRows <= 0)
+        return;
+      size_t startRow = curDataSetRow.load();
+      appendH5Rows(dataSet,startRow,chunkBuf.data(),numRows);
+      curDataSetRow.store(startRow + numRows);
+      chunkBuf.clear();
+    };
+    auto writeRows = [&](const vector<float>& rowsBuf) {
+      size_t numRows = rowsBuf.size() / totalRowLen;
+      for(size_t i = 0; i<numRows; i++) {
+        if(npzWriter != NULL) {
+          npzWriter->addRow(rowsBuf.data() + i * totalRowLen);
+          curDataSetRow.fetch_add(1);
+          continue;
+        }
+        chunkBuf.insert(chunkBuf.end(), rowsBuf.data() + i * totalRowLen, rowsBuf.data() + (i+1) * totalRowLen);
+        if(chunkBuf.size() >= (size_t)chunkHeight * totalRowLen)
+          writeChunk();
+      }
+    };
+    //Call only from within a catch block. HDF5 exceptions are not std::exceptions, so convert them.
+    auto recordWriteException = [&]() {
+      try {
+        throw;
+      }
+      catch(const H5::Exception& e) {
+        writeException = std::make_exception_ptr(IOError("HDF5 error in " + e.getFuncName() + ": " + e.getDetailMsg()));
+      }
+      catch(...) {
+        writeException = std::current_exception();
+      }
+      writeFailed.store(true);
+    };
 
-  DataPool dataPool(totalRowLen,poolSize,chunkHeight,writeRow);
-
-  HandleRowFunc f =
-    [&dataPool,&rand,minRank,minOppRank,maxHandicap,target,&excludeUsers,fancyConditions,fancyPosKeepFactor,alwaysHistory,includePasses,&posHashes,&used](
-      const Board& board, const BoardHistory& hist, int source, int rank, int oppRank, const string& user, int handicap, const string& date,
-      const vector<Move>& moves, int moveIdx,
-      Player nextPlayer, const float* policyTarget, float valueTarget, Hash128 sgfHash
-    ) {
-    maybeUseRow(
-      board,hist,source,rank,oppRank,user,handicap,date,moves,moveIdx,
-      nextPlayer,policyTarget,valueTarget,sgfHash,
-      dataPool,rand,minRank,minOppRank,maxHandicap,target,
-      alwaysHistory, includePasses,
-      excludeUsers,fancyConditions,fancyPosKeepFactor,
-      posHashes,used
-    );
+    while(true) {
+      vector<float>* rowsBuf = writeQueue.waitPop();
+      if(rowsBuf == NULL)
+        break;
+      if(!writeFailed.load()) {
+        try {
+          writeRows(*rowsBuf);
+        }
+        catch(...) {
+          recordWriteException();
+        }
+      }
+      delete rowsBuf;
+    }
+    if(!writeFailed.load()) {
+      try {
+        if(npzWriter != NULL)
+          npzWriter->flush();
+        else
+          writeChunk();
+      }
+      catch(...) {
+        recordWriteException();
+      }
+    }
   };
+  std::function<void(const float*,size_t)> writeRow = [&writeQueue](const float* rows, size_t numRows) {
+    if(numRows <= 0)
+      return;
+    writeQueue.waitPush(new vector<float>(rows, rows + numRows * totalRowLen));
+  };
+  std::thread writeThread(writeLoop);
+
+  ShardedDataPool dataPool(totalRowLen,poolSize,writeBufCapacity,numPoolShards,writeRow);
+
+  //Workers---------------------------------------------------------------------------------------
+  //Any error other than a bad input file stops all the workers the same way a write error does, and the first one is
+  //rethrown once the workers and the writer are joined.
+  std::mutex statsMutex;
+  std::exception_ptr workException;
+  std::atomic<size_t> numMovesItered(0);
+  std::atomic<size_t> numMovesUsed(0);
+  vector<uint64_t> threadSeeds;
+  for(int i = 0; i<numThreads; i++)
+    threadSeeds.push_back(rand.nextUInt64());
+
+  for(int shard = 0; shard < numShards; shard++) {
+    std::atomic<size_t> nextFileIdx(0);
+    const size_t numFiles = sgfFiles.size() + lzFiles.size();
 
-  iterSgfsAndLZMoves(
-    sgfs,lzFiles,
-    shardSeed,numShards,
-    used.count,curDataSetRow,
-    total,keepProb,rand,
-    f
-  );
+    auto workLoop = [&](int threadIdx) {
+      Rand threadRand(threadSeeds[threadIdx] + (uint64_t)shard);
+      Stats threadTotal;
+      Stats threadUsed;
+      float* rowBuf = new float[totalRowLen];
+
+      auto useMove = [&](
+        const Board& board, const BoardHistory& hist, int source, int rank, int oppRank, const string& user, int handicap, const string& date,
+        const vector<Move>& moves, int moveIdx,
+        Player nextPlayer, const float* policyTarget, float valueTarget, Hash128 sgfHash
+      ) {
+        threadTotal.count += 1;
+        threadTotal.countBySource[source] += 1;
+        threadTotal.countByRank[rank] += 1;
+        threadTotal.countByOppRank[oppRank] += 1;
+        threadTotal.countByUser[user] += 1;
+        threadTotal.countByHandicap[handicap] += 1;
+        numMovesItered.fetch_add(1,std::memory_order_relaxed);
+
+        if(keepProb >= 1.0 || (threadRand.nextDouble() < keepProb)) {
+          size_t usedCountBefore = threadUsed.count;
+          maybeUseRow(
+            board,hist,source,rank,oppRank,user,handicap,date,moves,moveIdx,
+            nextPlayer,policyTarget,valueTarget,sgfHash,
+            dataPool,rowBuf,threadRand,minRank,minOppRank,maxHandicap,target,
+            alwaysHistory, includePasses,
+            excludeUsers,fancyConditions,fancyPosKeepFactor,
+            dedupPositions,posHashes,threadUsed
+          );
+          if(threadUsed.count != usedCountBefore)
+            numMovesUsed.fetch_add(1,std::memory_order_relaxed);
+        }
+      };
+
+      Board lzBoard;
+      BoardHistory lzHist;
+      vector<Move> lzMoves;
+      const string lzname = string("Leela Zero");
+      const string lzdate = string("No date");
+      size_t lzFileIdx = 0;
+      std::function<void(const LZSample& sample, const string& fileName, int sampleCount)> h =
+        [&](const LZSample& sample, const string& fileName, int sampleCount) {
+        //Only use this move if it's within our shard.
+        if(!isInShard(shardSeed,shard,numShards,lzFileIdx,sampleCount))
+          return;
+
+        int source = SOURCE_LEELAZERO;
+        //Leela zero is pro
+        int rank = 8;
+        int oppRank = 8;
+        //Leela zero games have no handicap
+        int handicap = 0;
+
+        assert(policyTargetLen == 362);
+        float policyTarget[362];
+        Player nextPlayer;
+        Player winner;
+        try {
+          sample.parse(lzBoard,lzHist,lzMoves,policyTarget,nextPlayer,winner);
+        }
+        catch(const IOError &e) {
+          std::lock_guard<std::mutex> lock(outputMutex);
+          cout << "Error reading: " << fileName << " sample " << sampleCount << ": " << e.message << endl;
+          return;
+        }
+
+        float valueTarget = 0.0;
+        if(winner == nextPlayer)
+          valueTarget = 1.0;
+        else if(winner == getOpp(nextPlayer))
+          valueTarget = -1.0;
+
+        //The "next" move is always the end of the sample's reported move history
+        int moveIdx = lzMoves.size()-1;
+        Hash128 sgfHash = Hash128(0,0);
+        useMove(lzBoard,lzHist,source,rank,oppRank,lzname,handicap,lzdate,lzMoves,moveIdx,nextPlayer,policyTarget,valueTarget,sgfHash);
+      };
+
+      try {
+        while(!writeFailed.load()) {
+          size_t idx = nextFileIdx.fetch_add(1);
+          if(idx >= numFiles)
+            break;
+
+          if(idx < sgfFiles.size() ? (idx % 5000 == 0) : ((idx - sgfFiles.size()) % 50 == 0)) {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            cout << "Shard " << shard << " "
+                 << "processed " << std::min(idx,sgfFiles.size()) << "/" << sgfFiles.size() << " sgfs, "
+                 << (idx - std::min(idx,sgfFiles.size())) << "/" << lzFiles.size() << " lz files, "
+                 << "itered " << numMovesItered.load() << " moves, "
+                 << "used " << numMovesUsed.load() << " moves, "
+                 << "written " << curDataSetRow.load() << " rows..." << endl;
+          }
+
+          if(idx < sgfFiles.size()) {
+            CompactSgf* sgf;
+            try {
+              sgf = CompactSgf::loadFile(sgfFiles[idx]);
+            }
+            catch(const IOError& e) {
+              std::lock_guard<std::mutex> lock(outputMutex);
+              cout << "Skipping sgf file: " << sgfFiles[idx] << ": " << e.message << endl;
+              continue;
+            }
+            if(contains(excludeHashes,sgf->hash)) {
+              delete sgf;
+              continue;
+            }
+            sgfFileUsed[idx] = 1;
+
+            HandleRowFunc g = [&](
+              const Board& board, const BoardHistory& hist, int source, int rank, int oppRank, const string& user, int handicap, const string& date,
+              const vector<Move>& moves, int moveIdx,
+              Player nextPlayer, const float* policyTarget, float valueTarget, Hash128 sgfHash
+            ) {
+              //Only use this move if it's within our shard.
+              if(isInShard(shardSeed,shard,numShards,sgfHash.hash0,moveIdx))
+                useMove(board,hist,source,rank,oppRank,user,handicap,date,moves,moveIdx,nextPlayer,policyTarget,valueTarget,sgfHash);
+            };
+            iterSgfMoves(sgf,g);
+            delete sgf;
+          }
+          else {
+            lzFileIdx = idx;
+            try {
+              LZSample::iterSamples(lzFiles[idx - sgfFiles.size()],h);
+            }
+            catch(const IOError& e) {
+              //Samples before the bad one were already used
+              std::lock_guard<std::mutex> lock(outputMutex);
+              cout << "Error reading lz file, skipping the rest of it: " << e.message << endl;
+            }
+          }
+        }
+      }
+      catch(...) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if(!workException)
+          workException = std::current_exception();
+        writeFailed.store(true);
+      }
+
+      delete[] rowBuf;
+      std::lock_guard<std::mutex> lock(statsMutex);
+      total.add(threadTotal);
+      used.add(threadUsed);
+    };
+
+    vector<std::thread> threads;
+    for(int i = 0; i<numThreads; i++)
+      threads.push_back(std::thread(workLoop,i));
+    for(int i = 0; i<numThreads; i++)
+      threads[i].join();
+    if(workException)
+      break;
+  }
+
+  if(workException) {
+    //The writer is discarding everything by now, so just stop it
+    writeQueue.waitPush(NULL);
+    writeThread.join();
+    std::rethrow_exception(workException);
+  }
+
+  cout << "Over all shards, numMovesItered = " << numMovesItered.load() << endl;
 
   cout << "Emptying pool" << endl;
   dataPool.finishAndWritePool(rand);
+  writeQueue.waitPush(NULL);
+  writeThread.join();
+  if(writeException)
+    std::rethrow_exception(writeException);
 }
 
 
-
 int main(int argc, const char* argv[]) {
   assert(sizeof(size_t) == 8);
   Board::initHash();
@@ -990,11 +1027,14 @@ int main(int argc, const char* argv[]) {
   vector<string> gamesDirs;
   vector<string> lzDirs;
   string outputFile;
+  string outputFormat;
+  int npzRowsPerFile;
   string onlyFilesFile;
   string excludeFilesFile;
   vector<string> excludeHashesFiles;
   size_t poolSize;
   int trainShards;
+  int numThreads;
   double valGameProb;
   double keepTrainProb;
   double keepValProb;
@@ -1007,18 +1047,24 @@ int main(int argc, const char* argv[]) {
   bool fancyConditions;
   double fancyGameKeepFactor;
   double fancyPosKeepFactor;
+  bool dedupPositions;
+  uint64_t posHashCapacity;
+  double posHashFalsePositiveRate;
   vector<string> excludeUsersFiles;
 
   try {
-    TCLAP::CmdLine cmd("Sgf->HDF5 data writer", ' ', "1.0",true);
+    TCLAP::CmdLine cmd("Sgf->HDF5 or npz data writer", ' ', "1.0",true);
     TCLAP::MultiArg<string> gamesdirArg("","gamesdir","Directory of sgf files",false,"DIR");
     TCLAP::MultiArg<string> lzdirArg("","lzdir","Directory of leela zero gzipped data files",false,"DIR");
-    TCLAP::ValueArg<string> outputArg("","output","H5 file to write",true,string(),"FILE");
+    TCLAP::ValueArg<string> outputArg("","output","H5 file to write, or prefix of npz files to write",true,string(),"FILE");
+    TCLAP::ValueArg<string> outputFormatArg("","output-format","h5 for float rows in an h5 file, npz for packed rows in npz files",false,string("h5"),"FORMAT");
+    TCLAP::ValueArg<int>    npzRowsPerFileArg("","npz-rows-per-file","Max rows in each npz file",false,100000,"INT");
     TCLAP::ValueArg<string> onlyFilesArg("","only-files","Specify a list of files to filter to, one per line in a txt file",false,string(),"FILEOFFILES");
     TCLAP::ValueArg<string> excludeFilesArg("","exclude-files","Specify a list of files to filter out, one per line in a txt file",false,string(),"FILEOFFILES");
     TCLAP::MultiArg<string> excludeHashesArg("","exclude-hashes","Specify a list of hashes to filter out, one per line in a txt file",false,"FILEOF(HASH,HASH)");
     TCLAP::ValueArg<size_t> poolSizeArg("","pool-size","Pool size for shuffling rows",true,(size_t)0,"SIZE");
-    TCLAP::ValueArg<int>    trainShardsArg("","train-shards","Make this many passes processing 1/N of the data each time",true,0,"INT");
+    TCLAP::ValueArg<int>    trainShardsArg("","train-shards","Make this many passes processing 1/N of the data each time",false,1,"INT");
+    TCLAP::ValueArg<int>    numThreadsArg("","num-threads","Number of threads to parse and featurize games with",false,std::max((int)std::thread::hardware_concurrency(),1),"INT");
     TCLAP::ValueArg<double> valGameProbArg("","val-game-prob","Probability of using a game for validation instead of train",true,0.0,"PROB");
     TCLAP::ValueArg<double> keepTrainProbArg("","keep-train-prob","Probability per-move of keeping a move in the train set",false,1.0,"PROB");
     TCLAP::ValueArg<double> keepValProbArg("","keep-val-prob","Probability per-move of keeping a move in the val set",false,1.0,"PROB");
@@ -1031,15 +1077,21 @@ int main(int argc, const char* argv[]) {
     TCLAP::SwitchArg        fancyConditionsArg("","fancy-conditions","Fancy filtering for rank balancing",false);
     TCLAP::ValueArg<double> fancyGameKeepFactorArg("","fancy-game-keep-factor","Multiply fancy game keep prob by this",false,1.0,"PROB");
     TCLAP::ValueArg<double> fancyPosKeepFactorArg("","fancy-pos-keep-factor","Multiply fancy pos keep prob by this",false,1.0,"PROB");
+    TCLAP::SwitchArg        dedupPositionsArg("","dedup-positions","Use only the first occurrence of each position",false);
+    TCLAP::ValueArg<uint64_t> posHashCapacityArg("","pos-hash-capacity","Expected max number of positions used, for sizing the filter of position hashes",false,(uint64_t)50000000,"INT");
+    TCLAP::ValueArg<double> posHashFPRateArg("","pos-hash-fp-rate","False positive rate of the filter of position hashes when at capacity",false,0.01,"PROB");
     TCLAP::MultiArg<string> excludeUsersArg("","exclude-users","File of users to exclude, one per line",false,"FILE");
     cmd.add(gamesdirArg);
     cmd.add(lzdirArg);
     cmd.add(outputArg);
+    cmd.add(outputFormatArg);
+    cmd.add(npzRowsPerFileArg);
     cmd.add(onlyFilesArg);
     cmd.add(excludeFilesArg);
     cmd.add(excludeHashesArg);
     cmd.add(poolSizeArg);
     cmd.add(trainShardsArg);
+    cmd.add(numThreadsArg);
     cmd.add(valGameProbArg);
     cmd.add(keepTrainProbArg);
     cmd.add(keepValProbArg);
@@ -1052,16 +1104,22 @@ int main(int argc, const char* argv[]) {
     cmd.add(fancyConditionsArg);
     cmd.add(fancyGameKeepFactorArg);
     cmd.add(fancyPosKeepFactorArg);
+    cmd.add(dedupPositionsArg);
+    cmd.add(posHashCapacityArg);
+    cmd.add(posHashFPRateArg);
     cmd.add(excludeUsersArg);
     cmd.parse(argc,argv);
     gamesDirs = gamesdirArg.getValue();
     lzDirs = lzdirArg.getValue();
     outputFile = outputArg.getValue();
+    outputFormat = outputFormatArg.getValue();
+    npzRowsPerFile = npzRowsPerFileArg.getValue();
     onlyFilesFile = onlyFilesArg.getValue();
     excludeFilesFile = excludeFilesArg.getValue();
     excludeHashesFiles = excludeHashesArg.getValue();
     poolSize = poolSizeArg.getValue();
     trainShards = trainShardsArg.getValue();
+    numThreads = numThreadsArg.getValue();
     valGameProb = valGameProbArg.getValue();
     keepTrainProb = keepTrainProbArg.getValue();
     keepValProb = keepValProbArg.getValue();
@@ -1073,8 +1131,28 @@ int main(int argc, const char* argv[]) {
     fancyConditions = fancyConditionsArg.getValue();
     fancyGameKeepFactor = fancyGameKeepFactorArg.getValue();
     fancyPosKeepFactor = fancyPosKeepFactorArg.getValue();
+    dedupPositions = dedupPositionsArg.getValue();
+    posHashCapacity = posHashCapacityArg.getValue();
+    posHashFalsePositiveRate = posHashFPRateArg.getValue();
     excludeUsersFiles = excludeUsersArg.getValue();
 
+    if(trainShards <= 0)
+      throw TCLAP::ArgException("Must be positive","train-shards");
+    if(numThreads <= 0)
+      throw TCLAP::ArgException("Must be positive","num-threads");
+    if(outputFormat != "h5" && outputFormat != "npz")
+      throw TCLAP::ArgException("Must be h5 or npz","output-format");
+    if(npzRowsPerFile <= 0)
+      throw TCLAP::ArgException("Must be positive","npz-rows-per-file");
+    if(lzDirs.size() > 0 && Board::MAX_LEN < 19)
+      throw TCLAP::ArgException(
+        "Leela zero data is 19x19 but this build only supports boards up to " + Global::intToString(Board::MAX_LEN),"lzdir"
+      );
+    if(posHashCapacity <= 0)
+      throw TCLAP::ArgException("Must be positive","pos-hash-capacity");
+    if(!(posHashFalsePositiveRate > 0.0 && posHashFalsePositiveRate < 1.0))
+      throw TCLAP::ArgException("Must be between 0 and 1","pos-hash-fp-rate");
+
     if(targetArg.getValue() == "nextmove")
       target = TARGET_NEXT_MOVE;
     else
@@ -1148,10 +1226,13 @@ int main(int argc, const char* argv[]) {
   cout << "targetWeightsLen " << targetWeightsLen << endl;
   cout << "rankLen " << rankLen << endl;
   cout << "totalRowLen " << totalRowLen << endl;
+  cout << "outputFormat " << outputFormat << endl;
   cout << "chunkHeight " << chunkHeight << endl;
   cout << "deflateLevel " << deflateLevel << endl;
+  cout << "npzRowsPerFile " << npzRowsPerFile << endl;
   cout << "poolSize " << poolSize << endl;
   cout << "trainShards " << trainShards << endl;
+  cout << "numThreads " << numThreads << endl;
   cout << "valGameProb " << valGameProb << endl;
   cout << "keepTrainProb " << keepTrainProb << endl;
   cout << "keepValProb " << keepValProb << endl;
@@ -1164,6 +1245,9 @@ int main(int argc, const char* argv[]) {
   cout << "fancyConditions " << fancyConditions << endl;
   cout << "fancyGameKeepFactor " << fancyGameKeepFactor << endl;
   cout << "fancyPosKeepFactor " << fancyPosKeepFactor << endl;
+  cout << "dedupPositions " << dedupPositions << endl;
+  cout << "posHashCapacity " << posHashCapacity << endl;
+  cout << "posHashFalsePositiveRate " << posHashFalsePositiveRate << endl;
 
   cout << endl;
   cout << "Excluding users:" << endl;
@@ -1202,8 +1286,17 @@ int main(int argc, const char* argv[]) {
     return 1;
   }
 
-  cout << "Opening h5 file..." << endl;
-  H5File* h5File = new H5File(H5std_string(outputFile), H5F_ACC_TRUNC);
+  H5File* h5File = NULL;
+  if(outputFormat == "h5") {
+    cout << "Opening h5 file..." << endl;
+    try {
+      h5File = new H5File(H5std_string(outputFile), H5F_ACC_TRUNC);
+    }
+    catch(const H5::Exception& e) {
+      cerr << "Error opening h5 file " << outputFile << ": " << e.getDetailMsg() << endl;
+      return 1;
+    }
+  }
   hsize_t maxDims[h5Dimension] = {H5S_UNLIMITED, totalRowLen};
   hsize_t chunkDims[h5Dimension] = {chunkHeight, totalRowLen};
   hsize_t initFileDims[h5Dimension] = {0, totalRowLen};
@@ -1258,49 +1351,17 @@ int main(int argc, const char* argv[]) {
     cout << "Kept " << files.size() << " sgf files after filtering by fancy source!" << endl;
   }
 
-  cout << "Loading SGFS..." << endl;
-  vector<CompactSgf*> sgfs = CompactSgf::loadFiles(files);
-
-  // for(int i = 0; i<sgfs.size(); i++) {
-  //   if(sgfs[i]->hash[0] == 0x1a94b16410ae6be0ULL ||
-  //      sgfs[i]->hash[0] == 0xcd09562bc06cd9bbULL ||
-  //      sgfs[i]->hash[0] == 0x2233404f2631382ULL ||
-  //      sgfs[i]->hash[0] == 0x76c1a947cde45a9eULL ||
-  //      sgfs[i]->hash[0] == 0xe471f1dbcf146ff1ULL ||
-  //      sgfs[i]->hash[0] == 0x810d5d87c8dce0cbULL ||
-  //      sgfs[i]->hash[0] == 0xa7fcf6c55ee16e30ULL ||
-  //      sgfs[i]->hash[0] == 0x594b712635a2692dULL ||
-  //      sgfs[i]->hash[0] == 0xa8cd003f20241f33ULL ||
-  //      sgfs[i]->hash[0] == 0xe069b39c42b26fe3ULL ||
-  //      sgfs[i]->hash[0] == 0xf4b683e270916e8eULL ||
-  //      sgfs[i]->hash[0] == 0x9510377733620c6dULL ||
-  //      sgfs[i]->hash[0] == 0xe8c22c39775764d2ULL)
-  //     cout << sgfs[i]->fileName << endl;
-  // }
-
-  if(excludeHashesProvided) {
-    int kept = 0;
-    for(int i = 0; i<sgfs.size(); i++) {
-      if(!contains(excludeHashes,sgfs[i]->hash)) {
-        if(i != kept)
-          std::swap(sgfs[i],sgfs[kept]);
-        kept++;
-      }
-      else {
-        delete sgfs[i];
-      }
-    }
-    sgfs.resize(kept);
-    cout << "Kept " << sgfs.size() << " sgf files after filtering by excludeHashes!" << endl;
-  }
+  //Sgfs are loaded by the worker threads in processData, which also skip any matching excludeHashes
+  if(excludeHashesProvided)
+    cout << "Excluding " << excludeHashes.size() << " sgf hashes" << endl;
 
   //Shuffle sgfs
   cout << "Shuffling SGFS..." << endl;
-  for(int i = 1; i<sgfs.size(); i++) {
+  for(int i = 1; i<files.size(); i++) {
     int r = rand.nextUInt(i+1);
-    CompactSgf* tmp = sgfs[i];
-    sgfs[i] = sgfs[r];
-    sgfs[r] = tmp;
+    string tmp = files[i];
+    files[i] = files[r];
+    files[r] = tmp;
   }
 
   //Shuffle lz files
@@ -1313,16 +1374,15 @@ int main(int argc, const char* argv[]) {
   }
 
   //Split into train and val
-  vector<CompactSgf*> trainSgfs;
-  vector<CompactSgf*> valSgfs;
-  for(int i = 0; i<sgfs.size(); i++) {
+  vector<string> trainSgfFiles;
+  vector<string> valSgfFiles;
+  for(int i = 0; i<files.size(); i++) {
     if(rand.nextDouble() < valGameProb)
-      valSgfs.push_back(sgfs[i]);
+      valSgfFiles.push_back(files[i]);
     else
-      trainSgfs.push_back(sgfs[i]);
+      trainSgfFiles.push_back(files[i]);
   }
-  //Clear sgfs via swap with enpty factor
-  vector<CompactSgf*>().swap(sgfs);
+  vector<string>().swap(files);
 
   //Split into train and val
   vector<string> trainLZFiles;
@@ -1340,39 +1400,67 @@ int main(int argc, const char* argv[]) {
 
   cout << "Generating TRAINING set..." << endl;
   H5std_string trainSetName("train");
-  DataSet* trainDataSet = new DataSet(h5File->createDataSet(trainSetName, PredType::IEEE_F32LE, DataSpace(h5Dimension,initFileDims,maxDims), dataSetProps));
-  set<uint64_t> trainPosHashes;
+  DataSet* trainDataSet = NULL;
+  NpzRowWriter* trainNpzWriter = NULL;
+  if(h5File != NULL)
+    trainDataSet = new DataSet(h5File->createDataSet(trainSetName, PredType::IEEE_F32LE, DataSpace(h5Dimension,initFileDims,maxDims), dataSetProps));
+  else
+    trainNpzWriter = new NpzRowWriter(outputFile + ".train", npzRowsPerFile);
+  BloomFilter trainPosHashes(posHashCapacity,posHashFalsePositiveRate);
   Stats trainTotalStats;
   Stats trainUsedStats;
-  processData(
-    trainSgfs,trainLZFiles,trainDataSet,
-    poolSize,
-    trainShardSeed, trainShards,
-    rand, keepTrainProb,
-    minRank, minOppRank, maxHandicap, target,
-    alwaysHistory, includePasses,
-    excludeUsers, fancyConditions, fancyPosKeepFactor,
-    trainPosHashes, trainTotalStats, trainUsedStats
-  );
+  vector<char> trainSgfFileUsed(trainSgfFiles.size(),0);
+  try {
+    processData(
+      trainSgfFiles,trainLZFiles,trainDataSet,trainNpzWriter,
+      excludeHashes,trainSgfFileUsed,
+      poolSize,
+      trainShardSeed, trainShards, numThreads,
+      rand, keepTrainProb,
+      minRank, minOppRank, maxHandicap, target,
+      alwaysHistory, includePasses,
+      excludeUsers, fancyConditions, fancyPosKeepFactor,
+      dedupPositions, trainPosHashes, trainTotalStats, trainUsedStats
+    );
+  }
+  catch(const std::exception& e) {
+    cerr << "Error writing training set: " << e.what() << endl;
+    return 1;
+  }
   delete trainDataSet;
+  delete trainNpzWriter;
 
   cout << "Generating VALIDATION set..." << endl;
   H5std_string valSetName("val");
-  DataSet* valDataSet = new DataSet(h5File->createDataSet(valSetName, PredType::IEEE_F32LE, DataSpace(h5Dimension,initFileDims,maxDims), dataSetProps));
-  set<uint64_t> valPosHashes;
+  DataSet* valDataSet = NULL;
+  NpzRowWriter* valNpzWriter = NULL;
+  if(h5File != NULL)
+    valDataSet = new DataSet(h5File->createDataSet(valSetName, PredType::IEEE_F32LE, DataSpace(h5Dimension,initFileDims,maxDims), dataSetProps));
+  else
+    valNpzWriter = new NpzRowWriter(outputFile + ".val", npzRowsPerFile);
+  BloomFilter valPosHashes(posHashCapacity,posHashFalsePositiveRate);
   Stats valTotalStats;
   Stats valUsedStats;
-  processData(
-    valSgfs,valLZFiles,valDataSet,
-    poolSize,
-    valShardSeed, trainShards,
-    rand, keepValProb,
-    minRank, minOppRank, maxHandicap, target,
-    alwaysHistory, includePasses,
-    excludeUsers, fancyConditions, fancyPosKeepFactor,
-    valPosHashes, valTotalStats, valUsedStats
-  );
+  vector<char> valSgfFileUsed(valSgfFiles.size(),0);
+  try {
+    processData(
+      valSgfFiles,valLZFiles,valDataSet,valNpzWriter,
+      excludeHashes,valSgfFileUsed,
+      poolSize,
+      valShardSeed, trainShards, numThreads,
+      rand, keepValProb,
+      minRank, minOppRank, maxHandicap, target,
+      alwaysHistory, includePasses,
+      excludeUsers, fancyConditions, fancyPosKeepFactor,
+      dedupPositions, valPosHashes, valTotalStats, valUsedStats
+    );
+  }
+  catch(const std::exception& e) {
+    cerr << "Error writing validation set: " << e.what() << endl;
+    return 1;
+  }
   delete valDataSet;
+  delete valNpzWriter;
 
   //Close the h5 file
   delete h5File;
@@ -1380,14 +1468,16 @@ int main(int argc, const char* argv[]) {
   //Record names of all the sgf files
   ofstream trainNames;
   trainNames.open(outputFile + ".train.txt");
-  for(int i = 0; i<trainSgfs.size(); i++) {
-    trainNames << trainSgfs[i]->fileName << "\n";
+  for(int i = 0; i<trainSgfFiles.size(); i++) {
+    if(trainSgfFileUsed[i])
+      trainNames << trainSgfFiles[i] << "\n";
   }
   trainNames.close();
   ofstream valNames;
   valNames.open(outputFile + ".val.txt");
-  for(int i = 0; i<valSgfs.size(); i++) {
-    valNames << valSgfs[i]->fileName << "\n";
+  for(int i = 0; i<valSgfFiles.size(); i++) {
+    if(valSgfFileUsed[i])
+      valNames << valSgfFiles[i] << "\n";
   }
   valNames.close();
 
@@ -1396,19 +1486,21 @@ int main(int argc, const char* argv[]) {
   cout << "TRAIN TOTAL------------------------------------" << endl;
   trainTotalStats.print();
   cout << "TRAIN USED------------------------------------" << endl;
-  cout << trainPosHashes.size() << " unique pos hashes used" << endl;
+  cout << trainPosHashes.getNumAdded() << " unique pos hashes used (approx)" << endl;
+  if(dedupPositions)
+    cout << trainUsedStats.numDuplicatesDropped << " rows dropped as duplicate positions" << endl;
+  warnIfPosHashesOverCapacity(trainPosHashes,posHashCapacity);
   trainUsedStats.print();
 
   cout << "VAL TOTAL------------------------------------" << endl;
   valTotalStats.print();
   cout << "VAL USED------------------------------------" << endl;
-  cout << valPosHashes.size() << " unique pos hashes used" << endl;
+  cout << valPosHashes.getNumAdded() << " unique pos hashes used (approx)" << endl;
+  if(dedupPositions)
+    cout << valUsedStats.numDuplicatesDropped << " rows dropped as duplicate positions" << endl;
+  warnIfPosHashesOverCapacity(valPosHashes,posHashCapacity);
   valUsedStats.print();
 
-  //Cleanup----------------------------------------------------------------------------
-  for(int i = 0; i<sgfs.size(); i++) {
-    delete sgfs[i];
-  }
   cout << "Everything cleaned up" << endl;
 
   return 0;
@@ -12,6 +12,8 @@ import multiprocessing
 
 import numpy as np
 
+from shuffle import load_npz_policy_targets_dense
+
 keys = [
   "binaryInputNCHWPacked",
   "globalInputNC",
@@ -23,7 +25,7 @@ keys = [
 ]
 
 def compute_stats(input_file):
-  npz = np.load(input_file)
+  npz = load_npz_policy_targets_dense(np.load(input_file))
   assert(set(npz.keys()) == set(keys))
 
   #binaryInputNCHWPacked = npz["binaryInputNCHWPacked"]
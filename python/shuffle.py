@@ -27,6 +27,23 @@ keys = [
   "valueTargetsNCHW"
 ]
 
+#Expand policy targets written in sparse form by the selfplay engine (dataSparsePolicyTargets), see TrainingWriteBuffers
+#in cpp/dataio/trainingwrite.h, returning a dict with the same arrays as a normal npz file.
+def load_npz_policy_targets_dense(npz):
+  if "policyTargetsNCMove" in npz.keys() or "policyTargetsSparseShape" not in npz.keys():
+    return npz
+  shape = tuple(npz["policyTargetsSparseShape"])
+  offsets = npz["policyTargetsSparseOffsetsNC"].reshape(-1).astype(np.int64)
+  entries = npz["policyTargetsSparseEntries"]
+  counts = np.diff(np.append(offsets,len(entries)))
+  targetidxs = np.repeat(np.arange(shape[0] * shape[1]), counts)
+  policyTargetsNCMove = np.zeros((shape[0] * shape[1], shape[2]), dtype=np.int16)
+  policyTargetsNCMove[targetidxs,entries[:,0]] = entries[:,1]
+
+  arrs = dict((key,npz[key]) for key in npz.keys() if not key.startswith("policyTargetsSparse"))
+  arrs["policyTargetsNCMove"] = policyTargetsNCMove.reshape(shape)
+  return arrs
+
 def joint_shuffle(arrs):
   rand_state = np.random.get_state()
   for arr in arrs:
@@ -42,7 +59,7 @@ def shardify(input_idx, input_file, num_out_files, out_tmp_dirs, keep_prob):
   np.random.seed([int.from_bytes(os.urandom(4), byteorder='little') for i in range(4)])
 
   #print("Shardify reading: " + input_file)
-  npz = np.load(input_file)
+  npz = load_npz_policy_targets_dense(np.load(input_file))
   assert(set(npz.keys()) == set(keys))
 
   ###
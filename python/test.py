@@ -13,6 +13,7 @@ import tensorflow as tf
 import numpy as np
 
 import data
+from shuffle import load_npz_policy_targets_dense
 from board import Board
 from model import Model, Target_vars, Metrics, ModelUtils
 
@@ -187,7 +188,8 @@ with tf.Session(config=tfconfig) as session:
         pass
     elif using_npz:
       for data_file in data_files:
-        with np.load(data_file) as npz:
+        with np.load(data_file) as npzfile:
+          npz = load_npz_policy_targets_dense(npzfile)
           binchwp = npz["binaryInputNCHWPacked"]
           ginc = npz["globalInputNC"]
           ptncm = npz["policyTargetsNCMove"].astype(np.float32)